@@ -7,13 +7,12 @@ layout(binding = 0) uniform sampler2D u_ssao_input;
 layout(binding = 1) uniform sampler2D u_depth;
 layout(binding = 2) uniform sampler2D u_normal;
 
-uniform float u_z_near;
-uniform float u_z_far;
+#include "frame_constants.glsl"
 
 float LinearizeDepth(float depth) {
   float z = depth * 2.0 - 1.0;
-  return (2.0 * u_z_near * u_z_far) /
-         (u_z_far + u_z_near - z * (u_z_far - u_z_near));
+  return (2.0 * frame.z_near * frame.z_far) /
+         (frame.z_far + frame.z_near - z * (frame.z_far - frame.z_near));
 }
 
 void main() {
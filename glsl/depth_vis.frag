@@ -5,13 +5,12 @@ out vec4 out_color;
 
 layout(binding = 0) uniform sampler2D u_depth;
 
-uniform float u_z_near;
-uniform float u_z_far;
+#include "frame_constants.glsl"
 
 float LinearizeDepth(float depth) {
   float z = depth * 2.0 - 1.0;  // Back to NDC
-  return (2.0 * u_z_near * u_z_far) /
-         (u_z_far + u_z_near - z * (u_z_far - u_z_near));
+  return (2.0 * frame.z_near * frame.z_far) /
+         (frame.z_far + frame.z_near - z * (frame.z_far - frame.z_near));
 }
 
 void main() {
@@ -20,7 +19,8 @@ void main() {
 
   // Normalize for visualization: [near, far] -> [0, 1]
   // roughly: (linear_depth - near) / (far - near)
-  float normalized_depth = (linear_depth - u_z_near) / (u_z_far - u_z_near);
+  float normalized_depth =
+      (linear_depth - frame.z_near) / (frame.z_far - frame.z_near);
 
   // Invert so close is white, far is black? Or close is black, far is white?
   // Let's do close = dark, far = light.
@@ -1,5 +1,8 @@
 #version 460 core
 
+#include "draw_record.glsl"
+#include "frame_constants.glsl"
+
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
 #ifdef CUTOUT
@@ -9,15 +12,13 @@ out vec2 v_uv;
 
 out vec3 v_view_normal;
 
-uniform mat4 u_view_proj;
-uniform mat4 u_model;
-uniform mat4 u_view;
-
 void main() {
-  mat3 normal_matrix = transpose(inverse(mat3(u_view * u_model)));
-  v_view_normal = normalize(normal_matrix * in_normal);
+  DrawRecord record = CurrentDrawRecord();
+  // The view matrix is a rigid transform, so it rotates normals as is.
+  v_view_normal = normalize(mat3(frame.view) * record.normal_matrix * in_normal);
 
-  gl_Position = u_view_proj * u_model * vec4(in_position, 1.0);
+  vec3 position = DecodePosition(record, in_position);
+  gl_Position = frame.view_proj * record.model * vec4(position, 1.0);
 
 #ifdef CUTOUT
   v_uv = in_uv;
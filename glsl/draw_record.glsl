@@ -0,0 +1,32 @@
+// Per-draw data of the geometry arena (GpuDrawRecord in geometry_arena.h),
+// refreshed every frame. Each instance of a draw finds its geometry's draw id
+// in the draw instance buffer, whose first entries are the draw ids
+// themselves. Vertex shaders only.
+#ifndef DRAW_RECORD_GLSL
+#define DRAW_RECORD_GLSL
+
+struct DrawRecord {
+  mat4 model;
+  mat3 normal_matrix;   // inverse transpose of mat3(model)
+  vec3 position_scale;  // position dequantization (identity for floats)
+  int material_index;   // into the material SSBOs; -1 for occluder shells
+  vec4 position_offset; // xyz
+};
+
+layout(std430, binding = 6) readonly buffer DrawRecords {
+  DrawRecord draw_records[];
+};
+
+layout(std430, binding = 12) readonly buffer DrawInstances {
+  uint draw_instances[];
+};
+
+DrawRecord CurrentDrawRecord() {
+  return draw_records[draw_instances[gl_BaseInstance + gl_InstanceID]];
+}
+
+vec3 DecodePosition(DrawRecord record, vec3 encoded) {
+  return record.position_offset.xyz + record.position_scale * encoded;
+}
+
+#endif  // DRAW_RECORD_GLSL
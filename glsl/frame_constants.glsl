@@ -0,0 +1,25 @@
+// Per-frame camera, sun and clock state (GpuFrameConstants in
+// frame_constants.h), written once per frame and shared by every pass.
+#ifndef FRAME_CONSTANTS_GLSL
+#define FRAME_CONSTANTS_GLSL
+
+layout(std140, binding = 0) uniform FrameConstants {
+  mat4 view;
+  mat4 projection;
+  mat4 view_proj;
+  mat4 inv_view;
+  mat4 inv_projection;
+  mat4 inv_view_proj;
+  vec4 camera_position;  // xyz
+  vec3 sun_direction;    // direction the sun light travels
+  float sun_intensity;
+  vec3 sun_color;
+  float _pad0;
+  vec3 sky_color;
+  float time;
+  ivec2 screen_size;
+  float z_near;
+  float z_far;
+} frame;
+
+#endif  // FRAME_CONSTANTS_GLSL
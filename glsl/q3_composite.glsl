@@ -3,8 +3,8 @@
 // Mirrors sh-baker/src/layer_composite.cpp so the real-time result matches the
 // baked indirect light at t=0 (the shared sh-scene lib is cancelled; parity is
 // by mirroring). Unlike the baker, which freezes everything at t=0, this animates
-// tcMod scroll/rotate and rgbGen wave by `u_time` (both are identity / equal to
-// the baker at t=0). turb/stretch stay frozen, matching the baker.
+// tcMod scroll/rotate and rgbGen wave by the time argument (both are identity /
+// equal to the baker at t=0). turb/stretch stay frozen, matching the baker.
 //
 // Requires the includer to declare `u_albedo_texture` at binding 0 (the modern
 // base albedo) and the macro MAX_LAYERS. std430 layouts mirror scene.h; each
@@ -15,6 +15,12 @@ struct GpuMaterial {
   int layer_count;
   int base_layer;
   int modern_has_alpha;
+  vec3 emissive_factor;
+  float emissive_strength;
+  int has_emissive_texture;
+  int pad0;
+  int pad1;
+  int pad2;
 };
 
 struct GpuMaterialLayer {
@@ -54,8 +60,6 @@ layout(std430, binding = 5) readonly buffer MaterialTcModBuffer {
 // One sampler per layer; the CPU binds each material's layers in order (animMap
 // frame already selected) and the base layer's own Q3 texture (for coverage).
 layout(binding = 16) uniform sampler2D u_layers[MAX_LAYERS];
-uniform float u_time;
-uniform int u_material_index;
 
 // --- enum constants (match q3_layer.h / layer_composite.h) ---
 #define Q3_BF_ZERO 0
@@ -7,18 +7,10 @@ in vec3 v_normal;
 in vec2 v_uv;
 in vec2 v_lightmap_uv;
 in vec4 v_tangent;
+flat in int v_material_index;
 
-// Camera
-uniform vec3 u_camera_pos;
-uniform mat4 u_view;  // Needed for cascade selection
-
-// Sun Light
-struct Light {
-  vec3 direction;
-  vec3 color;
-  float intensity;
-};
-uniform Light u_sun;
+// Camera, sun and sky.
+#include "frame_constants.glsl"
 
 // Shadows
 layout(binding = 5) uniform sampler2DShadow u_sun_shadow_maps[NUM_CASCADES];
@@ -39,14 +31,8 @@ layout(binding = 10) uniform sampler2D u_PackedTex2;
 layout(binding = 11) uniform sampler2DShadow u_spot_shadow_atlas;
 layout(binding = 12) uniform sampler2D u_ssao;
 
-uniform vec3 u_emissive_factor;
-uniform float u_emissive_strength;
-uniform int u_has_emissive_texture;
-uniform vec3 u_sky_color;
-
 // Forward+ tile info.
 uniform ivec2 u_tile_count;
-uniform ivec2 u_screen_size;
 
 // --- SSBOs for Forward+ ---
 struct GpuPointLight {
@@ -89,8 +75,9 @@ layout(std430, binding = 2) readonly buffer TileLightIndexBuffer {
 };
 
 // Quake 3 layer-stack compositor (SH_material_layers). Declares the material
-// descriptor SSBOs (bindings 3-5), u_layers (binding 16+), u_time and
-// u_material_index, and q3Composite(); uses u_albedo_texture (binding 0) above.
+// descriptor SSBOs (bindings 3-5, including the emission parameters), u_layers
+// (binding 16+) and q3Composite(); uses u_albedo_texture (binding 0)
+// above.
 #include "q3_composite.glsl"
 
 const float PI = 3.14159265359;
@@ -262,7 +249,7 @@ float ComputeShadow(vec3 world_pos, vec3 normal, ShadingAngles angles,
 }
 
 float ComputeSunShadow(vec3 world_pos, vec3 normal, ShadingAngles angles) {
-  vec4 view_pos = u_view * vec4(world_pos, 1.0);
+  vec4 view_pos = frame.view * vec4(world_pos, 1.0);
   float view_depth = abs(view_pos.z);
 
   int layer = 0;
@@ -378,7 +365,7 @@ void main() {
   // 1. Material Properties
   // Composite the Quake 3 layer stack (or just the modern albedo for plain PBR
   // materials) into albedo + coverage.
-  vec4 albedo_sample = q3Composite(u_material_index, v_uv, u_time);
+  vec4 albedo_sample = q3Composite(v_material_index, v_uv, frame.time);
   vec3 albedo = albedo_sample.rgb;
   float alpha = albedo_sample.a;
 
@@ -407,9 +394,9 @@ void main() {
   vec3 normal_world = normalize(tangent_to_world_space * tangent_space_normal);
 
   // Lighting Vectors
-  vec3 view_dir = normalize(u_camera_pos - v_world_pos);
+  vec3 view_dir = normalize(frame.camera_position.xyz - v_world_pos);
   vec3 light_dir =
-      normalize(-u_sun.direction);  // Direction from surface to light
+      normalize(-frame.sun_direction);  // Direction from surface to light
   vec3 half_dir = normalize(view_dir + light_dir);
   vec3 reflection_dir = reflect(-view_dir, normal_world);
 
@@ -420,7 +407,7 @@ void main() {
   // Indirect lighting (SH)
   LightmapTexel texel = GetLightmapTexel();
   vec3 sh_irradiance = EvalSHIrradiance(normal_world, texel.sh_coeffs);
-  vec3 sky_emission = u_sky_color * u_sun.intensity / 10.f;
+  vec3 sky_emission = frame.sky_color * frame.sun_intensity / 10.f;
   vec3 indirect_irradiance = sh_irradiance + sky_emission * texel.visibility;
   vec3 indirect_reflection_radiance =
       EvalSHRadiance(reflection_dir, texel.sh_coeffs);
@@ -429,14 +416,18 @@ void main() {
                                         indirect_reflection_radiance, f0,
                                         albedo, metallic, roughness, occlusion);
 
-  vec2 ssao_uv = gl_FragCoord.xy / vec2(u_screen_size);
+  vec2 ssao_uv = gl_FragCoord.xy / vec2(frame.screen_size);
   float ssao_occlusion = texture(u_ssao, ssao_uv).r;
   l_indirect *= ssao_occlusion;
 
   // Emission
-  vec3 l_emission = u_emissive_strength * u_emissive_factor;
-  if (u_has_emissive_texture > 0) {
-    l_emission *= texture(u_emissive_texture, v_uv).rgb;
+  vec3 l_emission = vec3(0.0);
+  if (v_material_index >= 0 && v_material_index < int(material_count)) {
+    GpuMaterial material = gpu_materials[v_material_index];
+    l_emission = material.emissive_strength * material.emissive_factor;
+    if (material.has_emissive_texture > 0) {
+      l_emission *= texture(u_emissive_texture, v_uv).rgb;
+    }
   }
 
   // Direct lighting (forward+).
@@ -444,7 +435,7 @@ void main() {
 
   // Direct sun.
   float sun_visibility = ComputeSunShadow(v_world_pos, normal_world, angles);
-  vec3 sun_incoming = u_sun.color * u_sun.intensity * sun_visibility;
+  vec3 sun_incoming = frame.sun_color * frame.sun_intensity * sun_visibility;
   vec3 direct_sun_brdf =
       ComputeDirectBRDF(angles, f0, albedo, metallic, roughness, occlusion);
   l_direct += direct_sun_brdf * angles.n_dot_l * sun_incoming;
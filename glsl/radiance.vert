@@ -1,5 +1,8 @@
 #version 460 core
 
+#include "draw_record.glsl"
+#include "frame_constants.glsl"
+
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec2 in_uv;
@@ -11,17 +14,19 @@ out vec3 v_normal;
 out vec2 v_uv;
 out vec2 v_lightmap_uv;
 out vec4 v_tangent;
-
-uniform mat4 u_model;
-uniform mat4 u_view_proj;
+flat out int v_material_index;
 
 void main() {
-  vec4 world_pos = u_model * vec4(in_position, 1.0);
+  DrawRecord record = CurrentDrawRecord();
+  mat4 model = record.model;
+  vec3 position = DecodePosition(record, in_position);
+  vec4 world_pos = model * vec4(position, 1.0);
   v_world_pos = world_pos.xyz;
-  v_normal = normalize(mat3(u_model) * in_normal);
+  v_normal = normalize(record.normal_matrix * in_normal);
   v_uv = in_uv;
   v_lightmap_uv = in_lightmap_uv;
-  v_tangent = vec4(normalize(mat3(u_model) * in_tangent.xyz), in_tangent.w);
+  v_tangent = vec4(normalize(mat3(model) * in_tangent.xyz), in_tangent.w);
+  v_material_index = record.material_index;
 
-  gl_Position = u_view_proj * world_pos;
+  gl_Position = frame.view_proj * world_pos;
 }
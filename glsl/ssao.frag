@@ -8,16 +8,13 @@ layout(binding = 0) uniform sampler2D u_depth;
 layout(binding = 1) uniform sampler2D u_normal;
 layout(binding = 2) uniform sampler2D u_noise;
 
-uniform mat4 u_projection;
-uniform mat4 u_inv_projection;
+#include "frame_constants.glsl"
 
 uniform vec3 u_samples[MAX_SAMPLES];
 const int kKernelSize = MAX_SAMPLES;
 const float kRadius = .5f;
 const float kBias = 0.025;
 
-uniform vec2 u_resolution;
-
 void main() {
   float depth = texture(u_depth, v_uv).r;
   if (depth == 1.0) {
@@ -37,11 +34,11 @@ void main() {
 
   // reconstruct view space position
   vec4 clip_pos = vec4(v_uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
-  vec4 view_pos_h = u_inv_projection * clip_pos;
+  vec4 view_pos_h = frame.inv_projection * clip_pos;
   vec3 view_pos = view_pos_h.xyz / view_pos_h.w;
 
   // Build TBN matrix
-  vec2 noise_scale = u_resolution / 4.0;  // 4x4 noise texture
+  vec2 noise_scale = vec2(frame.screen_size) / 4.0;  // 4x4 noise texture
   vec3 random_vec = normalize(texture(u_noise, v_uv * noise_scale).xyz);
 
   vec3 tangent = normalize(random_vec - normal * dot(random_vec, normal));
@@ -56,8 +53,8 @@ void main() {
 
     // project sample position (to sample texture)
     vec2 offset = vec2(
-        u_projection[0][0] * sample_pos.x + u_projection[2][0] * sample_pos.z,
-        u_projection[1][1] * sample_pos.y + u_projection[2][1] * sample_pos.z);
+        frame.projection[0][0] * sample_pos.x + frame.projection[2][0] * sample_pos.z,
+        frame.projection[1][1] * sample_pos.y + frame.projection[2][1] * sample_pos.z);
     offset /= -sample_pos.z;      // perspective divide
     offset = offset * 0.5 + 0.5;  // transform to range 0.0 - 1.0
 
@@ -67,7 +64,7 @@ void main() {
     // Reconstruct Z for depth comparison
     float sample_ndc_z = sample_depth * 2.0 - 1.0;
     float actual_sample_z =
-        -u_projection[3][2] / (sample_ndc_z + u_projection[2][2]);
+        -frame.projection[3][2] / (sample_ndc_z + frame.projection[2][2]);
 
     // range check & accumulate
     float depth_diff = abs(view_pos.z - actual_sample_z);
@@ -0,0 +1,108 @@
+// Offline PVS baker: loads the cooked glTF scene, casts rays from every view
+// cell with Embree (BuildPvs) and writes the compressed visible sets next to
+// the glTF, where LoadCookedScene picks them up. Rebake whenever the scene
+// changes; a PVS baked from other sources is ignored at load time.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+
+#include "pvs.h"
+#include "pvs_builder.h"
+#include "scene.h"
+#include "scene_cache.h"
+
+DEFINE_string(input, "", "Path to the glTF scene file.");
+DEFINE_string(output, "",
+              "Where to write the PVS. Defaults to the glTF's path with a "
+              ".shpvs extension, where the renderer looks for it.");
+DEFINE_double(cell_size, 2.0, "Edge length of the view cells, in scene units.");
+DEFINE_int32(max_cells_per_axis, 64, "Upper bound on the cells per axis.");
+DEFINE_int32(samples_per_cell, 16, "Ray origins per view cell.");
+DEFINE_int32(rays_per_sample, 1024, "Rays cast from each origin.");
+DEFINE_uint32(seed, 1, "Seed of the sample points and ray directions.");
+DEFINE_uint32(threads, 0, "Worker threads (0 for all cores).");
+DEFINE_uint32(cluster_max_triangles, 4096,
+              "The renderer's --cluster_max_triangles; the PVS only applies "
+              "to a scene cooked with the same budget.");
+DEFINE_double(cluster_max_extent, 4.0, "The renderer's --cluster_max_extent.");
+
+namespace sh_renderer {
+
+int Run() {
+  if (FLAGS_input.empty()) {
+    LOG(ERROR) << "--input is required.";
+    return 1;
+  }
+  const std::filesystem::path gltf_file = FLAGS_input;
+  const ClusterBudget cluster_budget = {
+      .max_triangles = FLAGS_cluster_max_triangles,
+      .max_extent = static_cast<float>(FLAGS_cluster_max_extent),
+  };
+  std::optional<Scene> scene = LoadCookedScene(
+      gltf_file, FLAGS_threads, /*use_cache=*/true, cluster_budget);
+  if (!scene) {
+    LOG(ERROR) << "Failed to load scene: " << gltf_file;
+    return 1;
+  }
+  std::optional<uint64_t> source_hash = HashSceneSources(gltf_file);
+  if (!source_hash) {
+    LOG(ERROR) << "Cannot hash the sources of " << gltf_file;
+    return 1;
+  }
+
+  const PvsBuildOptions options = {
+      .cell_size = static_cast<float>(FLAGS_cell_size),
+      .max_cells_per_axis = FLAGS_max_cells_per_axis,
+      .samples_per_cell = FLAGS_samples_per_cell,
+      .rays_per_sample = FLAGS_rays_per_sample,
+      .seed = FLAGS_seed,
+      .num_threads = FLAGS_threads,
+  };
+  const auto start = std::chrono::steady_clock::now();
+  const Pvs pvs = BuildPvs(*scene, options);
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  uint64_t visible = 0;
+  for (uint64_t word : pvs.visible) visible += std::popcount(word);
+  const size_t cells = PvsCellCount(pvs);
+  const double mean_visible =
+      static_cast<double>(visible) / cells /
+      std::max<uint32_t>(pvs.num_geometries, 1);
+  LOG(INFO) << "Baked " << cells << " view cells (" << pvs.cells.x() << " x "
+            << pvs.cells.y() << " x " << pvs.cells.z() << ") in " << seconds
+            << " s; each sees " << 100.0 * mean_visible << "% of "
+            << pvs.num_geometries << " geometries on average.";
+
+  const std::filesystem::path output =
+      FLAGS_output.empty() ? PvsPath(gltf_file)
+                           : std::filesystem::path(FLAGS_output);
+  if (!WritePvs(pvs, CookedSceneHash(*source_hash, cluster_budget), output)) {
+    return 1;
+  }
+  LOG(INFO) << "Wrote " << output << " (" << std::filesystem::file_size(output)
+            << " bytes, " << pvs.visible.size() * sizeof(uint64_t)
+            << " uncompressed).";
+  return 0;
+}
+
+}  // namespace sh_renderer
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("Bakes the potentially visible sets of a scene.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  int result = sh_renderer::Run();
+
+  gflags::ShutDownCommandLineFlags();
+  return result;
+}
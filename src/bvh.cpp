@@ -0,0 +1,242 @@
+#include "bvh.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace sh_renderer {
+
+namespace {
+
+// Split candidates per axis are the boundaries between this many equal-width
+// centroid bins.
+constexpr int kNumBins = 16;
+constexpr uint32_t kAllPlanes = 0x3f;
+
+struct BuildPrimitive {
+  AABB box;
+  Eigen::Vector3f centroid;
+  uint32_t index;
+};
+
+struct BvhBuild {
+  std::vector<BuildPrimitive> primitives;
+  int max_leaf_size;
+  Bvh* bvh;
+};
+
+void Grow(AABB* box, const AABB& other) {
+  box->min = box->min.cwiseMin(other.min);
+  box->max = box->max.cwiseMax(other.max);
+}
+
+void Grow(AABB* box, const Eigen::Vector3f& point) {
+  box->min = box->min.cwiseMin(point);
+  box->max = box->max.cwiseMax(point);
+}
+
+bool IsEmpty(const AABB& box) {
+  return (box.min.array() > box.max.array()).any();
+}
+
+// Half the surface area, which is all the SAH needs to compare splits.
+float HalfArea(const AABB& box) {
+  const Eigen::Vector3f d = box.max - box.min;
+  return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+}
+
+int BinOf(float centroid, float lo, float scale) {
+  return std::min(kNumBins - 1, static_cast<int>((centroid - lo) * scale));
+}
+
+// Partitions primitives [begin, end) at the binned SAH split with the lowest
+// cost and returns the split point, which is strictly inside the range.
+uint32_t SplitSah(std::vector<BuildPrimitive>& primitives, uint32_t begin,
+                  uint32_t end, const AABB& centroid_bounds) {
+  int best_axis = -1;
+  int best_bin = 0;
+  float best_cost = std::numeric_limits<float>::infinity();
+  for (int axis = 0; axis < 3; ++axis) {
+    const float lo = centroid_bounds.min[axis];
+    const float extent = centroid_bounds.max[axis] - lo;
+    if (!(extent > 0.0f)) continue;
+    const float scale = kNumBins / extent;
+
+    AABB bin_bounds[kNumBins];
+    uint32_t bin_counts[kNumBins] = {};
+    for (uint32_t i = begin; i < end; ++i) {
+      const int bin = BinOf(primitives[i].centroid[axis], lo, scale);
+      Grow(&bin_bounds[bin], primitives[i].box);
+      ++bin_counts[bin];
+    }
+
+    // Split after bin i: left is bins [0, i], right is bins (i, kNumBins).
+    float right_area[kNumBins - 1];
+    uint32_t right_count[kNumBins - 1];
+    AABB accum;
+    uint32_t count = 0;
+    for (int i = kNumBins - 1; i > 0; --i) {
+      Grow(&accum, bin_bounds[i]);
+      count += bin_counts[i];
+      right_area[i - 1] = count > 0 ? HalfArea(accum) : 0.0f;
+      right_count[i - 1] = count;
+    }
+    accum = AABB();
+    count = 0;
+    for (int i = 0; i < kNumBins - 1; ++i) {
+      Grow(&accum, bin_bounds[i]);
+      count += bin_counts[i];
+      if (count == 0 || right_count[i] == 0) continue;
+      const float cost =
+          HalfArea(accum) * count + right_area[i] * right_count[i];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = i;
+      }
+    }
+  }
+
+  // Every centroid is the same point: any split is as good as another.
+  if (best_axis < 0) return begin + (end - begin) / 2;
+
+  const float lo = centroid_bounds.min[best_axis];
+  const float scale = kNumBins / (centroid_bounds.max[best_axis] - lo);
+  auto mid = std::partition(
+      primitives.begin() + begin, primitives.begin() + end,
+      [&](const BuildPrimitive& p) {
+        return BinOf(p.centroid[best_axis], lo, scale) <= best_bin;
+      });
+  return static_cast<uint32_t>(mid - primitives.begin());
+}
+
+void BuildNode(BvhBuild& build, uint32_t begin, uint32_t end, int depth) {
+  std::vector<BvhNode>& nodes = build.bvh->nodes;
+  const uint32_t node_index = static_cast<uint32_t>(nodes.size());
+  nodes.emplace_back();
+
+  AABB bounds;
+  AABB centroid_bounds;
+  for (uint32_t i = begin; i < end; ++i) {
+    Grow(&bounds, build.primitives[i].box);
+    Grow(&centroid_bounds, build.primitives[i].centroid);
+  }
+  nodes[node_index].bounds = bounds;
+  nodes[node_index].first = begin;
+  nodes[node_index].count = end - begin;
+
+  if (end - begin <= static_cast<uint32_t>(build.max_leaf_size) ||
+      depth >= kBvhMaxDepth) {
+    return;
+  }
+
+  const uint32_t mid = SplitSah(build.primitives, begin, end, centroid_bounds);
+  BuildNode(build, begin, mid, depth + 1);
+  const uint32_t second_child = static_cast<uint32_t>(nodes.size());
+  BuildNode(build, mid, end, depth + 1);
+  nodes[node_index].second_child = second_child;
+}
+
+// Returns false if `box` is outside one of the planes in `mask`, and otherwise
+// clears from `mask` the planes it lies fully inside. Uses the p-vertex test of
+// IsAABBInFrustum, plus the n-vertex (nearest corner) for "fully inside".
+bool CullPlanes(const AABB& box, const Eigen::Vector4f planes[6],
+                uint32_t* mask) {
+  for (int i = 0; i < 6; ++i) {
+    const uint32_t bit = 1u << i;
+    if (!(*mask & bit)) continue;
+    const Eigen::Vector4f& plane = planes[i];
+    Eigen::Vector3f p;
+    Eigen::Vector3f n;
+    p.x() = plane.x() > 0 ? box.max.x() : box.min.x();
+    p.y() = plane.y() > 0 ? box.max.y() : box.min.y();
+    p.z() = plane.z() > 0 ? box.max.z() : box.min.z();
+    n.x() = plane.x() > 0 ? box.min.x() : box.max.x();
+    n.y() = plane.y() > 0 ? box.min.y() : box.max.y();
+    n.z() = plane.z() > 0 ? box.min.z() : box.max.z();
+    const float p_distance = plane.x() * p.x() + plane.y() * p.y() +
+                             plane.z() * p.z() + plane.w();
+    if (p_distance < 0) return false;
+    const float n_distance = plane.x() * n.x() + plane.y() * n.y() +
+                             plane.z() * n.z() + plane.w();
+    if (n_distance >= 0) *mask &= ~bit;
+  }
+  return true;
+}
+
+}  // namespace
+
+Bvh BuildBvh(std::span<const AABB> boxes, int max_leaf_size) {
+  CHECK_GT(max_leaf_size, 0);
+  BvhBuild build{.max_leaf_size = max_leaf_size};
+  build.primitives.reserve(boxes.size());
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    if (IsEmpty(boxes[i])) continue;
+    build.primitives.push_back({
+        .box = boxes[i],
+        .centroid = 0.5f * (boxes[i].min + boxes[i].max),
+        .index = static_cast<uint32_t>(i),
+    });
+  }
+
+  Bvh bvh;
+  if (build.primitives.empty()) return bvh;
+  build.bvh = &bvh;
+  // A binary tree with leaves of at least one primitive has < 2n nodes.
+  bvh.nodes.reserve(2 * build.primitives.size());
+  BuildNode(build, 0, static_cast<uint32_t>(build.primitives.size()),
+            /*depth=*/0);
+
+  bvh.primitives.reserve(build.primitives.size());
+  bvh.primitive_bounds.reserve(build.primitives.size());
+  for (const BuildPrimitive& p : build.primitives) {
+    bvh.primitives.push_back(p.index);
+    bvh.primitive_bounds.push_back(p.box);
+  }
+  return bvh;
+}
+
+void QueryBvhFrustum(const Bvh& bvh, const Eigen::Vector4f planes[6],
+                     std::vector<uint32_t>* out) {
+  if (bvh.nodes.empty()) return;
+
+  struct Entry {
+    uint32_t node;
+    uint32_t mask;  // planes the node's parent straddles
+  };
+  // Each inner node on the path to the current one pushes at most one entry.
+  Entry stack[kBvhMaxDepth + 1];
+  int stack_size = 0;
+  stack[stack_size++] = {.node = 0, .mask = kAllPlanes};
+
+  auto emit_range = [&](uint32_t first, uint32_t count) {
+    out->insert(out->end(), bvh.primitives.begin() + first,
+                bvh.primitives.begin() + first + count);
+  };
+
+  while (stack_size > 0) {
+    Entry entry = stack[--stack_size];
+    while (true) {
+      const BvhNode& node = bvh.nodes[entry.node];
+      if (!CullPlanes(node.bounds, planes, &entry.mask)) break;
+      if (entry.mask == 0) {
+        emit_range(node.first, node.count);
+        break;
+      }
+      if (node.second_child == 0) {
+        for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+          uint32_t mask = entry.mask;
+          if (CullPlanes(bvh.primitive_bounds[i], planes, &mask)) {
+            out->push_back(bvh.primitives[i]);
+          }
+        }
+        break;
+      }
+      stack[stack_size++] = {.node = node.second_child, .mask = entry.mask};
+      entry.node += 1;
+    }
+  }
+}
+
+}  // namespace sh_renderer
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "culling.h"
+
+namespace sh_renderer {
+
+// --- Bounding volume hierarchy ---
+// A binary tree over a set of AABBs (for the scene, Geometry::bounding_box),
+// built with the binned surface area heuristic. Nodes are stored depth first:
+// an inner node's first child directly follows it, and the primitives under any
+// node form one contiguous range of Bvh::primitives. A frustum query can thus
+// accept a subtree that lies fully inside the frustum without visiting it.
+
+struct BvhNode {
+  AABB bounds;
+  uint32_t first = 0;         // first entry of Bvh::primitives under the node
+  uint32_t count = 0;         // number of primitives under the node
+  uint32_t second_child = 0;  // 0 for leaves; the first child is this + 1
+};
+
+struct Bvh {
+  std::vector<BvhNode> nodes;  // nodes[0] is the root; empty if no primitives
+  // Input box indices in leaf order, and their boxes in the same order.
+  std::vector<uint32_t> primitives;
+  std::vector<AABB> primitive_bounds;
+};
+
+constexpr int kBvhMaxLeafSize = 4;
+// Nodes at this depth become leaves regardless of their size, which bounds the
+// traversal stack.
+constexpr int kBvhMaxDepth = 48;
+
+// Builds a BVH over `boxes`. Empty boxes (min > max on some axis, like the
+// default AABB) are left out.
+Bvh BuildBvh(std::span<const AABB> boxes, int max_leaf_size = kBvhMaxLeafSize);
+
+// Appends to `out` the index of every box that IsAABBInFrustum(box, planes)
+// accepts, in traversal order. Each node is tested only against the planes its
+// parent straddles, and a node inside all of them is accepted as a whole.
+void QueryBvhFrustum(const Bvh& bvh, const Eigen::Vector4f planes[6],
+                     std::vector<uint32_t>* out);
+
+}  // namespace sh_renderer
@@ -0,0 +1,321 @@
+// Benchmark of frustum culling the scene's bounding boxes: the linear
+// IsAABBInFrustum scan the draw passes used before the BVH, the batched SIMD
+// scan of CullAABBsInFrustum with each supported kernel (including compaction
+// to an index list), and QueryBvhFrustum, alone, with the result sorted, and
+// as FrustumCullGeometries returns it in scene order. Runs on a synthetic scene of
+// --num_objects random boxes and, with --input, on the cooked glTF scene. The
+// views are perspective cameras spinning around the middle of the scene.
+//
+// A second part times one frame of culling for all the views the renderer
+// draws (camera, sun cascades, shadowed spot lights): ComputeFrameVisibility
+// against the passes each building their own lists, as they did before the
+// visibility stage (the depth pre-pass scanning every geometry unculled), and
+// the visibility stage with occlusion culling, whose share of culled
+// geometries and CPU cost it reports. The synthetic boxes are box meshes, so
+// the largest near the camera serve as occluders.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "cascade.h"
+#include "culling.h"
+#include "scene.h"
+#include "scene_cache.h"
+#include "visibility.h"
+
+DEFINE_string(input, "", "Optional glTF scene (e.g. Sponza) to benchmark.");
+DEFINE_uint32(num_objects, 100000, "Boxes in the synthetic scene.");
+DEFINE_uint32(views, 64, "Camera views per scene.");
+DEFINE_uint32(repeats, 20, "Times each view is culled per strategy.");
+DEFINE_uint32(spot_shadows, 10, "Shadowed spot lights in the frame benchmark.");
+
+namespace sh_renderer {
+namespace {
+
+struct View {
+  Eigen::Vector4f planes[6];
+};
+
+// Cameras at `center` turning a full circle, tilted slightly downwards.
+std::vector<View> MakeViews(const Eigen::Vector3f& center, float z_far) {
+  std::vector<View> views(FLAGS_views);
+  for (uint32_t i = 0; i < FLAGS_views; ++i) {
+    const float yaw = 2.0f * std::numbers::pi_v<float> * i / FLAGS_views;
+    Camera camera{.position = center,
+                  .orientation = Eigen::Quaternionf::Identity(),
+                  .intrinsics = {.z_far = z_far}};
+    LookAt(center + Eigen::Vector3f(std::cos(yaw), -0.2f, std::sin(yaw)),
+           &camera);
+    ExtractFrustumPlanes(GetViewProjMatrix(camera), views[i].planes);
+  }
+  return views;
+}
+
+std::vector<AABB> MakeRandomBoxes(uint32_t count, float extent) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> position(-extent, extent);
+  std::uniform_real_distribution<float> size(0.1f, 2.0f);
+  std::vector<AABB> boxes(count);
+  for (AABB& box : boxes) {
+    box.min = Eigen::Vector3f(position(rng), position(rng), position(rng));
+    box.max = box.min + Eigen::Vector3f(size(rng), size(rng), size(rng));
+  }
+  return boxes;
+}
+
+// Culls every view FLAGS_repeats times and logs the time per view and the
+// average number of visible boxes.
+template <typename Fn>
+void Measure(const char* name, const std::vector<View>& views, Fn&& cull) {
+  std::vector<uint32_t> visible;
+  size_t total_visible = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < FLAGS_repeats; ++r) {
+    for (const View& view : views) {
+      visible.clear();
+      cull(view, &visible);
+      total_visible += visible.size();
+    }
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const double num_culls = static_cast<double>(FLAGS_repeats) * views.size();
+  LOG(INFO) << "  " << name << ": " << elapsed.count() / num_culls
+            << " us per view, " << total_visible / num_culls << " visible";
+}
+
+// A scene of `boxes` with two materials, the second alpha-tested.
+Scene MakeBoxScene(const std::vector<AABB>& boxes) {
+  Scene scene;
+  scene.materials.resize(2);
+  scene.materials[1].alpha_cutout = true;
+  scene.geometries.resize(boxes.size());
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    Geometry& geo = scene.geometries[i];
+    geo.bounding_box = boxes[i];
+    for (int corner = 0; corner < 8; ++corner) {
+      geo.vertices.emplace_back(
+          (corner & 1) ? boxes[i].max.x() : boxes[i].min.x(),
+          (corner & 2) ? boxes[i].max.y() : boxes[i].min.y(),
+          (corner & 4) ? boxes[i].max.z() : boxes[i].min.z());
+    }
+    geo.indices = {0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+                   2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3};
+    geo.index_count = static_cast<uint32_t>(geo.indices.size());
+    geo.material_id = i % 8 == 0 ? 1 : 0;
+  }
+  BuildSceneBvh(scene);
+  return scene;
+}
+
+void RunScene(const char* name, const std::vector<AABB>& boxes,
+              const std::vector<View>& views) {
+  auto build_start = std::chrono::steady_clock::now();
+  Bvh bvh = BuildBvh(boxes);
+  std::chrono::duration<double, std::milli> build_time =
+      std::chrono::steady_clock::now() - build_start;
+  LOG(INFO) << name << ": " << boxes.size() << " boxes, " << bvh.nodes.size()
+            << " nodes, built in " << build_time.count() << " ms";
+
+  Measure("linear", views, [&](const View& view, std::vector<uint32_t>* out) {
+    for (uint32_t i = 0; i < boxes.size(); ++i) {
+      if (IsAABBInFrustum(boxes[i], view.planes)) out->push_back(i);
+    }
+  });
+  const AABBSoA soa = MakeAABBSoA(boxes);
+  std::vector<uint64_t> mask;
+  for (CullKernel kernel : {CullKernel::kScalar, CullKernel::kSse,
+                            CullKernel::kAvx2, CullKernel::kAvx512}) {
+    if (!IsCullKernelSupported(kernel)) continue;
+    const std::string label = std::string("batched ") + CullKernelName(kernel);
+    Measure(label.c_str(), views,
+            [&](const View& view, std::vector<uint32_t>* out) {
+              CullAABBsInFrustum(soa, view.planes, &mask, kernel);
+              CompactVisible(mask, out);
+            });
+  }
+  Measure("bvh", views, [&](const View& view, std::vector<uint32_t>* out) {
+    QueryBvhFrustum(bvh, view.planes, out);
+  });
+  Measure("bvh+sort", views,
+          [&](const View& view, std::vector<uint32_t>* out) {
+            QueryBvhFrustum(bvh, view.planes, out);
+            std::sort(out->begin(), out->end());
+          });
+  Scene scene = MakeBoxScene(boxes);
+  Measure("FrustumCullGeometries", views,
+          [&](const View& view, std::vector<uint32_t>* out) {
+            FrustumCullGeometries(scene, view.planes, out);
+          });
+}
+
+// Splits the geometries of `in_frustum` (or, if null, all of them) into opaque
+// and cutout lists, as each shadow and depth pass did for itself.
+void PerPassLists(const Scene& scene, const std::vector<uint32_t>* in_frustum,
+                  DrawLists* lists) {
+  lists->opaque.clear();
+  lists->cutout.clear();
+  auto add = [&](const Geometry& geo) {
+    if (geo.index_count == 0) return;
+    if (geo.material_id >= 0 && scene.materials[geo.material_id].alpha_cutout) {
+      lists->cutout.push_back(&geo);
+    } else {
+      lists->opaque.push_back(&geo);
+    }
+  };
+  if (!in_frustum) {
+    for (const Geometry& geo : scene.geometries) add(geo);
+    return;
+  }
+  for (uint32_t i : *in_frustum) add(scene.geometries[i]);
+}
+
+// Times a frame of culling: every pass for itself, then the visibility stage.
+void RunFrame(const char* name, Scene& scene, const Camera& camera) {
+  SunLight sun;
+  sun.direction = Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized();
+  const std::vector<Cascade> cascades = ComputeCascades(sun, camera);
+  const float z_far = camera.intrinsics.z_far;
+  scene.spot_lights.resize(FLAGS_spot_shadows);
+  for (uint32_t i = 0; i < FLAGS_spot_shadows; ++i) {
+    SpotLight& light = scene.spot_lights[i];
+    light.position = camera.position;
+    light.direction = GetViewMatrix(camera).topLeftCorner<3, 3>().transpose() *
+                      Eigen::Vector3f(std::sin(i * 0.6f), -0.3f, -1.0f);
+    light.direction.normalize();
+    light.radius = 0.25f * z_far;
+    light.has_shadow = 1;
+    light.shadow_view_proj = ComputeSpotShadowViewProj(light);
+  }
+
+  auto time_frames = [](auto&& frame) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < FLAGS_repeats; ++r) frame();
+    return std::chrono::duration<double, std::micro>(
+               std::chrono::steady_clock::now() - start)
+               .count() /
+           FLAGS_repeats;
+  };
+
+  size_t per_pass_depth = 0;
+  const double per_pass_us = time_frames([&] {
+    auto cull = [&](const Eigen::Matrix4f& view_proj,
+                    std::vector<uint32_t>* in_frustum) {
+      Eigen::Vector4f planes[6];
+      ExtractFrustumPlanes(view_proj, planes);
+      FrustumCullGeometries(scene, planes, in_frustum);
+    };
+    std::vector<uint32_t> in_frustum;
+    DrawLists lists;
+    for (const SpotLight& light : scene.spot_lights) {
+      cull(light.shadow_view_proj, &in_frustum);
+      PerPassLists(scene, &in_frustum, &lists);
+    }
+    for (const Cascade& cascade : cascades) {
+      cull(cascade.view_projection_matrix, &in_frustum);
+      PerPassLists(scene, &in_frustum, &lists);
+    }
+    PerPassLists(scene, nullptr, &lists);
+    per_pass_depth = lists.opaque.size() + lists.cutout.size();
+    cull(GetViewProjMatrix(camera), &in_frustum);
+    std::vector<const Geometry*> shaded;
+    for (uint32_t i : in_frustum) {
+      const Geometry& geo = scene.geometries[i];
+      if (geo.index_count != 0 && geo.material_id >= 0) shaded.push_back(&geo);
+    }
+  });
+
+  FrameVisibility visibility;
+  const double stage_us = time_frames(
+      [&] { ComputeFrameVisibility(scene, camera, cascades, &visibility); });
+  const size_t stage_depth =
+      visibility.camera.opaque.size() + visibility.camera.cutout.size();
+
+  visibility.occlusion_culling = true;
+  GetVisibilityStats() = {};
+  const double occlusion_us = time_frames(
+      [&] { ComputeFrameVisibility(scene, camera, cascades, &visibility); });
+  const VisibilityStats& stats = GetVisibilityStats();
+  const size_t occlusion_depth =
+      visibility.camera.opaque.size() + visibility.camera.cutout.size();
+
+  LOG(INFO) << name << " frame (" << 1 + cascades.size() + FLAGS_spot_shadows
+            << " views): per-pass lists " << per_pass_us
+            << " us, visibility stage " << stage_us
+            << " us; depth pre-pass draws " << stage_depth << " instead of "
+            << per_pass_depth;
+  LOG(INFO) << name << " frame with occlusion culling: " << occlusion_us
+            << " us, of which occlusion "
+            << 1000.0 * stats.occlusion_ms / stats.frames << " us for "
+            << stats.occluders / stats.frames << " occluders ("
+            << stats.occluder_triangles / stats.frames << " triangles); "
+            << 100.0 * stats.occlusion_culled / stats.occlusion_tested
+            << "% of the camera's " << stats.occlusion_tested / stats.frames
+            << " geometries in the frustum culled, depth pre-pass draws "
+            << occlusion_depth;
+}
+
+int Run() {
+  constexpr float kSyntheticExtent = 100.0f;
+  const std::vector<AABB> synthetic_boxes =
+      MakeRandomBoxes(FLAGS_num_objects, kSyntheticExtent);
+  RunScene("synthetic", synthetic_boxes,
+           MakeViews(Eigen::Vector3f::Zero(), 2.0f * kSyntheticExtent));
+  Scene synthetic = MakeBoxScene(synthetic_boxes);
+  RunFrame("synthetic", synthetic,
+           Camera{.position = Eigen::Vector3f::Zero(),
+                  .orientation = Eigen::Quaternionf::Identity(),
+                  .intrinsics = {.z_far = 2.0f * kSyntheticExtent}});
+
+  if (!FLAGS_input.empty()) {
+    std::optional<Scene> scene =
+        LoadCookedScene(FLAGS_input, /*num_decode_threads=*/0,
+                        /*use_cache=*/true);
+    if (!scene) {
+      LOG(ERROR) << "Failed to load scene: " << FLAGS_input;
+      return 1;
+    }
+    std::vector<AABB> boxes;
+    AABB bounds;
+    for (const Geometry& geo : scene->geometries) {
+      boxes.push_back(geo.bounding_box);
+      if (GeometryMesh(scene->geometries, geo).vertices.empty()) continue;
+      bounds.min = bounds.min.cwiseMin(geo.bounding_box.min);
+      bounds.max = bounds.max.cwiseMax(geo.bounding_box.max);
+    }
+    const Eigen::Vector3f center = 0.5f * (bounds.min + bounds.max);
+    const float diagonal = (bounds.max - bounds.min).norm();
+    RunScene(FLAGS_input.c_str(), boxes, MakeViews(center, diagonal));
+    RunFrame(FLAGS_input.c_str(), *scene,
+             Camera{.position = center,
+                    .orientation = Eigen::Quaternionf::Identity(),
+                    .intrinsics = {.z_far = diagonal}});
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace sh_renderer
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage(
+      "Frustum culling benchmark: linear scan vs SIMD vs BVH.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  int result = sh_renderer::Run();
+
+  gflags::ShutDownCommandLineFlags();
+  return result;
+}
@@ -0,0 +1,140 @@
+#include "bvh.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+
+#include "camera.h"
+
+namespace sh_renderer {
+namespace {
+
+AABB Box(const Eigen::Vector3f& min, const Eigen::Vector3f& max) {
+  AABB box;
+  box.min = min;
+  box.max = max;
+  return box;
+}
+
+std::vector<AABB> RandomBoxes(int count) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+  std::uniform_real_distribution<float> size(0.1f, 3.0f);
+  std::vector<AABB> boxes(count);
+  for (AABB& box : boxes) {
+    box.min = Eigen::Vector3f(position(rng), position(rng), position(rng));
+    box.max = box.min + Eigen::Vector3f(size(rng), size(rng), size(rng));
+  }
+  return boxes;
+}
+
+bool Contains(const AABB& outer, const AABB& inner) {
+  return (outer.min.array() <= inner.min.array()).all() &&
+         (outer.max.array() >= inner.max.array()).all();
+}
+
+TEST(BvhTest, EmptyInputHasNoNodes) {
+  Bvh bvh = BuildBvh({});
+  EXPECT_TRUE(bvh.nodes.empty());
+
+  Eigen::Vector4f planes[6];
+  ExtractFrustumPlanes(Eigen::Matrix4f::Identity(), planes);
+  std::vector<uint32_t> visible;
+  QueryBvhFrustum(bvh, planes, &visible);
+  EXPECT_TRUE(visible.empty());
+}
+
+TEST(BvhTest, SkipsEmptyBoxes) {
+  std::vector<AABB> boxes = {Box({0, 0, 0}, {1, 1, 1}), AABB(),
+                             Box({2, 0, 0}, {3, 1, 1})};
+  Bvh bvh = BuildBvh(boxes);
+  std::vector<uint32_t> primitives = bvh.primitives;
+  std::sort(primitives.begin(), primitives.end());
+  EXPECT_EQ(primitives, (std::vector<uint32_t>{0, 2}));
+}
+
+TEST(BvhTest, NodesAreDepthFirstWithContiguousRanges) {
+  std::vector<AABB> boxes = RandomBoxes(1000);
+  Bvh bvh = BuildBvh(boxes);
+  ASSERT_FALSE(bvh.nodes.empty());
+  EXPECT_EQ(bvh.nodes[0].first, 0u);
+  EXPECT_EQ(bvh.nodes[0].count, boxes.size());
+
+  for (size_t i = 0; i < bvh.nodes.size(); ++i) {
+    const BvhNode& node = bvh.nodes[i];
+    if (node.second_child == 0) {
+      EXPECT_LE(node.count, static_cast<uint32_t>(kBvhMaxLeafSize));
+      for (uint32_t p = node.first; p < node.first + node.count; ++p) {
+        EXPECT_TRUE(Contains(node.bounds, bvh.primitive_bounds[p]));
+      }
+      continue;
+    }
+    const BvhNode& left = bvh.nodes[i + 1];
+    const BvhNode& right = bvh.nodes[node.second_child];
+    EXPECT_EQ(left.first, node.first);
+    EXPECT_EQ(right.first, left.first + left.count);
+    EXPECT_EQ(left.count + right.count, node.count);
+    EXPECT_GT(left.count, 0u);
+    EXPECT_GT(right.count, 0u);
+    EXPECT_TRUE(Contains(node.bounds, left.bounds));
+    EXPECT_TRUE(Contains(node.bounds, right.bounds));
+  }
+
+  std::vector<uint32_t> primitives = bvh.primitives;
+  std::sort(primitives.begin(), primitives.end());
+  for (uint32_t i = 0; i < primitives.size(); ++i) EXPECT_EQ(primitives[i], i);
+}
+
+TEST(BvhTest, CoincidentBoxesStillSplit) {
+  std::vector<AABB> boxes(100, Box({1, 1, 1}, {2, 2, 2}));
+  Bvh bvh = BuildBvh(boxes);
+  for (const BvhNode& node : bvh.nodes) {
+    if (node.second_child == 0) {
+      EXPECT_LE(node.count, static_cast<uint32_t>(kBvhMaxLeafSize));
+    }
+  }
+}
+
+TEST(BvhTest, FrustumQueryMatchesLinearScan) {
+  std::vector<AABB> boxes = RandomBoxes(5000);
+  Bvh bvh = BuildBvh(boxes);
+
+  for (int view = 0; view < 8; ++view) {
+    Camera camera{.position = Eigen::Vector3f(0, 0, 0),
+                  .orientation = Eigen::Quaternionf::Identity(),
+                  .intrinsics = {.z_far = 40.0f}};
+    const float yaw = view * 0.785f;
+    LookAt(Eigen::Vector3f(std::cos(yaw), 0.3f, std::sin(yaw)), &camera);
+    Eigen::Vector4f planes[6];
+    ExtractFrustumPlanes(GetViewProjMatrix(camera), planes);
+
+    std::vector<uint32_t> expected;
+    for (uint32_t i = 0; i < boxes.size(); ++i) {
+      if (IsAABBInFrustum(boxes[i], planes)) expected.push_back(i);
+    }
+    std::vector<uint32_t> visible;
+    QueryBvhFrustum(bvh, planes, &visible);
+    std::sort(visible.begin(), visible.end());
+    EXPECT_EQ(visible, expected) << "view " << view;
+    EXPECT_FALSE(expected.empty());
+    EXPECT_LT(expected.size(), boxes.size());
+  }
+}
+
+TEST(BvhTest, FrustumContainingEverythingReturnsAll) {
+  std::vector<AABB> boxes = {Box({-0.5f, -0.5f, -0.5f}, {-0.4f, -0.4f, -0.4f}),
+                             Box({0.1f, 0.1f, 0.1f}, {0.2f, 0.2f, 0.2f}),
+                             Box({0.3f, -0.2f, 0.0f}, {0.4f, 0.0f, 0.1f})};
+  Bvh bvh = BuildBvh(boxes, /*max_leaf_size=*/1);
+  Eigen::Vector4f planes[6];
+  ExtractFrustumPlanes(Eigen::Matrix4f::Identity(), planes);
+
+  std::vector<uint32_t> visible;
+  QueryBvhFrustum(bvh, planes, &visible);
+  std::sort(visible.begin(), visible.end());
+  EXPECT_EQ(visible, (std::vector<uint32_t>{0, 1, 2}));
+}
+
+}  // namespace
+}  // namespace sh_renderer
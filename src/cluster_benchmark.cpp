@@ -0,0 +1,227 @@
+// Tuning report for ClusterGeometries: sweeps the triangle and extent budgets
+// over a partitioned scene and reports, for each pair, what the views of a
+// camera spinning around the middle of the scene would draw. Fewer, larger
+// clusters mean fewer draws, but each visible cluster draws all of its
+// triangles, so the frustum culls less precisely. The report lists the
+// geometries of the clustered scene, the visible draws and triangles per
+// view, the precision (the visible triangles of the unclustered scene over
+// those of the clustered one), the BVH culling time per view, and a frame cost
+// estimated as --draw_cost_us per draw plus --triangle_cost_ns per triangle.
+// The budget pair with the lowest estimate is logged last.
+//
+// Runs on a synthetic scene of --num_pieces small boxes of --num_materials
+// materials and, with --input, on the glTF scene as the cook partitions it.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "culling.h"
+#include "loader.h"
+#include "scene.h"
+
+DEFINE_string(input, "", "Optional glTF scene (e.g. Sponza) to sweep.");
+DEFINE_uint32(num_pieces, 50000, "Pieces of the synthetic scene.");
+DEFINE_uint32(num_materials, 8, "Materials of the synthetic scene.");
+DEFINE_string(triangle_budgets, "256,1024,4096,16384,65536",
+              "ClusterBudget::max_triangles values to sweep.");
+DEFINE_string(extent_budgets, "1,2,4,8,16",
+              "ClusterBudget::max_extent values to sweep, in meters.");
+DEFINE_uint32(views, 64, "Camera views per budget pair.");
+DEFINE_double(draw_cost_us, 0.5,
+              "Estimated cost of one draw (a multi-draw command).");
+DEFINE_double(triangle_cost_ns, 1.0, "Estimated cost of one triangle.");
+
+namespace sh_renderer {
+namespace {
+
+template <typename T>
+std::vector<T> ParseList(const std::string& list) {
+  std::vector<T> values;
+  std::istringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    std::istringstream value_stream(item);
+    T value;
+    if (value_stream >> value) values.push_back(value);
+  }
+  return values;
+}
+
+// Frustum planes of cameras at `center` turning a full circle, tilted
+// slightly downwards.
+std::vector<std::array<Eigen::Vector4f, 6>> MakeViews(
+    const Eigen::Vector3f& center, float z_far) {
+  std::vector<std::array<Eigen::Vector4f, 6>> views(FLAGS_views);
+  for (uint32_t i = 0; i < FLAGS_views; ++i) {
+    const float yaw = 2.0f * std::numbers::pi_v<float> * i / FLAGS_views;
+    Camera camera{.position = center,
+                  .orientation = Eigen::Quaternionf::Identity(),
+                  .intrinsics = {.z_far = z_far}};
+    LookAt(center + Eigen::Vector3f(std::cos(yaw), -0.2f, std::sin(yaw)),
+           &camera);
+    ExtractFrustumPlanes(GetViewProjMatrix(camera), views[i].data());
+  }
+  return views;
+}
+
+// Small boxes of random size and material scattered over a 60 x 20 x 60 m
+// room, like the clutter partitioning leaves behind.
+Scene MakePieceScene() {
+  Scene scene;
+  scene.materials.resize(FLAGS_num_materials);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> x(-30.0f, 30.0f);
+  std::uniform_real_distribution<float> y(0.0f, 20.0f);
+  std::uniform_real_distribution<float> size(0.05f, 0.5f);
+  std::uniform_int_distribution<int> material(0, FLAGS_num_materials - 1);
+  scene.geometries.resize(FLAGS_num_pieces);
+  for (Geometry& geo : scene.geometries) {
+    const Eigen::Vector3f min(x(rng), y(rng), x(rng));
+    const Eigen::Vector3f max =
+        min + Eigen::Vector3f(size(rng), size(rng), size(rng));
+    for (int corner = 0; corner < 8; ++corner) {
+      geo.vertices.emplace_back((corner & 1) ? max.x() : min.x(),
+                                (corner & 2) ? max.y() : min.y(),
+                                (corner & 4) ? max.z() : min.z());
+    }
+    geo.indices = {0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+                   2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3};
+    geo.material_id = material(rng);
+  }
+  ComputeSceneBoundingBoxes(scene);
+  return scene;
+}
+
+struct SweepResult {
+  size_t geometries = 0;
+  double draws = 0.0;      // per view
+  double triangles = 0.0;  // per view
+  double cull_us = 0.0;    // per view
+};
+
+SweepResult Measure(
+    const Scene& scene,
+    const std::vector<std::array<Eigen::Vector4f, 6>>& views) {
+  SweepResult result;
+  result.geometries = scene.geometries.size();
+  std::vector<uint32_t> visible;
+  double cull_us = 0.0;
+  for (const auto& planes : views) {
+    const auto start = std::chrono::steady_clock::now();
+    FrustumCullGeometries(scene, planes.data(), &visible);
+    cull_us += std::chrono::duration<double, std::micro>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+    result.draws += visible.size();
+    for (uint32_t i : visible) {
+      result.triangles +=
+          GeometryMesh(scene.geometries, scene.geometries[i]).indices.size() /
+          3;
+    }
+  }
+  const double num_views = std::max<size_t>(views.size(), 1);
+  result.draws /= num_views;
+  result.triangles /= num_views;
+  result.cull_us = cull_us / num_views;
+  return result;
+}
+
+double EstimatedCostUs(const SweepResult& result) {
+  return result.draws * FLAGS_draw_cost_us +
+         result.triangles * FLAGS_triangle_cost_ns * 1e-3;
+}
+
+void Sweep(const char* name, const Scene& partitioned) {
+  AABB bounds;
+  for (const Geometry& geo : partitioned.geometries) {
+    if (GeometryMesh(partitioned.geometries, geo).vertices.empty()) continue;
+    bounds.min = bounds.min.cwiseMin(geo.bounding_box.min);
+    bounds.max = bounds.max.cwiseMax(geo.bounding_box.max);
+  }
+  const auto views = MakeViews(0.5f * (bounds.min + bounds.max),
+                               (bounds.max - bounds.min).norm());
+
+  Scene unclustered = partitioned;
+  BuildSceneBvh(unclustered);
+  const SweepResult baseline = Measure(unclustered, views);
+  auto log_row = [&](const std::string& budget, const SweepResult& result) {
+    LOG(INFO) << name << " " << budget << ": " << result.geometries
+              << " geometries, " << result.draws << " draws and "
+              << result.triangles << " triangles per view, precision "
+              << baseline.triangles / std::max(result.triangles, 1.0)
+              << ", culled in " << result.cull_us << " us, estimated cost "
+              << EstimatedCostUs(result) << " us.";
+  };
+  log_row("unclustered", baseline);
+
+  std::optional<ClusterBudget> best;
+  double best_cost = EstimatedCostUs(baseline);
+  for (uint32_t max_triangles : ParseList<uint32_t>(FLAGS_triangle_budgets)) {
+    for (float max_extent : ParseList<float>(FLAGS_extent_budgets)) {
+      const ClusterBudget budget = {.max_triangles = max_triangles,
+                                    .max_extent = max_extent};
+      Scene scene = partitioned;
+      ClusterGeometries(scene, budget);
+      BuildSceneBvh(scene);
+      const SweepResult result = Measure(scene, views);
+      std::ostringstream label;
+      label << max_triangles << " triangles, " << max_extent << " m";
+      log_row(label.str(), result);
+      if (EstimatedCostUs(result) < best_cost) {
+        best_cost = EstimatedCostUs(result);
+        best = budget;
+      }
+    }
+  }
+  if (best) {
+    LOG(INFO) << name << ": lowest estimated cost " << best_cost
+              << " us with --cluster_max_triangles=" << best->max_triangles
+              << " --cluster_max_extent=" << best->max_extent << ".";
+  } else {
+    LOG(INFO) << name << ": clustering does not lower the estimated cost.";
+  }
+}
+
+int Run() {
+  Sweep("synthetic", MakePieceScene());
+
+  if (!FLAGS_input.empty()) {
+    std::optional<Scene> scene = LoadScene(FLAGS_input);
+    if (!scene) {
+      LOG(ERROR) << "Failed to load scene: " << FLAGS_input;
+      return 1;
+    }
+    PartitionLooseGeometries(*scene);
+    ComputeSceneBoundingBoxes(*scene);
+    Sweep(FLAGS_input.c_str(), *scene);
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace sh_renderer
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage(
+      "Geometry clustering tuning report: sweeps the cluster budgets.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  int result = sh_renderer::Run();
+
+  gflags::ShutDownCommandLineFlags();
+  return result;
+}
@@ -0,0 +1,259 @@
+#include "compute_hiz.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#include "glad.h"
+
+namespace sh_renderer {
+namespace {
+
+const char* kHiZCompute = "glsl/hiz.comp";
+const int kGroupSize = 8;
+
+// Level 0 size: the screen rounded up so that every level halves exactly.
+int PaddedSize(int size, int levels) {
+  const int multiple = 1 << (levels - 1);
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+}  // namespace
+
+int HiZLevelCount(int width, int height) {
+  const int full =
+      std::bit_width(static_cast<unsigned>(std::max(width, height)));
+  return std::clamp(full, kHiZTileLevel + 1, kHiZMaxLevels);
+}
+
+ShaderProgram CreateHiZProgram() {
+  auto program = ShaderProgram::CreateCompute(kHiZCompute);
+  if (!program) {
+    LOG(FATAL) << "Failed to create hierarchical Z compute shader program.";
+    return {};
+  }
+  return std::move(*program);
+}
+
+HiZUniforms ResolveHiZUniforms(const ShaderProgram& hiz_program) {
+  return {.level = hiz_program.Handle("u_level")};
+}
+
+HiZPyramid CreateHiZPyramid(int width, int height) {
+  CHECK_GT(width, 0);
+  CHECK_GT(height, 0);
+
+  HiZPyramid hiz;
+  hiz.screen_width = width;
+  hiz.screen_height = height;
+  hiz.levels = HiZLevelCount(width, height);
+  hiz.width = PaddedSize(width, hiz.levels);
+  hiz.height = PaddedSize(height, hiz.levels);
+
+  glCreateTextures(GL_TEXTURE_2D, 1, &hiz.texture);
+  glTextureStorage2D(hiz.texture, hiz.levels, GL_RG32F, hiz.width, hiz.height);
+  glTextureParameteri(hiz.texture, GL_TEXTURE_MIN_FILTER,
+                      GL_NEAREST_MIPMAP_NEAREST);
+  glTextureParameteri(hiz.texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTextureParameteri(hiz.texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(hiz.texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  LOG(INFO) << "Created hierarchical Z pyramid: " << hiz.width << "x"
+            << hiz.height << ", " << hiz.levels << " levels.";
+  return hiz;
+}
+
+void DestroyHiZPyramid(HiZPyramid* hiz) {
+  if (hiz->texture != 0) {
+    glDeleteTextures(1, &hiz->texture);
+    hiz->texture = 0;
+  }
+}
+
+bool ResizeHiZPyramid(int width, int height, HiZPyramid* hiz) {
+  if (hiz->screen_width == width && hiz->screen_height == height) {
+    return false;
+  }
+  DestroyHiZPyramid(hiz);
+  *hiz = CreateHiZPyramid(width, height);
+  return true;
+}
+
+void ComputeHiZPyramid(const RenderTarget& depth_target,
+                       const ShaderProgram& hiz_program,
+                       const HiZUniforms& uniforms,
+                       const Eigen::Matrix4f& view_proj, HiZPyramid* hiz) {
+  if (!hiz_program) return;
+  ResizeHiZPyramid(depth_target.width, depth_target.height, hiz);
+
+  hiz_program.Use();
+  glBindTextureUnit(15, depth_target.depth_buffer);
+  for (int level = 0; level < hiz->levels; ++level) {
+    uniforms.level.Set(level);
+    // Image units 0 and 1 must match the bindings in hiz.comp. Level 0 reads
+    // no image.
+    glBindImageTexture(0, hiz->texture, std::max(level - 1, 0), GL_FALSE, 0,
+                       GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(1, hiz->texture, level, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_RG32F);
+    const int width = hiz->width >> level;
+    const int height = hiz->height >> level;
+    glDispatchCompute((width + kGroupSize - 1) / kGroupSize,
+                      (height + kGroupSize - 1) / kGroupSize, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  glBindTextureUnit(kHiZTextureUnit, hiz->texture);
+  hiz->view_proj = view_proj;
+  hiz->built = true;
+}
+
+CpuHiZPyramid ReduceDepthToHiZ(std::span<const float> depth, int width,
+                               int height) {
+  CHECK_GT(width, 0);
+  CHECK_GT(height, 0);
+  CHECK_EQ(depth.size(), static_cast<size_t>(width) * height);
+
+  CpuHiZPyramid hiz;
+  hiz.screen_width = width;
+  hiz.screen_height = height;
+  const int levels = HiZLevelCount(width, height);
+  hiz.levels.resize(levels);
+
+  HiZLevel& base = hiz.levels[0];
+  base.width = PaddedSize(width, levels);
+  base.height = PaddedSize(height, levels);
+  base.depth.resize(static_cast<size_t>(base.width) * base.height);
+  for (int y = 0; y < base.height; ++y) {
+    const int source_y = std::min(y, height - 1);
+    for (int x = 0; x < base.width; ++x) {
+      const float d = depth[source_y * width + std::min(x, width - 1)];
+      base.depth[y * base.width + x] = Eigen::Vector2f(d, d);
+    }
+  }
+
+  for (int level = 1; level < levels; ++level) {
+    const HiZLevel& source = hiz.levels[level - 1];
+    HiZLevel& target = hiz.levels[level];
+    target.width = source.width / 2;
+    target.height = source.height / 2;
+    target.depth.resize(static_cast<size_t>(target.width) * target.height);
+    for (int y = 0; y < target.height; ++y) {
+      for (int x = 0; x < target.width; ++x) {
+        const Eigen::Vector2f* row0 =
+            &source.depth[(2 * y) * source.width + 2 * x];
+        const Eigen::Vector2f* row1 = row0 + source.width;
+        target.depth[y * target.width + x] = Eigen::Vector2f(
+            std::min({row0[0].x(), row0[1].x(), row1[0].x(), row1[1].x()}),
+            std::max({row0[0].y(), row0[1].y(), row1[0].y(), row1[1].y()}));
+      }
+    }
+  }
+  return hiz;
+}
+
+CpuHiZPyramid ReadHiZPyramid(const HiZPyramid& hiz) {
+  glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+  CpuHiZPyramid result;
+  result.screen_width = hiz.screen_width;
+  result.screen_height = hiz.screen_height;
+  result.levels.resize(hiz.levels);
+  for (int level = 0; level < hiz.levels; ++level) {
+    HiZLevel& out = result.levels[level];
+    out.width = hiz.width >> level;
+    out.height = hiz.height >> level;
+    out.depth.resize(static_cast<size_t>(out.width) * out.height);
+    glGetTextureImage(hiz.texture, level, GL_RG, GL_FLOAT,
+                      out.depth.size() * sizeof(Eigen::Vector2f),
+                      out.depth.data());
+  }
+  return result;
+}
+
+size_t CheckHiZPyramid(const RenderTarget& depth_target,
+                       const HiZPyramid& hiz) {
+  CHECK_EQ(depth_target.width, hiz.screen_width);
+  CHECK_EQ(depth_target.height, hiz.screen_height);
+  glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+  std::vector<float> depth(static_cast<size_t>(depth_target.width) *
+                           depth_target.height);
+  glGetTextureImage(depth_target.depth_buffer, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+                    depth.size() * sizeof(float), depth.data());
+
+  const CpuHiZPyramid expected =
+      ReduceDepthToHiZ(depth, depth_target.width, depth_target.height);
+  const CpuHiZPyramid actual = ReadHiZPyramid(hiz);
+  size_t mismatches = 0;
+  for (size_t level = 0; level < expected.levels.size(); ++level) {
+    const std::vector<Eigen::Vector2f>& a = expected.levels[level].depth;
+    const std::vector<Eigen::Vector2f>& b = actual.levels[level].depth;
+    for (size_t i = 0; i < a.size(); ++i) {
+      if (a[i] != b[i]) ++mismatches;
+    }
+  }
+  return mismatches;
+}
+
+bool IsAABBOccludedByHiZ(const CpuHiZPyramid& hiz,
+                         const Eigen::Matrix4f& view_proj, const AABB& box) {
+  if (hiz.levels.empty()) return false;
+
+  Eigen::Vector2f ndc_min =
+      Eigen::Vector2f::Constant(std::numeric_limits<float>::infinity());
+  Eigen::Vector2f ndc_max = -ndc_min;
+  float min_depth = std::numeric_limits<float>::infinity();
+  for (int corner = 0; corner < 8; ++corner) {
+    const Eigen::Vector3f p((corner & 1) ? box.max.x() : box.min.x(),
+                            (corner & 2) ? box.max.y() : box.min.y(),
+                            (corner & 4) ? box.max.z() : box.min.z());
+    const Eigen::Vector4f clip = view_proj * p.homogeneous();
+    // In front of the near plane.
+    if (!(clip.w() > 0.0f) || clip.z() < -clip.w()) return false;
+    const Eigen::Vector3f ndc = clip.head<3>() / clip.w();
+    ndc_min = ndc_min.cwiseMin(ndc.head<2>());
+    ndc_max = ndc_max.cwiseMax(ndc.head<2>());
+    min_depth = std::min(min_depth, 0.5f * ndc.z() + 0.5f);
+  }
+  if (ndc_max.x() < -1.0f || ndc_min.x() > 1.0f || ndc_max.y() < -1.0f ||
+      ndc_min.y() > 1.0f) {
+    return false;
+  }
+
+  // The screen rectangle in pixels, clamped to the screen.
+  const Eigen::Vector2f screen(hiz.screen_width, hiz.screen_height);
+  auto to_pixel = [&](const Eigen::Vector2f& ndc) {
+    const Eigen::Vector2f pixel =
+        (0.5f * ndc.array() + 0.5f).matrix().cwiseProduct(screen);
+    return Eigen::Vector2i(
+        std::clamp(static_cast<int>(std::floor(pixel.x())), 0,
+                   hiz.screen_width - 1),
+        std::clamp(static_cast<int>(std::floor(pixel.y())), 0,
+                   hiz.screen_height - 1));
+  };
+  const Eigen::Vector2i p0 = to_pixel(ndc_min);
+  const Eigen::Vector2i p1 = to_pixel(ndc_max);
+
+  for (int level = 0; level < static_cast<int>(hiz.levels.size()); ++level) {
+    const int x0 = p0.x() >> level;
+    const int x1 = p1.x() >> level;
+    const int y0 = p0.y() >> level;
+    const int y1 = p1.y() >> level;
+    if (x1 - x0 > 1 || y1 - y0 > 1) continue;
+
+    const HiZLevel& texels = hiz.levels[level];
+    float max_depth = 0.0f;
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        max_depth = std::max(max_depth, texels.depth[y * texels.width + x].y());
+      }
+    }
+    return min_depth > max_depth;
+  }
+  return false;
+}
+
+}  // namespace sh_renderer
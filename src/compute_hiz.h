@@ -0,0 +1,111 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "culling.h"
+#include "render_target.h"
+#include "shader.h"
+
+namespace sh_renderer {
+
+// --- Hierarchical Z pyramid ---
+// A min/max mip chain of the depth pre-pass, built by a compute pass each
+// frame. Level 0 holds (depth, depth) per pixel and each further level the
+// min and max of 2x2 texels of the level above, so texel (x, y) of level k
+// bounds the window-space depth of the pixels [x, x + 1) * 2^k by
+// [y, y + 1) * 2^k. The base is padded to a multiple of 2^(levels - 1) so that
+// every level halves exactly; padding texels repeat the screen's edge.
+//
+// Level kHiZTileLevel has one texel per light-culling tile. The pyramid also
+// keeps the view-projection it was built with, so the next frame can test its
+// geometry against it (IsAABBOccludedByHiZ).
+
+constexpr int kHiZTileLevel = 4;  // 16x16 pixels
+constexpr int kHiZMaxLevels = 8;
+
+// Texture unit the pyramid is bound to for the passes that read it.
+constexpr int kHiZTextureUnit = 14;
+
+struct HiZPyramid {
+  uint32_t texture = 0;  // GL_RG32F: r = min depth, g = max depth
+  int screen_width = 0;
+  int screen_height = 0;
+  int width = 0;  // of level 0, padded
+  int height = 0;
+  int levels = 0;
+  Eigen::Matrix4f view_proj = Eigen::Matrix4f::Identity();
+  bool built = false;  // false until ComputeHiZPyramid first fills it
+};
+
+// The number of levels of the pyramid of a `width` x `height` screen: down to
+// a single texel, but at least kHiZTileLevel + 1 and at most kHiZMaxLevels.
+int HiZLevelCount(int width, int height);
+
+// Creates the pyramid build compute shader program.
+ShaderProgram CreateHiZProgram();
+
+// The build program's per-level uniforms. Resolve them once the program has
+// linked, and again after a hot reload swaps it.
+struct HiZUniforms {
+  UniformHandle level;
+};
+
+HiZUniforms ResolveHiZUniforms(const ShaderProgram& hiz_program);
+
+// Creates the pyramid texture for the given screen dimensions.
+HiZPyramid CreateHiZPyramid(int width, int height);
+
+// Destroys the pyramid texture.
+void DestroyHiZPyramid(HiZPyramid* hiz);
+
+// Recreates the pyramid if the screen dimensions changed.
+// Returns true if it was recreated.
+bool ResizeHiZPyramid(int width, int height, HiZPyramid* hiz);
+
+// Builds the pyramid from `depth_target`'s depth buffer, drawn with
+// `view_proj`, and binds it to kHiZTextureUnit.
+void ComputeHiZPyramid(const RenderTarget& depth_target,
+                       const ShaderProgram& hiz_program,
+                       const HiZUniforms& uniforms,
+                       const Eigen::Matrix4f& view_proj, HiZPyramid* hiz);
+
+// --- CPU side (tests and debugging) ---
+
+struct HiZLevel {
+  int width = 0;
+  int height = 0;
+  std::vector<Eigen::Vector2f> depth;  // (min, max), rows from the bottom
+};
+
+struct CpuHiZPyramid {
+  int screen_width = 0;
+  int screen_height = 0;
+  std::vector<HiZLevel> levels;
+};
+
+// Reduces a `width` x `height` depth image (rows from the bottom) to its
+// pyramid, as ComputeHiZPyramid does.
+CpuHiZPyramid ReduceDepthToHiZ(std::span<const float> depth, int width,
+                               int height);
+
+// Reads `hiz` back from the GPU. Stalls the pipeline.
+CpuHiZPyramid ReadHiZPyramid(const HiZPyramid& hiz);
+
+// Reads `depth_target`'s depth buffer and `hiz` back and compares the pyramid
+// with ReduceDepthToHiZ of the depth. Returns the number of texels that
+// differ. Stalls the pipeline.
+size_t CheckHiZPyramid(const RenderTarget& depth_target,
+                       const HiZPyramid& hiz);
+
+// Whether `box` lies behind the depth in `hiz`, a pyramid built with
+// `view_proj`: its nearest depth is farther than the max depth of the up to
+// 2x2 texels of the finest level that cover its screen rectangle. Boxes
+// crossing the near plane, off screen, or too large for the coarsest level
+// are never occluded.
+bool IsAABBOccludedByHiZ(const CpuHiZPyramid& hiz,
+                         const Eigen::Matrix4f& view_proj, const AABB& box);
+
+}  // namespace sh_renderer
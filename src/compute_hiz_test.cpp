@@ -0,0 +1,152 @@
+#include "compute_hiz.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+
+#include "camera.h"
+#include "glad.h"
+#include "window.h"
+
+namespace sh_renderer {
+namespace {
+
+std::vector<float> RandomDepth(int width, int height, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::vector<float> depth(static_cast<size_t>(width) * height);
+  for (float& d : depth) d = uniform(rng);
+  return depth;
+}
+
+// Checks every texel of `hiz` that covers part of the screen against the min
+// and max of the pixels it covers.
+void ExpectMatchesBruteForce(const CpuHiZPyramid& hiz,
+                             const std::vector<float>& depth, int width,
+                             int height) {
+  ASSERT_EQ(hiz.levels.size(),
+            static_cast<size_t>(HiZLevelCount(width, height)));
+  for (size_t level = 0; level < hiz.levels.size(); ++level) {
+    const HiZLevel& texels = hiz.levels[level];
+    const int size = 1 << level;
+    ASSERT_EQ(texels.width, hiz.levels[0].width >> level);
+    ASSERT_EQ(texels.height, hiz.levels[0].height >> level);
+    for (int ty = 0; ty * size < height; ++ty) {
+      for (int tx = 0; tx * size < width; ++tx) {
+        float min_depth = 1.0f;
+        float max_depth = 0.0f;
+        for (int y = ty * size; y < std::min((ty + 1) * size, height); ++y) {
+          for (int x = tx * size; x < std::min((tx + 1) * size, width); ++x) {
+            min_depth = std::min(min_depth, depth[y * width + x]);
+            max_depth = std::max(max_depth, depth[y * width + x]);
+          }
+        }
+        const Eigen::Vector2f& texel = texels.depth[ty * texels.width + tx];
+        ASSERT_EQ(texel.x(), min_depth) << level << " " << tx << " " << ty;
+        ASSERT_EQ(texel.y(), max_depth) << level << " " << tx << " " << ty;
+      }
+    }
+  }
+}
+
+// The view of a camera at the origin looking down -Z.
+Eigen::Matrix4f TestViewProj() {
+  return GetViewProjMatrix(
+      Camera{.position = Eigen::Vector3f::Zero(),
+             .orientation = Eigen::Quaternionf::Identity()});
+}
+
+// Window-space depth of the point at view depth `z` on the view axis.
+float WindowDepth(const Eigen::Matrix4f& view_proj, float z) {
+  const Eigen::Vector4f clip = view_proj * Eigen::Vector4f(0, 0, z, 1);
+  return 0.5f * clip.z() / clip.w() + 0.5f;
+}
+
+AABB Box(const Eigen::Vector3f& min, const Eigen::Vector3f& max) {
+  AABB box;
+  box.min = min;
+  box.max = max;
+  return box;
+}
+
+TEST(HiZTest, LevelsReachTheTileLevelAndAreCapped) {
+  EXPECT_EQ(HiZLevelCount(1920, 1080), kHiZMaxLevels);
+  EXPECT_EQ(HiZLevelCount(100, 20), 7);
+  EXPECT_EQ(HiZLevelCount(8, 8), kHiZTileLevel + 1);
+
+  const CpuHiZPyramid hiz =
+      ReduceDepthToHiZ(RandomDepth(100, 20, 1), 100, 20);
+  ASSERT_EQ(hiz.levels.size(), 7u);
+  EXPECT_EQ(hiz.levels[0].width, 128);  // padded to a multiple of 64
+  EXPECT_EQ(hiz.levels[0].height, 64);
+  EXPECT_EQ(hiz.levels[6].width, 2);
+  EXPECT_EQ(hiz.levels[6].height, 1);
+}
+
+TEST(HiZTest, ReductionMatchesBruteForce) {
+  for (const auto& [width, height] :
+       {std::pair{37, 23}, std::pair{100, 61}, std::pair{5, 3},
+        std::pair{300, 17}}) {
+    const std::vector<float> depth = RandomDepth(width, height, width);
+    ExpectMatchesBruteForce(ReduceDepthToHiZ(depth, width, height), depth,
+                            width, height);
+  }
+}
+
+TEST(HiZTest, BoxesBehindTheDepthAreOccluded) {
+  const Eigen::Matrix4f view_proj = TestViewProj();
+  // A wall at z = -5 over the left half of the screen; the sky elsewhere.
+  const int width = 64;
+  const int height = 32;
+  std::vector<float> depth(width * height, 1.0f);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width / 2; ++x) {
+      depth[y * width + x] = WindowDepth(view_proj, -5.0f);
+    }
+  }
+  const CpuHiZPyramid hiz = ReduceDepthToHiZ(depth, width, height);
+
+  EXPECT_TRUE(IsAABBOccludedByHiZ(hiz, view_proj,
+                                  Box({-6, -1, -21}, {-3, 1, -20})));
+  // In front of the wall, across its edge, or over the sky.
+  EXPECT_FALSE(IsAABBOccludedByHiZ(hiz, view_proj,
+                                   Box({-2, -1, -4}, {-1, 1, -3})));
+  EXPECT_FALSE(IsAABBOccludedByHiZ(hiz, view_proj,
+                                   Box({-3, -1, -21}, {3, 1, -20})));
+  EXPECT_FALSE(IsAABBOccludedByHiZ(hiz, view_proj,
+                                   Box({3, -1, -21}, {6, 1, -20})));
+  // Crossing the near plane, or off screen.
+  EXPECT_FALSE(IsAABBOccludedByHiZ(hiz, view_proj,
+                                   Box({-6, -1, -21}, {-3, 1, 1})));
+  EXPECT_FALSE(IsAABBOccludedByHiZ(hiz, view_proj,
+                                   Box({-100, -1, -21}, {-90, 1, -20})));
+}
+
+TEST(HiZTest, GpuPyramidMatchesBruteForce) {
+  auto window = CreateWindow(64, 64, "Hierarchical Z test");
+  ASSERT_TRUE(window.has_value());
+  {
+    const int width = 100;
+    const int height = 61;
+    const std::vector<float> depth = RandomDepth(width, height, 7);
+    RenderTarget depth_target = CreateDepthTarget(width, height);
+    glTextureSubImage2D(depth_target.depth_buffer, 0, 0, 0, width, height,
+                        GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+
+    ShaderProgram program = CreateHiZProgram();
+    HiZPyramid hiz = CreateHiZPyramid(width, height);
+    ComputeHiZPyramid(depth_target, program, ResolveHiZUniforms(program),
+                      TestViewProj(), &hiz);
+    ExpectMatchesBruteForce(ReadHiZPyramid(hiz), depth, width, height);
+    EXPECT_EQ(CheckHiZPyramid(depth_target, hiz), 0u);
+
+    DestroyHiZPyramid(&hiz);
+    glDeleteFramebuffers(1, &depth_target.fbo);
+    glDeleteTextures(1, &depth_target.depth_buffer);
+  }
+  DestroyWindow(*window);
+}
+
+}  // namespace
+}  // namespace sh_renderer
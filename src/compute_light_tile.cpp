@@ -11,6 +11,9 @@ const uint32_t kMaxLightsPerTile = 256;
 const uint32_t kTileSize = 16;
 const char* kLightCullCompute = "glsl/light_cull.comp";
 
+// A tile's depth range is one texel of this pyramid level.
+static_assert(kTileSize == 1u << kHiZTileLevel);
+
 }  // namespace
 
 ShaderProgram CreateLightCullProgram() {
@@ -35,9 +38,9 @@ TileLightListList CreateTileLightList(uint32_t width, uint32_t height) {
   uint32_t total_tiles = result.tile_count_x * result.tile_count_y;
 
   // SSBO layout:
-  // [header: total_tiles * 2 uints (offset, count per tile)]
+  // [header: total_tiles * 3 uints (offset, point count, spot count per tile)]
   // [data:   total_tiles * MAX_LIGHTS_PER_TILE uints (light indices)]
-  size_t header_size = total_tiles * 2 * sizeof(uint32_t);
+  size_t header_size = total_tiles * 3 * sizeof(uint32_t);
   size_t data_size = total_tiles * kMaxLightsPerTile * sizeof(uint32_t);
   size_t total_size = header_size + data_size;
 
@@ -76,8 +79,9 @@ bool ResizeTileLightList(uint32_t width, uint32_t height,
   return true;
 }
 
-void ComputeTileLightList(const Camera& camera, const RenderTarget& hdr_target,
-                          const Scene& scene, const ShaderProgram& cull_program,
+void ComputeTileLightList(const RenderTarget& hdr_target, const Scene& scene,
+                          const ShaderProgram& cull_program,
+                          const HiZPyramid& hiz,
                           TileLightListList* tile_light_list) {
   if (!cull_program) return;
 
@@ -91,28 +95,16 @@ void ComputeTileLightList(const Camera& camera, const RenderTarget& hdr_target,
   BindSSBO(scene.spot_light_list_ssbo, 1);
   BindSSBO(tile_light_list->tile_light_index_ssbo, 2);
 
-  // Bind depth texture.
-  glBindTextureUnit(15, hdr_target.depth_buffer);
+  // Bind the depth pyramid.
+  glBindTextureUnit(kHiZTextureUnit, hiz.texture);
 
   // Bind debug heatmap as image unit 0 (must match the binding in
   // light_cull.comp).
   glBindImageTexture(0, tile_light_list->debug_heatmap_texture, 0, GL_FALSE, 0,
                      GL_WRITE_ONLY, GL_RGBA8);
 
-  // Set uniforms.
-  Eigen::Matrix4f projection = GetProjectionMatrix(camera);
-  Eigen::Matrix4f view = GetViewMatrix(camera);
-  Eigen::Matrix4f inv_projection = projection.inverse();
-
-  cull_program.Uniform("u_projection", projection);
-  cull_program.Uniform("u_inv_projection", inv_projection);
-  cull_program.Uniform("u_view", view);
-
-  // u_screen_size is ivec2
-  cull_program.Uniform("u_screen_size",
-                       Eigen::Vector2i(hdr_target.width, hdr_target.height));
-
-  // Dispatch.
+  // Dispatch. The camera matrices and screen size come from the frame
+  // constants.
   glDispatchCompute(tile_light_list->tile_count_x,
                     tile_light_list->tile_count_y, 1);
 
@@ -3,6 +3,7 @@
 #include <cstdint>
 
 #include "camera.h"
+#include "compute_hiz.h"
 #include "render_target.h"
 #include "scene.h"
 #include "shader.h"
@@ -34,9 +35,12 @@ void DestroyTileLightList(TileLightListList* tile_light_list);
 bool ResizeLightTileList(uint32_t width, uint32_t height,
                          TileLightListList* tile_light_list);
 
-// Dispatches the compute shader to build per-tile light lists.
-void ComputeTileLightList(const Camera& camera, const RenderTarget& hdr_target,
-                          const Scene& scene, const ShaderProgram& cull_program,
+// Dispatches the compute shader to build per-tile light lists for the camera
+// of the bound frame constants. Each tile's depth range is one texel of
+// `hiz`, which must be built from this frame's depth pre-pass.
+void ComputeTileLightList(const RenderTarget& hdr_target, const Scene& scene,
+                          const ShaderProgram& cull_program,
+                          const HiZPyramid& hiz,
                           TileLightListList* tile_light_list);
 
 // Binds the tile light SSBOs for consumption by the forward pass.
@@ -1,5 +1,16 @@
 #include "culling.h"
 
+#include <glog/logging.h>
+
+#include <bit>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SH_CULLING_X86 1
+#include <immintrin.h>
+#else
+#define SH_CULLING_X86 0
+#endif
+
 namespace sh_renderer {
 
 void ExtractFrustumPlanes(const Eigen::Matrix4f& vp,
@@ -45,4 +56,249 @@ bool IsAABBInFrustum(const AABB& aabb, const Eigen::Vector4f planes[6]) {
   return true;
 }
 
+AABBSoA MakeAABBSoA(std::span<const AABB> boxes) {
+  AABBSoA soa;
+  soa.count = boxes.size();
+  const size_t padded =
+      (boxes.size() + kCullBatchSize - 1) / kCullBatchSize * kCullBatchSize;
+  for (auto* array : {&soa.min_x, &soa.min_y, &soa.min_z, &soa.max_x,
+                      &soa.max_y, &soa.max_z}) {
+    array->resize(padded, 0.0f);
+  }
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    soa.min_x[i] = boxes[i].min.x();
+    soa.min_y[i] = boxes[i].min.y();
+    soa.min_z[i] = boxes[i].min.z();
+    soa.max_x[i] = boxes[i].max.x();
+    soa.max_y[i] = boxes[i].max.y();
+    soa.max_z[i] = boxes[i].max.z();
+  }
+  return soa;
+}
+
+namespace {
+
+// A frustum plane with the p-vertex arrays it selects: the box corner furthest
+// along the plane normal takes max on the axes where the normal is positive.
+struct CullPlane {
+  const float* x;
+  const float* y;
+  const float* z;
+  float a, b, c, d;
+};
+
+void PrepareCullPlanes(const AABBSoA& boxes, const Eigen::Vector4f planes[6],
+                       CullPlane out[6]) {
+  for (int i = 0; i < 6; ++i) {
+    out[i] = {
+        .x = planes[i].x() > 0 ? boxes.max_x.data() : boxes.min_x.data(),
+        .y = planes[i].y() > 0 ? boxes.max_y.data() : boxes.min_y.data(),
+        .z = planes[i].z() > 0 ? boxes.max_z.data() : boxes.min_z.data(),
+        .a = planes[i].x(),
+        .b = planes[i].y(),
+        .c = planes[i].z(),
+        .d = planes[i].w(),
+    };
+  }
+}
+
+// Ors the visible bits of batch `batch` into the bitmask.
+void StoreBatch(size_t batch, uint32_t visible, uint64_t* words) {
+  constexpr size_t kBatchesPerWord = 64 / kCullBatchSize;
+  words[batch / kBatchesPerWord] |= static_cast<uint64_t>(visible)
+                                    << (kCullBatchSize *
+                                        (batch % kBatchesPerWord));
+}
+
+// The kernels evaluate the plane distance as ((a * x + b * y) + c * z) + d,
+// like IsAABBInFrustum, so they round identically.
+void CullScalar(const CullPlane planes[6], size_t num_batches,
+                uint64_t* words) {
+  for (size_t batch = 0; batch < num_batches; ++batch) {
+    uint32_t visible = 0;
+    for (int lane = 0; lane < kCullBatchSize; ++lane) {
+      const size_t i = batch * kCullBatchSize + lane;
+      bool inside = true;
+      for (int p = 0; p < 6 && inside; ++p) {
+        const CullPlane& plane = planes[p];
+        const float distance = plane.a * plane.x[i] + plane.b * plane.y[i] +
+                               plane.c * plane.z[i] + plane.d;
+        inside = !(distance < 0);
+      }
+      visible |= static_cast<uint32_t>(inside) << lane;
+    }
+    StoreBatch(batch, visible, words);
+  }
+}
+
+#if SH_CULLING_X86
+
+void CullSse(const CullPlane planes[6], size_t num_batches, uint64_t* words) {
+  const __m128 zero = _mm_setzero_ps();
+  for (size_t batch = 0; batch < num_batches; ++batch) {
+    uint32_t visible = 0;
+    for (int lane = 0; lane < kCullBatchSize; lane += 4) {
+      const size_t i = batch * kCullBatchSize + lane;
+      __m128 outside = zero;
+      for (int p = 0; p < 6; ++p) {
+        const CullPlane& plane = planes[p];
+        const __m128 x = _mm_loadu_ps(plane.x + i);
+        const __m128 y = _mm_loadu_ps(plane.y + i);
+        const __m128 z = _mm_loadu_ps(plane.z + i);
+        __m128 distance = _mm_mul_ps(_mm_set1_ps(plane.a), x);
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.b), y));
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.c), z));
+        distance = _mm_add_ps(distance, _mm_set1_ps(plane.d));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+      }
+      visible |= (~_mm_movemask_ps(outside) & 0xfu) << lane;
+    }
+    StoreBatch(batch, visible, words);
+  }
+}
+
+__attribute__((target("avx2"))) void CullAvx2(const CullPlane planes[6],
+                                              size_t num_batches,
+                                              uint64_t* words) {
+  const __m256 zero = _mm256_setzero_ps();
+  for (size_t batch = 0; batch < num_batches; ++batch) {
+    uint32_t visible = 0;
+    for (int lane = 0; lane < kCullBatchSize; lane += 8) {
+      const size_t i = batch * kCullBatchSize + lane;
+      __m256 outside = zero;
+      for (int p = 0; p < 6; ++p) {
+        const CullPlane& plane = planes[p];
+        const __m256 x = _mm256_loadu_ps(plane.x + i);
+        const __m256 y = _mm256_loadu_ps(plane.y + i);
+        const __m256 z = _mm256_loadu_ps(plane.z + i);
+        __m256 distance = _mm256_mul_ps(_mm256_set1_ps(plane.a), x);
+        distance = _mm256_add_ps(
+            distance, _mm256_mul_ps(_mm256_set1_ps(plane.b), y));
+        distance = _mm256_add_ps(
+            distance, _mm256_mul_ps(_mm256_set1_ps(plane.c), z));
+        distance = _mm256_add_ps(distance, _mm256_set1_ps(plane.d));
+        outside =
+            _mm256_or_ps(outside, _mm256_cmp_ps(distance, zero, _CMP_LT_OQ));
+      }
+      visible |= (~_mm256_movemask_ps(outside) & 0xffu) << lane;
+    }
+    StoreBatch(batch, visible, words);
+  }
+}
+
+__attribute__((target("avx512f"))) void CullAvx512(const CullPlane planes[6],
+                                                   size_t num_batches,
+                                                   uint64_t* words) {
+  const __m512 zero = _mm512_setzero_ps();
+  for (size_t batch = 0; batch < num_batches; ++batch) {
+    const size_t i = batch * kCullBatchSize;
+    __mmask16 outside = 0;
+    for (int p = 0; p < 6; ++p) {
+      const CullPlane& plane = planes[p];
+      const __m512 x = _mm512_loadu_ps(plane.x + i);
+      const __m512 y = _mm512_loadu_ps(plane.y + i);
+      const __m512 z = _mm512_loadu_ps(plane.z + i);
+      __m512 distance = _mm512_mul_ps(_mm512_set1_ps(plane.a), x);
+      distance = _mm512_add_ps(
+          distance, _mm512_mul_ps(_mm512_set1_ps(plane.b), y));
+      distance = _mm512_add_ps(
+          distance, _mm512_mul_ps(_mm512_set1_ps(plane.c), z));
+      distance = _mm512_add_ps(distance, _mm512_set1_ps(plane.d));
+      outside |= _mm512_cmp_ps_mask(distance, zero, _CMP_LT_OQ);
+    }
+    StoreBatch(batch, static_cast<uint16_t>(~outside), words);
+  }
+}
+
+#endif  // SH_CULLING_X86
+
+}  // namespace
+
+const char* CullKernelName(CullKernel kernel) {
+  switch (kernel) {
+    case CullKernel::kScalar:
+      return "scalar";
+    case CullKernel::kSse:
+      return "sse";
+    case CullKernel::kAvx2:
+      return "avx2";
+    case CullKernel::kAvx512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+bool IsCullKernelSupported(CullKernel kernel) {
+  switch (kernel) {
+    case CullKernel::kScalar:
+      return true;
+#if SH_CULLING_X86
+    case CullKernel::kSse:
+      return true;  // part of x86-64
+    case CullKernel::kAvx2:
+      return __builtin_cpu_supports("avx2");
+    case CullKernel::kAvx512:
+      return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+      return false;
+  }
+}
+
+CullKernel BestCullKernel() {
+  static const CullKernel best = [] {
+    for (CullKernel kernel :
+         {CullKernel::kAvx512, CullKernel::kAvx2, CullKernel::kSse}) {
+      if (IsCullKernelSupported(kernel)) return kernel;
+    }
+    return CullKernel::kScalar;
+  }();
+  return best;
+}
+
+void CullAABBsInFrustum(const AABBSoA& boxes, const Eigen::Vector4f planes[6],
+                        std::vector<uint64_t>* visible, CullKernel kernel) {
+  CHECK(IsCullKernelSupported(kernel)) << CullKernelName(kernel);
+  visible->assign((boxes.count + 63) / 64, 0);
+  if (boxes.count == 0) return;
+
+  CullPlane cull_planes[6];
+  PrepareCullPlanes(boxes, planes, cull_planes);
+  const size_t num_batches = boxes.min_x.size() / kCullBatchSize;
+  uint64_t* words = visible->data();
+  switch (kernel) {
+    case CullKernel::kScalar:
+      CullScalar(cull_planes, num_batches, words);
+      break;
+#if SH_CULLING_X86
+    case CullKernel::kSse:
+      CullSse(cull_planes, num_batches, words);
+      break;
+    case CullKernel::kAvx2:
+      CullAvx2(cull_planes, num_batches, words);
+      break;
+    case CullKernel::kAvx512:
+      CullAvx512(cull_planes, num_batches, words);
+      break;
+#endif
+    default:
+      break;
+  }
+
+  // Clear the bits of the padding boxes.
+  if (const size_t tail = boxes.count % 64; tail != 0) {
+    visible->back() &= (uint64_t{1} << tail) - 1;
+  }
+}
+
+void CompactVisible(std::span<const uint64_t> visible,
+                    std::vector<uint32_t>* indices) {
+  for (size_t w = 0; w < visible.size(); ++w) {
+    for (uint64_t bits = visible[w]; bits != 0; bits &= bits - 1) {
+      indices->push_back(
+          static_cast<uint32_t>(w * 64 + std::countr_zero(bits)));
+    }
+  }
+}
+
 }  // namespace sh_renderer
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <Eigen/Dense>
+#include <cstdint>
+#include <span>
+#include <vector>
 
 namespace sh_renderer {
 
@@ -25,4 +28,42 @@ void ExtractFrustumPlanes(const Eigen::Matrix4f& vp, Eigen::Vector4f planes[6]);
 // True means the AABB should be rendered.
 bool IsAABBInFrustum(const AABB& aabb, const Eigen::Vector4f planes[6]);
 
+// --- Batched culling ---
+// Bounding boxes in structure-of-arrays layout, so the SIMD kernels load one
+// coordinate of 4, 8 or 16 boxes with a single instruction. The arrays are
+// padded to a multiple of kCullBatchSize; `count` is the number of boxes.
+constexpr int kCullBatchSize = 16;
+
+struct AABBSoA {
+  std::vector<float> min_x, min_y, min_z;
+  std::vector<float> max_x, max_y, max_z;
+  size_t count = 0;
+};
+
+AABBSoA MakeAABBSoA(std::span<const AABB> boxes);
+
+// Implementations of CullAABBsInFrustum. Each one tests kCullBatchSize boxes
+// per iteration: kScalar one at a time, kSse with 4 lanes, kAvx2 with 8 and
+// kAvx512 with 16. The SIMD kernels exist on x86-64 only.
+enum class CullKernel { kScalar, kSse, kAvx2, kAvx512 };
+
+const char* CullKernelName(CullKernel kernel);
+
+// Whether this build and CPU can run `kernel`.
+bool IsCullKernelSupported(CullKernel kernel);
+
+// The widest supported kernel, detected once.
+CullKernel BestCullKernel();
+
+// Replaces `visible` with a bitmask of the boxes IsAABBInFrustum accepts: bit
+// i % 64 of word i / 64 is set for box i. Every kernel gives the same result.
+void CullAABBsInFrustum(const AABBSoA& boxes, const Eigen::Vector4f planes[6],
+                        std::vector<uint64_t>* visible,
+                        CullKernel kernel = BestCullKernel());
+
+// Appends the index of every set bit of `visible` to `indices`, in ascending
+// order.
+void CompactVisible(std::span<const uint64_t> visible,
+                    std::vector<uint32_t>* indices);
+
 }  // namespace sh_renderer
@@ -2,6 +2,11 @@
 
 #include <gtest/gtest.h>
 
+#include <random>
+#include <vector>
+
+#include "camera.h"
+
 namespace sh_renderer {
 namespace {
 
@@ -47,5 +52,73 @@ TEST(CullingTest, IsAABBInFrustum_Intersecting) {
   EXPECT_TRUE(IsAABBInFrustum(aabb, planes));
 }
 
+std::vector<AABB> RandomBoxes(int count, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> position(-30.0f, 30.0f);
+  std::uniform_real_distribution<float> size(0.0f, 4.0f);
+  std::vector<AABB> boxes(count);
+  for (AABB& box : boxes) {
+    box.min = Eigen::Vector3f(position(rng), position(rng), position(rng));
+    box.max = box.min + Eigen::Vector3f(size(rng), size(rng), size(rng));
+  }
+  return boxes;
+}
+
+void RandomFrustum(uint32_t seed, Eigen::Vector4f planes[6]) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  Camera camera{.position = Eigen::Vector3f(unit(rng), unit(rng), unit(rng)),
+                .orientation = Eigen::Quaternionf::Identity(),
+                .intrinsics = {.z_far = 25.0f}};
+  LookAt(camera.position + Eigen::Vector3f(unit(rng), unit(rng), unit(rng)),
+         &camera);
+  ExtractFrustumPlanes(GetViewProjMatrix(camera), planes);
+}
+
+bool IsSet(const std::vector<uint64_t>& visible, size_t i) {
+  return (visible[i / 64] >> (i % 64)) & 1;
+}
+
+TEST(CullingTest, BatchedKernelsMatchScalarReference) {
+  const CullKernel kernels[] = {CullKernel::kScalar, CullKernel::kSse,
+                                CullKernel::kAvx2, CullKernel::kAvx512};
+  // Counts that leave partial batches and partial bitmask words.
+  for (int count : {0, 1, 15, 16, 63, 100, 1000}) {
+    std::vector<AABB> boxes = RandomBoxes(count, count);
+    AABBSoA soa = MakeAABBSoA(boxes);
+    for (uint32_t view = 0; view < 8; ++view) {
+      Eigen::Vector4f planes[6];
+      RandomFrustum(view, planes);
+      for (CullKernel kernel : kernels) {
+        if (!IsCullKernelSupported(kernel)) continue;
+        SCOPED_TRACE(CullKernelName(kernel));
+        std::vector<uint64_t> visible;
+        CullAABBsInFrustum(soa, planes, &visible, kernel);
+        ASSERT_EQ(visible.size(), (boxes.size() + 63) / 64);
+        for (size_t i = 0; i < boxes.size(); ++i) {
+          EXPECT_EQ(IsSet(visible, i), IsAABBInFrustum(boxes[i], planes))
+              << "box " << i << " of " << count << ", view " << view;
+        }
+        for (size_t i = boxes.size(); i < visible.size() * 64; ++i) {
+          EXPECT_FALSE(IsSet(visible, i)) << "padding bit " << i;
+        }
+      }
+    }
+  }
+}
+
+TEST(CullingTest, BestKernelIsSupported) {
+  EXPECT_TRUE(IsCullKernelSupported(BestCullKernel()));
+  EXPECT_TRUE(IsCullKernelSupported(CullKernel::kScalar));
+}
+
+TEST(CullingTest, CompactVisibleListsSetBitsInOrder) {
+  std::vector<uint64_t> visible = {(uint64_t{1} << 0) | (uint64_t{1} << 63),
+                                   0, uint64_t{1} << 5};
+  std::vector<uint32_t> indices = {7};
+  CompactVisible(visible, &indices);
+  EXPECT_EQ(indices, (std::vector<uint32_t>{7, 0, 63, 133}));
+}
+
 }  // namespace
 }  // namespace sh_renderer
@@ -3,6 +3,8 @@
 #include <glog/logging.h>
 
 #include "glad.h"
+#include "gpu_culling.h"
+#include "render_queue.h"
 
 namespace sh_renderer {
 
@@ -94,7 +96,7 @@ ShaderProgram CreateDepthVisualizerProgram() {
 }
 
 void DrawDepth(const Scene& scene, const Camera& camera,
-               const ShaderProgram& opaque_program,
+               const DrawLists& lists, const ShaderProgram& opaque_program,
                const ShaderProgram& cutout_program,
                const RenderTarget& target) {
   if (!opaque_program || !cutout_program) return;
@@ -113,66 +115,25 @@ void DrawDepth(const Scene& scene, const Camera& camera,
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LESS);
 
-  std::vector<const Geometry*> opaque_geos;
-  std::vector<const Geometry*> cutout_geos;
-  opaque_geos.reserve(scene.geometries.size());
-  cutout_geos.reserve(scene.geometries.size());
-
-  for (const auto& geo : scene.geometries) {
-    if (geo.vao == 0) continue;
-    if (geo.material_id >= 0 &&
-        static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-      const auto& mat = scene.materials[geo.material_id];
-      if (mat.alpha_cutout) {
-        cutout_geos.push_back(&geo);
-      } else {
-        opaque_geos.push_back(&geo);
-      }
-    } else {
-      opaque_geos.push_back(&geo);
+  // The opaque geometries front to back, then the cutout geometries per
+  // material: for cutout transparency, we need to bind the albedo texture.
+  static RenderQueue queue;
+  const GeometryArena& arena = scene.geometry_arena;
+  const Eigen::Matrix4f view_proj = GetViewProjMatrix(camera);
+  auto set_state = [&](uint64_t key, uint64_t changed) {
+    const bool cutout = RenderKeyProgram(key) == RenderProgram::kCutout;
+    if (changed & kRenderKeyProgramMask) {
+      const ShaderProgram& program = cutout ? cutout_program : opaque_program;
+      program.Use();
+      UniformHandle(program.id(), kDepthViewProjLocation).Set(view_proj);
+      BindGeometryArena(arena, cutout ? arena.depth_vao : arena.position_vao);
     }
-  }
-
-  // Draw the opaque geometries.
-  opaque_program.Use();
-  opaque_program.Uniform("u_view_proj", GetViewProjMatrix(camera));
-
-  for (const Geometry* geo_ptr : opaque_geos) {
-    const Geometry& geo = *geo_ptr;
-    opaque_program.Uniform("u_model", geo.transform.matrix());
-
-    glBindVertexArray(geo.vao);
-    if (geo.index_count > 0) {
-      glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
-    } else {
-      glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
+    if (cutout && (changed & kRenderKeyMaterialMask)) {
+      glBindTextureUnit(
+          0, scene.materials[RenderKeyMaterial(key)].albedo.texture_id);
     }
-  }
-
-  // Draw the cutout geometries.
-  cutout_program.Use();
-  cutout_program.Uniform("u_view_proj", GetViewProjMatrix(camera));
-
-  for (const Geometry* geo_ptr : cutout_geos) {
-    const Geometry& geo = *geo_ptr;
-    cutout_program.Uniform("u_model", geo.transform.matrix());
-
-    // For cutout transparency, we need to bind the albedo texture.
-    if (geo.material_id >= 0 &&
-        static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-      const auto& mat = scene.materials[geo.material_id];
-      glBindTextureUnit(0, mat.albedo.texture_id);
-    } else {
-      glBindTextureUnit(0, 0);
-    }
-
-    glBindVertexArray(geo.vao);
-    if (geo.index_count > 0) {
-      glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
-    } else {
-      glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
-    }
-  }
+  };
+  SubmitDrawLists(scene, lists, RenderPass::kDepthPrepass, &queue, set_state);
 
   // Restore State
   glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
@@ -180,7 +141,7 @@ void DrawDepth(const Scene& scene, const Camera& camera,
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void DrawDepthWNormal(const Scene& scene, const Camera& camera,
+void DrawDepthWNormal(const Scene& scene, const DrawLists& lists,
                       const ShaderProgram& opaque_program,
                       const ShaderProgram& cutout_program,
                       const RenderTarget& target) {
@@ -209,70 +170,24 @@ void DrawDepthWNormal(const Scene& scene, const Camera& camera,
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LESS);
 
-  std::vector<const Geometry*> opaque_geos;
-  std::vector<const Geometry*> cutout_geos;
-  opaque_geos.reserve(scene.geometries.size());
-  cutout_geos.reserve(scene.geometries.size());
-
-  for (const auto& geo : scene.geometries) {
-    if (geo.vao == 0) continue;
-    if (geo.material_id >= 0 &&
-        static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-      const auto& mat = scene.materials[geo.material_id];
-      if (mat.alpha_cutout) {
-        cutout_geos.push_back(&geo);
-      } else {
-        opaque_geos.push_back(&geo);
-      }
-    } else {
-      opaque_geos.push_back(&geo);
+  const GeometryArena& arena = scene.geometry_arena;
+  BindGeometryArena(arena, arena.depth_vao);
+
+  // The opaque geometries front to back, then the cutout geometries per
+  // material: for cutout transparency, we need to bind the albedo texture. The
+  // camera comes from the frame constants.
+  static RenderQueue queue;
+  auto set_state = [&](uint64_t key, uint64_t changed) {
+    const bool cutout = RenderKeyProgram(key) == RenderProgram::kCutout;
+    if (changed & kRenderKeyProgramMask) {
+      (cutout ? cutout_program : opaque_program).Use();
     }
-  }
-
-  Eigen::Matrix4f view = GetViewMatrix(camera);
-
-  // Draw the opaque geometries.
-  opaque_program.Use();
-  opaque_program.Uniform("u_view_proj", GetViewProjMatrix(camera));
-  opaque_program.Uniform("u_view", view);
-
-  for (const Geometry* geo_ptr : opaque_geos) {
-    const Geometry& geo = *geo_ptr;
-    opaque_program.Uniform("u_model", geo.transform.matrix());
-
-    glBindVertexArray(geo.vao);
-    if (geo.index_count > 0) {
-      glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
-    } else {
-      glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
-    }
-  }
-
-  // Draw the cutout geometries.
-  cutout_program.Use();
-  cutout_program.Uniform("u_view_proj", GetViewProjMatrix(camera));
-  cutout_program.Uniform("u_view", view);
-
-  for (const Geometry* geo_ptr : cutout_geos) {
-    const Geometry& geo = *geo_ptr;
-    cutout_program.Uniform("u_model", geo.transform.matrix());
-
-    // For cutout transparency, we need to bind the albedo texture.
-    if (geo.material_id >= 0 &&
-        static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-      const auto& mat = scene.materials[geo.material_id];
-      glBindTextureUnit(0, mat.albedo.texture_id);
-    } else {
-      glBindTextureUnit(0, 0);
+    if (cutout && (changed & kRenderKeyMaterialMask)) {
+      glBindTextureUnit(
+          0, scene.materials[RenderKeyMaterial(key)].albedo.texture_id);
     }
-
-    glBindVertexArray(geo.vao);
-    if (geo.index_count > 0) {
-      glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
-    } else {
-      glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
-    }
-  }
+  };
+  SubmitDrawLists(scene, lists, RenderPass::kDepthPrepass, &queue, set_state);
 
   // Restore State
   glColorMaski(0, GL_TRUE, GL_TRUE, GL_TRUE,
@@ -281,7 +196,7 @@ void DrawDepthWNormal(const Scene& scene, const Camera& camera,
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void DrawDepthVisualization(const RenderTarget& depth, const Camera& camera,
+void DrawDepthVisualization(const RenderTarget& depth,
                             const ShaderProgram& program,
                             const RenderTarget& out) {
   if (!program) return;
@@ -318,9 +233,6 @@ void DrawDepthVisualization(const RenderTarget& depth, const Camera& camera,
 
   // Bind Depth Texture
   glBindTextureUnit(0, depth.depth_buffer);
-  program.Uniform("u_depth", 0);
-  program.Uniform("u_z_near", camera.intrinsics.z_near);
-  program.Uniform("u_z_far", camera.intrinsics.z_far);
 
   glBindVertexArray(GetQuadVAO());
   glDrawArrays(GL_TRIANGLES, 0, 6);
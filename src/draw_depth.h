@@ -4,9 +4,14 @@
 #include "render_target.h"
 #include "scene.h"
 #include "shader.h"
+#include "visibility.h"
 
 namespace sh_renderer {
 
+// Explicit location of u_view_proj in depth.vert, which the depth pre-pass and
+// shadow map programs share, so the passes set it without a lookup.
+constexpr int kDepthViewProjLocation = 0;
+
 // Creates the depth pre-pass shader program for opaque materials.
 ShaderProgram CreateDepthOpaqueProgram();
 
@@ -24,19 +29,20 @@ ShaderProgram CreateDepthCutoutWNormalProgram();
 // Creates the depth visualization shader program.
 ShaderProgram CreateDepthVisualizerProgram();
 
-// Draws the scene to the depth buffer.
+// Draws the camera's draw lists to the depth buffer.
 void DrawDepth(const Scene& scene, const Camera& camera,
-               const ShaderProgram& opaque_program,
+               const DrawLists& lists, const ShaderProgram& opaque_program,
                const ShaderProgram& cutout_program, const RenderTarget& target);
 
-// Draws the scene to the depth buffer and normal buffer.
-void DrawDepthWNormal(const Scene& scene, const Camera& camera,
+// Draws the camera's draw lists (FrameVisibility::camera) to the depth buffer
+// and normal buffer from the camera of the bound frame constants.
+void DrawDepthWNormal(const Scene& scene, const DrawLists& lists,
                       const ShaderProgram& opaque_program,
                       const ShaderProgram& cutout_program,
                       const RenderTarget& target);
 
 // Draws the depth buffer to the output target (or screen) for visualization.
-void DrawDepthVisualization(const RenderTarget& depth, const Camera& camera,
+void DrawDepthVisualization(const RenderTarget& depth,
                             const ShaderProgram& program,
                             const RenderTarget& out = {});
 
@@ -3,13 +3,14 @@
 #include <glog/logging.h>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 
 #include "cascade.h"
 #include "compute_light_tile.h"
-#include "culling.h"
-#include "draw_sky.h"
 #include "glad.h"
+#include "gpu_culling.h"
+#include "render_queue.h"
 #include "shader.h"
 #include "ssbo.h"
 
@@ -59,32 +60,44 @@ ShaderProgram CreateRadianceProgram() {
   return std::move(*program);
 }
 
-void DrawSceneRadiance(const Scene& scene, const Camera& camera,
+RadianceUniforms ResolveRadianceUniforms(const ShaderProgram& program) {
+  return {
+      .sun_cascade_splits = program.Handle("u_sun_cascade_splits"),
+      .sun_cascade_view_projections =
+          program.Handle("u_sun_cascade_view_projections"),
+      .tile_count = program.Handle("u_tile_count"),
+  };
+}
+
+void DrawSceneRadiance(const Scene& scene, const DrawLists& camera_lists,
                        const std::vector<RenderTarget>& sun_shadow_maps,
                        const std::vector<Cascade>& sun_cascades,
                        const RenderTarget& spot_shadow_atlas,
                        const TileLightListList& tile_light_list,
                        const RenderTarget& ssao_target,
                        const ShaderProgram& program,
+                       const RadianceUniforms& uniforms,
                        const RenderTarget& hdr_target, float time) {
   if (!program) return;
   program.Use();
 
   // Bind Sun Shadow Maps and set uniforms
   if (!sun_cascades.empty() && !sun_shadow_maps.empty()) {
-    for (size_t i = 0; i < sun_cascades.size(); ++i) {
-      if (i >= kNumShadowMapCascades) break;
-
+    std::array<float, kNumShadowMapCascades> splits;
+    std::array<Eigen::Matrix4f, kNumShadowMapCascades> view_projections;
+    size_t count = std::min<size_t>(sun_cascades.size(), kNumShadowMapCascades);
+    for (size_t i = 0; i < count; ++i) {
       // Bind texture unit 5 + i
       glBindTextureUnit(5 + i, sun_shadow_maps[i].depth_buffer);
-
-      // Set uniforms
-      std::string base = "u_sun_cascade_splits[" + std::to_string(i) + "]";
-      program.Uniform(base, sun_cascades[i].split_depth);
-
-      base = "u_sun_cascade_view_projections[" + std::to_string(i) + "]";
-      program.Uniform(base, sun_cascades[i].view_projection_matrix);
+      splits[i] = sun_cascades[i].split_depth;
+      view_projections[i] = sun_cascades[i].view_projection_matrix;
     }
+
+    // Set uniforms: each array in one call.
+    uniforms.sun_cascade_splits.Set(
+        std::span<const float>(splits.data(), count));
+    uniforms.sun_cascade_view_projections.Set(
+        std::span<const Eigen::Matrix4f>(view_projections.data(), count));
   }
 
   // Bind FBO
@@ -100,38 +113,13 @@ void DrawSceneRadiance(const Scene& scene, const Camera& camera,
   glDepthFunc(GL_LEQUAL);
   glDepthMask(GL_FALSE);
 
-  // Set u_view matrix for shadow selection
-  program.Uniform("u_view", GetViewMatrix(camera));
-
-  program.Use();
-  program.Uniform("u_view_proj", GetViewProjMatrix(camera));
-  program.Uniform("u_camera_pos", camera.position);
-
-  // Sun Light (Hardcoded for now as per instructions usually, but we have a
-  // scene light?) Finding the first directional light in the scene for now.
-  const SunLight* sun = scene.sun_light ? &(*scene.sun_light) : nullptr;
-
-  if (sun) {
-    program.Uniform("u_sun.direction", sun->direction);
-    program.Uniform("u_sun.color", sun->color);
-    program.Uniform("u_sun.intensity", sun->intensity);
-  } else {
-    // Default sun if none found
-    program.Uniform("u_sun.direction",
-                    Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized());
-    program.Uniform("u_sun.color", Eigen::Vector3f(1.0f, 1.0f, 1.0f));
-    program.Uniform("u_sun.intensity", 1.0f);
-  }
-
-  program.Uniform("u_sky_color", kSkyColor);
+  // The camera, sun, sky color, screen size and time come from the frame
+  // constants.
 
   // Forward+ tile info.
   BindTileLightList(scene, tile_light_list);
-  program.Uniform("u_tile_count",
-                  Eigen::Vector2i(tile_light_list.tile_count_x,
-                                  tile_light_list.tile_count_y));
-  program.Uniform("u_screen_size",
-                  Eigen::Vector2i(hdr_target.width, hdr_target.height));
+  uniforms.tile_count.Set(Eigen::Vector2i(tile_light_list.tile_count_x,
+                                         tile_light_list.tile_count_y));
 
   // Bind Lightmap Textures
   if (scene.lightmaps_packed[0].texture_id != 0) {
@@ -162,64 +150,38 @@ void DrawSceneRadiance(const Scene& scene, const Camera& camera,
   BindSSBO(scene.material_range_ssbo, 3);
   BindSSBO(scene.material_layer_ssbo, 4);
   BindSSBO(scene.material_tcmod_ssbo, 5);
-  program.Uniform("u_time", time);
-
-  Eigen::Vector4f planes[6];
-  ExtractFrustumPlanes(GetViewProjMatrix(camera), planes);
-
-  int current_material_id = -2;
-
-  for (const auto& geo : scene.geometries) {
-    if (geo.vao == 0) continue;
-    if (geo.material_id < 0) continue;  // pure occluder shell — shadow/depth only
-    if (!IsAABBInFrustum(geo.bounding_box, planes)) continue;
-
-    program.Uniform("u_model", geo.transform.matrix());
-
-    if (geo.material_id != current_material_id) {
-      current_material_id = geo.material_id;
-
-      if (geo.material_id >= 0 &&
-          static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-        const auto& mat = scene.materials[geo.material_id];
-        glBindTextureUnit(0, mat.albedo.texture_id);
-        glBindTextureUnit(1, mat.normal_texture.texture_id);
-        glBindTextureUnit(2, mat.metallic_roughness_texture.texture_id);
-
-        // Layer compositor: which material to read, and its stage textures.
-        program.Uniform("u_material_index", geo.material_id);
-        if (!mat.layers.empty()) BindMaterialLayers(mat, time);
-
-        program.Uniform("u_emissive_factor", mat.emissive_factor);
-        program.Uniform("u_emissive_strength", mat.emissive_strength);
-
-        if (mat.emissive_texture) {
-          program.Uniform("u_has_emissive_texture", 1);
-          glBindTextureUnit(3, mat.emissive_texture->texture_id);
-        } else {
-          program.Uniform("u_has_emissive_texture", 0);
-          glBindTextureUnit(3, 0);
-        }
-      } else {
-        glBindTextureUnit(0, 0);
-        glBindTextureUnit(1, 0);
-        glBindTextureUnit(2, 0);
-        glBindTextureUnit(3, 0);
-        program.Uniform("u_material_index", -1);
-        program.Uniform("u_has_emissive_texture", 0);
-        program.Uniform("u_emissive_factor",
-                        Eigen::Vector3f(Eigen::Vector3f::Zero()));
-        program.Uniform("u_emissive_strength", 0.0f);
-      }
-    }
 
-    glBindVertexArray(geo.vao);
-    if (geo.index_count > 0) {
-      glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
+  // One batch per material, front to back: bind its textures, then draw every
+  // visible geometry using it. The material index and emission parameters
+  // come from the draw records and the material SSBO, so no uniforms change
+  // per batch. Materials sharing layer textures are adjacent in the queue.
+  auto bind_material = [&](int material_id) {
+    if (static_cast<size_t>(material_id) < scene.materials.size()) {
+      const auto& mat = scene.materials[material_id];
+      glBindTextureUnit(0, mat.albedo.texture_id);
+      glBindTextureUnit(1, mat.normal_texture.texture_id);
+      glBindTextureUnit(2, mat.metallic_roughness_texture.texture_id);
+      glBindTextureUnit(
+          3, mat.emissive_texture ? mat.emissive_texture->texture_id : 0);
+      // Layer compositor stage textures.
+      if (!mat.layers.empty()) BindMaterialLayers(mat, time);
     } else {
-      glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
+      glBindTextureUnit(0, 0);
+      glBindTextureUnit(1, 0);
+      glBindTextureUnit(2, 0);
+      glBindTextureUnit(3, 0);
     }
-  }
+  };
+
+  const GeometryArena& arena = scene.geometry_arena;
+  BindGeometryArena(arena, arena.vao);
+  static RenderQueue queue;
+  SubmitDrawLists(scene, camera_lists, RenderPass::kRadiance, &queue,
+                  [&](uint64_t key, uint64_t changed) {
+                    if (changed & kRenderKeyMaterialMask) {
+                      bind_material(RenderKeyMaterial(key));
+                    }
+                  });
 
   // Restore State
   glDepthMask(GL_TRUE);
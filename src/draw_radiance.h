@@ -8,6 +8,7 @@
 #include "render_target.h"
 #include "scene.h"
 #include "shader.h"
+#include "visibility.h"
 
 namespace sh_renderer {
 
@@ -21,14 +22,26 @@ void DrawSceneUnlit(const Scene& scene, const Camera& camera,
 // Creates a radiance shader program (forward shading).
 ShaderProgram CreateRadianceProgram();
 
-// Draws the scene with a radiance shader (forward shading).
-void DrawSceneRadiance(const Scene& scene, const Camera& camera,
+// The radiance program's per-frame uniforms. Resolve them once the program has
+// linked, and again after a hot reload swaps it.
+struct RadianceUniforms {
+  UniformHandle sun_cascade_splits;
+  UniformHandle sun_cascade_view_projections;
+  UniformHandle tile_count;
+};
+
+RadianceUniforms ResolveRadianceUniforms(const ShaderProgram& program);
+
+// Draws the camera's visible geometries (`camera_lists.shaded`) with a radiance
+// shader (forward shading).
+void DrawSceneRadiance(const Scene& scene, const DrawLists& camera_lists,
                        const std::vector<RenderTarget>& sun_shadow_maps,
                        const std::vector<Cascade>& sun_cascades,
                        const RenderTarget& spot_shadow_atlas,
                        const TileLightListList& tile_light_list,
                        const RenderTarget& ssao_target,
                        const ShaderProgram& program,
+                       const RadianceUniforms& uniforms,
                        const RenderTarget& hdr_target, float time);
 
 }  // namespace sh_renderer
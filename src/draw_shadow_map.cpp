@@ -4,14 +4,44 @@
 
 #include "camera.h"
 #include "cascade.h"
-#include "culling.h"
+#include "draw_depth.h"
 #include "glad.h"
+#include "gpu_culling.h"
+#include "render_queue.h"
 #include "render_target.h"
 #include "scene.h"
 #include "shader.h"
 
 namespace sh_renderer {
 
+namespace {
+
+// Draws one shadow view's lists, sorted through `queue`. The opaque and
+// cutout programs read different VAOs; the cutout one also needs each
+// material's albedo texture.
+void DrawShadowLists(const Scene& scene, const DrawLists& lists,
+                     RenderPass pass, const Eigen::Matrix4f& view_proj,
+                     const ShaderProgram& opaque_program,
+                     const ShaderProgram& cutout_program, RenderQueue* queue) {
+  const GeometryArena& arena = scene.geometry_arena;
+  auto set_state = [&](uint64_t key, uint64_t changed) {
+    const bool cutout = RenderKeyProgram(key) == RenderProgram::kCutout;
+    if (changed & kRenderKeyProgramMask) {
+      const ShaderProgram& program = cutout ? cutout_program : opaque_program;
+      program.Use();
+      UniformHandle(program.id(), kDepthViewProjLocation).Set(view_proj);
+      BindGeometryArena(arena, cutout ? arena.depth_vao : arena.position_vao);
+    }
+    if (cutout && (changed & kRenderKeyMaterialMask)) {
+      glBindTextureUnit(
+          0, scene.materials[RenderKeyMaterial(key)].albedo.texture_id);
+    }
+  };
+  SubmitDrawLists(scene, lists, pass, queue, set_state);
+}
+
+}  // namespace
+
 ShaderProgram CreateShadowMapOpaqueProgram() {
   auto program =
       ShaderProgram::CreateGraphics("glsl/depth.vert", "glsl/depth.frag");
@@ -118,14 +148,15 @@ RenderTarget CreateShadowAtlasTarget(int size) {
 }
 
 void DrawCascadedShadowMap(
-    const Scene& scene, const Camera& camera,
+    const Scene& scene, const std::vector<DrawLists>& cascade_lists,
     const ShaderProgram& opaque_program, const ShaderProgram& cutout_program,
     const std::vector<Cascade>& cascades,
     const std::vector<RenderTarget>& shadow_map_targets) {
   if (!opaque_program || !cutout_program) return;
-  if (cascades.size() != shadow_map_targets.size()) {
+  if (cascades.size() != shadow_map_targets.size() ||
+      cascades.size() != cascade_lists.size()) {
     LOG_EVERY_N(ERROR, 100)
-        << "Mismatch between cascades and shadow map targets size.";
+        << "Mismatch between cascades, draw lists and shadow map targets size.";
     return;
   }
 
@@ -139,74 +170,19 @@ void DrawCascadedShadowMap(
   glCullFace(GL_BACK);
   // glDisable(GL_CULL_FACE);
 
-  std::vector<const Geometry*> opaque_geos;
-  std::vector<const Geometry*> cutout_geos;
-  opaque_geos.reserve(scene.geometries.size());
-  cutout_geos.reserve(scene.geometries.size());
-
-  for (const auto& geo : scene.geometries) {
-    if (geo.vao == 0) continue;
-    if (geo.material_id >= 0 &&
-        static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-      const auto& mat = scene.materials[geo.material_id];
-      if (mat.alpha_cutout) {
-        cutout_geos.push_back(&geo);
-      } else {
-        opaque_geos.push_back(&geo);
-      }
-    } else {
-      opaque_geos.push_back(&geo);
-    }
-  }
-
+  static RenderQueue queue;
   for (size_t i = 0; i < cascades.size(); ++i) {
     const auto& cascade = cascades[i];
     const auto& target = shadow_map_targets[i];
+    const DrawLists& lists = cascade_lists[i];
 
     glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
     glViewport(0, 0, target.width, target.height);
     glClear(GL_DEPTH_BUFFER_BIT);
 
-    Eigen::Vector4f planes[6];
-    ExtractFrustumPlanes(cascade.view_projection_matrix, planes);
-
-    opaque_program.Use();
-    opaque_program.Uniform("u_view_proj", cascade.view_projection_matrix);
-    for (const Geometry* geo_ptr : opaque_geos) {
-      const Geometry& geo = *geo_ptr;
-      if (!IsAABBInFrustum(geo.bounding_box, planes)) continue;
-      opaque_program.Uniform("u_model", geo.transform.matrix());
-      glBindVertexArray(geo.vao);
-      if (geo.index_count > 0) {
-        glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
-      } else {
-        glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
-      }
-    }
-
-    cutout_program.Use();
-    cutout_program.Uniform("u_view_proj", cascade.view_projection_matrix);
-    for (const Geometry* geo_ptr : cutout_geos) {
-      const Geometry& geo = *geo_ptr;
-      if (!IsAABBInFrustum(geo.bounding_box, planes)) continue;
-      cutout_program.Uniform("u_model", geo.transform.matrix());
-
-      if (geo.material_id >= 0 &&
-          static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-        const auto& mat = scene.materials[geo.material_id];
-        glBindTextureUnit(0, mat.albedo.texture_id);
-      } else {
-        glBindTextureUnit(0, 0);
-      }
-
-      glBindVertexArray(geo.vao);
-
-      if (geo.index_count > 0) {
-        glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
-      } else {
-        glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
-      }
-    }
+    DrawShadowLists(scene, lists, RenderPass::kSunShadow,
+                    cascade.view_projection_matrix, opaque_program,
+                    cutout_program, &queue);
   }
 
   // Restore state.
@@ -216,10 +192,17 @@ void DrawCascadedShadowMap(
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void DrawShadowAtlas(Scene& scene, const ShaderProgram& opaque_program,
+void DrawShadowAtlas(const Scene& scene,
+                     const std::vector<DrawLists>& spot_light_lists,
+                     const ShaderProgram& opaque_program,
                      const ShaderProgram& cutout_program,
                      const RenderTarget& shadow_atlas) {
   if (!opaque_program || !cutout_program) return;
+  if (spot_light_lists.size() != scene.spot_lights.size()) {
+    LOG_EVERY_N(ERROR, 100)
+        << "Mismatch between spot lights and draw lists size.";
+    return;
+  }
 
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LEQUAL);
@@ -228,32 +211,16 @@ void DrawShadowAtlas(Scene& scene, const ShaderProgram& opaque_program,
   glCullFace(GL_BACK);
   // glDisable(GL_CULL_FACE);
 
-  std::vector<const Geometry*> opaque_geos;
-  std::vector<const Geometry*> cutout_geos;
-  opaque_geos.reserve(scene.geometries.size());
-  cutout_geos.reserve(scene.geometries.size());
-
-  for (const auto& geo : scene.geometries) {
-    if (geo.vao == 0) continue;
-    if (geo.material_id >= 0 &&
-        static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-      const auto& mat = scene.materials[geo.material_id];
-      if (mat.alpha_cutout) {
-        cutout_geos.push_back(&geo);
-      } else {
-        opaque_geos.push_back(&geo);
-      }
-    } else {
-      opaque_geos.push_back(&geo);
-    }
-  }
+  static RenderQueue queue;
 
   glBindFramebuffer(GL_FRAMEBUFFER, shadow_atlas.fbo);
   glViewport(0, 0, shadow_atlas.width, shadow_atlas.height);
   glClear(GL_DEPTH_BUFFER_BIT);
 
-  for (auto& light : scene.spot_lights) {
+  for (size_t i = 0; i < scene.spot_lights.size(); ++i) {
+    const SpotLight& light = scene.spot_lights[i];
     if (!light.has_shadow) continue;
+    const DrawLists& lists = spot_light_lists[i];
 
     int vx = std::round(light.shadow_uv_offset.x() * shadow_atlas.width);
     int vy = std::round(light.shadow_uv_offset.y() * shadow_atlas.height);
@@ -261,75 +228,9 @@ void DrawShadowAtlas(Scene& scene, const ShaderProgram& opaque_program,
     int vh = std::round(light.shadow_uv_scale.y() * shadow_atlas.height);
     glViewport(vx, vy, vw, vh);
 
-    Eigen::Vector3f up = Eigen::Vector3f(0, 1, 0);
-    if (std::abs(light.direction.y()) > 0.999f) {
-      up = Eigen::Vector3f(1, 0, 0);
-    }
-
-    Eigen::Matrix3f R;
-    Eigen::Vector3f Z = -light.direction.normalized();
-    Eigen::Vector3f X = up.cross(Z).normalized();
-    Eigen::Vector3f Y = Z.cross(X).normalized();
-    R.col(0) = X;
-    R.col(1) = Y;
-    R.col(2) = Z;
-    Eigen::Matrix4f view_matrix = Eigen::Matrix4f::Identity();
-    view_matrix.block<3, 3>(0, 0) = R.transpose();
-    view_matrix.block<3, 1>(0, 3) = -R.transpose() * light.position;
-
-    float fov_y = 2.0f * std::acos(light.cos_outer_cone);
-    float aspect = 1.0f;
-    float z_near = 0.1f;
-    float z_far = light.radius;
-    if (z_far < z_near + 0.1f) z_far = z_near + 10.0f;
-
-    float f = 1.0f / std::tan(fov_y / 2.0f);
-    Eigen::Matrix4f proj_matrix = Eigen::Matrix4f::Zero();
-    proj_matrix(0, 0) = f / aspect;
-    proj_matrix(1, 1) = f;
-    proj_matrix(2, 2) = (z_near + z_far) / (z_near - z_far);
-    proj_matrix(2, 3) = (2.0f * z_far * z_near) / (z_near - z_far);
-    proj_matrix(3, 2) = -1.0f;
-
-    light.shadow_view_proj = proj_matrix * view_matrix;
-
-    Eigen::Vector4f planes[6];
-    ExtractFrustumPlanes(light.shadow_view_proj, planes);
-
-    opaque_program.Use();
-    opaque_program.Uniform("u_view_proj", light.shadow_view_proj);
-    for (const Geometry* geo_ptr : opaque_geos) {
-      const Geometry& geo = *geo_ptr;
-      if (!IsAABBInFrustum(geo.bounding_box, planes)) continue;
-      opaque_program.Uniform("u_model", geo.transform.matrix());
-      glBindVertexArray(geo.vao);
-      if (geo.index_count > 0) {
-        glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
-      } else {
-        glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
-      }
-    }
-
-    cutout_program.Use();
-    cutout_program.Uniform("u_view_proj", light.shadow_view_proj);
-    for (const Geometry* geo_ptr : cutout_geos) {
-      const Geometry& geo = *geo_ptr;
-      if (!IsAABBInFrustum(geo.bounding_box, planes)) continue;
-      cutout_program.Uniform("u_model", geo.transform.matrix());
-      if (geo.material_id >= 0 &&
-          static_cast<size_t>(geo.material_id) < scene.materials.size()) {
-        const auto& mat = scene.materials[geo.material_id];
-        glBindTextureUnit(0, mat.albedo.texture_id);
-      } else {
-        glBindTextureUnit(0, 0);
-      }
-      glBindVertexArray(geo.vao);
-      if (geo.index_count > 0) {
-        glDrawElements(GL_TRIANGLES, geo.index_count, GL_UNSIGNED_INT, nullptr);
-      } else {
-        glDrawArrays(GL_TRIANGLES, 0, geo.vertices.size());
-      }
-    }
+    DrawShadowLists(scene, lists, RenderPass::kSpotShadow,
+                    light.shadow_view_proj, opaque_program, cutout_program,
+                    &queue);
   }
 
   // Restore state.
@@ -396,7 +297,6 @@ void DrawCascadedShadowMapVisualization(
   glDisable(GL_DEPTH_TEST);
 
   program.Use();
-  program.Uniform("u_shadow_map", 0);
 
   int x = offset.x();
   for (size_t i = 0; i < shadow_map_targets.size(); ++i) {
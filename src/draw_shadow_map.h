@@ -5,6 +5,7 @@
 #include "render_target.h"
 #include "scene.h"
 #include "shader.h"
+#include "visibility.h"
 
 namespace sh_renderer {
 
@@ -18,8 +19,10 @@ ShaderProgram CreateShadowMapCutoutProgram();
 std::vector<RenderTarget> CreateCascadedShadowMapTargets();
 
 // Draws the cascaded shadow maps in the sun light's perspective over the
-// camera's view frustum.
-void DrawCascadedShadowMap(const Scene& scene, const Camera& camera,
+// camera's view frustum. `cascade_lists` are the cascades' draw lists
+// (FrameVisibility::cascades).
+void DrawCascadedShadowMap(const Scene& scene,
+                           const std::vector<DrawLists>& cascade_lists,
                            const ShaderProgram& opaque_program,
                            const ShaderProgram& cutout_program,
                            const std::vector<Cascade>& cascades,
@@ -28,8 +31,12 @@ void DrawCascadedShadowMap(const Scene& scene, const Camera& camera,
 // Creates a large depth shadow atlas target.
 RenderTarget CreateShadowAtlasTarget(int size = 2048);
 
-// Renders the spot light shadow maps into the shadow atlas.
-void DrawShadowAtlas(Scene& scene, const ShaderProgram& opaque_program,
+// Renders the spot light shadow maps into the shadow atlas, each from its
+// shadow_view_proj. `spot_light_lists` are the lights' draw lists
+// (FrameVisibility::spot_lights).
+void DrawShadowAtlas(const Scene& scene,
+                     const std::vector<DrawLists>& spot_light_lists,
+                     const ShaderProgram& opaque_program,
                      const ShaderProgram& cutout_program,
                      const RenderTarget& shadow_atlas);
 
@@ -2,7 +2,6 @@
 
 #include <glog/logging.h>
 
-#include "camera.h"
 #include "glad.h"
 
 namespace sh_renderer {
@@ -22,8 +21,7 @@ ShaderProgram CreateSkyAnalyticProgram() {
   return std::move(*program);
 }
 
-void DrawSkyAnalytic(const Scene& scene, const Camera& camera,
-                     const SunLight& sun_light, const RenderTarget& target,
+void DrawSkyAnalytic(const RenderTarget& target,
                      const ShaderProgram& program) {
   if (!program) return;
 
@@ -40,16 +38,9 @@ void DrawSkyAnalytic(const Scene& scene, const Camera& camera,
   // Disable culling since we're drawing a fullscreen triangle
   glDisable(GL_CULL_FACE);
 
+  // The camera, sun and sky color come from the frame constants.
   program.Use();
 
-  // Set uniforms
-  program.Uniform("u_inv_view_proj",
-                  GetViewProjMatrix(camera).inverse().eval());
-  program.Uniform("u_camera_pos", camera.position);
-  program.Uniform("u_sun_direction", sun_light.direction);
-  program.Uniform("u_sun_intensity", sun_light.intensity);
-  program.Uniform("u_sky_color", kSkyColor);
-
   // Draw fullscreen triangle
   glDrawArrays(GL_TRIANGLES, 0, 3);
 
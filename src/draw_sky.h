@@ -16,12 +16,10 @@ const Eigen::Vector3f kSkyColor = Eigen::Vector3f(0.2, 0.5, 0.9);
 ShaderProgram CreateSkyAnalyticProgram();
 
 /**
- * @brief Draw the skybox to the render target.
- * @param sun_light The sun light.
+ * @brief Draw the skybox to the render target for the camera and sun of the
+ * bound frame constants.
  * @param target The render target to draw the skybox to.
  */
-void DrawSkyAnalytic(const Scene& scene, const Camera& camera,
-                     const SunLight& sun_light, const RenderTarget& target,
-                     const ShaderProgram& program);
+void DrawSkyAnalytic(const RenderTarget& target, const ShaderProgram& program);
 
 }  // namespace sh_renderer
\ No newline at end of file
@@ -127,8 +127,13 @@ void DestroySSAOContext(SSAOContext* ctx) {
   }
 }
 
-void DrawSSAO(const RenderTarget& depth_normal_target, const Camera& camera,
-              const ShaderProgram& ssao_program, const SSAOContext& context,
+SSAOUniforms ResolveSSAOUniforms(const ShaderProgram& ssao_program) {
+  return {.samples = ssao_program.Handle("u_samples")};
+}
+
+void DrawSSAO(const RenderTarget& depth_normal_target,
+              const ShaderProgram& ssao_program,
+              const SSAOUniforms& uniforms, const SSAOContext& context,
               const RenderTarget& ssao_out) {
   glBindFramebuffer(GL_FRAMEBUFFER, ssao_out.fbo);
   glViewport(0, 0, ssao_out.width, ssao_out.height);
@@ -148,17 +153,9 @@ void DrawSSAO(const RenderTarget& depth_normal_target, const Camera& camera,
   // Bind noise texture to binding 2
   glBindTextureUnit(2, context.noise_texture);
 
-  // Upload Uniforms
-  ssao_program.Uniform("u_projection", GetProjectionMatrix(camera));
-  ssao_program.Uniform("u_inv_projection",
-                       GetProjectionMatrix(camera).inverse().eval());
-  ssao_program.Uniform("u_resolution",
-                       Eigen::Vector2f(ssao_out.width, ssao_out.height));
-
-  for (unsigned int i = 0; i < kKernelSize; ++i) {
-    ssao_program.Uniform("u_samples[" + std::to_string(i) + "]",
-                         context.kernel[i]);
-  }
+  // Upload Uniforms. The projection comes from the frame constants.
+  uniforms.samples.Set(
+      std::span<const Eigen::Vector3f>(context.kernel.data(), kKernelSize));
 
   // Draw fullscreen quad
   glBindVertexArray(GetFullscreenQuadVAO());
@@ -168,7 +165,7 @@ void DrawSSAO(const RenderTarget& depth_normal_target, const Camera& camera,
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void DrawSSAOBlur(const RenderTarget& ssao_in, const Camera& camera,
+void DrawSSAOBlur(const RenderTarget& ssao_in,
                   const ShaderProgram& blur_horizontal_program,
                   const ShaderProgram& blur_vertical_program,
                   const RenderTarget& depth_normal_target,
@@ -180,8 +177,6 @@ void DrawSSAOBlur(const RenderTarget& ssao_in, const Camera& camera,
   glDisable(GL_DEPTH_TEST);
 
   blur_horizontal_program.Use();
-  blur_horizontal_program.Uniform("u_z_near", camera.intrinsics.z_near);
-  blur_horizontal_program.Uniform("u_z_far", camera.intrinsics.z_far);
 
   // Bind unblurred SSAO texture to binding 0
   glBindTextureUnit(0, ssao_in.texture);
@@ -197,8 +192,6 @@ void DrawSSAOBlur(const RenderTarget& ssao_in, const Camera& camera,
   glClear(GL_COLOR_BUFFER_BIT);
 
   blur_vertical_program.Use();
-  blur_vertical_program.Uniform("u_z_near", camera.intrinsics.z_near);
-  blur_vertical_program.Uniform("u_z_far", camera.intrinsics.z_far);
 
   // Bind horizontally blurred SSAO texture to binding 0
   glBindTextureUnit(0, blur_temp.texture);
@@ -227,7 +220,6 @@ void DrawSSAOVisualization(const RenderTarget& ssao,
 
   // Bind SSAO Texture
   glBindTextureUnit(0, ssao.texture);
-  program.Uniform("u_ssao", 0);
 
   glBindVertexArray(GetFullscreenQuadVAO());
   glDrawArrays(GL_TRIANGLES, 0, 6);
@@ -12,6 +12,14 @@ ShaderProgram CreateSSAOProgram();
 ShaderProgram CreateSSAOBlurProgram(bool horizontal);
 ShaderProgram CreateSSAOVisualizerProgram();
 
+// The SSAO program's per-frame uniforms. Resolve them once the program has
+// linked, and again after a hot reload swaps it.
+struct SSAOUniforms {
+  UniformHandle samples;
+};
+
+SSAOUniforms ResolveSSAOUniforms(const ShaderProgram& ssao_program);
+
 struct SSAOContext {
   GLuint noise_texture = 0;
   std::vector<Eigen::Vector3f> kernel;
@@ -20,11 +28,12 @@ struct SSAOContext {
 SSAOContext CreateSSAOContext();
 void DestroySSAOContext(SSAOContext* ctx);
 
-void DrawSSAO(const RenderTarget& depth_normal_target, const Camera& camera,
-              const ShaderProgram& ssao_program, const SSAOContext& context,
+void DrawSSAO(const RenderTarget& depth_normal_target,
+              const ShaderProgram& ssao_program,
+              const SSAOUniforms& uniforms, const SSAOContext& context,
               const RenderTarget& ssao_out);
 
-void DrawSSAOBlur(const RenderTarget& ssao_in, const Camera& camera,
+void DrawSSAOBlur(const RenderTarget& ssao_in,
                   const ShaderProgram& blur_horizontal_program,
                   const ShaderProgram& blur_vertical_program,
                   const RenderTarget& depth_normal_target,
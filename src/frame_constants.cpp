@@ -0,0 +1,112 @@
+#include "frame_constants.h"
+
+#include <glog/logging.h>
+
+#include <cstring>
+
+#include "draw_sky.h"
+#include "glad.h"
+
+namespace sh_renderer {
+
+namespace {
+
+void CopyMatrix(const Eigen::Matrix4f& m, float* out) {
+  std::memcpy(out, m.data(), sizeof(float) * 16);
+}
+
+void CopyVector(const Eigen::Vector3f& v, float* out) {
+  std::memcpy(out, v.data(), sizeof(float) * 3);
+}
+
+}  // namespace
+
+GpuFrameConstants ComputeFrameConstants(const Camera& camera,
+                                        const SunLight& sun, int width,
+                                        int height, float time) {
+  Eigen::Matrix4f view = GetViewMatrix(camera);
+  Eigen::Matrix4f projection = GetProjectionMatrix(camera);
+  Eigen::Matrix4f view_proj = projection * view;
+
+  GpuFrameConstants constants = {};
+  CopyMatrix(view, constants.view);
+  CopyMatrix(projection, constants.projection);
+  CopyMatrix(view_proj, constants.view_proj);
+  CopyMatrix(view.inverse(), constants.inv_view);
+  CopyMatrix(projection.inverse(), constants.inv_projection);
+  CopyMatrix(view_proj.inverse(), constants.inv_view_proj);
+  CopyVector(camera.position, constants.camera_position);
+  CopyVector(sun.direction, constants.sun_direction);
+  constants.sun_intensity = sun.intensity;
+  CopyVector(sun.color, constants.sun_color);
+  CopyVector(kSkyColor, constants.sky_color);
+  constants.time = time;
+  constants.screen_size[0] = width;
+  constants.screen_size[1] = height;
+  constants.z_near = camera.intrinsics.z_near;
+  constants.z_far = camera.intrinsics.z_far;
+  return constants;
+}
+
+FrameConstantsRing CreateFrameConstantsRing() {
+  FrameConstantsRing ring;
+  GLint alignment = 256;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  ring.stride = (sizeof(GpuFrameConstants) + alignment - 1) / alignment *
+                alignment;
+
+  const GLbitfield flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  const size_t size = ring.stride * kFramesInFlight;
+  glCreateBuffers(1, &ring.buffer);
+  glNamedBufferStorage(ring.buffer, size, nullptr, flags);
+  ring.mapped =
+      static_cast<uint8_t*>(glMapNamedBufferRange(ring.buffer, 0, size, flags));
+  CHECK(ring.mapped) << "Failed to map the frame constants buffer.";
+  return ring;
+}
+
+void DestroyFrameConstantsRing(FrameConstantsRing* ring) {
+  for (void*& fence : ring->fences) {
+    if (fence) glDeleteSync(static_cast<GLsync>(fence));
+    fence = nullptr;
+  }
+  if (ring->buffer != 0) {
+    glUnmapNamedBuffer(ring->buffer);
+    glDeleteBuffers(1, &ring->buffer);
+  }
+  *ring = {};
+}
+
+void BeginFrame(const GpuFrameConstants& constants, FrameConstantsRing* ring) {
+  const uint32_t region = ring->frame % kFramesInFlight;
+
+  // The region was last read kFramesInFlight frames ago; wait for that frame.
+  if (void* fence = ring->fences[region]) {
+    GLsync sync = static_cast<GLsync>(fence);
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;) {
+      GLenum result = glClientWaitSync(sync, flags, /*timeout=*/1000000);
+      if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+        break;
+      }
+      CHECK_NE(result, static_cast<GLenum>(GL_WAIT_FAILED));
+      flags = 0;
+    }
+    glDeleteSync(sync);
+    ring->fences[region] = nullptr;
+  }
+
+  const size_t offset = region * ring->stride;
+  std::memcpy(ring->mapped + offset, &constants, sizeof(constants));
+  glBindBufferRange(GL_UNIFORM_BUFFER, kFrameConstantsBinding, ring->buffer,
+                    offset, sizeof(GpuFrameConstants));
+}
+
+void EndFrame(FrameConstantsRing* ring) {
+  const uint32_t region = ring->frame % kFramesInFlight;
+  ring->fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  ++ring->frame;
+}
+
+}  // namespace sh_renderer
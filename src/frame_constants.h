@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "camera.h"
+#include "scene.h"
+
+namespace sh_renderer {
+
+// --- Frame constants ---
+// The camera, sun and clock state every pass reads, computed once per frame
+// and bound as one uniform block (frame_constants.glsl) instead of being set
+// on each program as loose uniforms.
+
+// Uniform block binding of FrameConstants; must match frame_constants.glsl.
+constexpr uint32_t kFrameConstantsBinding = 0;
+
+// std140 mirror of the FrameConstants block. Matrices are column-major.
+struct GpuFrameConstants {
+  float view[16];
+  float projection[16];
+  float view_proj[16];
+  float inv_view[16];
+  float inv_projection[16];
+  float inv_view_proj[16];
+  float camera_position[4];  // xyz
+  float sun_direction[3];    // direction the sun light travels
+  float sun_intensity;
+  float sun_color[3];
+  float _pad0;
+  float sky_color[3];
+  float time;  // seconds, drives the layer compositor's animation
+  int32_t screen_size[2];
+  float z_near;
+  float z_far;
+};
+static_assert(sizeof(GpuFrameConstants) == 464);
+static_assert(offsetof(GpuFrameConstants, camera_position) == 384);
+static_assert(offsetof(GpuFrameConstants, sky_color) == 432);
+static_assert(offsetof(GpuFrameConstants, screen_size) == 448);
+
+// Fills the constants for rendering `camera` into a `width` x `height` target
+// (pure CPU; no GL).
+GpuFrameConstants ComputeFrameConstants(const Camera& camera,
+                                        const SunLight& sun, int width,
+                                        int height, float time);
+
+// Number of frames the CPU may run ahead of the GPU before BeginFrame waits.
+constexpr uint32_t kFramesInFlight = 3;
+
+// A ring of kFramesInFlight GpuFrameConstants in one persistently mapped
+// uniform buffer. Each frame writes the next region straight through the
+// mapping and fences it, so the CPU only waits when it laps the GPU, and never
+// on a glBufferSubData of a block the GPU is still reading.
+struct FrameConstantsRing {
+  uint32_t buffer = 0;
+  uint8_t* mapped = nullptr;
+  size_t stride = 0;  // region size, padded to the uniform offset alignment
+  uint32_t frame = 0;
+  std::array<void*, kFramesInFlight> fences = {};  // GLsync per region
+};
+
+FrameConstantsRing CreateFrameConstantsRing();
+
+void DestroyFrameConstantsRing(FrameConstantsRing* ring);
+
+// Waits for the GPU to release the next region, writes `constants` into it and
+// binds it at kFrameConstantsBinding. Call once per frame before the first
+// pass.
+void BeginFrame(const GpuFrameConstants& constants, FrameConstantsRing* ring);
+
+// Fences the current region after the frame's last command and advances the
+// ring. Call once per frame after the last pass.
+void EndFrame(FrameConstantsRing* ring);
+
+}  // namespace sh_renderer
@@ -0,0 +1,71 @@
+#include "frame_constants.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+namespace sh_renderer {
+namespace {
+
+constexpr float kEpsilon = 1e-4f;
+
+Eigen::Matrix4f LoadMatrix(const float* m) {
+  Eigen::Matrix4f out;
+  std::memcpy(out.data(), m, sizeof(float) * 16);
+  return out;
+}
+
+Camera MakeCamera() {
+  Camera camera{
+      .position = Eigen::Vector3f(1.0f, 2.0f, 3.0f),
+      .orientation = Eigen::Quaternionf(
+          Eigen::AngleAxisf(0.3f, Eigen::Vector3f::UnitY())),
+  };
+  camera.intrinsics.z_near = 0.5f;
+  camera.intrinsics.z_far = 50.0f;
+  return camera;
+}
+
+TEST(FrameConstantsTest, MatchesCameraMatrices) {
+  Camera camera = MakeCamera();
+  GpuFrameConstants c =
+      ComputeFrameConstants(camera, SunLight(), 640, 480, 2.5f);
+
+  Eigen::Matrix4f view = LoadMatrix(c.view);
+  Eigen::Matrix4f projection = LoadMatrix(c.projection);
+  EXPECT_TRUE(view.isApprox(GetViewMatrix(camera), kEpsilon));
+  EXPECT_TRUE(projection.isApprox(GetProjectionMatrix(camera), kEpsilon));
+  EXPECT_TRUE(
+      LoadMatrix(c.view_proj).isApprox(GetViewProjMatrix(camera), kEpsilon));
+
+  // The inverses undo their matrices.
+  const Eigen::Matrix4f identity = Eigen::Matrix4f::Identity();
+  EXPECT_TRUE((LoadMatrix(c.inv_view) * view).isApprox(identity, kEpsilon));
+  EXPECT_TRUE((LoadMatrix(c.inv_projection) * projection)
+                  .isApprox(identity, kEpsilon));
+  EXPECT_TRUE((LoadMatrix(c.inv_view_proj) * LoadMatrix(c.view_proj))
+                  .isApprox(identity, kEpsilon));
+
+  EXPECT_EQ(c.camera_position[0], 1.0f);
+  EXPECT_EQ(c.camera_position[2], 3.0f);
+  EXPECT_EQ(c.screen_size[0], 640);
+  EXPECT_EQ(c.screen_size[1], 480);
+  EXPECT_EQ(c.z_near, 0.5f);
+  EXPECT_EQ(c.z_far, 50.0f);
+  EXPECT_EQ(c.time, 2.5f);
+}
+
+TEST(FrameConstantsTest, CarriesSun) {
+  SunLight sun;
+  sun.direction = Eigen::Vector3f(0.0f, -0.6f, 0.8f);
+  sun.color = Eigen::Vector3f(1.0f, 0.9f, 0.8f);
+  sun.intensity = 4.0f;
+  GpuFrameConstants c = ComputeFrameConstants(MakeCamera(), sun, 8, 8, 0.0f);
+  EXPECT_EQ(c.sun_direction[1], -0.6f);
+  EXPECT_EQ(c.sun_direction[2], 0.8f);
+  EXPECT_EQ(c.sun_color[2], 0.8f);
+  EXPECT_EQ(c.sun_intensity, 4.0f);
+}
+
+}  // namespace
+}  // namespace sh_renderer
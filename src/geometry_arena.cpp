@@ -0,0 +1,371 @@
+#include "geometry_arena.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+#include "glad.h"
+#include "scene.h"
+
+namespace sh_renderer {
+
+namespace {
+
+// Creates a VAO over the arena's vertex streams with the attribute locations in
+// [0, num_locations) enabled.
+GLuint CreateStreamVAO(GLuint vbo, GLuint ebo, const PackedVertices& packed,
+                       GLuint num_locations) {
+  GLuint vao;
+  glCreateVertexArrays(1, &vao);
+  glVertexArrayElementBuffer(vao, ebo);
+
+  // One binding per stream, at the stream's offset in the shared buffer.
+  for (GLuint stream = 0; stream < kNumVertexStreams; ++stream) {
+    glVertexArrayVertexBuffer(vao, stream, vbo, packed.stream_offsets[stream],
+                              packed.strides[stream]);
+  }
+
+  // Attributes: 0 Pos, 1 Normal, 2 UV, 3 Lightmap UV, 4 Tangent.
+  for (GLuint location = 0; location < num_locations; ++location) {
+    const VertexAttrib& attrib = packed.attribs[location];
+    glEnableVertexArrayAttrib(vao, location);
+    glVertexArrayAttribFormat(vao, location, attrib.components, attrib.type,
+                              attrib.normalized ? GL_TRUE : GL_FALSE,
+                              attrib.offset);
+    glVertexArrayAttribBinding(vao, location, attrib.stream);
+  }
+  return vao;
+}
+
+}  // namespace
+
+PackedArena PackGeometryArena(std::vector<Geometry>& geometries,
+                              VertexFormat format) {
+  // All geometries share one layout, so half-float uvs only if all fit.
+  bool half_uvs = true;
+  for (const auto& geo : geometries) half_uvs = half_uvs && UvsFitHalf(geo);
+
+  // Index ranges and base vertices. Instances take their mesh's.
+  uint32_t vertex_count = 0;
+  uint32_t index_count = 0;
+  for (size_t i = 0; i < geometries.size(); ++i) {
+    Geometry& geo = geometries[i];
+    geo.draw_id = static_cast<uint32_t>(i);
+    if (geo.instance_of >= 0) {
+      CHECK_LT(geo.instance_of, static_cast<int32_t>(i));
+      const Geometry& mesh = geometries[geo.instance_of];
+      geo.base_vertex = mesh.base_vertex;
+      geo.first_index = mesh.first_index;
+      geo.index_count = mesh.index_count;
+      geo.lods.resize(mesh.lods.size());
+      for (size_t l = 0; l < mesh.lods.size(); ++l) {
+        geo.lods[l].error = mesh.lods[l].error;
+        geo.lods[l].first_index = mesh.lods[l].first_index;
+        geo.lods[l].index_count = mesh.lods[l].index_count;
+      }
+      continue;
+    }
+    const auto num_vertices = static_cast<uint32_t>(geo.vertices.size());
+    geo.base_vertex = static_cast<int32_t>(vertex_count);
+    geo.first_index = index_count;
+    geo.index_count = geo.indices.empty()
+                          ? num_vertices
+                          : static_cast<uint32_t>(geo.indices.size());
+    if (num_vertices == 0) geo.index_count = 0;
+    vertex_count += num_vertices;
+    index_count += geo.index_count;
+    // The levels of detail follow the full detail range.
+    for (GeometryLod& lod : geo.lods) {
+      lod.first_index = index_count;
+      lod.index_count =
+          num_vertices == 0 ? 0 : static_cast<uint32_t>(lod.indices.size());
+      index_count += lod.index_count;
+    }
+  }
+
+  PackedArena arena;
+  PackedVertices& out = arena.vertices;
+  arena.indices.reserve(index_count);
+  for (const Geometry& geo : geometries) {
+    if (geo.index_count == 0 || geo.instance_of >= 0) continue;
+    if (geo.indices.empty()) {
+      arena.indices.resize(arena.indices.size() + geo.index_count);
+      std::iota(arena.indices.end() - geo.index_count, arena.indices.end(), 0u);
+    } else {
+      arena.indices.insert(arena.indices.end(), geo.indices.begin(),
+                           geo.indices.end());
+    }
+    for (const GeometryLod& lod : geo.lods) {
+      arena.indices.insert(arena.indices.end(), lod.indices.begin(),
+                           lod.indices.end());
+    }
+  }
+
+  // Layout: every stream holds all vertices, in geometry order.
+  Geometry empty;
+  PackedVertices layout = PackVertices(empty, format, half_uvs);
+  out.attribs = layout.attribs;
+  out.strides = layout.strides;
+  uint32_t size = 0;
+  for (uint32_t stream = 0; stream < kNumVertexStreams; ++stream) {
+    out.stream_offsets[stream] = size;
+    size += (vertex_count * out.strides[stream] + 15) & ~15u;
+  }
+  out.data.assign(size, 0);
+
+  for (Geometry& geo : geometries) {
+    if (geo.vertices.empty()) continue;
+    PackedVertices packed = PackVertices(geo, format, half_uvs);
+    CHECK(packed.strides == out.strides);
+    geo.position_scale = packed.position_scale;
+    geo.position_offset = packed.position_offset;
+    for (uint32_t stream = 0; stream < kNumVertexStreams; ++stream) {
+      std::memcpy(out.data.data() + out.stream_offsets[stream] +
+                      geo.base_vertex * out.strides[stream],
+                  packed.data.data() + packed.stream_offsets[stream],
+                  geo.vertices.size() * out.strides[stream]);
+    }
+  }
+
+  uint32_t vertex_stride = 0;
+  for (uint32_t stride : out.strides) vertex_stride += stride;
+  for (Geometry& geo : geometries) {
+    if (geo.instance_of < 0) continue;
+    const Geometry& mesh = geometries[geo.instance_of];
+    geo.position_scale = mesh.position_scale;
+    geo.position_offset = mesh.position_offset;
+    arena.instanced_bytes += mesh.vertices.size() * vertex_stride +
+                             mesh.index_count * sizeof(uint32_t);
+  }
+  return arena;
+}
+
+GeometryArena CreateGeometryArena(std::vector<Geometry>& geometries,
+                                  VertexFormat format, size_t* vertex_bytes,
+                                  size_t* instanced_bytes) {
+  GeometryArena arena;
+  PackedArena packed = PackGeometryArena(geometries, format);
+  if (vertex_bytes) *vertex_bytes = packed.vertices.data.size();
+  if (instanced_bytes) *instanced_bytes = packed.instanced_bytes;
+
+  // Zero-sized storage is an error, so empty scenes get a minimal buffer.
+  packed.vertices.data.resize(std::max<size_t>(packed.vertices.data.size(), 16));
+  if (packed.indices.empty()) packed.indices.push_back(0);
+
+  glCreateBuffers(1, &arena.vbo);
+  glNamedBufferStorage(arena.vbo, packed.vertices.data.size(),
+                       packed.vertices.data.data(), 0);
+  glCreateBuffers(1, &arena.ebo);
+  glNamedBufferStorage(arena.ebo, packed.indices.size() * sizeof(uint32_t),
+                       packed.indices.data(), 0);
+
+  arena.vao = CreateStreamVAO(arena.vbo, arena.ebo, packed.vertices, 5);
+  arena.depth_vao = CreateStreamVAO(arena.vbo, arena.ebo, packed.vertices, 3);
+  arena.position_vao =
+      CreateStreamVAO(arena.vbo, arena.ebo, packed.vertices, 1);
+
+  std::vector<GpuDrawRecord> records = BuildDrawRecords(geometries);
+  if (records.empty()) records.push_back({});
+  arena.draw_record_ssbo =
+      CreateSSBO(records.data(), records.size() * sizeof(GpuDrawRecord));
+
+  // A geometry draws one command, or one per visible run of its meshlets.
+  arena.max_commands = 0;
+  for (const Geometry& geo : geometries) {
+    const size_t meshlets = GeometryMesh(geometries, geo).meshlets.size();
+    arena.max_commands += static_cast<uint32_t>(
+        std::max<size_t>(1, (meshlets + 1) / 2));
+  }
+  arena.max_commands =
+      std::max(arena.max_commands, static_cast<uint32_t>(records.size()));
+  std::vector<uint32_t> draw_instances(2 * arena.max_commands, 0);
+  std::iota(draw_instances.begin(), draw_instances.begin() + arena.max_commands,
+            0u);
+  arena.draw_instance_ssbo = CreateSSBO(
+      draw_instances.data(), draw_instances.size() * sizeof(uint32_t));
+
+  glCreateBuffers(1, &arena.indirect_buffer);
+  glNamedBufferStorage(
+      arena.indirect_buffer,
+      arena.max_commands * sizeof(DrawElementsIndirectCommand), nullptr,
+      GL_DYNAMIC_STORAGE_BIT);
+  return arena;
+}
+
+std::vector<GpuDrawRecord> BuildDrawRecords(
+    const std::vector<Geometry>& geometries) {
+  std::vector<GpuDrawRecord> records(geometries.size());
+  for (const Geometry& geo : geometries) {
+    DCHECK_LT(geo.draw_id, records.size());
+    GpuDrawRecord& record = records[geo.draw_id];
+    record = {};
+    std::memcpy(record.model, geo.transform.matrix().data(),
+                sizeof(record.model));
+    Eigen::Matrix3f normal_matrix =
+        geo.transform.linear().inverse().transpose();
+    for (int col = 0; col < 3; ++col) {
+      for (int row = 0; row < 3; ++row) {
+        record.normal_matrix[4 * col + row] = normal_matrix(row, col);
+      }
+    }
+    for (int c = 0; c < 3; ++c) {
+      record.position_scale[c] = geo.position_scale[c];
+      record.position_offset[c] = geo.position_offset[c];
+    }
+    record.material_index = geo.material_id;
+  }
+  return records;
+}
+
+void UploadDrawRecords(const std::vector<Geometry>& geometries,
+                       const GeometryArena& arena) {
+  if (geometries.empty()) return;
+  std::vector<GpuDrawRecord> records = BuildDrawRecords(geometries);
+  UpdateSSBO(arena.draw_record_ssbo, records.data(),
+             records.size() * sizeof(GpuDrawRecord));
+}
+
+DrawElementsIndirectCommand MakeDrawCommand(const Geometry& geometry,
+                                            uint32_t lod) {
+  DCHECK_LE(lod, geometry.lods.size());
+  if (lod > 0) {
+    const GeometryLod& level = geometry.lods[lod - 1];
+    return {.count = level.index_count,
+            .instance_count = 1,
+            .first_index = level.first_index,
+            .base_vertex = geometry.base_vertex,
+            .base_instance = geometry.draw_id};
+  }
+  return {.count = geometry.index_count,
+          .instance_count = 1,
+          .first_index = geometry.first_index,
+          .base_vertex = geometry.base_vertex,
+          .base_instance = geometry.draw_id};
+}
+
+void BindGeometryArena(const GeometryArena& arena, uint32_t vao) {
+  glBindVertexArray(vao);
+  BindSSBO(arena.draw_record_ssbo, kDrawRecordBinding);
+  BindSSBO(arena.draw_instance_ssbo, kDrawInstanceBinding);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, arena.indirect_buffer);
+}
+
+void MergeInstancedCommands(std::vector<DrawElementsIndirectCommand>* commands,
+                            uint32_t first_instance,
+                            std::vector<uint32_t>* instance_ids) {
+  instance_ids->clear();
+  // One command per index range, where the range first appears; each
+  // original command's merged one.
+  thread_local std::unordered_map<uint64_t, uint32_t> range_commands;
+  thread_local std::vector<DrawElementsIndirectCommand> merged;
+  thread_local std::vector<uint32_t> merged_index;
+  range_commands.clear();
+  merged.clear();
+  merged_index.clear();
+  for (const DrawElementsIndirectCommand& cmd : *commands) {
+    DCHECK_EQ(cmd.instance_count, 1u);
+    const auto [it, inserted] = range_commands.try_emplace(
+        uint64_t{cmd.first_index} << 32 | cmd.count,
+        static_cast<uint32_t>(merged.size()));
+    if (inserted) {
+      merged.push_back(cmd);
+      merged.back().instance_count = 0;
+    }
+    ++merged[it->second].instance_count;
+    merged_index.push_back(it->second);
+  }
+  if (merged.size() == commands->size()) return;
+
+  // Slices of `instance_ids` for the commands drawing several instances.
+  thread_local std::vector<uint32_t> next_id;
+  next_id.assign(merged.size(), 0);
+  uint32_t size = 0;
+  for (size_t m = 0; m < merged.size(); ++m) {
+    if (merged[m].instance_count == 1) continue;
+    merged[m].base_instance = first_instance + size;
+    next_id[m] = size;
+    size += merged[m].instance_count;
+  }
+  instance_ids->resize(size);
+  for (size_t i = 0; i < commands->size(); ++i) {
+    const uint32_t m = merged_index[i];
+    if (merged[m].instance_count == 1) continue;
+    (*instance_ids)[next_id[m]++] = (*commands)[i].base_instance;
+  }
+  commands->swap(merged);
+}
+
+DrawCallStats& GetDrawCallStats() {
+  static DrawCallStats stats;
+  return stats;
+}
+
+void DrawBatch::Add(const Geometry& geometry, uint32_t lod) {
+  if (geometry.index_count == 0) return;
+  commands_.push_back(MakeDrawCommand(geometry, lod));
+  has_instances_ = has_instances_ || geometry.instance_of >= 0;
+}
+
+void DrawBatch::Add(const Geometry& geometry,
+                    std::span<const IndexRange> ranges) {
+  if (geometry.index_count == 0) return;
+  for (const IndexRange& range : ranges) {
+    DCHECK_LE(range.first_index + range.index_count, geometry.index_count);
+    commands_.push_back(
+        {.count = range.index_count,
+         .instance_count = 1,
+         .first_index = geometry.first_index + range.first_index,
+         .base_vertex = geometry.base_vertex,
+         .base_instance = geometry.draw_id});
+  }
+  has_instances_ = has_instances_ || geometry.instance_of >= 0;
+}
+
+void DrawBatch::Submit() {
+  if (commands_.empty()) return;
+  CHECK_LE(commands_.size(), arena_.max_commands);
+  DrawCallStats& stats = GetDrawCallStats();
+  stats.draws += commands_.size();
+  for (const DrawElementsIndirectCommand& cmd : commands_) {
+    stats.triangles += cmd.count / 3;
+  }
+
+  if (has_instances_ && arena_.instancing) {
+    MergeInstancedCommands(&commands_, arena_.max_commands, &instance_ids_);
+    // Like the commands, the staged draw ids overwrite the previous batch's.
+    if (!instance_ids_.empty()) {
+      glNamedBufferSubData(arena_.draw_instance_ssbo.id,
+                           arena_.max_commands * sizeof(uint32_t),
+                           instance_ids_.size() * sizeof(uint32_t),
+                           instance_ids_.data());
+    }
+  }
+  has_instances_ = false;
+  stats.commands += commands_.size();
+
+  if (arena_.multi_draw_indirect) {
+    // Every submission rewrites the start of the staging buffer; the driver
+    // orders the update after the draws still reading it.
+    glNamedBufferSubData(arena_.indirect_buffer, 0,
+                         commands_.size() * sizeof(DrawElementsIndirectCommand),
+                         commands_.data());
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                                static_cast<GLsizei>(commands_.size()), 0);
+    stats.draw_calls += 1;
+  } else {
+    for (const DrawElementsIndirectCommand& cmd : commands_) {
+      glDrawElementsInstancedBaseVertexBaseInstance(
+          GL_TRIANGLES, cmd.count, GL_UNSIGNED_INT,
+          reinterpret_cast<const void*>(
+              static_cast<uintptr_t>(cmd.first_index) * sizeof(uint32_t)),
+          cmd.instance_count, cmd.base_vertex, cmd.base_instance);
+    }
+    stats.draw_calls += commands_.size();
+  }
+  commands_.clear();
+}
+
+}  // namespace sh_renderer
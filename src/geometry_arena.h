@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "mesh_optimizer.h"
+#include "ssbo.h"
+#include "vertex_format.h"
+
+namespace sh_renderer {
+
+struct Geometry;
+
+// --- Geometry arena ---
+// Every scene geometry's vertex streams and indices live in one vertex buffer
+// and one index buffer, so all draws of a pass share a VAO and can be
+// submitted with glMultiDrawElementsIndirect. A geometry is located by its
+// Geometry::first_index, index_count and base_vertex; its per-draw data
+// (transform, position dequantization) is the GpuDrawRecord at
+// Geometry::draw_id, which the vertex shaders look up through gl_BaseInstance
+// and gl_InstanceID in the draw instance buffer.
+//
+// A geometry's levels of detail (Geometry::lods) follow its range in the index
+// buffer, each with its own range over the same base vertex. A meshlet culled
+// view draws the visible index ranges within the full detail range instead,
+// one command each.
+//
+// Instances of a shared mesh (Geometry::instance_of) reuse the mesh's ranges.
+// The first max_commands entries of the instance buffer are the draw ids
+// themselves, so a command drawing one geometry passes its draw id as the base
+// instance. DrawBatch merges the instances of a mesh in one batch into a single
+// instanced command whose draw ids it stages after them.
+struct GeometryArena {
+  // GL Resources. The VAOs bind the same `vbo` and `ebo`: `vao` binds every
+  // attribute, `depth_vao` position, normal and uv, `position_vao` position.
+  uint32_t vao = 0;
+  uint32_t depth_vao = 0;
+  uint32_t position_vao = 0;
+  uint32_t vbo = 0;
+  uint32_t ebo = 0;
+  SSBO draw_record_ssbo;  // one GpuDrawRecord per geometry (UploadDrawRecords)
+  // uint draw ids: the identity over the geometries, then DrawBatch's staging
+  // for instanced commands; 2 * max_commands entries.
+  SSBO draw_instance_ssbo;
+  // Staging for DrawElementsIndirectCommand arrays; holds one command per
+  // geometry, or per pair of its mesh's meshlets (the most index ranges
+  // CullMeshlets leaves), the most any single submission needs.
+  uint32_t indirect_buffer = 0;
+  uint32_t max_commands = 0;
+
+  // Submit one glMultiDrawElementsIndirect per batch. When false every command
+  // becomes its own draw call, for comparison in the draw-call counters.
+  bool multi_draw_indirect = true;
+  // Draw the instances of a mesh in a batch with one instanced command. When
+  // false each instance gets its own command, for comparison.
+  bool instancing = true;
+};
+
+// SSBO binding points of the draw records and the draw instance buffer; must
+// match draw_record.glsl.
+constexpr uint32_t kDrawRecordBinding = 6;
+constexpr uint32_t kDrawInstanceBinding = 12;
+
+// Per-geometry draw data (std430), rebuilt from the geometries every frame so
+// the passes need no per-draw uniforms.
+struct GpuDrawRecord {
+  float model[16];          // column-major
+  float normal_matrix[12];  // mat3 inverse transpose of the model, vec4 columns
+  float position_scale[3];  // position = offset + scale * attribute
+  int32_t material_index;   // -1 for occluder shells
+  float position_offset[4];  // xyz
+};
+static_assert(sizeof(GpuDrawRecord) == 144);
+
+// GL's indirect draw layout for glMultiDrawElementsIndirect.
+struct DrawElementsIndirectCommand {
+  uint32_t count;
+  uint32_t instance_count;
+  uint32_t first_index;
+  int32_t base_vertex;
+  uint32_t base_instance;
+};
+static_assert(sizeof(DrawElementsIndirectCommand) == 20);
+
+// The arena's contents before upload. `vertices` holds the streams of all
+// geometries back to back per stream (geometry i's vertices start at its
+// base_vertex in every stream); `vertices.position_scale/offset` are unused.
+struct PackedArena {
+  PackedVertices vertices;
+  std::vector<uint32_t> indices;
+  // The vertex and index bytes the instances would have added had each been
+  // packed on its own.
+  size_t instanced_bytes = 0;
+};
+
+// Packs every geometry into one shared layout in `format` and assigns each its
+// index range, base vertex, draw id (its index) and position dequantization
+// (pure CPU; no GL), and each level of detail its index range after the
+// geometry's. Non-indexed geometries get sequential indices. Instances get the
+// ranges, level errors and dequantization of their mesh. The compact layouts
+// keep half-float uvs only if every geometry's uvs fit.
+PackedArena PackGeometryArena(std::vector<Geometry>& geometries,
+                              VertexFormat format);
+
+// Uploads the geometries into a new arena (see PackGeometryArena) along with
+// their draw records. Returns the arena; `vertex_bytes` receives the size of
+// the vertex buffer and `instanced_bytes` PackedArena::instanced_bytes.
+GeometryArena CreateGeometryArena(std::vector<Geometry>& geometries,
+                                  VertexFormat format, size_t* vertex_bytes,
+                                  size_t* instanced_bytes);
+
+// Builds the draw record of every geometry, indexed by draw_id (pure CPU; no
+// GL). Exposed for testing.
+std::vector<GpuDrawRecord> BuildDrawRecords(
+    const std::vector<Geometry>& geometries);
+
+// Refreshes the arena's draw records from the geometries' current transforms
+// and materials. Call once per frame before the first pass.
+void UploadDrawRecords(const std::vector<Geometry>& geometries,
+                       const GeometryArena& arena);
+
+// Returns the command that draws `geometry` once from the arena, at level of
+// detail `lod` (0 for full detail; see SelectLod).
+DrawElementsIndirectCommand MakeDrawCommand(const Geometry& geometry,
+                                            uint32_t lod = 0);
+
+// Binds `vao` (one of the arena's VAOs), the draw records, the draw instances
+// and the indirect buffer for subsequent DrawBatch submissions.
+void BindGeometryArena(const GeometryArena& arena, uint32_t vao);
+
+// Folds the commands in `commands` that draw the same index range, the
+// instances of one mesh (or the same meshlets of them), into one instanced
+// command at the position of the first (pure CPU; no GL). A merged command's
+// base instance indexes `instance_ids`, which receives the draw ids of its
+// instances in submission order, offset by `first_instance`; single draws keep
+// theirs. Exposed for testing.
+void MergeInstancedCommands(std::vector<DrawElementsIndirectCommand>* commands,
+                            uint32_t first_instance,
+                            std::vector<uint32_t>* instance_ids);
+
+// Counts of the GL draw calls the renderer issued, of the indirect commands
+// (instanced draws) in them, of the geometry draws they expanded to and of
+// the triangles of those draws. Accumulated by DrawBatch on the render thread;
+// reset by the caller. GPU culled views count draw calls only.
+struct DrawCallStats {
+  uint64_t draw_calls = 0;
+  uint64_t commands = 0;
+  uint64_t draws = 0;
+  uint64_t triangles = 0;
+};
+
+DrawCallStats& GetDrawCallStats();
+
+// Collects the draw commands of a bucket of geometries sharing GL state and
+// submits them together. The arena must be bound (BindGeometryArena).
+class DrawBatch {
+ public:
+  explicit DrawBatch(const GeometryArena& arena) : arena_(arena) {}
+
+  // Adds the draw of `geometry` at level of detail `lod`.
+  void Add(const Geometry& geometry, uint32_t lod = 0);
+  // Adds one draw of `geometry` per range of its full detail indices.
+  void Add(const Geometry& geometry, std::span<const IndexRange> ranges);
+
+  // Issues the collected commands, as one glMultiDrawElementsIndirect unless
+  // the arena disables it, and clears the batch. Instances of one mesh become
+  // one instanced command unless the arena disables instancing. A no-op when
+  // empty.
+  void Submit();
+
+ private:
+  const GeometryArena& arena_;
+  std::vector<DrawElementsIndirectCommand> commands_;
+  std::vector<uint32_t> instance_ids_;
+  bool has_instances_ = false;
+};
+
+}  // namespace sh_renderer
@@ -0,0 +1,224 @@
+#include "geometry_arena.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "glad.h"
+#include "scene.h"
+
+namespace sh_renderer {
+namespace {
+
+Geometry MakeTriangle(float x, float uv_scale) {
+  Geometry geo;
+  geo.vertices = {{x, 0, 0}, {x + 1, 0, 0}, {x, 1, 0}};
+  geo.texture_uvs = {{0, 0}, {uv_scale, 0}, {0, uv_scale}};
+  return geo;
+}
+
+// Reads the position of arena vertex `vertex` from a float layout.
+Eigen::Vector3f LoadPosition(const PackedArena& arena, uint32_t vertex) {
+  const PackedVertices& v = arena.vertices;
+  Eigen::Vector3f p;
+  std::memcpy(p.data(),
+              v.data.data() + v.stream_offsets[kPositionStream] +
+                  vertex * v.strides[kPositionStream],
+              sizeof(float) * 3);
+  return p;
+}
+
+TEST(GeometryArenaTest, AssignsRangesAndDrawIds) {
+  std::vector<Geometry> geos;
+  geos.push_back(MakeTriangle(0, 1));
+  geos[0].indices = {2, 1, 0};
+  geos.push_back(Geometry());  // no vertices: never drawn
+  geos.push_back(MakeTriangle(10, 1));  // non-indexed
+
+  PackedArena arena = PackGeometryArena(geos, VertexFormat::kFloat);
+
+  EXPECT_EQ(geos[0].first_index, 0u);
+  EXPECT_EQ(geos[0].index_count, 3u);
+  EXPECT_EQ(geos[0].base_vertex, 0);
+  EXPECT_EQ(geos[1].index_count, 0u);
+  EXPECT_EQ(geos[2].first_index, 3u);
+  EXPECT_EQ(geos[2].index_count, 3u);
+  EXPECT_EQ(geos[2].base_vertex, 3);
+  for (uint32_t i = 0; i < geos.size(); ++i) EXPECT_EQ(geos[i].draw_id, i);
+
+  // Non-indexed geometry gets sequential indices.
+  EXPECT_EQ(arena.indices, (std::vector<uint32_t>{2, 1, 0, 0, 1, 2}));
+
+  // Fetching through (first_index, base_vertex) yields each geometry's own
+  // vertices, as the GPU does for an indirect draw.
+  for (const Geometry& geo : geos) {
+    for (uint32_t i = 0; i < geo.index_count; ++i) {
+      uint32_t index = arena.indices[geo.first_index + i];
+      EXPECT_EQ(LoadPosition(arena, geo.base_vertex + index),
+                geo.vertices[index]);
+    }
+  }
+}
+
+TEST(GeometryArenaTest, InstancesShareTheirMeshRange) {
+  std::vector<Geometry> geos;
+  geos.push_back(MakeTriangle(0, 1));
+  geos.push_back(MakeTriangle(10, 1));
+  geos[1].indices = {2, 1, 0};
+  Geometry instance;
+  instance.instance_of = 1;
+  instance.transform = Eigen::Translation3f(0, 0, 5);
+  geos.push_back(instance);
+  geos.push_back(instance);
+
+  PackedArena arena = PackGeometryArena(geos, VertexFormat::kQuantized);
+
+  // Only the meshes are packed.
+  EXPECT_EQ(arena.indices.size(), 6u);
+  for (int i = 2; i < 4; ++i) {
+    EXPECT_EQ(geos[i].draw_id, static_cast<uint32_t>(i));
+    EXPECT_EQ(geos[i].first_index, geos[1].first_index);
+    EXPECT_EQ(geos[i].index_count, 3u);
+    EXPECT_EQ(geos[i].base_vertex, geos[1].base_vertex);
+    EXPECT_EQ(geos[i].position_scale, geos[1].position_scale);
+    EXPECT_EQ(geos[i].position_offset, geos[1].position_offset);
+  }
+  // 24 bytes per quantized vertex and 4 per index, for each instance.
+  EXPECT_EQ(arena.instanced_bytes, 2u * (3 * 24 + 3 * 4));
+}
+
+TEST(GeometryArenaTest, LevelsOfDetailFollowTheirGeometry) {
+  std::vector<Geometry> geos;
+  geos.push_back(MakeTriangle(0, 1));
+  geos[0].vertices.emplace_back(1, 1, 0);
+  geos[0].indices = {0, 1, 2, 2, 1, 3};
+  geos[0].lods.push_back({.indices = {0, 1, 3}, .error = 0.5f});
+  geos.push_back(MakeTriangle(10, 1));
+  Geometry instance;
+  instance.instance_of = 0;
+  geos.push_back(instance);
+
+  PackedArena arena = PackGeometryArena(geos, VertexFormat::kFloat);
+
+  EXPECT_EQ(arena.indices,
+            (std::vector<uint32_t>{0, 1, 2, 2, 1, 3, 0, 1, 3, 0, 1, 2}));
+  const GeometryLod& lod = geos[0].lods[0];
+  EXPECT_EQ(lod.first_index, 6u);
+  EXPECT_EQ(lod.index_count, 3u);
+  EXPECT_EQ(geos[1].first_index, 9u);
+
+  // The instance gets the range and error, not the indices.
+  ASSERT_EQ(geos[2].lods.size(), 1u);
+  EXPECT_TRUE(geos[2].lods[0].indices.empty());
+  EXPECT_EQ(geos[2].lods[0].error, 0.5f);
+  const DrawElementsIndirectCommand cmd = MakeDrawCommand(geos[2], 1);
+  EXPECT_EQ(cmd.first_index, 6u);
+  EXPECT_EQ(cmd.count, 3u);
+  EXPECT_EQ(cmd.base_vertex, geos[0].base_vertex);
+  EXPECT_EQ(cmd.base_instance, 2u);
+  EXPECT_EQ(MakeDrawCommand(geos[2], 0).count, 6u);
+}
+
+TEST(GeometryArenaTest, MergesInstancedCommands) {
+  auto command = [](uint32_t first_index, uint32_t draw_id) {
+    return DrawElementsIndirectCommand{.count = 3,
+                                       .instance_count = 1,
+                                       .first_index = first_index,
+                                       .base_vertex = 0,
+                                       .base_instance = draw_id};
+  };
+  // Draws 1, 4 and 6 share one mesh, 2 and 5 another; 3 is alone.
+  std::vector<DrawElementsIndirectCommand> commands = {
+      command(0, 1), command(3, 2), command(0, 4),
+      command(6, 3), command(3, 5), command(0, 6)};
+  std::vector<uint32_t> instance_ids;
+  MergeInstancedCommands(&commands, 100, &instance_ids);
+
+  ASSERT_EQ(commands.size(), 3u);
+  EXPECT_EQ(commands[0].first_index, 0u);
+  EXPECT_EQ(commands[0].instance_count, 3u);
+  EXPECT_EQ(commands[0].base_instance, 100u);
+  EXPECT_EQ(commands[1].first_index, 3u);
+  EXPECT_EQ(commands[1].instance_count, 2u);
+  EXPECT_EQ(commands[1].base_instance, 103u);
+  // A single draw keeps its draw id.
+  EXPECT_EQ(commands[2].instance_count, 1u);
+  EXPECT_EQ(commands[2].base_instance, 3u);
+  EXPECT_EQ(instance_ids, (std::vector<uint32_t>{1, 4, 6, 2, 5}));
+
+  // Nothing shared: unchanged.
+  commands = {command(0, 1), command(3, 2)};
+  MergeInstancedCommands(&commands, 100, &instance_ids);
+  ASSERT_EQ(commands.size(), 2u);
+  EXPECT_EQ(commands[1].base_instance, 2u);
+  EXPECT_TRUE(instance_ids.empty());
+
+  // Different meshlet ranges of one mesh stay apart.
+  commands = {command(0, 1), command(0, 2)};
+  commands[1].count = 6;
+  MergeInstancedCommands(&commands, 100, &instance_ids);
+  ASSERT_EQ(commands.size(), 2u);
+  EXPECT_EQ(commands[1].count, 6u);
+  EXPECT_TRUE(instance_ids.empty());
+}
+
+TEST(GeometryArenaTest, MakeDrawCommand) {
+  Geometry geo;
+  geo.first_index = 30;
+  geo.index_count = 12;
+  geo.base_vertex = 7;
+  geo.draw_id = 4;
+  DrawElementsIndirectCommand cmd = MakeDrawCommand(geo);
+  EXPECT_EQ(cmd.count, 12u);
+  EXPECT_EQ(cmd.instance_count, 1u);
+  EXPECT_EQ(cmd.first_index, 30u);
+  EXPECT_EQ(cmd.base_vertex, 7);
+  EXPECT_EQ(cmd.base_instance, 4u);
+}
+
+// One geometry with large uvs keeps float uvs for the whole arena, since all
+// geometries share one VAO.
+TEST(GeometryArenaTest, SharedLayoutFallsBackToFloatUvs) {
+  std::vector<Geometry> geos = {MakeTriangle(0, 1), MakeTriangle(0, 1)};
+  PackedArena half = PackGeometryArena(geos, VertexFormat::kCompact);
+  EXPECT_EQ(half.vertices.attribs[2].type, GL_HALF_FLOAT);
+
+  geos.push_back(MakeTriangle(0, 2 * kMaxHalfUv));
+  PackedArena mixed = PackGeometryArena(geos, VertexFormat::kCompact);
+  EXPECT_EQ(mixed.vertices.attribs[2].type, GL_FLOAT);
+}
+
+// Quantized positions keep a per-geometry range, carried by the draw record.
+TEST(GeometryArenaTest, QuantizedRangesArePerGeometry) {
+  std::vector<Geometry> geos = {MakeTriangle(0, 1), MakeTriangle(10, 1)};
+  PackGeometryArena(geos, VertexFormat::kQuantized);
+  EXPECT_EQ(geos[0].position_offset, Eigen::Vector3f(0, 0, 0));
+  EXPECT_EQ(geos[1].position_offset, Eigen::Vector3f(10, 0, 0));
+  EXPECT_EQ(geos[1].position_scale, Eigen::Vector3f(1, 1, 0));
+}
+
+TEST(GeometryArenaTest, DrawRecordsCarryTransformAndMaterial) {
+  std::vector<Geometry> geos = {MakeTriangle(0, 1), MakeTriangle(0, 1)};
+  geos[0].material_id = 3;
+  geos[1].transform = Eigen::Translation3f(1, 2, 3) *
+                      Eigen::Scaling(Eigen::Vector3f(2.0f, 1.0f, 1.0f));
+  PackGeometryArena(geos, VertexFormat::kFloat);
+  std::vector<GpuDrawRecord> records = BuildDrawRecords(geos);
+  ASSERT_EQ(records.size(), 2u);
+
+  EXPECT_EQ(records[0].material_index, 3);
+  EXPECT_EQ(records[1].material_index, -1);
+  EXPECT_EQ(records[1].model[12], 1.0f);  // translation column
+  EXPECT_EQ(records[1].model[14], 3.0f);
+  EXPECT_EQ(records[1].position_scale[0], 1.0f);
+
+  // Non-uniform scale: the normal matrix is the inverse transpose, stored as
+  // three vec4 columns.
+  EXPECT_FLOAT_EQ(records[1].normal_matrix[0], 0.5f);
+  EXPECT_FLOAT_EQ(records[1].normal_matrix[5], 1.0f);
+  EXPECT_FLOAT_EQ(records[1].normal_matrix[10], 1.0f);
+  EXPECT_EQ(records[1].normal_matrix[3], 0.0f);
+}
+
+}  // namespace
+}  // namespace sh_renderer
@@ -0,0 +1,671 @@
+#include "gpu_culling.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <utility>
+
+#include "culling.h"
+#include "glad.h"
+
+namespace sh_renderer {
+
+namespace {
+
+const char* kDrawCullCompute = "glsl/draw_cull.comp";
+const uint32_t kGroupSize = 64;
+
+// Uploads `layout`'s items, runs and groups; zero-sized storage is an error,
+// so empty layouts get a placeholder.
+void UploadDrawLayout(GpuDrawLayout* layout) {
+  std::vector<uint32_t> items;
+  items.reserve(4 * layout->num_items() + 4);
+  for (uint32_t run = 0; run < layout->num_runs(); ++run) {
+    for (uint32_t i = layout->run_first[run]; i < layout->run_first[run + 1];
+         ++i) {
+      items.push_back(layout->queue.items[i].geometry->draw_id);
+      items.push_back(run);
+      items.push_back(layout->item_group[i]);
+      items.push_back(static_cast<uint32_t>(
+          RenderKeyCullMode(layout->queue.items[i].key)));
+    }
+  }
+  if (items.empty()) items.assign(4, 0);
+  layout->item_ssbo =
+      CreateSSBO(items.data(), items.size() * sizeof(uint32_t));
+
+  std::vector<uint32_t> runs(layout->run_first_command.begin(),
+                             layout->run_first_command.end() - 1);
+  if (runs.empty()) runs.push_back(0);
+  layout->run_ssbo = CreateSSBO(runs.data(), runs.size() * sizeof(uint32_t));
+
+  std::vector<GpuCullGroup> groups = layout->groups;
+  if (groups.empty()) groups.push_back({});
+  layout->group_ssbo =
+      CreateSSBO(groups.data(), groups.size() * sizeof(GpuCullGroup));
+}
+
+void DestroyDrawLayout(GpuDrawLayout* layout) {
+  DestroySSBO(layout->item_ssbo);
+  DestroySSBO(layout->run_ssbo);
+  DestroySSBO(layout->group_ssbo);
+  layout->item_ssbo = {};
+  layout->run_ssbo = {};
+  layout->group_ssbo = {};
+}
+
+// Grows `buffer` to hold `count` elements of `element_size` bytes; the old
+// contents are dropped.
+void ReserveBuffer(uint32_t count, size_t element_size, uint32_t* buffer,
+                   uint32_t* capacity) {
+  if (count <= *capacity && *buffer != 0) return;
+  if (*buffer != 0) glDeleteBuffers(1, buffer);
+  *capacity = std::max(count, *capacity + *capacity / 2);
+  *capacity = std::max(*capacity, 1u);
+  glCreateBuffers(1, buffer);
+  glNamedBufferStorage(*buffer, *capacity * element_size, nullptr, 0);
+}
+
+// Grows the instance buffer to `count` entries, the first `num_geometries` of
+// them the identity over the draw ids.
+void ReserveInstanceBuffer(uint32_t count, uint32_t num_geometries,
+                           GpuCulling* culling) {
+  if (count <= culling->instance_capacity && culling->instance_buffer != 0) {
+    return;
+  }
+  if (culling->instance_buffer != 0) {
+    glDeleteBuffers(1, &culling->instance_buffer);
+  }
+  culling->instance_capacity = std::max(
+      {count, culling->instance_capacity + culling->instance_capacity / 2, 1u});
+  std::vector<uint32_t> instances(culling->instance_capacity, 0);
+  for (uint32_t i = 0; i < num_geometries; ++i) instances[i] = i;
+  glCreateBuffers(1, &culling->instance_buffer);
+  glNamedBufferStorage(culling->instance_buffer,
+                       instances.size() * sizeof(uint32_t), instances.data(),
+                       0);
+}
+
+}  // namespace
+
+ShaderProgram CreateDrawCullProgram() {
+  auto program = ShaderProgram::CreateCompute(kDrawCullCompute);
+  if (!program) {
+    LOG(FATAL) << "Failed to create draw cull compute shader program.";
+    return {};
+  }
+  return std::move(*program);
+}
+
+DrawCullUniforms ResolveDrawCullUniforms(const ShaderProgram& cull_program) {
+  return {
+      .planes = cull_program.Handle("u_planes"),
+      .num_items = cull_program.Handle("u_num_items"),
+      .first_command = cull_program.Handle("u_first_command"),
+      .first_count = cull_program.Handle("u_first_count"),
+      .view_proj = cull_program.Handle("u_view_proj"),
+      .lod_scale = cull_program.Handle("u_lod_scale"),
+      .hiz_culling = cull_program.Handle("u_hiz_culling"),
+      .hiz_view_proj = cull_program.Handle("u_hiz_view_proj"),
+      .hiz_screen_size = cull_program.Handle("u_hiz_screen_size"),
+      .hiz_levels = cull_program.Handle("u_hiz_levels"),
+      .pvs_offset = cull_program.Handle("u_pvs_offset"),
+      .stage = cull_program.Handle("u_stage"),
+      .num_groups = cull_program.Handle("u_num_groups"),
+      .first_group_count = cull_program.Handle("u_first_group_count"),
+      .first_instance = cull_program.Handle("u_first_instance"),
+      .meshlet_culling = cull_program.Handle("u_meshlet_culling"),
+  };
+}
+
+std::vector<GpuCullRecord> BuildCullRecords(
+    const std::vector<Geometry>& geometries) {
+  std::vector<GpuCullRecord> records(geometries.size());
+  // Each mesh's first meshlet, in the order of BuildCullMeshlets.
+  std::vector<uint32_t> first_meshlet(geometries.size(), 0);
+  uint32_t num_meshlets = 0;
+  for (size_t i = 0; i < geometries.size(); ++i) {
+    first_meshlet[i] = num_meshlets;
+    num_meshlets += static_cast<uint32_t>(geometries[i].meshlets.size());
+  }
+  for (const Geometry& geo : geometries) {
+    DCHECK_LT(geo.draw_id, records.size());
+    GpuCullRecord& record = records[geo.draw_id];
+    record = {};
+    for (int c = 0; c < 3; ++c) {
+      record.box_min[c] = geo.bounding_box.min[c];
+      record.box_max[c] = geo.bounding_box.max[c];
+    }
+    record.index_count = geo.index_count;
+    record.first_index = geo.first_index;
+    record.base_vertex = geo.base_vertex;
+    CHECK_LE(geo.lods.size(), static_cast<size_t>(kMaxGeometryLods));
+    record.num_lods = static_cast<uint32_t>(geo.lods.size());
+    const Geometry& mesh = GeometryMesh(geometries, geo);
+    record.first_meshlet = first_meshlet[&mesh - geometries.data()];
+    record.num_meshlets = static_cast<uint32_t>(mesh.meshlets.size());
+    const float scale = geo.transform.linear().colwise().norm().maxCoeff();
+    for (size_t l = 0; l < geo.lods.size(); ++l) {
+      record.lod_error[l] = geo.lods[l].error * scale;
+      record.lod_first_index[l] = geo.lods[l].first_index;
+      record.lod_index_count[l] = geo.lods[l].index_count;
+    }
+  }
+  return records;
+}
+
+std::vector<GpuCullMeshlet> BuildCullMeshlets(
+    const std::vector<Geometry>& geometries) {
+  std::vector<GpuCullMeshlet> meshlets;
+  for (const Geometry& geo : geometries) {
+    for (const Meshlet& meshlet : geo.meshlets) {
+      GpuCullMeshlet& out = meshlets.emplace_back();
+      out = {};
+      for (int c = 0; c < 3; ++c) {
+        out.center[c] = meshlet.center[c];
+        out.cone_axis[c] = meshlet.cone_axis[c];
+      }
+      out.radius = meshlet.radius;
+      out.cone_cutoff = meshlet.cone_cutoff;
+      out.first_index = geo.first_index + meshlet.range.first_index;
+      out.index_count = meshlet.range.index_count;
+    }
+  }
+  return meshlets;
+}
+
+void BuildDrawLayout(const Scene& scene, RenderPass pass, bool instancing,
+                     GpuDrawLayout* layout) {
+  // Every drawable geometry, split as the visibility stage splits the visible
+  // ones. A zero view-projection puts every view depth at 0, so the runs keep
+  // scene order.
+  DrawLists lists;
+  lists.view_proj = Eigen::Matrix4f::Zero();
+  for (const Geometry& geo : scene.geometries) {
+    if (geo.index_count == 0) continue;
+    const bool has_material =
+        geo.material_id >= 0 &&
+        static_cast<size_t>(geo.material_id) < scene.materials.size();
+    if (has_material && scene.materials[geo.material_id].alpha_cutout) {
+      lists.cutout.push_back(&geo);
+    } else {
+      lists.opaque.push_back(&geo);
+    }
+    if (geo.material_id >= 0) lists.shaded.push_back(&geo);
+  }
+  BuildRenderQueue(scene, lists, pass, &layout->queue);
+
+  const std::vector<RenderItem>& items = layout->queue.items;
+  layout->run_keys.clear();
+  layout->run_first.clear();
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (i == 0 || ((items[i].key ^ items[i - 1].key) & kRenderKeyStateMask)) {
+      layout->run_keys.push_back(items[i].key);
+      layout->run_first.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  layout->run_first.push_back(static_cast<uint32_t>(items.size()));
+
+  // The items of each run sharing a mesh, if more than one does, form a group,
+  // its lists in the order of the mesh's first item.
+  layout->item_group.assign(items.size(), kNoCullGroup);
+  layout->groups.clear();
+  layout->num_instances = 0;
+  std::vector<std::pair<size_t, uint32_t>> meshes;  // (mesh, item)
+  for (uint32_t run = 0; instancing && run < layout->num_runs(); ++run) {
+    meshes.clear();
+    for (uint32_t i = layout->run_first[run]; i < layout->run_first[run + 1];
+         ++i) {
+      const Geometry& mesh =
+          GeometryMesh(scene.geometries, *items[i].geometry);
+      meshes.emplace_back(&mesh - scene.geometries.data(), i);
+    }
+    std::sort(meshes.begin(), meshes.end());
+    for (size_t first = 0; first < meshes.size();) {
+      size_t last = first + 1;
+      while (last < meshes.size() && meshes[last].first == meshes[first].first) {
+        ++last;
+      }
+      if (last - first > 1) {
+        const auto group = static_cast<uint32_t>(layout->groups.size());
+        const auto size = static_cast<uint32_t>(last - first);
+        layout->groups.push_back(
+            {.run = run,
+             .first_instance = layout->num_instances,
+             .size = size,
+             .draw_id = items[meshes[first].second].geometry->draw_id});
+        for (size_t k = first; k < last; ++k) {
+          layout->item_group[meshes[k].second] = group;
+        }
+        layout->num_instances += kCullGroupLevels * size;
+      }
+      first = last;
+    }
+  }
+
+  // Command slots: one per item, or as many as CullMeshlets can leave ranges
+  // (every other meshlet) for the items outside a group with meshlets.
+  layout->item_meshlets.assign(items.size(), {});
+  layout->run_first_command.assign(1, 0);
+  uint32_t num_commands = 0;
+  for (uint32_t run = 0; run < layout->num_runs(); ++run) {
+    for (uint32_t i = layout->run_first[run]; i < layout->run_first[run + 1];
+         ++i) {
+      const Geometry& mesh =
+          GeometryMesh(scene.geometries, *items[i].geometry);
+      if (layout->item_group[i] == kNoCullGroup) {
+        layout->item_meshlets[i] = mesh.meshlets;
+      }
+      num_commands += std::max<uint32_t>(
+          1, static_cast<uint32_t>(layout->item_meshlets[i].size() + 1) / 2);
+    }
+    layout->run_first_command.push_back(num_commands);
+  }
+}
+
+GpuCulling CreateGpuCulling(const Scene& scene) {
+  GpuCulling culling;
+  std::vector<GpuCullRecord> records = BuildCullRecords(scene.geometries);
+  if (records.empty()) records.push_back({});
+  culling.record_ssbo =
+      CreateSSBO(records.data(), records.size() * sizeof(GpuCullRecord));
+  if (scene.pvs.visible.empty()) {
+    const uint64_t none = 0;
+    culling.pvs_ssbo = CreateSSBO(&none, sizeof(none));
+  } else {
+    culling.pvs_ssbo =
+        CreateSSBO(scene.pvs.visible.data(),
+                   scene.pvs.visible.size() * sizeof(uint64_t));
+  }
+
+  const bool instancing = scene.geometry_arena.instancing;
+  BuildDrawLayout(scene, RenderPass::kDepthPrepass, instancing,
+                  &culling.depth);
+  BuildDrawLayout(scene, RenderPass::kRadiance, instancing, &culling.radiance);
+  std::vector<GpuCullMeshlet> meshlets = BuildCullMeshlets(scene.geometries);
+  const size_t num_meshlets = meshlets.size();
+  if (meshlets.empty()) meshlets.push_back({});
+  culling.meshlet_ssbo =
+      CreateSSBO(meshlets.data(), meshlets.size() * sizeof(GpuCullMeshlet));
+  UploadDrawLayout(&culling.depth);
+  UploadDrawLayout(&culling.radiance);
+
+  LOG(INFO) << "GPU culling: " << culling.depth.num_items()
+            << " depth-only draws in " << culling.depth.num_runs()
+            << " runs and " << culling.depth.num_groups()
+            << " instance groups, " << culling.radiance.num_items()
+            << " radiance draws in " << culling.radiance.num_runs()
+            << " runs and " << culling.radiance.num_groups()
+            << " instance groups, " << num_meshlets << " meshlets.";
+  return culling;
+}
+
+void DestroyGpuCulling(GpuCulling* culling) {
+  DestroySSBO(culling->record_ssbo);
+  DestroySSBO(culling->pvs_ssbo);
+  DestroySSBO(culling->meshlet_ssbo);
+  culling->record_ssbo = {};
+  culling->pvs_ssbo = {};
+  culling->meshlet_ssbo = {};
+  DestroyDrawLayout(&culling->depth);
+  DestroyDrawLayout(&culling->radiance);
+  if (culling->command_buffer != 0) {
+    glDeleteBuffers(1, &culling->command_buffer);
+    culling->command_buffer = 0;
+  }
+  if (culling->count_buffer != 0) {
+    glDeleteBuffers(1, &culling->count_buffer);
+    culling->count_buffer = 0;
+  }
+  if (culling->instance_buffer != 0) {
+    glDeleteBuffers(1, &culling->instance_buffer);
+    culling->instance_buffer = 0;
+  }
+  culling->command_capacity = 0;
+  culling->count_capacity = 0;
+  culling->instance_capacity = 0;
+  culling->views.clear();
+}
+
+void CullFrameOnGpu(const Scene& scene, const Camera& camera,
+                    const std::vector<Cascade>& cascades,
+                    const ShaderProgram& cull_program,
+                    const DrawCullUniforms& uniforms, const HiZPyramid& hiz,
+                    bool hiz_culling, GpuCulling* culling,
+                    FrameVisibility* visibility) {
+  if (!cull_program) return;
+  const auto start = std::chrono::steady_clock::now();
+
+  // Lay the views out in the buffers first: the lists point into `views`.
+  // Their instance slots follow the identity over the draw ids.
+  uint32_t num_commands = 0;
+  uint32_t num_counts = 0;
+  const auto num_geometries = static_cast<uint32_t>(scene.geometries.size());
+  uint32_t num_instances = num_geometries;
+  culling->views.clear();
+  auto add_view = [&](const GpuDrawLayout& layout, RenderPass pass,
+                      const Eigen::Matrix4f& view_proj, float lod_scale,
+                      bool test_hiz, std::span<const uint64_t> pvs_cell) {
+    culling->views.push_back({.layout = &layout,
+                              .pass = pass,
+                              .view_proj = view_proj,
+                              .lod_scale = lod_scale,
+                              .hiz_culling = test_hiz,
+                              .meshlet_culling = visibility->meshlet_culling,
+                              .pvs_cell = pvs_cell,
+                              .first_command = num_commands,
+                              .first_count = num_counts,
+                              .first_instance = num_instances});
+    num_commands += layout.num_commands();
+    num_counts += layout.num_counts();
+    num_instances += layout.num_instances;
+  };
+  const Eigen::Matrix4f camera_view_proj = GetViewProjMatrix(camera);
+  const bool camera_hiz = hiz_culling && hiz.built;
+  std::span<const uint64_t> pvs_cell;
+  if (visibility->pvs_culling) {
+    const int cell = FindPvsCell(scene.pvs, camera.position);
+    if (cell >= 0) pvs_cell = PvsCellBits(scene.pvs, cell);
+  }
+  const float error_pixels = visibility->lod_error_pixels;
+  const float camera_lod_scale =
+      LodScale(camera_view_proj, visibility->viewport_width,
+               visibility->viewport_height, error_pixels);
+  add_view(culling->depth, RenderPass::kDepthPrepass, camera_view_proj,
+           camera_lod_scale, camera_hiz, pvs_cell);
+  add_view(culling->radiance, RenderPass::kRadiance, camera_view_proj,
+           camera_lod_scale, camera_hiz, pvs_cell);
+  for (const Cascade& cascade : cascades) {
+    const Eigen::Matrix4f& view_proj = cascade.view_projection_matrix;
+    add_view(culling->depth, RenderPass::kSunShadow, view_proj,
+             LodScale(view_proj, kCascadeShadowMapSize, kCascadeShadowMapSize,
+                      error_pixels),
+             /*test_hiz=*/false, /*pvs_cell=*/{});
+  }
+  for (const SpotLight& light : scene.spot_lights) {
+    if (!light.has_shadow) continue;
+    const Eigen::Vector2f tile =
+        light.shadow_uv_scale *
+        static_cast<float>(scene.shadow_atlas.resolution);
+    add_view(culling->depth, RenderPass::kSpotShadow, light.shadow_view_proj,
+             LodScale(light.shadow_view_proj, static_cast<uint32_t>(tile.x()),
+                      static_cast<uint32_t>(tile.y()), error_pixels),
+             /*test_hiz=*/false, /*pvs_cell=*/{});
+  }
+
+  ReserveBuffer(num_commands, sizeof(DrawElementsIndirectCommand),
+                &culling->command_buffer, &culling->command_capacity);
+  ReserveBuffer(num_counts, sizeof(uint32_t), &culling->count_buffer,
+                &culling->count_capacity);
+  ReserveInstanceBuffer(num_instances, num_geometries, culling);
+  for (GpuCullView& view : culling->views) {
+    view.command_buffer = culling->command_buffer;
+    view.count_buffer = culling->count_buffer;
+    view.instance_buffer = culling->instance_buffer;
+  }
+  if (num_counts > 0) {
+    glClearNamedBufferSubData(culling->count_buffer, GL_R32UI, 0,
+                              num_counts * sizeof(uint32_t), GL_RED_INTEGER,
+                              GL_UNSIGNED_INT, nullptr);
+  }
+
+  cull_program.Use();
+  BindSSBO(culling->record_ssbo, kCullRecordBinding);
+  BindSSBO(culling->pvs_ssbo, kCullPvsBinding);
+  BindSSBO(culling->meshlet_ssbo, kCullMeshletBinding);
+  BindSSBO(scene.geometry_arena.draw_record_ssbo, kDrawRecordBinding);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCullCommandBinding,
+                   culling->command_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCullCountBinding,
+                   culling->count_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kDrawInstanceBinding,
+                   culling->instance_buffer);
+  if (camera_hiz) {
+    glBindTextureUnit(kHiZTextureUnit, hiz.texture);
+    uniforms.hiz_view_proj.Set(hiz.view_proj);
+    uniforms.hiz_screen_size.Set(
+        Eigen::Vector2i(hiz.screen_width, hiz.screen_height));
+    uniforms.hiz_levels.Set(hiz.levels);
+  }
+  auto set_view = [&](const GpuCullView& view) {
+    const GpuDrawLayout& layout = *view.layout;
+    BindSSBO(layout.item_ssbo, kCullItemBinding);
+    BindSSBO(layout.run_ssbo, kCullRunBinding);
+    BindSSBO(layout.group_ssbo, kCullGroupBinding);
+    Eigen::Vector4f planes[6];
+    ExtractFrustumPlanes(view.view_proj, planes);
+    uniforms.planes.Set(std::span<const Eigen::Vector4f>(planes, 6));
+    uniforms.num_items.Set(static_cast<int>(layout.num_items()));
+    uniforms.num_groups.Set(static_cast<int>(layout.num_groups()));
+    uniforms.first_command.Set(static_cast<int>(view.first_command));
+    uniforms.first_count.Set(static_cast<int>(view.first_count));
+    uniforms.first_group_count.Set(
+        static_cast<int>(view.first_count + layout.num_runs()));
+    uniforms.first_instance.Set(static_cast<int>(view.first_instance));
+    uniforms.hiz_culling.Set(view.hiz_culling ? 1 : 0);
+    uniforms.meshlet_culling.Set(view.meshlet_culling ? 1 : 0);
+    uniforms.lod_scale.Set(view.lod_scale);
+    uniforms.view_proj.Set(view.view_proj);
+    // The cell's first word, in the kernel's 32-bit words.
+    uniforms.pvs_offset.Set(
+        view.pvs_cell.empty()
+            ? -1
+            : static_cast<int>(2 * (view.pvs_cell.data() -
+                                    scene.pvs.visible.data())));
+  };
+  // Stage 0 culls the items, stage 1 turns the groups' instance lists into
+  // commands once every view's items are in.
+  uniforms.stage.Set(0);
+  bool has_groups = false;
+  for (const GpuCullView& view : culling->views) {
+    const GpuDrawLayout& layout = *view.layout;
+    if (layout.num_items() == 0) continue;
+    set_view(view);
+    glDispatchCompute((layout.num_items() + kGroupSize - 1) / kGroupSize, 1, 1);
+    has_groups = has_groups || layout.num_groups() > 0;
+  }
+  if (has_groups) {
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    uniforms.stage.Set(1);
+    for (const GpuCullView& view : culling->views) {
+      const GpuDrawLayout& layout = *view.layout;
+      if (layout.num_groups() == 0) continue;
+      set_view(view);
+      glDispatchCompute((layout.num_groups() + kGroupSize - 1) / kGroupSize, 1,
+                        1);
+    }
+  }
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Point the lists at the views, in the order they were added.
+  const GpuCullView* view = culling->views.data();
+  DrawLists& camera_lists = visibility->camera;
+  camera_lists = {};
+  camera_lists.view_proj = camera_view_proj;
+  camera_lists.gpu_depth = view++;
+  camera_lists.gpu_shaded = view++;
+  visibility->cascades.resize(cascades.size());
+  for (size_t i = 0; i < cascades.size(); ++i) {
+    DrawLists& lists = visibility->cascades[i];
+    lists = {};
+    lists.view_proj = cascades[i].view_projection_matrix;
+    lists.gpu_depth = view++;
+  }
+  visibility->spot_lights.resize(scene.spot_lights.size());
+  for (size_t i = 0; i < scene.spot_lights.size(); ++i) {
+    DrawLists& lists = visibility->spot_lights[i];
+    lists = {};
+    if (!scene.spot_lights[i].has_shadow) continue;
+    lists.view_proj = scene.spot_lights[i].shadow_view_proj;
+    lists.gpu_depth = view++;
+  }
+  DCHECK_EQ(view, culling->views.data() + culling->views.size());
+
+  VisibilityStats& stats = GetVisibilityStats();
+  ++stats.frames;
+  stats.views += culling->views.size() - 1;  // the camera is one view
+  stats.cpu_ms += std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  stats.depth_candidates += culling->depth.num_items();
+}
+
+void SubmitGpuCullView(
+    const GeometryArena& arena, const GpuCullView& view,
+    const std::function<void(uint64_t key, uint64_t changed)>& set_state) {
+  const GpuDrawLayout& layout = *view.layout;
+  RenderQueueStats& stats = GetRenderQueueStats(view.pass);
+  DrawCallStats& draw_stats = GetDrawCallStats();
+  stats.items += layout.num_items();
+
+  uint64_t previous = 0;
+  for (uint32_t run = 0; run < layout.num_runs(); ++run) {
+    const uint64_t key = layout.run_keys[run];
+    const uint64_t state = key & kRenderKeyStateMask;
+    const uint64_t changed = run == 0 ? ~uint64_t{0} : state ^ previous;
+    ++stats.runs;
+    if (changed & kRenderKeyProgramMask) ++stats.program_changes;
+    if (changed & kRenderKeyCullModeMask) ++stats.cull_mode_changes;
+    if (changed & kRenderKeyLayerSetMask) ++stats.layer_set_changes;
+    if (changed & kRenderKeyMaterialMask) ++stats.material_changes;
+
+    if (changed & kRenderKeyCullModeMask) {
+      ApplyCullMode(RenderKeyCullMode(key));
+    }
+    set_state(key, changed);
+    // set_state may bind the arena, and with it the arena's indirect buffer
+    // and draw instances.
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, view.command_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kDrawInstanceBinding,
+                     view.instance_buffer);
+    glBindBuffer(GL_PARAMETER_BUFFER, view.count_buffer);
+    const uint32_t first = layout.run_first_command[run];
+    const uint32_t size = layout.run_first_command[run + 1] - first;
+    glMultiDrawElementsIndirectCount(
+        GL_TRIANGLES, GL_UNSIGNED_INT,
+        reinterpret_cast<const void*>(
+            static_cast<uintptr_t>(view.first_command + first) *
+            sizeof(DrawElementsIndirectCommand)),
+        static_cast<GLintptr>(view.first_count + run) * sizeof(uint32_t),
+        static_cast<GLsizei>(size), 0);
+    draw_stats.draw_calls += 1;
+    previous = state;
+  }
+  ApplyCullMode(CullMode::kFront);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, arena.indirect_buffer);
+  BindSSBO(arena.draw_instance_ssbo, kDrawInstanceBinding);
+}
+
+void SubmitDrawLists(
+    const Scene& scene, const DrawLists& lists, RenderPass pass,
+    RenderQueue* queue,
+    const std::function<void(uint64_t key, uint64_t changed)>& set_state) {
+  const GpuCullView* view =
+      pass == RenderPass::kRadiance ? lists.gpu_shaded : lists.gpu_depth;
+  if (view) {
+    SubmitGpuCullView(scene.geometry_arena, *view, set_state);
+    return;
+  }
+  BuildRenderQueue(scene, lists, pass, queue);
+  SubmitRenderQueue(scene.geometry_arena, *queue, set_state);
+}
+
+std::vector<std::vector<uint32_t>> ReadGpuCullView(const GpuCullView& view) {
+  const GpuDrawLayout& layout = *view.layout;
+  std::vector<std::vector<uint32_t>> runs(layout.num_runs());
+  if (layout.num_runs() == 0) return runs;
+
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  std::vector<uint32_t> counts(layout.num_runs());
+  glGetNamedBufferSubData(view.count_buffer,
+                          view.first_count * sizeof(uint32_t),
+                          counts.size() * sizeof(uint32_t), counts.data());
+  std::vector<DrawElementsIndirectCommand> commands(layout.num_commands());
+  glGetNamedBufferSubData(
+      view.command_buffer,
+      view.first_command * sizeof(DrawElementsIndirectCommand),
+      commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+  GLint instance_bytes = 0;
+  glGetNamedBufferParameteriv(view.instance_buffer, GL_BUFFER_SIZE,
+                              &instance_bytes);
+  std::vector<uint32_t> instances(instance_bytes / sizeof(uint32_t));
+  glGetNamedBufferSubData(view.instance_buffer, 0, instance_bytes,
+                          instances.data());
+
+  for (uint32_t run = 0; run < layout.num_runs(); ++run) {
+    const uint32_t first = layout.run_first_command[run];
+    CHECK_LE(counts[run], layout.run_first_command[run + 1] - first);
+    for (uint32_t i = 0; i < counts[run]; ++i) {
+      const DrawElementsIndirectCommand& command = commands[first + i];
+      CHECK_LE(command.base_instance + command.instance_count,
+               instances.size());
+      runs[run].insert(
+          runs[run].end(), instances.begin() + command.base_instance,
+          instances.begin() + command.base_instance + command.instance_count);
+    }
+    std::sort(runs[run].begin(), runs[run].end());
+    runs[run].erase(std::unique(runs[run].begin(), runs[run].end()),
+                    runs[run].end());
+  }
+  return runs;
+}
+
+std::vector<std::vector<uint32_t>> CullDrawLayoutOnCpu(
+    const GpuDrawLayout& layout, const Eigen::Matrix4f& view_proj,
+    std::span<const uint64_t> pvs_cell, const CpuHiZPyramid* hiz,
+    const Eigen::Matrix4f& hiz_view_proj, float lod_scale,
+    bool meshlet_culling) {
+  Eigen::Vector4f planes[6];
+  ExtractFrustumPlanes(view_proj, planes);
+  std::vector<std::vector<uint32_t>> runs(layout.num_runs());
+  std::vector<IndexRange> ranges;
+  for (uint32_t run = 0; run < layout.num_runs(); ++run) {
+    for (uint32_t i = layout.run_first[run]; i < layout.run_first[run + 1];
+         ++i) {
+      const Geometry& geo = *layout.queue.items[i].geometry;
+      if (!IsAABBInFrustum(geo.bounding_box, planes)) continue;
+      if (!pvs_cell.empty() && !IsPvsBitSet(pvs_cell, geo.draw_id)) continue;
+      if (hiz && IsAABBOccludedByHiZ(*hiz, hiz_view_proj, geo.bounding_box)) {
+        continue;
+      }
+      const std::span<const Meshlet> meshlets = layout.item_meshlets[i];
+      if (meshlet_culling && !meshlets.empty() &&
+          SelectLod(geo, view_proj, lod_scale) == 0) {
+        ranges.clear();
+        CullMeshlets(meshlets, view_proj, geo.transform,
+                     RenderKeyCullMode(layout.queue.items[i].key), &ranges);
+        if (ranges.empty()) continue;
+      }
+      runs[run].push_back(geo.draw_id);
+    }
+    std::sort(runs[run].begin(), runs[run].end());
+  }
+  return runs;
+}
+
+size_t CheckGpuCulling(const GpuCulling& culling, const HiZPyramid& hiz) {
+  std::optional<CpuHiZPyramid> cpu_hiz;
+  size_t mismatches = 0;
+  for (const GpuCullView& view : culling.views) {
+    if (view.hiz_culling && !cpu_hiz) cpu_hiz = ReadHiZPyramid(hiz);
+    const std::vector<std::vector<uint32_t>> expected = CullDrawLayoutOnCpu(
+        *view.layout, view.view_proj, view.pvs_cell,
+        view.hiz_culling ? &*cpu_hiz : nullptr, hiz.view_proj, view.lod_scale,
+        view.meshlet_culling);
+    const std::vector<std::vector<uint32_t>> actual = ReadGpuCullView(view);
+    for (size_t run = 0; run < expected.size(); ++run) {
+      std::vector<uint32_t> difference;
+      std::set_symmetric_difference(
+          expected[run].begin(), expected[run].end(), actual[run].begin(),
+          actual[run].end(), std::back_inserter(difference));
+      mismatches += difference.size();
+    }
+  }
+  return mismatches;
+}
+
+}  // namespace sh_renderer
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "camera.h"
+#include "cascade.h"
+#include "compute_hiz.h"
+#include "render_queue.h"
+#include "scene.h"
+#include "shader.h"
+#include "ssbo.h"
+#include "visibility.h"
+
+namespace sh_renderer {
+
+// --- GPU culling ---
+// Moves the per-geometry culling of every view to a compute kernel
+// (glsl/draw_cull.comp). What the kernel reads is uploaded once, when the
+// scene is: a GpuCullRecord per geometry (bounds and draw range), and per pass
+// layout every draw the pass could make, sorted by state into render queue
+// runs. Each frame the kernel tests each view's draws against its frustum
+// and, for the camera, the previous frame's hierarchical Z pyramid, and
+// compacts the survivors of each run into the run's slice of a command buffer,
+// counting them in a parameter buffer. The passes draw each run with one
+// glMultiDrawElementsIndirectCount, so the visible set never reaches the CPU.
+//
+// The camera views are also tested against the scene's PVS, uploaded whole
+// with the records, the bitset of the camera's view cell selected per frame.
+//
+// The camera's depth pre-pass, the sun cascades and the spot light shadows
+// share the depth-only layout; the radiance pass has its own. Within a run the
+// draws come in whatever order the kernel appended them. Each view's kernel
+// also selects the level of detail of every draw it keeps, like SelectLod.
+//
+// With instancing on (GeometryArena::instancing), the instances of a shared
+// mesh within a run form a group. The kernel compacts the draw ids of a
+// group's survivors into the view's slice of an instance buffer, one list per
+// level of detail, and a second dispatch appends one instanced command per
+// non-empty list, as DrawBatch merges instances on the CPU. The culled views
+// are drawn with that buffer bound in place of the arena's draw instances.
+//
+// With meshlet culling on (DrawLists::meshlet_culling), the kernel also culls
+// the meshlets of each full detail draw outside a group, like CullMeshlets,
+// against the meshlets of the scene uploaded with the records, and appends
+// one command per merged range of the survivors. Each item gets as many
+// command slots as CullMeshlets can leave it ranges. Instanced commands draw
+// whole levels.
+
+// SSBO binding points of the cull kernel; must match draw_cull.comp.
+constexpr uint32_t kCullRecordBinding = 7;
+constexpr uint32_t kCullItemBinding = 8;
+constexpr uint32_t kCullRunBinding = 9;
+constexpr uint32_t kCullCommandBinding = 10;
+constexpr uint32_t kCullCountBinding = 11;
+constexpr uint32_t kCullPvsBinding = 13;
+constexpr uint32_t kCullGroupBinding = 14;
+constexpr uint32_t kCullMeshletBinding = 15;
+
+// GpuDrawLayout::item_group of a draw that is not part of an instance group.
+constexpr uint32_t kNoCullGroup = ~0u;
+// A group's instance lists: one per level of detail, full detail first.
+constexpr uint32_t kCullGroupLevels = kMaxGeometryLods + 1;
+
+// Per-geometry cull data (std430), indexed by draw id. The levels of detail
+// are in the order of Geometry::lods, their errors scaled by the geometry's
+// transform.
+struct GpuCullRecord {
+  float box_min[3];
+  uint32_t index_count;
+  float box_max[3];
+  uint32_t first_index;
+  int32_t base_vertex;
+  uint32_t num_lods;
+  uint32_t first_meshlet;  // the mesh's, in the meshlet buffer
+  uint32_t num_meshlets;
+  float lod_error[kMaxGeometryLods];
+  uint32_t lod_first_index[kMaxGeometryLods];
+  uint32_t lod_index_count[kMaxGeometryLods];
+};
+static_assert(sizeof(GpuCullRecord) == 96);
+
+// A meshlet of the scene (std430): Meshlet with its range in the arena's
+// index buffer.
+struct GpuCullMeshlet {
+  float center[3];
+  float radius;
+  float cone_axis[3];
+  float cone_cutoff;
+  uint32_t first_index;
+  uint32_t index_count;
+  uint32_t pad[2];
+};
+static_assert(sizeof(GpuCullMeshlet) == 48);
+
+// The instances of one mesh within a run (std430). A view's instance slice
+// holds the group's kCullGroupLevels lists of `size` draw ids each from
+// `first_instance` on.
+struct GpuCullGroup {
+  uint32_t run;
+  uint32_t first_instance;
+  uint32_t size;
+  uint32_t draw_id;  // of the first instance, whose ranges all of them share
+};
+static_assert(sizeof(GpuCullGroup) == 16);
+
+// The draws of one pass layout over every geometry, in state order.
+struct GpuDrawLayout {
+  RenderQueue queue;                // sorted; every view depth is 0
+  std::vector<uint64_t> run_keys;   // the key of each run's first item
+  std::vector<uint32_t> run_first;  // each run's first item, then the count
+  // Each run's first command slot, then the count.
+  std::vector<uint32_t> run_first_command;
+  std::vector<uint32_t> item_group;  // each item's group, or kNoCullGroup
+  // The meshlets each item outside a group culls at full detail.
+  std::vector<std::span<const Meshlet>> item_meshlets;
+  std::vector<GpuCullGroup> groups;
+  uint32_t num_instances = 0;  // instance slots of a view, over the groups
+  SSBO item_ssbo;   // uvec4 (draw id, run, group, cull mode) per item
+  SSBO run_ssbo;    // run_first_command without the final count
+  SSBO group_ssbo;  // `groups`
+
+  uint32_t num_items() const {
+    return static_cast<uint32_t>(queue.items.size());
+  }
+  uint32_t num_runs() const { return static_cast<uint32_t>(run_keys.size()); }
+  uint32_t num_commands() const { return run_first_command.back(); }
+  uint32_t num_groups() const { return static_cast<uint32_t>(groups.size()); }
+  // A view's counts: one per run, then one per group list.
+  uint32_t num_counts() const {
+    return num_runs() + kCullGroupLevels * num_groups();
+  }
+};
+
+// One view's culled draws: its slices of the frame's command, count and
+// instance buffers, the layout's command slots, counts and instance slots.
+struct GpuCullView {
+  const GpuDrawLayout* layout = nullptr;
+  RenderPass pass = RenderPass::kDepthPrepass;
+  Eigen::Matrix4f view_proj = Eigen::Matrix4f::Identity();
+  float lod_scale = 0.0f;  // LodScale; 0 draws full detail
+  bool hiz_culling = false;
+  bool meshlet_culling = false;
+  // The bitset of the camera's PVS cell, in Scene::pvs; empty for views not
+  // tested against the PVS.
+  std::span<const uint64_t> pvs_cell;
+  uint32_t command_buffer = 0;
+  uint32_t count_buffer = 0;
+  uint32_t instance_buffer = 0;
+  uint32_t first_command = 0;
+  uint32_t first_count = 0;
+  uint32_t first_instance = 0;
+};
+
+struct GpuCulling {
+  SSBO record_ssbo;  // GpuCullRecord per geometry
+  SSBO pvs_ssbo;      // Pvs::visible of the scene
+  SSBO meshlet_ssbo;  // GpuCullMeshlet per meshlet of the scene's meshes
+  GpuDrawLayout depth;
+  GpuDrawLayout radiance;
+
+  // DrawElementsIndirectCommand and uint counts of the frame's views, and
+  // their capacity.
+  uint32_t command_buffer = 0;
+  uint32_t count_buffer = 0;
+  uint32_t command_capacity = 0;
+  uint32_t count_capacity = 0;
+  // uint draw ids the commands index through their base instance: the
+  // identity over the geometries, then the instance slots of the frame's
+  // views, and its capacity.
+  uint32_t instance_buffer = 0;
+  uint32_t instance_capacity = 0;
+
+  // This frame's views; the DrawLists of FrameVisibility point into it.
+  std::vector<GpuCullView> views;
+};
+
+// Creates the cull kernel program.
+ShaderProgram CreateDrawCullProgram();
+
+// The cull kernel's per-view uniforms. Resolve them once the program has
+// linked, and again after a hot reload swaps it.
+struct DrawCullUniforms {
+  UniformHandle planes;
+  UniformHandle num_items;
+  UniformHandle first_command;
+  UniformHandle first_count;
+  UniformHandle view_proj;
+  UniformHandle lod_scale;
+  UniformHandle hiz_culling;
+  UniformHandle hiz_view_proj;
+  UniformHandle hiz_screen_size;
+  UniformHandle hiz_levels;
+  UniformHandle pvs_offset;
+  UniformHandle stage;
+  UniformHandle num_groups;
+  UniformHandle first_group_count;
+  UniformHandle first_instance;
+  UniformHandle meshlet_culling;
+};
+
+DrawCullUniforms ResolveDrawCullUniforms(const ShaderProgram& cull_program);
+
+// Builds the cull records of the uploaded scene (pure CPU; no GL). Exposed for
+// testing.
+std::vector<GpuCullRecord> BuildCullRecords(
+    const std::vector<Geometry>& geometries);
+
+// The meshlets of the uploaded scene's meshes, in the order the cull records
+// refer to them (pure CPU; no GL). Exposed for testing.
+std::vector<GpuCullMeshlet> BuildCullMeshlets(
+    const std::vector<Geometry>& geometries);
+
+// Sorts every draw `pass` could make of the scene into `layout`'s runs (pure
+// CPU; no GL): the geometries with indices for the depth-only passes, those
+// with a material for the radiance pass. With `instancing`, groups the
+// instances of each mesh within a run. The items of meshes with meshlets get
+// command slots for their ranges.
+void BuildDrawLayout(const Scene& scene, RenderPass pass, bool instancing,
+                     GpuDrawLayout* layout);
+
+// Uploads the records, meshlets and layouts of the scene, whose geometry arena
+// must exist, with instance groups if the arena enables instancing.
+GpuCulling CreateGpuCulling(const Scene& scene);
+
+void DestroyGpuCulling(GpuCulling* culling);
+
+// Culls every view of the frame with the kernel, like ComputeFrameVisibility
+// does on the CPU: the camera for the depth pre-pass and radiance layouts,
+// each cascade and each shadowed spot light for the depth layout. The camera
+// views are also tested against `hiz` if `hiz_culling` is set and the pyramid
+// was built, and against the camera's PVS cell if `visibility` enables PVS
+// culling. Levels of detail are selected, and meshlets culled, as
+// ComputeFrameVisibility and the passes drawing its lists do. The arena's
+// draw records must be current. Replaces the culling's views, points each of
+// `visibility`'s DrawLists at its view and empties their lists; the pyramid
+// stands in for the occlusion culling of `visibility`.
+void CullFrameOnGpu(const Scene& scene, const Camera& camera,
+                    const std::vector<Cascade>& cascades,
+                    const ShaderProgram& cull_program,
+                    const DrawCullUniforms& uniforms, const HiZPyramid& hiz,
+                    bool hiz_culling, GpuCulling* culling,
+                    FrameVisibility* visibility);
+
+// Draws `view` as one glMultiDrawElementsIndirectCount per layout run, with
+// the state handling of SubmitRenderQueue, and counts the runs in the view
+// pass's GetRenderQueueStats (its items are the layout's, culled or not). The
+// arena must be bound; its indirect buffer and draw instances are bound again
+// afterwards.
+void SubmitGpuCullView(
+    const GeometryArena& arena, const GpuCullView& view,
+    const std::function<void(uint64_t key, uint64_t changed)>& set_state);
+
+// Draws what `pass` draws of `lists`: its GPU culled view if it has one,
+// otherwise its lists sorted through `queue` (BuildRenderQueue and
+// SubmitRenderQueue).
+void SubmitDrawLists(
+    const Scene& scene, const DrawLists& lists, RenderPass pass,
+    RenderQueue* queue,
+    const std::function<void(uint64_t key, uint64_t changed)>& set_state);
+
+// --- CPU reference (tests and debugging) ---
+
+// The draw ids of each run of `view` in ascending order, those of instanced
+// commands included, each once however many ranges it draws. Stalls the
+// pipeline.
+std::vector<std::vector<uint32_t>> ReadGpuCullView(const GpuCullView& view);
+
+// Reads back every view of the frame and compares it with CullDrawLayoutOnCpu,
+// reading `hiz` back for the views tested against it. Returns the number of
+// draws kept by one and not the other. Call before `hiz` is rebuilt for the
+// frame. Stalls the pipeline.
+size_t CheckGpuCulling(const GpuCulling& culling, const HiZPyramid& hiz);
+
+// The draw ids of each run of `layout` the kernel keeps for a view of
+// `view_proj`, in ascending order: those IsAABBInFrustum accepts, less those
+// outside `pvs_cell` if not empty and those IsAABBOccludedByHiZ finds behind
+// `hiz`, built with `hiz_view_proj`, if given. With `meshlet_culling`, also
+// less the items CullMeshlets leaves no range of at the level of detail
+// SelectLod picks with `lod_scale`.
+std::vector<std::vector<uint32_t>> CullDrawLayoutOnCpu(
+    const GpuDrawLayout& layout, const Eigen::Matrix4f& view_proj,
+    std::span<const uint64_t> pvs_cell, const CpuHiZPyramid* hiz,
+    const Eigen::Matrix4f& hiz_view_proj, float lod_scale,
+    bool meshlet_culling);
+
+}  // namespace sh_renderer
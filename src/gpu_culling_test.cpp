@@ -0,0 +1,622 @@
+#include "gpu_culling.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+
+#include "glad.h"
+#include "window.h"
+
+namespace sh_renderer {
+namespace {
+
+// Adds a drawable geometry with the box `min`, `max`, as if uploaded.
+void AddGeometry(Scene* scene, const Eigen::Vector3f& min,
+                 const Eigen::Vector3f& max, int material_id,
+                 uint32_t index_count = 3) {
+  Geometry geo;
+  geo.material_id = material_id;
+  geo.draw_id = static_cast<uint32_t>(scene->geometries.size());
+  geo.first_index = 3 * geo.draw_id;
+  geo.index_count = index_count;
+  geo.base_vertex = static_cast<int32_t>(geo.draw_id);
+  geo.bounding_box.min = min;
+  geo.bounding_box.max = max;
+  scene->geometries.push_back(std::move(geo));
+}
+
+// Adds an instance of geometry `mesh` with the box `min`, `max`.
+void AddInstance(Scene* scene, int32_t mesh, const Eigen::Vector3f& min,
+                 const Eigen::Vector3f& max, int material_id) {
+  Geometry geo;
+  const Geometry& source = scene->geometries[mesh];
+  geo.instance_of = mesh;
+  geo.material_id = material_id;
+  geo.draw_id = static_cast<uint32_t>(scene->geometries.size());
+  geo.first_index = source.first_index;
+  geo.index_count = source.index_count;
+  geo.base_vertex = source.base_vertex;
+  geo.lods = source.lods;
+  geo.bounding_box.min = min;
+  geo.bounding_box.max = max;
+  scene->geometries.push_back(std::move(geo));
+}
+
+// Material 0 is opaque, 1 alpha-tested and 2 opaque and double sided.
+Scene MaterialScene() {
+  Scene scene;
+  scene.materials.resize(3);
+  scene.materials[1].alpha_cutout = true;
+  scene.materials[2].cull_mode = CullMode::kNone;
+  return scene;
+}
+
+// A camera at the origin looking down -Z.
+Camera TestCamera() {
+  return Camera{.position = Eigen::Vector3f::Zero(),
+                .orientation = Eigen::Quaternionf::Identity()};
+}
+
+std::vector<uint32_t> LayoutDrawIds(const GpuDrawLayout& layout) {
+  std::vector<uint32_t> ids;
+  for (const RenderItem& item : layout.queue.items) {
+    ids.push_back(item.geometry->draw_id);
+  }
+  return ids;
+}
+
+TEST(GpuCullingTest, LayoutsGroupEveryDrawableGeometryByState) {
+  Scene scene = MaterialScene();
+  const Eigen::Vector3f one = Eigen::Vector3f::Ones();
+  AddGeometry(&scene, -one, one, 0);
+  AddGeometry(&scene, -one, one, 1);
+  AddGeometry(&scene, -one, one, -1);  // occluder shell
+  AddGeometry(&scene, -one, one, 2);
+  AddGeometry(&scene, -one, one, 0, /*index_count=*/0);
+  AddGeometry(&scene, -one, one, 1);
+
+  GpuDrawLayout depth;
+  BuildDrawLayout(scene, RenderPass::kDepthPrepass, /*instancing=*/false,
+                  &depth);
+  // Opaque draws merge per cull mode in scene order; cutout ones split by
+  // material.
+  EXPECT_EQ(LayoutDrawIds(depth), (std::vector<uint32_t>{0, 2, 3, 1, 5}));
+  EXPECT_EQ(depth.run_first, (std::vector<uint32_t>{0, 2, 3, 5}));
+  // Without meshlets, one command slot per item.
+  EXPECT_EQ(depth.run_first_command, depth.run_first);
+  ASSERT_EQ(depth.num_runs(), 3u);
+  EXPECT_EQ(RenderKeyProgram(depth.run_keys[2]), RenderProgram::kCutout);
+  EXPECT_EQ(RenderKeyMaterial(depth.run_keys[2]), 1);
+
+  GpuDrawLayout radiance;
+  BuildDrawLayout(scene, RenderPass::kRadiance, /*instancing=*/false,
+                  &radiance);
+  EXPECT_EQ(LayoutDrawIds(radiance), (std::vector<uint32_t>{0, 3, 1, 5}));
+  EXPECT_EQ(radiance.run_first, (std::vector<uint32_t>{0, 1, 2, 4}));
+
+  const std::vector<GpuCullRecord> records =
+      BuildCullRecords(scene.geometries);
+  ASSERT_EQ(records.size(), scene.geometries.size());
+  EXPECT_EQ(records[3].first_index, 9u);
+  EXPECT_EQ(records[3].base_vertex, 3);
+  EXPECT_EQ(records[4].index_count, 0u);
+  EXPECT_EQ(records[3].box_max[2], 1.0f);
+  EXPECT_EQ(records[3].num_lods, 0u);
+}
+
+TEST(GpuCullingTest, LayoutsGroupTheInstancesOfAMeshPerRun) {
+  Scene scene = MaterialScene();
+  const Eigen::Vector3f one = Eigen::Vector3f::Ones();
+  AddGeometry(&scene, -one, one, 0);
+  AddGeometry(&scene, -one, one, 0);
+  AddInstance(&scene, 0, -one, one, 0);
+  AddInstance(&scene, 0, -one, one, 1);
+  AddInstance(&scene, 1, -one, one, 0);
+  AddInstance(&scene, 0, -one, one, 1);
+  AddInstance(&scene, 0, -one, one, 0);
+
+  GpuDrawLayout layout;
+  BuildDrawLayout(scene, RenderPass::kDepthPrepass, /*instancing=*/true,
+                  &layout);
+  EXPECT_EQ(LayoutDrawIds(layout),
+            (std::vector<uint32_t>{0, 1, 2, 4, 6, 3, 5}));
+  ASSERT_EQ(layout.num_groups(), 3u);
+  // Mesh 0 in the opaque run, mesh 1 in it, mesh 0 in the cutout run.
+  EXPECT_EQ(layout.item_group,
+            (std::vector<uint32_t>{0, 1, 0, 1, 0, 2, 2}));
+  EXPECT_EQ(layout.groups[0].run, 0u);
+  EXPECT_EQ(layout.groups[0].size, 3u);
+  EXPECT_EQ(layout.groups[0].draw_id, 0u);
+  EXPECT_EQ(layout.groups[1].first_instance, 3 * kCullGroupLevels);
+  EXPECT_EQ(layout.groups[1].draw_id, 1u);
+  EXPECT_EQ(layout.groups[2].run, 1u);
+  EXPECT_EQ(layout.groups[2].size, 2u);
+  EXPECT_EQ(layout.num_instances, 7 * kCullGroupLevels);
+  EXPECT_EQ(layout.num_counts(), 2 + 3 * kCullGroupLevels);
+
+  GpuDrawLayout single;
+  BuildDrawLayout(scene, RenderPass::kDepthPrepass, /*instancing=*/false,
+                  &single);
+  EXPECT_EQ(single.num_groups(), 0u);
+  EXPECT_EQ(single.item_group, std::vector<uint32_t>(7, kNoCullGroup));
+}
+
+TEST(GpuCullingTest, RecordsCarryScaledLevelsOfDetail) {
+  Scene scene = MaterialScene();
+  const Eigen::Vector3f one = Eigen::Vector3f::Ones();
+  AddGeometry(&scene, -one, one, 0);
+  Geometry& geo = scene.geometries[0];
+  geo.transform = Eigen::Scaling(1.0f, 3.0f, 2.0f);
+  geo.lods = {{.error = 0.5f, .first_index = 40, .index_count = 6},
+              {.error = 1.0f, .first_index = 46, .index_count = 3}};
+
+  const std::vector<GpuCullRecord> records =
+      BuildCullRecords(scene.geometries);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].num_lods, 2u);
+  EXPECT_FLOAT_EQ(records[0].lod_error[0], 1.5f);
+  EXPECT_FLOAT_EQ(records[0].lod_error[1], 3.0f);
+  EXPECT_EQ(records[0].lod_first_index[1], 46u);
+  EXPECT_EQ(records[0].lod_index_count[1], 3u);
+}
+
+TEST(GpuCullingTest, CpuReferenceCullsFrustumAndHiZ) {
+  Scene scene = MaterialScene();
+  AddGeometry(&scene, {-1, -1, -6}, {1, 1, -4}, 0);      // in front
+  AddGeometry(&scene, {-1, -1, 4}, {1, 1, 6}, 0);        // behind
+  AddGeometry(&scene, {-6, -1, -21}, {-3, 1, -20}, 0);   // behind a wall
+  GpuDrawLayout layout;
+  BuildDrawLayout(scene, RenderPass::kDepthPrepass, /*instancing=*/false,
+                  &layout);
+  const Eigen::Matrix4f view_proj = GetViewProjMatrix(TestCamera());
+
+  using Runs = std::vector<std::vector<uint32_t>>;
+  EXPECT_EQ(CullDrawLayoutOnCpu(layout, view_proj, {}, nullptr, view_proj,
+                                /*lod_scale=*/0.0f, /*meshlet_culling=*/false),
+            (Runs{{0, 2}}));
+
+  // A wall at z = -5 over the left half of the screen.
+  const int width = 64;
+  const int height = 32;
+  const Eigen::Vector4f clip = view_proj * Eigen::Vector4f(0, 0, -5, 1);
+  std::vector<float> depth(width * height, 1.0f);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width / 2; ++x) {
+      depth[y * width + x] = 0.5f * clip.z() / clip.w() + 0.5f;
+    }
+  }
+  const CpuHiZPyramid hiz = ReduceDepthToHiZ(depth, width, height);
+  EXPECT_EQ(CullDrawLayoutOnCpu(layout, view_proj, {}, &hiz, view_proj,
+                                /*lod_scale=*/0.0f, /*meshlet_culling=*/false),
+            (Runs{{0}}));
+}
+
+TEST(GpuCullingTest, GpuViewsMatchCpuReference) {
+  auto window = CreateWindow(64, 64, "GPU culling test");
+  ASSERT_TRUE(window.has_value());
+  {
+    // Random boxes all around the camera, so every view keeps some and culls
+    // some.
+    Scene scene = MaterialScene();
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> position(-40.0f, 40.0f);
+    std::uniform_real_distribution<float> size(0.2f, 3.0f);
+    std::uniform_int_distribution<int> material(-1, 2);
+    for (int i = 0; i < 2000; ++i) {
+      const Eigen::Vector3f min(position(rng), position(rng), position(rng));
+      const Eigen::Vector3f extent(size(rng), size(rng), size(rng));
+      AddGeometry(&scene, min, min + extent, material(rng));
+    }
+    SpotLight light;
+    light.position = Eigen::Vector3f(0, 10, 0);
+    light.direction = Eigen::Vector3f(0, -1, 0);
+    light.radius = 30.0f;
+    light.has_shadow = 1;
+    light.shadow_view_proj = ComputeSpotShadowViewProj(light);
+    SpotLight unshadowed = light;
+    unshadowed.has_shadow = 0;
+    scene.spot_lights = {light, unshadowed};
+    SunLight sun;
+    sun.direction = Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized();
+    const Camera camera = TestCamera();
+    const std::vector<Cascade> cascades = ComputeCascades(sun, camera);
+
+    // The previous frame's pyramid: a wall at z = -10 over the left half.
+    const int width = 100;
+    const int height = 61;
+    const Eigen::Matrix4f view_proj = GetViewProjMatrix(camera);
+    const Eigen::Vector4f clip = view_proj * Eigen::Vector4f(0, 0, -10, 1);
+    std::vector<float> depth(width * height, 1.0f);
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width / 2; ++x) {
+        depth[y * width + x] = 0.5f * clip.z() / clip.w() + 0.5f;
+      }
+    }
+    RenderTarget depth_target = CreateDepthTarget(width, height);
+    glTextureSubImage2D(depth_target.depth_buffer, 0, 0, 0, width, height,
+                        GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+    ShaderProgram hiz_program = CreateHiZProgram();
+    HiZPyramid hiz = CreateHiZPyramid(width, height);
+    ComputeHiZPyramid(depth_target, hiz_program,
+                      ResolveHiZUniforms(hiz_program), view_proj, &hiz);
+
+    ShaderProgram cull_program = CreateDrawCullProgram();
+    GpuCulling culling = CreateGpuCulling(scene);
+    FrameVisibility visibility;
+    CullFrameOnGpu(scene, camera, cascades, cull_program,
+                   ResolveDrawCullUniforms(cull_program), hiz,
+                   /*hiz_culling=*/true, &culling, &visibility);
+
+    // Camera depth and radiance, the cascades and the shadowed light.
+    ASSERT_EQ(culling.views.size(), 2 + cascades.size() + 1);
+    EXPECT_EQ(visibility.camera.gpu_depth, &culling.views[0]);
+    EXPECT_EQ(visibility.camera.gpu_shaded, &culling.views[1]);
+    EXPECT_TRUE(visibility.camera.opaque.empty());
+    EXPECT_EQ(visibility.spot_lights[1].gpu_depth, nullptr);
+
+    const CpuHiZPyramid cpu_hiz = ReadHiZPyramid(hiz);
+    for (const GpuCullView& view : culling.views) {
+      const auto actual = ReadGpuCullView(view);
+      const auto expected = CullDrawLayoutOnCpu(
+          *view.layout, view.view_proj, view.pvs_cell,
+          view.hiz_culling ? &cpu_hiz : nullptr, hiz.view_proj, view.lod_scale,
+          view.meshlet_culling);
+      EXPECT_EQ(actual, expected) << RenderPassName(view.pass);
+
+      size_t kept = 0;
+      for (const auto& run : expected) kept += run.size();
+      EXPECT_GT(kept, 0u);
+      EXPECT_LT(kept, view.layout->num_items());
+    }
+    EXPECT_EQ(CheckGpuCulling(culling, hiz), 0u);
+
+    // The pyramid hides some of what the camera frustum keeps.
+    const auto frustum_only =
+        CullDrawLayoutOnCpu(culling.depth, view_proj, {}, nullptr, view_proj,
+                            /*lod_scale=*/0.0f, /*meshlet_culling=*/false);
+    const auto with_hiz = ReadGpuCullView(culling.views[0]);
+    size_t frustum_kept = 0;
+    size_t hiz_kept = 0;
+    for (const auto& run : frustum_only) frustum_kept += run.size();
+    for (const auto& run : with_hiz) hiz_kept += run.size();
+    EXPECT_LT(hiz_kept, frustum_kept);
+
+    DestroyGpuCulling(&culling);
+    DestroyHiZPyramid(&hiz);
+    glDeleteFramebuffers(1, &depth_target.fbo);
+    glDeleteTextures(1, &depth_target.depth_buffer);
+  }
+  DestroyWindow(*window);
+}
+
+TEST(GpuCullingTest, CameraViewsDropWhatTheirPvsCellCannotSee) {
+  auto window = CreateWindow(64, 64, "GPU culling test");
+  ASSERT_TRUE(window.has_value());
+  {
+    Scene scene = MaterialScene();
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> position(-40.0f, 40.0f);
+    std::uniform_int_distribution<int> material(-1, 2);
+    for (int i = 0; i < 500; ++i) {
+      const Eigen::Vector3f min(position(rng), position(rng), position(rng));
+      AddGeometry(&scene, min, min + Eigen::Vector3f::Ones(), material(rng));
+    }
+    // Every cell of a 4 x 4 x 4 grid sees a random half of the geometries.
+    scene.pvs = MakePvsGrid({.min = Eigen::Vector3f::Constant(-50.0f),
+                             .max = Eigen::Vector3f::Constant(50.0f)},
+                            25.0f, 4,
+                            static_cast<uint32_t>(scene.geometries.size()));
+    std::bernoulli_distribution visible(0.5);
+    for (size_t cell = 0; cell < PvsCellCount(scene.pvs); ++cell) {
+      for (uint32_t i = 0; i < scene.pvs.num_geometries; ++i) {
+        if (visible(rng)) SetPvsBit(PvsCellBits(scene.pvs, cell), i);
+      }
+    }
+    SunLight sun;
+    sun.direction = Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized();
+    const Camera camera = TestCamera();
+    const std::vector<Cascade> cascades = ComputeCascades(sun, camera);
+
+    ShaderProgram cull_program = CreateDrawCullProgram();
+    GpuCulling culling = CreateGpuCulling(scene);
+    FrameVisibility visibility;
+    visibility.pvs_culling = true;
+    HiZPyramid hiz;
+    CullFrameOnGpu(scene, camera, cascades, cull_program,
+                   ResolveDrawCullUniforms(cull_program), hiz,
+                   /*hiz_culling=*/false, &culling, &visibility);
+
+    const int cell = FindPvsCell(scene.pvs, camera.position);
+    ASSERT_GE(cell, 0);
+    for (const GpuCullView& view : culling.views) {
+      const bool camera_view = view.pass == RenderPass::kDepthPrepass ||
+                               view.pass == RenderPass::kRadiance;
+      EXPECT_EQ(view.pvs_cell.data(),
+                camera_view ? PvsCellBits(scene.pvs, cell).data() : nullptr)
+          << RenderPassName(view.pass);
+      EXPECT_EQ(ReadGpuCullView(view),
+                CullDrawLayoutOnCpu(*view.layout, view.view_proj,
+                                    view.pvs_cell, nullptr, view.view_proj,
+                                    view.lod_scale, view.meshlet_culling))
+          << RenderPassName(view.pass);
+    }
+    EXPECT_EQ(CheckGpuCulling(culling, hiz), 0u);
+
+    // The cell hides about half of what the camera frustum keeps.
+    const auto frustum_only = CullDrawLayoutOnCpu(
+        culling.depth, culling.views[0].view_proj, {}, nullptr,
+        culling.views[0].view_proj, /*lod_scale=*/0.0f,
+        /*meshlet_culling=*/false);
+    size_t frustum_kept = 0;
+    size_t pvs_kept = 0;
+    for (const auto& run : frustum_only) frustum_kept += run.size();
+    for (const auto& run : ReadGpuCullView(culling.views[0])) {
+      pvs_kept += run.size();
+    }
+    EXPECT_GT(pvs_kept, 0u);
+    EXPECT_LT(pvs_kept, frustum_kept);
+
+    DestroyGpuCulling(&culling);
+  }
+  DestroyWindow(*window);
+}
+
+TEST(GpuCullingTest, KernelSelectsLevelsOfDetailLikeTheCpu) {
+  auto window = CreateWindow(64, 64, "GPU culling test");
+  ASSERT_TRUE(window.has_value());
+  {
+    // Geometries with two levels at growing distances down the camera's
+    // view.
+    Scene scene = MaterialScene();
+    for (int i = 0; i < 40; ++i) {
+      const float z = -2.0f - 5.0f * i;
+      AddGeometry(&scene, {-0.5f, -0.5f, z - 0.5f}, {0.5f, 0.5f, z + 0.5f},
+                  0, /*index_count=*/12);
+      Geometry& geo = scene.geometries.back();
+      geo.lods = {{.error = 0.01f, .first_index = 1000, .index_count = 6},
+                  {.error = 0.1f, .first_index = 2000, .index_count = 3}};
+    }
+    const Camera camera = TestCamera();
+    ShaderProgram cull_program = CreateDrawCullProgram();
+    GpuCulling culling = CreateGpuCulling(scene);
+    FrameVisibility visibility;
+    visibility.lod_error_pixels = 1.0f;
+    visibility.viewport_width = 1280;
+    visibility.viewport_height = 720;
+    HiZPyramid hiz;
+    CullFrameOnGpu(scene, camera, /*cascades=*/{}, cull_program,
+                   ResolveDrawCullUniforms(cull_program), hiz,
+                   /*hiz_culling=*/false, &culling, &visibility);
+
+    const GpuCullView& view = culling.views[0];
+    ASSERT_EQ(view.layout->num_runs(), 1u);
+    uint32_t count = 0;
+    glGetNamedBufferSubData(view.count_buffer,
+                            view.first_count * sizeof(uint32_t),
+                            sizeof(uint32_t), &count);
+    ASSERT_EQ(count, scene.geometries.size());
+    std::vector<DrawElementsIndirectCommand> commands(count);
+    glGetNamedBufferSubData(
+        view.command_buffer,
+        view.first_command * sizeof(DrawElementsIndirectCommand),
+        commands.size() * sizeof(DrawElementsIndirectCommand),
+        commands.data());
+    std::vector<uint32_t> lods_used(3, 0);
+    for (const DrawElementsIndirectCommand& cmd : commands) {
+      const Geometry& geo = scene.geometries[cmd.base_instance];
+      const uint32_t lod = SelectLod(geo, view.view_proj, view.lod_scale);
+      const DrawElementsIndirectCommand expected = MakeDrawCommand(geo, lod);
+      EXPECT_EQ(cmd.first_index, expected.first_index) << cmd.base_instance;
+      EXPECT_EQ(cmd.count, expected.count) << cmd.base_instance;
+      ++lods_used[lod];
+    }
+    for (uint32_t used : lods_used) EXPECT_GT(used, 0u);
+
+    DestroyGpuCulling(&culling);
+  }
+  DestroyWindow(*window);
+}
+
+TEST(GpuCullingTest, InstancesOfAMeshDrawAsOneCommandPerLevel) {
+  auto window = CreateWindow(64, 64, "GPU culling test");
+  ASSERT_TRUE(window.has_value());
+  {
+    // Two meshes with two levels, each placed many times all around the
+    // camera.
+    Scene scene = MaterialScene();
+    const Eigen::Vector3f half = Eigen::Vector3f::Constant(0.5f);
+    for (int mesh = 0; mesh < 2; ++mesh) {
+      AddGeometry(&scene, -half, half, 0, /*index_count=*/12);
+      scene.geometries.back().lods = {
+          {.error = 0.01f, .first_index = 1000, .index_count = 6},
+          {.error = 0.1f, .first_index = 2000, .index_count = 3}};
+    }
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    for (int i = 0; i < 1000; ++i) {
+      const Eigen::Vector3f center(position(rng), position(rng),
+                                   position(rng));
+      AddInstance(&scene, i % 2, center - half, center + half, 0);
+    }
+    SunLight sun;
+    sun.direction = Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized();
+    const Camera camera = TestCamera();
+    const std::vector<Cascade> cascades = ComputeCascades(sun, camera);
+
+    ShaderProgram cull_program = CreateDrawCullProgram();
+    GpuCulling culling = CreateGpuCulling(scene);
+    ASSERT_EQ(culling.depth.num_groups(), 2u);
+    FrameVisibility visibility;
+    visibility.lod_error_pixels = 1.0f;
+    visibility.viewport_width = 1280;
+    visibility.viewport_height = 720;
+    HiZPyramid hiz;
+    CullFrameOnGpu(scene, camera, cascades, cull_program,
+                   ResolveDrawCullUniforms(cull_program), hiz,
+                   /*hiz_culling=*/false, &culling, &visibility);
+    EXPECT_EQ(CheckGpuCulling(culling, hiz), 0u);
+
+    // The camera's depth view: at most one command per mesh and level, each
+    // drawing its instances at the level the kernel chose for them.
+    const GpuCullView& view = culling.views[0];
+    ASSERT_EQ(view.layout->num_runs(), 1u);
+    uint32_t count = 0;
+    glGetNamedBufferSubData(view.count_buffer,
+                            view.first_count * sizeof(uint32_t),
+                            sizeof(uint32_t), &count);
+    EXPECT_GT(count, 1u);
+    EXPECT_LE(count, 2 * 3u);
+    std::vector<DrawElementsIndirectCommand> commands(count);
+    glGetNamedBufferSubData(
+        view.command_buffer,
+        view.first_command * sizeof(DrawElementsIndirectCommand),
+        commands.size() * sizeof(DrawElementsIndirectCommand),
+        commands.data());
+    size_t drawn = 0;
+    for (const DrawElementsIndirectCommand& cmd : commands) {
+      std::vector<uint32_t> ids(cmd.instance_count);
+      glGetNamedBufferSubData(view.instance_buffer,
+                              cmd.base_instance * sizeof(uint32_t),
+                              ids.size() * sizeof(uint32_t), ids.data());
+      for (uint32_t id : ids) {
+        const Geometry& geo = scene.geometries[id];
+        const DrawElementsIndirectCommand expected = MakeDrawCommand(
+            geo, SelectLod(geo, view.view_proj, view.lod_scale));
+        EXPECT_EQ(cmd.first_index, expected.first_index) << id;
+        EXPECT_EQ(cmd.count, expected.count) << id;
+      }
+      drawn += ids.size();
+    }
+    size_t kept = 0;
+    for (const auto& run : ReadGpuCullView(view)) kept += run.size();
+    EXPECT_EQ(drawn, kept);
+    EXPECT_GT(kept, count);
+
+    DestroyGpuCulling(&culling);
+  }
+  DestroyWindow(*window);
+}
+
+// Eight meshlets of 10 triangles around the center of a unit box, each facing
+// away from it along a diagonal.
+std::vector<Meshlet> DiagonalMeshlets() {
+  std::vector<Meshlet> meshlets;
+  for (uint32_t k = 0; k < 8; ++k) {
+    const Eigen::Vector3f axis =
+        Eigen::Vector3f((k & 1) ? 1 : -1, (k & 2) ? 1 : -1, (k & 4) ? 1 : -1)
+            .normalized();
+    meshlets.push_back({.range = {.first_index = 30 * k, .index_count = 30},
+                        .center = 0.3f * axis,
+                        .radius = 0.2f,
+                        .cone_axis = axis,
+                        .cone_cutoff = 0.3f});
+  }
+  return meshlets;
+}
+
+TEST(GpuCullingTest, KernelCullsMeshletsLikeTheCpu) {
+  auto window = CreateWindow(64, 64, "GPU culling test");
+  ASSERT_TRUE(window.has_value());
+  {
+    // Unit boxes of meshlets all around the camera, some mirrored and some
+    // double sided.
+    Scene scene = MaterialScene();
+    scene.geometry_arena.instancing = false;
+    std::mt19937 rng(13);
+    std::uniform_real_distribution<float> position(-30.0f, 30.0f);
+    std::uniform_int_distribution<int> material(0, 2);
+    for (int i = 0; i < 400; ++i) {
+      const Eigen::Vector3f center(position(rng), position(rng),
+                                   position(rng));
+      const Eigen::Vector3f half = Eigen::Vector3f::Constant(0.5f);
+      AddGeometry(&scene, center - half, center + half, material(rng),
+                  /*index_count=*/240);
+      Geometry& geo = scene.geometries.back();
+      geo.first_index = 240 * geo.draw_id;
+      geo.transform = Eigen::Translation3f(center);
+      if (i % 5 == 0) geo.transform.scale(Eigen::Vector3f(-1.0f, 1.0f, 1.0f));
+      geo.meshlets = DiagonalMeshlets();
+    }
+    const std::vector<GpuDrawRecord> draw_records =
+        BuildDrawRecords(scene.geometries);
+    scene.geometry_arena.draw_record_ssbo = CreateSSBO(
+        draw_records.data(), draw_records.size() * sizeof(GpuDrawRecord));
+    SunLight sun;
+    sun.direction = Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized();
+    const Camera camera = TestCamera();
+    const std::vector<Cascade> cascades = ComputeCascades(sun, camera);
+
+    ShaderProgram cull_program = CreateDrawCullProgram();
+    GpuCulling culling = CreateGpuCulling(scene);
+    EXPECT_EQ(culling.depth.num_commands(), 4 * culling.depth.num_items());
+    FrameVisibility visibility;
+    visibility.meshlet_culling = true;
+    HiZPyramid hiz;
+    CullFrameOnGpu(scene, camera, cascades, cull_program,
+                   ResolveDrawCullUniforms(cull_program), hiz,
+                   /*hiz_culling=*/false, &culling, &visibility);
+    EXPECT_EQ(CheckGpuCulling(culling, hiz), 0u);
+
+    // Every view, the perspective camera and the orthographic cascades, draws
+    // the ranges CullMeshlets leaves of each draw.
+    for (const GpuCullView& view : culling.views) {
+      const GpuDrawLayout& layout = *view.layout;
+      std::vector<uint32_t> counts(layout.num_runs());
+      glGetNamedBufferSubData(view.count_buffer,
+                              view.first_count * sizeof(uint32_t),
+                              counts.size() * sizeof(uint32_t), counts.data());
+      std::vector<DrawElementsIndirectCommand> commands(layout.num_commands());
+      glGetNamedBufferSubData(
+          view.command_buffer,
+          view.first_command * sizeof(DrawElementsIndirectCommand),
+          commands.size() * sizeof(DrawElementsIndirectCommand),
+          commands.data());
+      std::vector<std::vector<IndexRange>> actual(scene.geometries.size());
+      size_t num_ranges = 0;
+      for (uint32_t run = 0; run < layout.num_runs(); ++run) {
+        for (uint32_t c = 0; c < counts[run]; ++c) {
+          const DrawElementsIndirectCommand& cmd =
+              commands[layout.run_first_command[run] + c];
+          const Geometry& geo = scene.geometries[cmd.base_instance];
+          actual[cmd.base_instance].push_back(
+              {cmd.first_index - geo.first_index, cmd.count});
+          ++num_ranges;
+        }
+      }
+      size_t num_meshlets = 0;
+      for (const auto& run : ReadGpuCullView(view)) {
+        for (uint32_t id : run) {
+          const Geometry& geo = scene.geometries[id];
+          std::vector<IndexRange> expected;
+          CullMeshlets(geo.meshlets, view.view_proj, geo.transform,
+                       geo.material_id >= 0
+                           ? scene.materials[geo.material_id].cull_mode
+                           : CullMode::kFront,
+                       &expected);
+          std::vector<IndexRange>& ranges = actual[id];
+          std::sort(ranges.begin(), ranges.end(),
+                    [](const IndexRange& a, const IndexRange& b) {
+                      return a.first_index < b.first_index;
+                    });
+          ASSERT_EQ(ranges.size(), expected.size()) << id;
+          for (size_t r = 0; r < ranges.size(); ++r) {
+            EXPECT_EQ(ranges[r].first_index, expected[r].first_index) << id;
+            EXPECT_EQ(ranges[r].index_count, expected[r].index_count) << id;
+          }
+          num_meshlets += geo.meshlets.size();
+        }
+      }
+      // Some of the kept draws' meshlets face away.
+      EXPECT_GT(num_ranges, 0u) << RenderPassName(view.pass);
+      EXPECT_LT(num_ranges, num_meshlets) << RenderPassName(view.pass);
+    }
+
+    DestroyGpuCulling(&culling);
+    DestroySSBO(scene.geometry_arena.draw_record_ssbo);
+  }
+  DestroyWindow(*window);
+}
+
+}  // namespace
+}  // namespace sh_renderer
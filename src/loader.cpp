@@ -2,13 +2,19 @@
 
 #include <glog/logging.h>
 
+#include <stb_image.h>
+
 #include <Eigen/Geometry>
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <iostream>
+#include <map>
+#include <utility>
 
 #include "colorspace.h"
+#include "parallel.h"
 #include "scene.h"
 #include "tiny_gltf.h"
 
@@ -32,6 +38,74 @@ bool AnyTransparentPixel(const std::vector<uint8_t>& pixel_data) {
   return false;
 }
 
+// Encoded image files captured while tinygltf parses the document, indexed by
+// glTF image index. Decoding is deferred so it can run on a worker pool.
+struct EncodedImages {
+  std::vector<std::vector<uint8_t>> bytes;
+};
+
+// tinygltf image loader callback: records the encoded bytes instead of
+// decoding them on the parsing thread. See DecodeImages().
+bool RecordEncodedImage(tinygltf::Image* /*image*/, const int image_idx,
+                        std::string* /*err*/, std::string* /*warn*/,
+                        int /*req_width*/, int /*req_height*/,
+                        const unsigned char* bytes, int size, void* user_data) {
+  auto* encoded = static_cast<EncodedImages*>(user_data);
+  if (image_idx < 0) return false;
+  if (static_cast<size_t>(image_idx) >= encoded->bytes.size()) {
+    encoded->bytes.resize(image_idx + 1);
+  }
+  encoded->bytes[image_idx].assign(bytes, bytes + size);
+  return true;
+}
+
+// Decodes every recorded image into `model->images` on `num_threads` workers
+// (0 = all cores). Always 8-bit RGBA, which is what the texture upload
+// expects: unlike tinygltf's default loader, which keeps 16-bit PNGs at 16
+// bits, 16-bit images are deliberately narrowed to 8 bits per channel.
+// Returns false if any image fails to decode.
+bool DecodeImages(EncodedImages* encoded, unsigned num_threads,
+                  tinygltf::Model* model) {
+  std::vector<uint8_t> ok(model->images.size(), 1);
+  ParallelFor(model->images.size(), num_threads, [&](size_t i) {
+    if (i >= encoded->bytes.size() || encoded->bytes[i].empty()) return;
+    std::vector<uint8_t>& bytes = encoded->bytes[i];
+
+    int width = 0;
+    int height = 0;
+    int channels_in_file = 0;
+    stbi_uc* pixels = stbi_load_from_memory(
+        bytes.data(), static_cast<int>(bytes.size()), &width, &height,
+        &channels_in_file, /*desired_channels=*/4);
+    if (pixels == nullptr) {
+      ok[i] = 0;
+      return;
+    }
+
+    tinygltf::Image& image = model->images[i];
+    image.width = width;
+    image.height = height;
+    image.component = 4;
+    image.bits = 8;
+    image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    image.image.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+
+    // The encoded copy is no longer needed.
+    std::vector<uint8_t>().swap(bytes);
+  });
+
+  bool all_ok = true;
+  for (size_t i = 0; i < ok.size(); ++i) {
+    if (!ok[i]) {
+      LOG(ERROR) << "Failed to decode image " << i << " ('"
+                 << model->images[i].uri << "').";
+      all_ok = false;
+    }
+  }
+  return all_ok;
+}
+
 // Helper to convert array to Eigen matrix/vector
 Eigen::Affine3f NodeToTransform(const tinygltf::Node& node) {
   Eigen::Affine3f transform = Eigen::Affine3f::Identity();
@@ -327,10 +401,11 @@ std::string UrlDecode(const std::string& str) {
   return ret;
 }
 
-// Helper to load a texture
+// Helper to load a texture. With a registry, an image already loaded with the
+// same colour space is shared instead of copied again.
 void LoadTexture(const tinygltf::Model& model, int tex_idx,
                  const std::filesystem::path& base_path, Texture* out_tex,
-                 bool srgb = true) {
+                 bool srgb = true, TextureRegistry* registry = nullptr) {
   if (tex_idx < 0 || tex_idx >= model.textures.size()) {
     return;
   }
@@ -340,6 +415,14 @@ void LoadTexture(const tinygltf::Model& model, int tex_idx,
     return;
   }
 
+  if (registry) {
+    auto it = registry->textures.find({img_idx, srgb});
+    if (it != registry->textures.end()) {
+      *out_tex = it->second;
+      return;
+    }
+  }
+
   const auto& img = model.images[img_idx];
   out_tex->width = img.width;
   out_tex->height = img.height;
@@ -353,11 +436,19 @@ void LoadTexture(const tinygltf::Model& model, int tex_idx,
       rgb_data.push_back(img.image[i + 1]);
       rgb_data.push_back(img.image[i + 2]);
     }
-    out_tex->pixel_data = std::move(rgb_data);
+    out_tex->pixel_data = MakePixelData(std::move(rgb_data));
     out_tex->channels = 3;
   } else {
-    out_tex->pixel_data = img.image;
     out_tex->channels = img.component;
+    // The other colour space may already hold the unmodified image.
+    if (registry) {
+      auto it = registry->textures.find({img_idx, !srgb});
+      if (it != registry->textures.end() &&
+          it->second.channels == out_tex->channels) {
+        out_tex->pixel_data = it->second.pixel_data;
+      }
+    }
+    if (!out_tex->pixel_data) out_tex->pixel_data = MakePixelData(img.image);
   }
 
   if (!img.uri.empty()) {
@@ -368,6 +459,8 @@ void LoadTexture(const tinygltf::Model& model, int tex_idx,
       out_tex->file_path = std::filesystem::absolute(base_path / uri_path);
     }
   }
+
+  if (registry) registry->textures[{img_idx, srgb}] = *out_tex;
 }
 
 // --- SH_material_layers parsing (mirrors sh-baker/src/layer_composite.cpp +
@@ -517,6 +610,8 @@ std::vector<TcMod> ParseTcMods(const tinygltf::Value& arr) {
 void ProcessMaterials(const tinygltf::Model& model,
                       const std::filesystem::path& base_path,
                       std::vector<Material>* result) {
+  TextureRegistry registry;
+
   if (model.materials.empty()) {
     Material default_mat;
     default_mat.name = "default";
@@ -524,20 +619,20 @@ void ProcessMaterials(const tinygltf::Model& model,
     default_mat.albedo.width = 1;
     default_mat.albedo.height = 1;
     default_mat.albedo.channels = 4;
-    default_mat.albedo.pixel_data = {255, 255, 255, 255};
+    default_mat.albedo.pixel_data = MakePixelData({255, 255, 255, 255});
 
     // Default 1x1 normal (0.5, 0.5, 1.0) -> (128, 128, 255)
     default_mat.normal_texture.width = 1;
     default_mat.normal_texture.height = 1;
     default_mat.normal_texture.channels = 3;
-    default_mat.normal_texture.pixel_data = {128, 128, 255};
+    default_mat.normal_texture.pixel_data = MakePixelData({128, 128, 255});
 
     // Default 1x1 metallic-roughness (roughness=1, metallic=1) -> G=255, B=255
     default_mat.metallic_roughness_texture.width = 1;
     default_mat.metallic_roughness_texture.height = 1;
     default_mat.metallic_roughness_texture.channels = 3;
-    default_mat.metallic_roughness_texture.pixel_data = {0, 255,
-                                                         255};  // R unused
+    default_mat.metallic_roughness_texture.pixel_data =
+        MakePixelData({0, 255, 255});  // R unused
 
     result->push_back(default_mat);
     return;
@@ -566,55 +661,58 @@ void ProcessMaterials(const tinygltf::Model& model,
     // Emissive Texture
     int emissive_idx = gltf_mat.emissiveTexture.index;
     Texture emissive_texture;
-    LoadTexture(model, emissive_idx, base_path, &emissive_texture, true);
-    if (!emissive_texture.pixel_data.empty()) {
+    LoadTexture(model, emissive_idx, base_path, &emissive_texture, true,
+                &registry);
+    if (HasPixels(emissive_texture)) {
       mat.emissive_texture = emissive_texture;
     }
 
     // Texture (Base Color)
     int albedo_idx = gltf_mat.pbrMetallicRoughness.baseColorTexture.index;
-    LoadTexture(model, albedo_idx, base_path, &mat.albedo, true);
+    LoadTexture(model, albedo_idx, base_path, &mat.albedo, true, &registry);
     mat.alpha_cutout = mat.albedo.channels == 4;
 
-    if (mat.albedo.pixel_data.empty()) {
+    if (!HasPixels(mat.albedo)) {
       // Create 1x1 texture from baseColorFactor (Linear -> sRGB)
       const auto& color = gltf_mat.pbrMetallicRoughness.baseColorFactor;
       mat.albedo.width = 1;
       mat.albedo.height = 1;
       mat.albedo.channels = 4;
-      mat.albedo.pixel_data.resize(4);
 
       // baseColorFactor is RGBA (4 items)
       if (color.size() == 4) {
-        mat.albedo.pixel_data[0] = LinearToSRGB(static_cast<float>(color[0]));
-        mat.albedo.pixel_data[1] = LinearToSRGB(static_cast<float>(color[1]));
-        mat.albedo.pixel_data[2] = LinearToSRGB(static_cast<float>(color[2]));
-        mat.albedo.pixel_data[3] = static_cast<unsigned char>(
-            std::rint(std::clamp(color[3], 0.0, 1.0) * 255.0));
+        mat.albedo.pixel_data = MakePixelData({
+            LinearToSRGB(static_cast<float>(color[0])),
+            LinearToSRGB(static_cast<float>(color[1])),
+            LinearToSRGB(static_cast<float>(color[2])),
+            static_cast<unsigned char>(
+                std::rint(std::clamp(color[3], 0.0, 1.0) * 255.0)),
+        });
       } else {
         // Fallback white
-        mat.albedo.pixel_data = {255, 255, 255, 255};
+        mat.albedo.pixel_data = MakePixelData({255, 255, 255, 255});
       }
     }
 
     // Normal Texture
     int norm_idx = gltf_mat.normalTexture.index;
-    LoadTexture(model, norm_idx, base_path, &mat.normal_texture, false);
+    LoadTexture(model, norm_idx, base_path, &mat.normal_texture, false,
+                &registry);
 
-    if (mat.normal_texture.pixel_data.empty()) {
+    if (!HasPixels(mat.normal_texture)) {
       // Default 1x1 normal (0.5, 0.5, 1.0) -> (128, 128, 255)
       mat.normal_texture.width = 1;
       mat.normal_texture.height = 1;
       mat.normal_texture.channels = 3;
-      mat.normal_texture.pixel_data = {128, 128, 255};
+      mat.normal_texture.pixel_data = MakePixelData({128, 128, 255});
     }
 
     // Metallic-Roughness Texture
     int mr_idx = gltf_mat.pbrMetallicRoughness.metallicRoughnessTexture.index;
     LoadTexture(model, mr_idx, base_path, &mat.metallic_roughness_texture,
-                false);
+                false, &registry);
 
-    if (mat.metallic_roughness_texture.pixel_data.empty()) {
+    if (!HasPixels(mat.metallic_roughness_texture)) {
       // Default 1x1 using factors
       // Metallic is stored in B, Roughness in G
       mat.metallic_roughness_texture.width = 1;
@@ -625,13 +723,13 @@ void ProcessMaterials(const tinygltf::Model& model,
           static_cast<float>(gltf_mat.pbrMetallicRoughness.roughnessFactor);
       auto metallic =
           static_cast<float>(gltf_mat.pbrMetallicRoughness.metallicFactor);
-      mat.metallic_roughness_texture.pixel_data = {
-          0, static_cast<uint8_t>(roughness * 255),
-          static_cast<uint8_t>(metallic * 255)};
+      mat.metallic_roughness_texture.pixel_data =
+          MakePixelData({0, static_cast<uint8_t>(roughness * 255),
+                         static_cast<uint8_t>(metallic * 255)});
     }
 
     // Quake 3 layer stack (SH_material_layers), retained for the GLSL compositor.
-    ParseMaterialLayers(model, gltf_mat, base_path, &mat);
+    ParseMaterialLayers(model, gltf_mat, base_path, &mat, &registry);
     if (!mat.layers.empty()) {
       // Coverage matches the baker: the modern albedo's alpha when it has one,
       // otherwise the base layer's Q3 alpha. LoadTexture only keeps a 4th channel
@@ -763,23 +861,39 @@ void ProcessAreaLights(const std::vector<Material>& materials,
       area_light.color = mat.emissive_factor;
       area_light.material = &materials[mat_idx];
       area_light.geometry = geo;
-      area_light.area = SurfaceArea(*geo);
+      area_light.area = SurfaceArea(geometries, *geo);
 
       result->emplace_back(std::move(area_light));
     }
   }
 }
 
+// The scene geometry first loaded for each (mesh, primitive) of the glTF.
+using MeshGeometries = std::map<std::pair<int, int>, int32_t>;
+
 bool TraverseNodes(const tinygltf::Model& model, int node_index,
-                   const Eigen::Affine3f& parent_transform, Scene* scene) {
+                   const Eigen::Affine3f& parent_transform,
+                   MeshGeometries* meshes, Scene* scene) {
   const tinygltf::Node& node = model.nodes[node_index];
 
   Eigen::Affine3f global_transform = parent_transform * NodeToTransform(node);
 
-  // Mesh
+  // Mesh. Nodes sharing a mesh load its primitives once; later nodes add
+  // instances of them.
   if (node.mesh >= 0) {
     const tinygltf::Mesh& mesh = model.meshes[node.mesh];
-    for (const auto& primitive : mesh.primitives) {
+    for (int p = 0; p < static_cast<int>(mesh.primitives.size()); ++p) {
+      const tinygltf::Primitive& primitive = mesh.primitives[p];
+      const auto [it, first] = meshes->try_emplace(
+          {node.mesh, p}, static_cast<int32_t>(scene->geometries.size()));
+      if (!first) {
+        Geometry instance;
+        instance.material_id = primitive.material;
+        instance.transform = global_transform;
+        instance.instance_of = it->second;
+        scene->geometries.push_back(std::move(instance));
+        continue;
+      }
       if (!ProcessPrimitive(model, primitive, global_transform,
                             &scene->geometries)) {
         return false;
@@ -811,7 +925,9 @@ bool TraverseNodes(const tinygltf::Model& model, int node_index,
   }
 
   for (int child : node.children) {
-    if (!TraverseNodes(model, child, global_transform, scene)) return false;
+    if (!TraverseNodes(model, child, global_transform, meshes, scene)) {
+      return false;
+    }
   }
   return true;
 }
@@ -820,7 +936,8 @@ bool TraverseNodes(const tinygltf::Model& model, int node_index,
 
 void ParseMaterialLayers(const tinygltf::Model& model,
                          const tinygltf::Material& gltf_mat,
-                         const std::filesystem::path& base_path, Material* mat) {
+                         const std::filesystem::path& base_path, Material* mat,
+                         TextureRegistry* registry) {
   auto it = gltf_mat.extensions.find("SH_material_layers");
   if (it == gltf_mat.extensions.end()) return;
   const tinygltf::Value& ext = it->second;
@@ -839,7 +956,7 @@ void ParseMaterialLayers(const tinygltf::Model& model,
     Layer layer;
     if (lo.Has("texture") && lo.Get("texture").Has("index")) {
       LoadTexture(model, lo.Get("texture").Get("index").GetNumberAsInt(),
-                  base_path, &layer.texture, true);
+                  base_path, &layer.texture, true, registry);
     }
     if (lo.Has("animFrames") && lo.Get("animFrames").IsArray()) {
       const auto& frames = lo.Get("animFrames");
@@ -847,7 +964,7 @@ void ParseMaterialLayers(const tinygltf::Model& model,
       for (size_t f = 0; f < frames.ArrayLen(); ++f) {
         Texture frame;
         LoadTexture(model, frames.Get(static_cast<int>(f)).GetNumberAsInt(),
-                    base_path, &frame, true);
+                    base_path, &frame, true, registry);
         layer.anim_frames.push_back(std::move(frame));
       }
       if (lo.Has("animFreq")) {
@@ -872,12 +989,20 @@ void ParseMaterialLayers(const tinygltf::Model& model,
   if (!mat->layers.empty()) mat->layers[mat->base_layer].is_base = true;
 }
 
-std::optional<Scene> LoadScene(const std::filesystem::path& gltf_file) {
+std::optional<Scene> LoadScene(const std::filesystem::path& gltf_file,
+                               unsigned num_decode_threads) {
+  auto start_time = std::chrono::steady_clock::now();
+
   tinygltf::Model model;
   tinygltf::TinyGLTF loader;
   std::string err;
   std::string warn;
 
+  // Only collect the encoded images while parsing; they are decoded in
+  // parallel below.
+  EncodedImages encoded_images;
+  loader.SetImageLoader(RecordEncodedImage, &encoded_images);
+
   bool ret = false;
   if (gltf_file.extension() == ".glb") {
     ret = loader.LoadBinaryFromFile(&model, &err, &warn, gltf_file.string());
@@ -896,6 +1021,14 @@ std::optional<Scene> LoadScene(const std::filesystem::path& gltf_file) {
     return std::nullopt;
   }
 
+  auto decode_start_time = std::chrono::steady_clock::now();
+  unsigned decode_threads =
+      num_decode_threads > 0 ? num_decode_threads : DefaultThreadCount();
+  if (!DecodeImages(&encoded_images, decode_threads, &model)) {
+    return std::nullopt;
+  }
+  auto decode_end_time = std::chrono::steady_clock::now();
+
   Scene scene;
 
   // Process Materials
@@ -904,8 +1037,9 @@ std::optional<Scene> LoadScene(const std::filesystem::path& gltf_file) {
   // Traverse Nodes to find Meshes/Punctual Lights
   const tinygltf::Scene& gltf_scene =
       model.scenes[model.defaultScene > -1 ? model.defaultScene : 0];
+  MeshGeometries meshes;
   for (int node_index : gltf_scene.nodes) {
-    if (!TraverseNodes(model, node_index, Eigen::Affine3f::Identity(),
+    if (!TraverseNodes(model, node_index, Eigen::Affine3f::Identity(), &meshes,
                        &scene)) {
       LOG(ERROR) << "Failed to process scene graph.";
       return std::nullopt;
@@ -918,6 +1052,16 @@ std::optional<Scene> LoadScene(const std::filesystem::path& gltf_file) {
   // Load Baked Indirect SH Lightmaps
   LoadLightmaps(scene, gltf_file);
 
+  auto end_time = std::chrono::steady_clock::now();
+  auto ms = [](auto duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  };
+  LOG(INFO) << "Loaded " << gltf_file.filename() << " in "
+            << ms(end_time - start_time) << " ms (decoded "
+            << model.images.size() << " images on " << decode_threads
+            << " thread(s) in " << ms(decode_end_time - decode_start_time)
+            << " ms).";
+
   return scene;
 }
 
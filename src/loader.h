@@ -1,7 +1,9 @@
 #pragma once
 
 #include <filesystem>
+#include <map>
 #include <optional>
+#include <utility>
 
 #include "scene.h"
 
@@ -12,16 +14,28 @@ struct Material;
 
 namespace sh_renderer {
 
+// Textures already built by the loader, keyed on (glTF image index, sRGB).
+// Every material slot that samples the same image with the same colour space
+// gets a copy of the registered Texture, so they all share its pixel buffer
+// (and, after UploadSceneToGPU, its GL texture).
+struct TextureRegistry {
+  std::map<std::pair<int, bool>, Texture> textures;
+};
+
 // Loads a glTF file and returns a Scene object.
-// Returns std::nullopt if loading fails.
-std::optional<Scene> LoadScene(const std::filesystem::path& gltf_file);
+// Images are decoded on `num_decode_threads` worker threads (0 = one per
+// core) after the document is parsed. Returns std::nullopt if loading fails.
+std::optional<Scene> LoadScene(const std::filesystem::path& gltf_file,
+                               unsigned num_decode_threads = 0);
 
 // Parses the `SH_material_layers` extension on `gltf_mat` into `mat->layers`
 // (loading each layer + animMap-frame texture from `model`), and sets
 // `mat->base_layer` / `mat->cull_mode`. No-op when the extension is absent.
+// Layer textures are shared through `registry` when one is given.
 // Exposed for testing; called by the loader during material processing.
 void ParseMaterialLayers(const tinygltf::Model& model,
                          const tinygltf::Material& gltf_mat,
-                         const std::filesystem::path& base_path, Material* mat);
+                         const std::filesystem::path& base_path, Material* mat,
+                         TextureRegistry* registry = nullptr);
 
 }  // namespace sh_renderer
@@ -165,5 +165,45 @@ TEST(LoaderLayers, OutOfRangeBaseLayerClampsToZero) {
   EXPECT_TRUE(mat.layers[0].is_base);
 }
 
+// Layers and animMap frames that reference the same image share one pixel
+// buffer when a TextureRegistry is passed, across materials too.
+TEST(LoaderLayers, RegistrySharesPixelsBetweenSlots) {
+  tinygltf::Model model;
+  int t0 = AddTexture(&model, 3);
+  int t1 = AddTexture(&model, 3);
+  tinygltf::Value::Object l0 = MakeLayer(t0, "ONE", "ZERO");
+  l0["animFrames"] = tinygltf::Value(
+      tinygltf::Value::Array{tinygltf::Value(t0), tinygltf::Value(t1)});
+  tinygltf::Value::Object ext;
+  ext["layers"] = tinygltf::Value(tinygltf::Value::Array{
+      tinygltf::Value(l0), tinygltf::Value(MakeLayer(t1, "ONE", "ONE"))});
+  tinygltf::Material gmat;
+  gmat.extensions["SH_material_layers"] = tinygltf::Value(ext);
+
+  TextureRegistry registry;
+  Material a;
+  Material b;
+  ParseMaterialLayers(model, gmat, ".", &a, &registry);
+  ParseMaterialLayers(model, gmat, ".", &b, &registry);
+  ASSERT_EQ(a.layers.size(), 2u);
+  ASSERT_EQ(a.layers[0].anim_frames.size(), 2u);
+  ASSERT_NE(a.layers[0].texture.pixel_data, nullptr);
+  EXPECT_EQ(a.layers[0].anim_frames[0].pixel_data,
+            a.layers[0].texture.pixel_data);
+  EXPECT_EQ(a.layers[1].texture.pixel_data,
+            a.layers[0].anim_frames[1].pixel_data);
+  EXPECT_NE(a.layers[0].texture.pixel_data, a.layers[1].texture.pixel_data);
+  EXPECT_EQ(b.layers[0].texture.pixel_data, a.layers[0].texture.pixel_data);
+  EXPECT_EQ(registry.textures.size(), 2u);
+
+  // Without a registry every slot gets its own copy.
+  Material c;
+  ParseMaterialLayers(model, gmat, ".", &c);
+  EXPECT_NE(c.layers[0].anim_frames[0].pixel_data,
+            c.layers[0].texture.pixel_data);
+  EXPECT_EQ(*c.layers[0].anim_frames[0].pixel_data,
+            *c.layers[0].texture.pixel_data);
+}
+
 }  // namespace
 }  // namespace sh_renderer
@@ -3,6 +3,7 @@
 #include <gtest/gtest.h>
 
 #include <filesystem>
+#include <fstream>
 
 #include "scene.h"
 
@@ -72,14 +73,16 @@ TEST(LoaderTest, LoadBoxFallbackColor) {
   EXPECT_EQ(mat.albedo.width, 1);
   EXPECT_EQ(mat.albedo.height, 1);
   EXPECT_EQ(mat.albedo.channels, 4);
-  ASSERT_EQ(mat.albedo.pixel_data.size(), 4);
+  ASSERT_TRUE(mat.albedo.pixel_data);
+  const std::vector<uint8_t>& pixels = *mat.albedo.pixel_data;
+  ASSERT_EQ(pixels.size(), 4);
 
   // Verify color (0.8 * 255 = 204)
   // Verify color (0.8 linear -> ~0.906 sRGB -> 231)
-  EXPECT_NEAR(mat.albedo.pixel_data[0], 231, 1);
-  EXPECT_EQ(mat.albedo.pixel_data[1], 0);
-  EXPECT_EQ(mat.albedo.pixel_data[2], 0);
-  EXPECT_EQ(mat.albedo.pixel_data[3], 255);
+  EXPECT_NEAR(pixels[0], 231, 1);
+  EXPECT_EQ(pixels[1], 0);
+  EXPECT_EQ(pixels[2], 0);
+  EXPECT_EQ(pixels[3], 255);
 }
 
 // A glTF primitive with no material field is a pure occluder shell. The loader
@@ -104,4 +107,66 @@ TEST(LoaderTest, OccluderShellAccepted) {
   EXPECT_TRUE(scene->geometries[0].tangents.empty());
 }
 
+// Nodes referencing one mesh load its vertices once: the first becomes the
+// mesh, the others instances of it with their own transforms.
+TEST(LoaderTest, SharedMeshLoadsOnceAsInstances) {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "sh_loader_instances.gltf";
+  std::ofstream(path) << R"({
+  "asset": {"version": "2.0"},
+  "scenes": [{"nodes": [0, 1, 2]}],
+  "nodes": [
+    {"mesh": 0},
+    {"mesh": 0, "translation": [5, 0, 0]},
+    {"children": [3], "translation": [0, 2, 0]},
+    {"mesh": 0, "scale": [2, 2, 2]}
+  ],
+  "meshes": [{
+    "primitives": [{"attributes": {"POSITION": 0, "NORMAL": 1}, "indices": 2}]
+  }],
+  "accessors": [
+    {"bufferView": 0, "componentType": 5126, "count": 3, "type": "VEC3",
+     "max": [1.0, 1.0, 0.0], "min": [0.0, 0.0, 0.0]},
+    {"bufferView": 1, "componentType": 5126, "count": 3, "type": "VEC3"},
+    {"bufferView": 2, "componentType": 5123, "count": 3, "type": "SCALAR"}
+  ],
+  "bufferViews": [
+    {"buffer": 0, "byteOffset": 0,  "byteLength": 36},
+    {"buffer": 0, "byteOffset": 36, "byteLength": 36},
+    {"buffer": 0, "byteOffset": 72, "byteLength": 6}
+  ],
+  "buffers": [{
+    "byteLength": 78,
+    "uri": "data:application/octet-stream;base64,AAAAAAAAAAAAAAAAAACAPwAAAAAAAAAAAAAAAAAAgD8AAAAAAAAAAAAAAAAAAIA/AAAAAAAAAAAAAIA/AAAAAAAAAAAAAIA/AAABAAIA"
+  }]
+})";
+
+  std::optional<Scene> scene = LoadScene(path);
+  std::filesystem::remove(path);
+  ASSERT_TRUE(scene.has_value());
+  ASSERT_EQ(scene->geometries.size(), 3u);
+
+  const Geometry& mesh = scene->geometries[0];
+  EXPECT_EQ(mesh.instance_of, -1);
+  EXPECT_EQ(mesh.vertices.size(), 3u);
+  EXPECT_EQ(mesh.indices.size(), 3u);
+  for (int i = 1; i < 3; ++i) {
+    const Geometry& instance = scene->geometries[i];
+    EXPECT_EQ(instance.instance_of, 0);
+    EXPECT_EQ(instance.material_id, -1);
+    EXPECT_TRUE(instance.vertices.empty());
+    EXPECT_TRUE(instance.indices.empty());
+    EXPECT_EQ(&GeometryMesh(scene->geometries, instance), &mesh);
+  }
+  EXPECT_TRUE(scene->geometries[1].transform.translation().isApprox(
+      Eigen::Vector3f(5, 0, 0)));
+  EXPECT_TRUE(scene->geometries[2].transform.matrix().isApprox(
+      (Eigen::Translation3f(0, 2, 0) * Eigen::Scaling(2.0f)).matrix()));
+
+  // Bounds follow each instance's transform.
+  ComputeSceneBoundingBoxes(*scene);
+  EXPECT_EQ(scene->geometries[1].bounding_box.min, Eigen::Vector3f(5, 0, 0));
+  EXPECT_EQ(scene->geometries[2].bounding_box.max, Eigen::Vector3f(2, 4, 0));
+}
+
 }  // namespace sh_renderer
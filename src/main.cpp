@@ -1,9 +1,12 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <string>
 
+#include "compute_hiz.h"
 #include "compute_light_tile.h"
 #include "draw_depth.h"
 #include "draw_radiance.h"
@@ -11,11 +14,18 @@
 #include "draw_sky.h"
 #include "draw_ssao.h"
 #include "draw_tonemap.h"
+#include "frame_constants.h"
+#include "gpu_culling.h"
 #include "input.h"
 #include "interaction.h"
-#include "loader.h"
+#include "program_cache.h"
+#include "render_queue.h"
 #include "render_target.h"
 #include "scene.h"
+#include "scene_cache.h"
+#include "shader_hot_reload.h"
+#include "visibility.h"
+#include "vertex_format.h"
 #include "window.h"
 
 DEFINE_string(input, "", "Path to the glTF scene file to render.");
@@ -24,6 +34,74 @@ DEFINE_uint32(height, 720, "Height of the window.");
 DEFINE_uint32(msaa_samples, 0, "Number of MSAA samples.");
 DEFINE_uint32(log_frame_time_interval, 100,
               "Log average frame time every N frames.");
+DEFINE_uint32(image_decode_threads, 0,
+              "Number of threads used to decode scene images (0 = one per "
+              "core). Compare load times against --image_decode_threads=1.");
+DEFINE_string(vertex_format, "float",
+              "Vertex buffer layout: float (56 B), compact (28 B: packed "
+              "normals/tangents, half uvs) or quantized (24 B: compact with "
+              "unorm16 positions).");
+DEFINE_bool(scene_cache, true,
+            "Load the cooked scene from <input>.shcache when it matches the "
+            "glTF sources, and write it after a cold load.");
+DEFINE_uint32(cluster_max_triangles, 4096,
+              "Merge the partitioned pieces of a material into spatially "
+              "coherent draws of at most this many triangles (0 disables). "
+              "Tune with sh_renderer_cluster_benchmark; a PVS must be baked "
+              "with the same budget.");
+DEFINE_double(cluster_max_extent, 4.0,
+              "Longest bounding box edge of a merged draw, in meters.");
+DEFINE_string(shader_cache_dir, "shader_cache",
+              "Directory of the program binary cache, which lets warm starts "
+              "skip GLSL compilation. Empty disables the cache.");
+DEFINE_bool(shader_hot_reload, false,
+            "Rebuild shader programs whose files change on disk, swapping each "
+            "in once it has linked.");
+DEFINE_bool(multi_draw_indirect, true,
+            "Submit each material batch with one glMultiDrawElementsIndirect. "
+            "When false every geometry is its own draw call; compare the "
+            "logged draw calls per frame.");
+DEFINE_bool(instancing, true,
+            "Draw the instances of a shared glTF mesh in a batch with one "
+            "instanced command; GPU culling compacts each mesh's visible "
+            "instances into one command per level of detail. When false "
+            "each instance is its own command; compare the logged commands "
+            "per frame.");
+DEFINE_bool(occlusion_culling, true,
+            "Drop the geometries hidden behind the occluder shells and the "
+            "largest nearby opaque geometry, rasterized on the CPU each "
+            "frame. Compare the logged draws per frame. With --gpu_culling, "
+            "test the camera's geometries against the previous frame's "
+            "hierarchical Z pyramid instead.");
+DEFINE_bool(pvs_culling, true,
+            "Drop the geometries the camera's view cell cannot see, if a PVS "
+            "was baked next to the scene (sh_renderer_bake_pvs).");
+DEFINE_bool(gpu_culling, true,
+            "Cull every view in a compute pass and draw it with "
+            "glMultiDrawElementsIndirectCount, instead of culling on the CPU. "
+            "The camera view is tested against the PVS too, and against the "
+            "previous frame's hierarchical Z pyramid in place of the CPU "
+            "occlusion buffer.");
+DEFINE_double(lod_error_pixels, 1.0,
+              "Draw each geometry at the coarsest level of detail whose "
+              "simplification error projects to at most this many pixels, "
+              "or texels of the view's shadow map or atlas tile (0 draws "
+              "full detail). Compare the logged triangles per frame with "
+              "--nogpu_culling.");
+DEFINE_bool(meshlet_culling, true,
+            "Draw only the meshlets (built when cooking) of each geometry "
+            "that are in the view's frustum and face its eye. GPU culled "
+            "views cull them in the cull kernel, except for instanced "
+            "draws, and log no meshlet statistics; compare the logged "
+            "triangles per frame with --nogpu_culling.");
+DEFINE_bool(check_gpu_culling, false,
+            "Every log interval, read the GPU culled views back and log how "
+            "many draws differ from the CPU reference. Stalls the GPU; for "
+            "debugging.");
+DEFINE_bool(check_hiz, false,
+            "Every log interval, read the hierarchical Z pyramid and the depth "
+            "buffer back and log how many pyramid texels differ from a CPU "
+            "reduction of the depth. Stalls the GPU; for debugging.");
 
 namespace sh_renderer {
 
@@ -42,17 +120,35 @@ void Run(const std::filesystem::path& scene_path) {
       .orientation = Eigen::Quaternionf::Identity(),
   };
 
-  std::optional<Scene> scene = LoadScene(scene_path);
+  std::optional<VertexFormat> vertex_format =
+      ParseVertexFormat(FLAGS_vertex_format);
+  if (!vertex_format) {
+    LOG(ERROR) << "Unknown --vertex_format: " << FLAGS_vertex_format;
+    return;
+  }
+
+  const ClusterBudget cluster_budget = {
+      .max_triangles = FLAGS_cluster_max_triangles,
+      .max_extent = static_cast<float>(FLAGS_cluster_max_extent),
+  };
+  std::optional<Scene> scene =
+      LoadCookedScene(scene_path, FLAGS_image_decode_threads, FLAGS_scene_cache,
+                      cluster_budget);
   if (!scene) {
     LOG(ERROR) << "Failed to load scene: " << scene_path;
     return;
   }
-  PartitionLooseGeometries(*scene);
-  OptimizeScene(*scene);
-  ComputeSceneBoundingBoxes(*scene);
   LogScene(*scene);
-  UploadSceneToGPU(*scene);
-
+  UploadSceneToGPU(*scene, *vertex_format);
+  scene->geometry_arena.multi_draw_indirect = FLAGS_multi_draw_indirect;
+  scene->geometry_arena.instancing = FLAGS_instancing;
+
+  // Programs come from the binary cache when warm; the log line compares
+  // cold (compiled) and warm (cached) setup.
+  SetProgramCacheDirectory(FLAGS_shader_cache_dir);
+  const auto shader_setup_start = std::chrono::steady_clock::now();
+  // Submit every compile and link before collecting any status.
+  ShaderBatch shader_batch;
   ShaderProgram cascaded_shadow_map_opaque_program =
       CreateShadowMapOpaqueProgram();
   ShaderProgram cascaded_shadow_map_cutout_program =
@@ -65,20 +161,56 @@ void Run(const std::filesystem::path& scene_path) {
   ShaderProgram sky_program = CreateSkyAnalyticProgram();
   ShaderProgram tonemap_program = CreateTonemapProgram();
   ShaderProgram light_cull_program = CreateLightCullProgram();
+  ShaderProgram hiz_program = CreateHiZProgram();
+  ShaderProgram draw_cull_program = CreateDrawCullProgram();
   ShaderProgram ssao_program = CreateSSAOProgram();
   ShaderProgram ssao_blur_horizontal_program = CreateSSAOBlurProgram(true);
   ShaderProgram ssao_blur_vertical_program = CreateSSAOBlurProgram(false);
   ShaderProgram ssao_vis_program = CreateSSAOVisualizerProgram();
 
-  if (!cascaded_shadow_map_opaque_program ||
-      !cascaded_shadow_map_cutout_program || !depth_opaque_program ||
-      !depth_cutout_program || !depth_vis_program || !shadow_vis_program ||
-      !radiance_program || !sky_program || !tonemap_program ||
-      !light_cull_program || !ssao_program || !ssao_blur_horizontal_program ||
-      !ssao_blur_vertical_program || !ssao_vis_program) {
+  const std::initializer_list<ShaderProgram*> programs = {
+      &cascaded_shadow_map_opaque_program,
+      &cascaded_shadow_map_cutout_program,
+      &depth_opaque_program,
+      &depth_cutout_program,
+      &depth_vis_program,
+      &shadow_vis_program,
+      &radiance_program,
+      &sky_program,
+      &tonemap_program,
+      &light_cull_program,
+      &hiz_program,
+      &draw_cull_program,
+      &ssao_program,
+      &ssao_blur_horizontal_program,
+      &ssao_blur_vertical_program,
+      &ssao_vis_program};
+  if (!shader_batch.Finish(programs)) {
     LOG(ERROR) << "Failed to create shader programs.";
     return;
   }
+  glFinish();
+  {
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - shader_setup_start;
+    const ProgramCacheStats& stats = GetProgramCacheStats();
+    LOG(INFO) << "Shader setup: " << elapsed.count() << " ms ("
+              << (stats.compiles == 0 ? "warm" : "cold") << ": " << stats.hits
+              << " cached, " << stats.compiles << " compiled, "
+              << stats.rejected << " rejected binaries)";
+  }
+
+  ShaderHotReload shader_hot_reload;
+  if (FLAGS_shader_hot_reload) {
+    for (ShaderProgram* program : programs) shader_hot_reload.Watch(program);
+  }
+  // Per-frame uniforms, resolved again whenever a hot reload swaps programs.
+  RadianceUniforms radiance_uniforms =
+      ResolveRadianceUniforms(radiance_program);
+  SSAOUniforms ssao_uniforms = ResolveSSAOUniforms(ssao_program);
+  HiZUniforms hiz_uniforms = ResolveHiZUniforms(hiz_program);
+  DrawCullUniforms draw_cull_uniforms =
+      ResolveDrawCullUniforms(draw_cull_program);
 
   // Initial Render Targets
   int initial_width, initial_height;
@@ -99,6 +231,10 @@ void Run(const std::filesystem::path& scene_path) {
       CreateShadowAtlasTarget(scene->shadow_atlas.resolution);
   TileLightListList tile_light_list =
       CreateTileLightList(initial_width, initial_height);
+  HiZPyramid hiz = CreateHiZPyramid(initial_width, initial_height);
+  GpuCulling gpu_culling;
+  if (FLAGS_gpu_culling) gpu_culling = CreateGpuCulling(*scene);
+  size_t gpu_culling_mismatches = 0;
 
   SSAOContext ssao_ctx = CreateSSAOContext();
   RenderTarget ssao_target = CreateSSAOTarget(initial_width, initial_height);
@@ -106,6 +242,18 @@ void Run(const std::filesystem::path& scene_path) {
   RenderTarget ssao_blur_target =
       CreateSSAOTarget(initial_width, initial_height);
 
+  FrameConstantsRing frame_constants_ring = CreateFrameConstantsRing();
+  FrameVisibility visibility;
+  visibility.occlusion_culling = FLAGS_occlusion_culling;
+  visibility.pvs_culling = FLAGS_pvs_culling;
+  visibility.lod_error_pixels = static_cast<float>(FLAGS_lod_error_pixels);
+  visibility.meshlet_culling = FLAGS_meshlet_culling;
+
+  SunLight default_sun;
+  default_sun.direction = Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized();
+  default_sun.color = Eigen::Vector3f(1.0f, 1.0f, 1.0f);
+  default_sun.intensity = 1.0f;
+
   InputState input_state;
   InteractionState interaction_state;
   bool should_close = false;
@@ -114,6 +262,13 @@ void Run(const std::filesystem::path& scene_path) {
   double last_time = glfwGetTime();
 
   while (!glfwWindowShouldClose(*window) && !should_close) {
+    if (FLAGS_shader_hot_reload && shader_hot_reload.Poll() > 0) {
+      radiance_uniforms = ResolveRadianceUniforms(radiance_program);
+      ssao_uniforms = ResolveSSAOUniforms(ssao_program);
+      hiz_uniforms = ResolveHiZUniforms(hiz_program);
+      draw_cull_uniforms = ResolveDrawCullUniforms(draw_cull_program);
+    }
+
     // Process all queued input events.
     std::vector<InputEvent> events = PollInputEvents(*window, &input_state);
     for (const auto& event : events) {
@@ -156,14 +311,42 @@ void Run(const std::filesystem::path& scene_path) {
 
     glViewport(0, 0, fb_width, fb_height);
 
+    // Camera, sun and clock for every pass, bound once for the frame.
+    const float time = static_cast<float>(glfwGetTime());
+    SunLight active_sun = scene->sun_light.value_or(default_sun);
+    BeginFrame(ComputeFrameConstants(camera, active_sun, fb_width, fb_height,
+                                     time),
+               &frame_constants_ring);
+
     // Enable depth testing.
     glEnable(GL_DEPTH_TEST);
 
-    // 0. Update dynamic light data and render shadow atlas
+    // 0. Update dynamic light data, cull every view and render shadow atlas
     AllocateShadowMapForLights(*scene, camera);
     UploadLightsToGPU(*scene);
+    UploadDrawRecords(scene->geometries, scene->geometry_arena);
+
+    std::vector<Cascade> sun_cascades;
+    if (scene->sun_light) {
+      sun_cascades = ComputeCascades(*(scene->sun_light), camera);
+    }
+    visibility.viewport_width = fb_width;
+    visibility.viewport_height = fb_height;
+    if (FLAGS_gpu_culling) {
+      CullFrameOnGpu(*scene, camera, sun_cascades, draw_cull_program,
+                     draw_cull_uniforms, hiz, FLAGS_occlusion_culling,
+                     &gpu_culling, &visibility);
+      // Checked before the pyramid is rebuilt for this frame.
+      if (FLAGS_check_gpu_culling &&
+          (frame_count + 1) % FLAGS_log_frame_time_interval == 0) {
+        gpu_culling_mismatches = CheckGpuCulling(gpu_culling, hiz);
+      }
+    } else {
+      ComputeFrameVisibility(*scene, camera, sun_cascades, &visibility);
+    }
 
-    DrawShadowAtlas(*scene, cascaded_shadow_map_opaque_program,
+    DrawShadowAtlas(*scene, visibility.spot_lights,
+                    cascaded_shadow_map_opaque_program,
                     cascaded_shadow_map_cutout_program, spot_shadow_atlas);
 
     // 1. Depth Pre-pass
@@ -172,44 +355,41 @@ void Run(const std::filesystem::path& scene_path) {
     glClear(GL_DEPTH_BUFFER_BIT);  // Clear depth only
     glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-    std::vector<Cascade> sun_cascades;
-    if (scene->sun_light) {
-      sun_cascades = ComputeCascades(*(scene->sun_light), camera);
-    }
-    DrawCascadedShadowMap(*scene, camera, cascaded_shadow_map_opaque_program,
+    DrawCascadedShadowMap(*scene, visibility.cascades,
+                          cascaded_shadow_map_opaque_program,
                           cascaded_shadow_map_cutout_program, sun_cascades,
                           sun_shadow_map_targets);
 
-    DrawDepthWNormal(*scene, camera, depth_opaque_program, depth_cutout_program,
-                     depth_normal_target);
+    DrawDepthWNormal(*scene, visibility.camera, depth_opaque_program,
+                     depth_cutout_program, depth_normal_target);
+
+    // 1.1 Hierarchical Z pyramid of the pre-pass depth
+    ComputeHiZPyramid(depth_normal_target, hiz_program, hiz_uniforms,
+                      GetViewProjMatrix(camera), &hiz);
 
     // 1.2 SSAO Pass
-    DrawSSAO(depth_normal_target, camera, ssao_program, ssao_ctx, ssao_target);
-    DrawSSAOBlur(ssao_target, camera, ssao_blur_horizontal_program,
+    DrawSSAO(depth_normal_target, ssao_program, ssao_uniforms, ssao_ctx,
+             ssao_target);
+    DrawSSAOBlur(ssao_target, ssao_blur_horizontal_program,
                  ssao_blur_vertical_program, depth_normal_target,
                  ssao_blur_temp, ssao_blur_target);
 
     // 1.5. Compute Light Culling (Forward+)
-    ComputeTileLightList(camera, hdr_target, *scene, light_cull_program,
+    ComputeTileLightList(hdr_target, *scene, light_cull_program, hiz,
                          &tile_light_list);
 
     // 2. Radiance Pass (Forward PBR)
     // DrawRadiance will handle clearing color, setting LEQUAL, etc.
-    DrawSceneRadiance(*scene, camera, sun_shadow_map_targets, sun_cascades,
-                      spot_shadow_atlas, tile_light_list, ssao_blur_target,
-                      radiance_program, hdr_target,
-                      static_cast<float>(glfwGetTime()));
-
-    SunLight default_sun;
-    default_sun.direction = Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized();
-    default_sun.color = Eigen::Vector3f(1.0f, 1.0f, 1.0f);
-    default_sun.intensity = 1.0f;
-    SunLight active_sun = scene->sun_light.value_or(default_sun);
+    DrawSceneRadiance(*scene, visibility.camera, sun_shadow_map_targets,
+                      sun_cascades, spot_shadow_atlas, tile_light_list,
+                      ssao_blur_target, radiance_program, radiance_uniforms,
+                      hdr_target, time);
 
-    DrawSkyAnalytic(*scene, camera, active_sun, hdr_target, sky_program);
+    DrawSkyAnalytic(hdr_target, sky_program);
 
     // 3. Tonemapping (to default framebuffer)
     DrawTonemap(hdr_target, tonemap_program);
+    EndFrame(&frame_constants_ring);
 
     glfwSwapBuffers(*window);
 
@@ -221,10 +401,112 @@ void Run(const std::filesystem::path& scene_path) {
       LOG(INFO) << "Average frame time over last "
                 << FLAGS_log_frame_time_interval
                 << " frames: " << average_time_ms << " ms";
+      if (FLAGS_check_hiz) {
+        LOG(INFO) << "Hierarchical Z check: "
+                  << CheckHiZPyramid(depth_normal_target, hiz)
+                  << " texels differ from the CPU reduction";
+      }
+      DrawCallStats& draw_stats = GetDrawCallStats();
+      LOG(INFO) << "Draw calls per frame: "
+                << draw_stats.draw_calls / FLAGS_log_frame_time_interval
+                << " with "
+                << draw_stats.commands / FLAGS_log_frame_time_interval
+                << " commands for "
+                << draw_stats.draws / FLAGS_log_frame_time_interval
+                << " geometry draws of "
+                << draw_stats.triangles / FLAGS_log_frame_time_interval
+                << " triangles";
+      draw_stats = {};
+      VisibilityStats& visibility_stats = GetVisibilityStats();
+      if (FLAGS_gpu_culling) {
+        LOG(INFO) << "Visibility: "
+                  << visibility_stats.cpu_ms / visibility_stats.frames
+                  << " ms CPU per frame to cull "
+                  << visibility_stats.views / visibility_stats.frames
+                  << " views on the GPU; depth pre-pass candidates "
+                  << visibility_stats.depth_candidates /
+                         visibility_stats.frames;
+        if (FLAGS_check_gpu_culling) {
+          LOG(INFO) << "GPU culling check: " << gpu_culling_mismatches
+                    << " draws differ from the CPU reference";
+        }
+      } else {
+        LOG(INFO) << "Visibility: "
+                  << visibility_stats.cpu_ms / visibility_stats.frames
+                  << " ms CPU per frame for "
+                  << visibility_stats.views / visibility_stats.frames
+                  << " views; depth pre-pass draws "
+                  << visibility_stats.depth_draws / visibility_stats.frames
+                  << " of "
+                  << visibility_stats.depth_candidates /
+                         visibility_stats.frames
+                  << " geometries";
+      }
+      if (FLAGS_occlusion_culling && visibility_stats.occlusion_tested > 0) {
+        LOG(INFO) << "Occlusion culling: "
+                  << 100.0 * visibility_stats.occlusion_culled /
+                         visibility_stats.occlusion_tested
+                  << "% of the geometries in the frustum culled, "
+                  << visibility_stats.occlusion_ms / visibility_stats.frames
+                  << " ms CPU per frame for "
+                  << visibility_stats.occluders / visibility_stats.frames
+                  << " occluders ("
+                  << visibility_stats.occluder_triangles /
+                         visibility_stats.frames
+                  << " triangles)";
+      }
+      if (FLAGS_pvs_culling && visibility_stats.pvs_tested > 0) {
+        LOG(INFO) << "PVS culling: "
+                  << 100.0 * visibility_stats.pvs_culled /
+                         visibility_stats.pvs_tested
+                  << "% of the geometries in the frustum culled";
+      }
+      visibility_stats = {};
+      for (int pass = 0; pass < kNumRenderPasses; ++pass) {
+        RenderQueueStats& queue_stats =
+            GetRenderQueueStats(static_cast<RenderPass>(pass));
+        LOG(INFO) << "Render queue, "
+                  << RenderPassName(static_cast<RenderPass>(pass)) << ": "
+                  << queue_stats.items / FLAGS_log_frame_time_interval
+                  << " items in "
+                  << queue_stats.runs / FLAGS_log_frame_time_interval
+                  << " batches per frame; state changes: "
+                  << queue_stats.program_changes /
+                         FLAGS_log_frame_time_interval
+                  << " program, "
+                  << queue_stats.cull_mode_changes /
+                         FLAGS_log_frame_time_interval
+                  << " cull mode, "
+                  << queue_stats.layer_set_changes /
+                         FLAGS_log_frame_time_interval
+                  << " layer set, "
+                  << queue_stats.material_changes /
+                         FLAGS_log_frame_time_interval
+                  << " material";
+        const MeshletCullStats& meshlet_stats = queue_stats.meshlets;
+        if (meshlet_stats.triangles > 0) {
+          const uint64_t in_frustum = meshlet_stats.triangles -
+                                      meshlet_stats.frustum_culled_triangles;
+          LOG(INFO) << "Meshlet culling, "
+                    << RenderPassName(static_cast<RenderPass>(pass)) << ": "
+                    << meshlet_stats.triangles / FLAGS_log_frame_time_interval
+                    << " triangles per frame tested, "
+                    << 100.0 * meshlet_stats.frustum_culled_triangles /
+                           meshlet_stats.triangles
+                    << "% outside the frustum, "
+                    << 100.0 * meshlet_stats.cone_culled_triangles /
+                           std::max<uint64_t>(in_frustum, 1)
+                    << "% of the rest facing away";
+        }
+        queue_stats = {};
+      }
       last_time = current_time;
     }
   }
 
+  DestroyFrameConstantsRing(&frame_constants_ring);
+  DestroyHiZPyramid(&hiz);
+  DestroyGpuCulling(&gpu_culling);
   DestroyWindow(*window);
 
   // Cleanup
@@ -0,0 +1,871 @@
+#include "mesh_optimizer.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+#include "scene.h"
+
+namespace sh_renderer {
+
+namespace {
+
+// A FIFO post-transform cache: a vertex is in it while fewer than
+// kVertexCacheSize misses happened since its own.
+class VertexCache {
+ public:
+  explicit VertexCache(size_t vertex_count) : miss_time_(vertex_count, 0) {}
+
+  // Returns whether `v` missed, and caches it if so.
+  bool Access(uint32_t v) {
+    if (miss_time_[v] != 0 && misses_ - miss_time_[v] < kVertexCacheSize) {
+      return false;
+    }
+    miss_time_[v] = ++misses_;
+    return true;
+  }
+
+  // Empties the cache in constant time.
+  void Flush() { misses_ += kVertexCacheSize; }
+
+ private:
+  std::vector<uint64_t> miss_time_;  // 0 until the first miss
+  uint64_t misses_ = 0;
+};
+
+// The triangles using each vertex: triangles[first[v]..first[v + 1]).
+struct VertexTriangles {
+  std::vector<uint32_t> first;
+  std::vector<uint32_t> triangles;
+};
+
+VertexTriangles BuildVertexTriangles(std::span<const uint32_t> indices,
+                                     size_t vertex_count) {
+  VertexTriangles adjacency;
+  adjacency.first.assign(vertex_count + 1, 0);
+  for (uint32_t v : indices) ++adjacency.first[v + 1];
+  std::partial_sum(adjacency.first.begin(), adjacency.first.end(),
+                   adjacency.first.begin());
+  adjacency.triangles.resize(indices.size());
+  std::vector<uint32_t> fill(adjacency.first.begin(),
+                             adjacency.first.end() - 1);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    adjacency.triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+  return adjacency;
+}
+
+// The weighted sum of the squared distances to a set of planes: each plane
+// (n, d) of weight w adds w (n, d)(n, d)^T, and a point p costs
+// (p, 1)^T Q (p, 1). Evaluate divides by the total weight, so a cost is a
+// mean squared distance whatever the number of planes.
+struct Quadric {
+  Eigen::Matrix4d q = Eigen::Matrix4d::Zero();
+  double weight = 0.0;
+
+  void AddPlane(const Eigen::Vector4d& plane, double plane_weight) {
+    q += plane_weight * plane * plane.transpose();
+    weight += plane_weight;
+  }
+  double Evaluate(const Eigen::Vector3f& p) const {
+    if (weight == 0.0) return 0.0;
+    const Eigen::Vector4d h(p.x(), p.y(), p.z(), 1.0);
+    return std::max(h.dot(q * h), 0.0) / weight;
+  }
+  Quadric& operator+=(const Quadric& other) {
+    q += other.q;
+    weight += other.weight;
+    return *this;
+  }
+};
+
+// How SimplifyMesh sees a geometry's vertices: each vertex's representative
+// among the vertices equal to it in every attribute, its representative
+// among those at its position, and whether it must stay where it is.
+struct SimplifyVertices {
+  std::vector<uint32_t> canonical;
+  std::vector<uint32_t> position;
+  std::vector<bool> locked;
+};
+
+bool SameAttributes(const Geometry& geometry, uint32_t a, uint32_t b) {
+  const size_t vertex_count = geometry.vertices.size();
+  auto same = [&](const auto& stream) {
+    return stream.size() != vertex_count || stream[a] == stream[b];
+  };
+  return same(geometry.normals) && same(geometry.texture_uvs) &&
+         same(geometry.lightmap_uvs) && same(geometry.tangents);
+}
+
+// Locks the positions where the attributes split (seams) and the ends of the
+// edges that do not join exactly two triangles (borders, non-manifold edges).
+SimplifyVertices ClassifyVertices(const Geometry& geometry) {
+  const size_t vertex_count = geometry.vertices.size();
+  SimplifyVertices out;
+  out.canonical.resize(vertex_count);
+  out.position.resize(vertex_count);
+  std::vector<bool> locked_position(vertex_count, false);
+
+  auto key = [&](uint32_t v) {
+    const Eigen::Vector3f& p = geometry.vertices[v];
+    return std::array<float, 3>{p.x(), p.y(), p.z()};
+  };
+  std::vector<uint32_t> order(vertex_count);
+  std::iota(order.begin(), order.end(), 0u);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    const auto key_a = key(a);
+    const auto key_b = key(b);
+    return key_a < key_b || (key_a == key_b && a < b);
+  });
+  for (size_t begin = 0; begin < vertex_count;) {
+    const uint32_t first = order[begin];
+    size_t end = begin + 1;
+    while (end < vertex_count && key(order[end]) == key(first)) ++end;
+    bool seam = false;
+    for (size_t i = begin; i < end; ++i) {
+      const uint32_t v = order[i];
+      out.position[v] = first;
+      out.canonical[v] = v;
+      for (size_t j = begin; j < i; ++j) {
+        if (SameAttributes(geometry, order[j], v)) {
+          out.canonical[v] = out.canonical[order[j]];
+          break;
+        }
+      }
+      seam = seam || out.canonical[v] != first;
+    }
+    locked_position[first] = seam;
+    begin = end;
+  }
+
+  std::unordered_map<uint64_t, uint32_t> edge_uses;
+  const std::vector<uint32_t>& indices = geometry.indices;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    for (int k = 0; k < 3; ++k) {
+      const uint32_t a = out.position[indices[i + k]];
+      const uint32_t b = out.position[indices[i + (k + 1) % 3]];
+      if (a == b) continue;
+      ++edge_uses[uint64_t{std::min(a, b)} << 32 | std::max(a, b)];
+    }
+  }
+  for (const auto& [edge, uses] : edge_uses) {
+    if (uses == 2) continue;
+    locked_position[edge >> 32] = true;
+    locked_position[edge & 0xFFFFFFFF] = true;
+  }
+
+  out.locked.resize(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v) {
+    out.locked[v] = locked_position[out.position[v]];
+  }
+  return out;
+}
+
+// Smallest cosine between a triangle's normals before and after a collapse.
+constexpr float kMinCollapseNormalCosine = 0.25f;
+
+// Whether moving `vertex` onto `target` turns over, or turns too far, one of
+// the triangles around `vertex` that survive the collapse.
+bool CollapseFlips(std::span<const uint32_t> indices,
+                   const VertexTriangles& adjacency,
+                   std::span<const Eigen::Vector3f> positions, uint32_t vertex,
+                   uint32_t target) {
+  for (uint32_t k = adjacency.first[vertex]; k < adjacency.first[vertex + 1];
+       ++k) {
+    const uint32_t* triangle = &indices[3 * adjacency.triangles[k]];
+    if (triangle[0] == target || triangle[1] == target ||
+        triangle[2] == target) {
+      continue;
+    }
+    std::array<Eigen::Vector3f, 3> before;
+    std::array<Eigen::Vector3f, 3> after;
+    for (int c = 0; c < 3; ++c) {
+      before[c] = positions[triangle[c]];
+      after[c] = triangle[c] == vertex ? positions[target] : before[c];
+    }
+    const Eigen::Vector3f n0 =
+        (before[1] - before[0]).cross(before[2] - before[0]);
+    const Eigen::Vector3f n1 =
+        (after[1] - after[0]).cross(after[2] - after[0]);
+    if (n0.squaredNorm() == 0.0f) continue;
+    if (!(n0.dot(n1) > kMinCollapseNormalCosine * n0.norm() * n1.norm())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The order OptimizeOverdraw draws the pieces of `indices` in, each piece
+// the triangles from pieces[p] to pieces[p + 1]: outward facing first.
+std::vector<uint32_t> FacingOrder(std::span<const uint32_t> indices,
+                                  std::span<const Eigen::Vector3f> positions,
+                                  std::span<const uint32_t> pieces) {
+  // Each piece's area-weighted centroid and normal, and the mesh's centroid.
+  const size_t num_pieces = pieces.size() - 1;
+  std::vector<Eigen::Vector3f> centroids(num_pieces);
+  std::vector<Eigen::Vector3f> normals(num_pieces);
+  Eigen::Vector3f mesh_centroid = Eigen::Vector3f::Zero();
+  float mesh_area = 0.0f;
+  for (size_t p = 0; p < num_pieces; ++p) {
+    Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+    float area = 0.0f;
+    for (uint32_t t = pieces[p]; t < pieces[p + 1]; ++t) {
+      const Eigen::Vector3f& a = positions[indices[3 * t]];
+      const Eigen::Vector3f& b = positions[indices[3 * t + 1]];
+      const Eigen::Vector3f& c = positions[indices[3 * t + 2]];
+      const Eigen::Vector3f cross = (b - a).cross(c - a);
+      const float weight = cross.norm();
+      centroid += weight * (a + b + c) / 3.0f;
+      normal += cross;
+      area += weight;
+    }
+    mesh_centroid += centroid;
+    mesh_area += area;
+    centroids[p] = area > 0.0f ? Eigen::Vector3f(centroid / area)
+                               : positions[indices[3 * pieces[p]]];
+    normals[p] = normal.normalized();
+  }
+  if (mesh_area > 0.0f) mesh_centroid /= mesh_area;
+
+  // Outward facing pieces first: they occlude the ones behind them from most
+  // directions.
+  std::vector<float> facing(num_pieces);
+  for (size_t p = 0; p < num_pieces; ++p) {
+    facing[p] = (centroids[p] - mesh_centroid).dot(normals[p]);
+  }
+  std::vector<uint32_t> order(num_pieces);
+  std::iota(order.begin(), order.end(), 0u);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return facing[a] > facing[b];
+  });
+  return order;
+}
+
+// The triangles after the first unemitted one, in index order, among which
+// BuildMeshlets looks for the nearest when a meshlet has no adjacent triangle
+// left to grow by.
+constexpr size_t kMeshletSearchWindow = 64;
+
+}  // namespace
+
+VertexCacheStats AnalyzeVertexCache(std::span<const uint32_t> indices,
+                                    size_t vertex_count) {
+  VertexCacheStats stats;
+  stats.triangles = indices.size() / 3;
+  VertexCache cache(vertex_count);
+  std::vector<bool> used(vertex_count, false);
+  for (uint32_t v : indices) {
+    DCHECK_LT(v, vertex_count);
+    if (cache.Access(v)) ++stats.transforms;
+    if (!used[v]) {
+      used[v] = true;
+      ++stats.vertices;
+    }
+  }
+  return stats;
+}
+
+std::vector<uint32_t> OptimizeVertexCache(std::span<uint32_t> indices,
+                                          size_t vertex_count) {
+  const size_t num_triangles = indices.size() / 3;
+  std::vector<uint32_t> clusters;
+  if (num_triangles == 0) return clusters;
+
+  const VertexTriangles adjacency = BuildVertexTriangles(indices, vertex_count);
+  // Triangles not yet emitted per vertex, and the time each vertex entered the
+  // simulated cache (the cache holds those within kVertexCacheSize of `time`).
+  std::vector<uint32_t> live(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v) {
+    live[v] = adjacency.first[v + 1] - adjacency.first[v];
+  }
+  std::vector<int64_t> cache_time(vertex_count, 0);
+  int64_t time = kVertexCacheSize + 1;
+  std::vector<bool> emitted(num_triangles, false);
+  std::vector<uint32_t> dead_ends;  // vertices of emitted triangles, a stack
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+  size_t cursor = 0;  // where the search for a fresh vertex continues
+
+  // Continues with a vertex that still has triangles when the fan's
+  // neighbours offer none: the most recent dead end, or else the next vertex
+  // in input order. Either starts a cluster.
+  auto skip_dead_end = [&]() -> int64_t {
+    while (!dead_ends.empty()) {
+      const uint32_t v = dead_ends.back();
+      dead_ends.pop_back();
+      if (live[v] > 0) return v;
+    }
+    for (; cursor < vertex_count; ++cursor) {
+      if (live[cursor] > 0) return static_cast<int64_t>(cursor);
+    }
+    return -1;
+  };
+
+  int64_t fan = skip_dead_end();
+  while (fan >= 0) {
+    clusters.push_back(static_cast<uint32_t>(output.size() / 3));
+    // Fan around `fan` for as long as the next vertex stays in the cache.
+    while (fan >= 0) {
+      candidates.clear();
+      for (uint32_t k = adjacency.first[fan]; k < adjacency.first[fan + 1];
+           ++k) {
+        const uint32_t t = adjacency.triangles[k];
+        if (emitted[t]) continue;
+        emitted[t] = true;
+        for (int c = 0; c < 3; ++c) {
+          const uint32_t v = indices[3 * t + c];
+          output.push_back(v);
+          dead_ends.push_back(v);
+          candidates.push_back(v);
+          --live[v];
+          if (time - cache_time[v] > kVertexCacheSize) cache_time[v] = time++;
+        }
+      }
+
+      // The candidate that will still be in the cache after its remaining
+      // triangles are emitted, and has been in it longest.
+      int64_t next = -1;
+      int64_t best_priority = -1;
+      for (uint32_t v : candidates) {
+        if (live[v] == 0) continue;
+        int64_t priority = 0;
+        if (time - cache_time[v] + 2 * live[v] <= kVertexCacheSize) {
+          priority = time - cache_time[v];
+        }
+        if (priority > best_priority) {
+          best_priority = priority;
+          next = v;
+        }
+      }
+      if (next < 0) break;
+      fan = next;
+    }
+    fan = skip_dead_end();
+  }
+  DCHECK_EQ(output.size(), indices.size());
+  std::copy(output.begin(), output.end(), indices.begin());
+  return clusters;
+}
+
+void OptimizeOverdraw(std::span<uint32_t> indices,
+                      std::span<const Eigen::Vector3f> positions,
+                      std::span<const uint32_t> clusters, float threshold) {
+  const auto num_triangles = static_cast<uint32_t>(indices.size() / 3);
+  if (num_triangles == 0) return;
+
+  // Split each cluster where the triangles so far, from a cold cache, miss
+  // about as rarely as the whole cluster does.
+  std::vector<uint32_t> pieces;
+  VertexCache cache(positions.size());
+  for (size_t c = 0; c < clusters.size(); ++c) {
+    const uint32_t begin = clusters[c];
+    const uint32_t end = c + 1 < clusters.size() ? clusters[c + 1]
+                                                 : num_triangles;
+    cache.Flush();
+    size_t cluster_misses = 0;
+    for (uint32_t i = 3 * begin; i < 3 * end; ++i) {
+      cluster_misses += cache.Access(indices[i]);
+    }
+    const double limit =
+        threshold * static_cast<double>(cluster_misses) / (end - begin);
+
+    pieces.push_back(begin);
+    cache.Flush();
+    size_t misses = 0;
+    for (uint32_t t = begin; t < end; ++t) {
+      for (int k = 0; k < 3; ++k) misses += cache.Access(indices[3 * t + k]);
+      const uint32_t size = t + 1 - pieces.back();
+      if (t + 1 < end && static_cast<double>(misses) / size <= limit) {
+        pieces.push_back(t + 1);
+        cache.Flush();
+        misses = 0;
+      }
+    }
+  }
+  pieces.push_back(num_triangles);
+
+  const std::vector<uint32_t> order = FacingOrder(indices, positions, pieces);
+  std::vector<uint32_t> sorted;
+  sorted.reserve(indices.size());
+  for (uint32_t p : order) {
+    sorted.insert(sorted.end(), indices.begin() + 3 * pieces[p],
+                  indices.begin() + 3 * pieces[p + 1]);
+  }
+  std::copy(sorted.begin(), sorted.end(), indices.begin());
+}
+
+void OptimizeVertexFetch(Geometry* geometry) {
+  const size_t vertex_count = geometry->vertices.size();
+  constexpr uint32_t kUnused = UINT32_MAX;
+  std::vector<uint32_t> remap(vertex_count, kUnused);
+  uint32_t next = 0;
+  for (uint32_t& v : geometry->indices) {
+    if (remap[v] == kUnused) remap[v] = next++;
+    v = remap[v];
+  }
+  for (uint32_t& r : remap) {
+    if (r == kUnused) r = next++;
+  }
+
+  auto permute = [&](auto& stream) {
+    if (stream.size() != vertex_count) return;
+    auto reordered = stream;
+    for (size_t v = 0; v < vertex_count; ++v) reordered[remap[v]] = stream[v];
+    stream = std::move(reordered);
+  };
+  permute(geometry->vertices);
+  permute(geometry->normals);
+  permute(geometry->texture_uvs);
+  permute(geometry->lightmap_uvs);
+  permute(geometry->tangents);
+}
+
+std::vector<uint32_t> SimplifyMesh(const Geometry& geometry,
+                                   size_t target_index_count, float* error) {
+  *error = 0.0f;
+  const size_t vertex_count = geometry.vertices.size();
+  const std::span<const Eigen::Vector3f> positions = geometry.vertices;
+  const SimplifyVertices vertices = ClassifyVertices(geometry);
+
+  // The triangles over the representative vertices, less the degenerate ones,
+  // and the quadric of each vertex's triangle planes, weighted by area.
+  std::vector<uint32_t> indices;
+  indices.reserve(geometry.indices.size());
+  std::vector<Quadric> quadrics(vertex_count);
+  for (size_t i = 0; i + 2 < geometry.indices.size(); i += 3) {
+    const uint32_t a = vertices.canonical[geometry.indices[i]];
+    const uint32_t b = vertices.canonical[geometry.indices[i + 1]];
+    const uint32_t c = vertices.canonical[geometry.indices[i + 2]];
+    if (a == b || b == c || a == c) continue;
+    indices.insert(indices.end(), {a, b, c});
+    const Eigen::Vector3d p0 = positions[a].cast<double>();
+    Eigen::Vector3d normal =
+        (positions[b].cast<double>() - p0).cross(positions[c].cast<double>() -
+                                                 p0);
+    const double area = 0.5 * normal.norm();
+    if (area == 0.0) continue;
+    normal.normalize();
+    const Eigen::Vector4d plane(normal.x(), normal.y(), normal.z(),
+                                -normal.dot(p0));
+    for (uint32_t v : {a, b, c}) quadrics[v].AddPlane(plane, area);
+  }
+
+  // Passes of independent collapses, cheapest first. A collapsed vertex's
+  // triangles sit out the rest of its pass, so the flip test of every collapse
+  // sees the triangles it changes as they are.
+  struct Collapse {
+    double cost;
+    uint32_t vertex;
+    uint32_t target;
+  };
+  std::vector<Collapse> candidates;
+  std::vector<uint32_t> collapse(vertex_count);
+  std::vector<bool> touched;
+  double max_cost = 0.0;
+  while (indices.size() > target_index_count) {
+    const VertexTriangles adjacency =
+        BuildVertexTriangles(indices, vertex_count);
+    candidates.clear();
+    for (uint32_t v = 0; v < vertex_count; ++v) {
+      if (vertices.locked[v]) continue;
+      Collapse best = {std::numeric_limits<double>::infinity(), v, v};
+      for (uint32_t k = adjacency.first[v]; k < adjacency.first[v + 1]; ++k) {
+        for (int c = 0; c < 3; ++c) {
+          const uint32_t target = indices[3 * adjacency.triangles[k] + c];
+          if (target == v) continue;
+          Quadric combined = quadrics[v];
+          combined += quadrics[target];
+          const double cost = combined.Evaluate(positions[target]);
+          if (cost < best.cost) best = {cost, v, target};
+        }
+      }
+      if (best.target != v) candidates.push_back(best);
+    }
+    if (candidates.empty()) break;
+    std::stable_sort(
+        candidates.begin(), candidates.end(),
+        [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+    // An interior collapse removes the two triangles of its edge.
+    const size_t wanted = (indices.size() - target_index_count) / 6 + 1;
+    std::iota(collapse.begin(), collapse.end(), 0u);
+    touched.assign(vertex_count, false);
+    size_t applied = 0;
+    for (const Collapse& candidate : candidates) {
+      if (applied == wanted) break;
+      if (touched[candidate.vertex] || touched[candidate.target]) continue;
+      if (CollapseFlips(indices, adjacency, positions, candidate.vertex,
+                        candidate.target)) {
+        continue;
+      }
+      collapse[candidate.vertex] = candidate.target;
+      quadrics[candidate.target] += quadrics[candidate.vertex];
+      for (uint32_t k = adjacency.first[candidate.vertex];
+           k < adjacency.first[candidate.vertex + 1]; ++k) {
+        for (int c = 0; c < 3; ++c) {
+          touched[indices[3 * adjacency.triangles[k] + c]] = true;
+        }
+      }
+      max_cost = std::max(max_cost, candidate.cost);
+      ++applied;
+    }
+    if (applied == 0) break;
+
+    size_t size = 0;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      const uint32_t a = collapse[indices[i]];
+      const uint32_t b = collapse[indices[i + 1]];
+      const uint32_t c = collapse[indices[i + 2]];
+      if (a == b || b == c || a == c) continue;
+      indices[size++] = a;
+      indices[size++] = b;
+      indices[size++] = c;
+    }
+    indices.resize(size);
+  }
+  *error = static_cast<float>(std::sqrt(max_cost));
+  return indices;
+}
+
+std::vector<GeometryLod> BuildLodChain(const Geometry& geometry,
+                                       const LodOptions& options) {
+  std::vector<GeometryLod> lods;
+  size_t triangles = geometry.indices.size() / 3;
+  if (geometry.instance_of >= 0 || triangles < options.min_triangles) {
+    return lods;
+  }
+  float error = 0.0f;
+  while (lods.size() < static_cast<size_t>(options.max_lods)) {
+    const auto target = static_cast<size_t>(triangles * options.reduction);
+    if (target < options.min_triangles) break;
+    GeometryLod lod;
+    lod.indices = SimplifyMesh(geometry, 3 * target, &lod.error);
+    const size_t kept = lod.indices.size() / 3;
+    if (kept == 0 || kept > options.max_kept * triangles) break;
+    // Each level is simplified from full detail; keep the errors ordered.
+    error = std::max(error, lod.error);
+    lod.error = error;
+    OptimizeVertexCache(lod.indices, geometry.vertices.size());
+    lods.push_back(std::move(lod));
+    triangles = kept;
+  }
+  return lods;
+}
+
+float MinClipW(const Eigen::Matrix4f& view_proj, const AABB& box) {
+  const Eigen::RowVector4f w = view_proj.row(3);
+  float min_w = w[3];
+  for (int c = 0; c < 3; ++c) {
+    min_w += std::min(w[c] * box.min[c], w[c] * box.max[c]);
+  }
+  return min_w;
+}
+
+float LodScale(const Eigen::Matrix4f& view_proj, uint32_t width,
+               uint32_t height, float error_pixels) {
+  if (!(error_pixels > 0.0f)) return 0.0f;
+  // Pixels per unit of world-space length at w 1, across and along the view.
+  const float x = 0.5f * width * view_proj.row(0).head<3>().norm();
+  const float y = 0.5f * height * view_proj.row(1).head<3>().norm();
+  return std::max(x, y) / error_pixels;
+}
+
+uint32_t SelectLod(const Geometry& geometry, const Eigen::Matrix4f& view_proj,
+                   float lod_scale) {
+  if (!(lod_scale > 0.0f) || geometry.lods.empty()) return 0;
+  // Boxes reaching behind the eye are close enough for full detail.
+  const float w = MinClipW(view_proj, geometry.bounding_box);
+  if (!(w > 0.0f)) return 0;
+  const float scale = geometry.transform.linear().colwise().norm().maxCoeff();
+  const float max_error = w / (scale * lod_scale);
+  uint32_t lod = 0;
+  while (lod < geometry.lods.size() && geometry.lods[lod].error <= max_error) {
+    ++lod;
+  }
+  return lod;
+}
+
+std::vector<Meshlet> BuildMeshlets(Geometry* geometry,
+                                   const MeshletOptions& options) {
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t>& indices = geometry->indices;
+  const size_t num_triangles = indices.size() / 3;
+  if (geometry->instance_of >= 0 || num_triangles == 0) return meshlets;
+  CHECK_GE(options.max_vertices, 3u);
+  CHECK_GE(options.max_triangles, 1u);
+  const std::vector<Eigen::Vector3f>& positions = geometry->vertices;
+  const size_t vertex_count = positions.size();
+  const VertexTriangles adjacency = BuildVertexTriangles(indices, vertex_count);
+
+  // Unit normals (zero for degenerate triangles) and centroids.
+  std::vector<Eigen::Vector3f> normals(num_triangles);
+  std::vector<Eigen::Vector3f> centroids(num_triangles);
+  for (size_t t = 0; t < num_triangles; ++t) {
+    const Eigen::Vector3f& a = positions[indices[3 * t]];
+    const Eigen::Vector3f& b = positions[indices[3 * t + 1]];
+    const Eigen::Vector3f& c = positions[indices[3 * t + 2]];
+    const Eigen::Vector3f n = (b - a).cross(c - a);
+    const float length = n.norm();
+    normals[t] = length > 0.0f ? Eigen::Vector3f(n / length)
+                               : Eigen::Vector3f::Zero();
+    centroids[t] = (a + b + c) / 3.0f;
+  }
+
+  std::vector<bool> emitted(num_triangles, false);
+  // The meshlet each vertex was last added to, and its index in it.
+  std::vector<uint32_t> vertex_meshlet(vertex_count, UINT32_MAX);
+  std::vector<uint32_t> local_index(vertex_count, 0);
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+  std::vector<uint32_t> meshlet_vertices;
+  std::vector<uint32_t> meshlet_triangles;
+  std::vector<uint32_t> local_indices;
+  size_t cursor = 0;  // no triangle before it is left
+
+  while (output.size() < indices.size()) {
+    const auto id = static_cast<uint32_t>(meshlets.size());
+    meshlet_vertices.clear();
+    meshlet_triangles.clear();
+    Eigen::Vector3f normal_sum = Eigen::Vector3f::Zero();
+    Eigen::Vector3f centroid_sum = Eigen::Vector3f::Zero();
+    auto added_vertices = [&](uint32_t t) {
+      uint32_t added = 0;
+      for (int c = 0; c < 3; ++c) {
+        added += vertex_meshlet[indices[3 * t + c]] != id;
+      }
+      return added;
+    };
+    auto add = [&](uint32_t t) {
+      emitted[t] = true;
+      meshlet_triangles.push_back(t);
+      for (int c = 0; c < 3; ++c) {
+        const uint32_t v = indices[3 * t + c];
+        if (vertex_meshlet[v] == id) continue;
+        vertex_meshlet[v] = id;
+        local_index[v] = static_cast<uint32_t>(meshlet_vertices.size());
+        meshlet_vertices.push_back(v);
+      }
+      normal_sum += normals[t];
+      centroid_sum += centroids[t];
+    };
+
+    while (emitted[cursor]) ++cursor;
+    add(static_cast<uint32_t>(cursor));
+    while (meshlet_triangles.size() < options.max_triangles) {
+      const Eigen::Vector3f axis = normal_sum.normalized();
+      auto turn = [&](uint32_t t) {
+        return options.cone_weight * (1.0f - normals[t].dot(axis));
+      };
+      // The adjacent triangle adding the fewest vertices and turning least.
+      int64_t best = -1;
+      float best_score = std::numeric_limits<float>::max();
+      for (uint32_t v : meshlet_vertices) {
+        for (uint32_t k = adjacency.first[v]; k < adjacency.first[v + 1];
+             ++k) {
+          const uint32_t t = adjacency.triangles[k];
+          if (emitted[t]) continue;
+          const uint32_t added = added_vertices(t);
+          if (meshlet_vertices.size() + added > options.max_vertices) continue;
+          const float score = added + turn(t);
+          if (score < best_score) {
+            best_score = score;
+            best = t;
+          }
+        }
+      }
+      // Without one, the nearest of the next triangles in index order, which
+      // the vertex cache order keeps close, preferring those facing alike.
+      if (best < 0) {
+        const Eigen::Vector3f center =
+            centroid_sum / static_cast<float>(meshlet_triangles.size());
+        const size_t end =
+            std::min(num_triangles, cursor + kMeshletSearchWindow);
+        for (size_t t = cursor; t < end; ++t) {
+          if (emitted[t]) continue;
+          const auto triangle = static_cast<uint32_t>(t);
+          if (meshlet_vertices.size() + added_vertices(triangle) >
+              options.max_vertices) {
+            continue;
+          }
+          const float score =
+              (centroids[t] - center).norm() * (1.0f + turn(triangle));
+          if (score < best_score) {
+            best_score = score;
+            best = triangle;
+          }
+        }
+      }
+      if (best < 0) break;
+      add(static_cast<uint32_t>(best));
+    }
+
+    // The meshlet's triangles in vertex cache order, over its own vertices.
+    local_indices.clear();
+    for (uint32_t t : meshlet_triangles) {
+      for (int c = 0; c < 3; ++c) {
+        local_indices.push_back(local_index[indices[3 * t + c]]);
+      }
+    }
+    OptimizeVertexCache(local_indices, meshlet_vertices.size());
+
+    Meshlet& meshlet = meshlets.emplace_back();
+    meshlet.range.first_index = static_cast<uint32_t>(output.size());
+    meshlet.range.index_count = static_cast<uint32_t>(local_indices.size());
+    for (uint32_t i : local_indices) output.push_back(meshlet_vertices[i]);
+
+    // Bounds: the sphere around the box of the vertices, and the cone of the
+    // normals of the triangles with an area.
+    AABB box;
+    for (uint32_t v : meshlet_vertices) {
+      box.min = box.min.cwiseMin(positions[v]);
+      box.max = box.max.cwiseMax(positions[v]);
+    }
+    meshlet.center = 0.5f * (box.min + box.max);
+    for (uint32_t v : meshlet_vertices) {
+      meshlet.radius =
+          std::max(meshlet.radius, (positions[v] - meshlet.center).norm());
+    }
+    const float axis_length = normal_sum.norm();
+    if (axis_length > 0.0f) {
+      meshlet.cone_axis = normal_sum / axis_length;
+      float min_cosine = 1.0f;
+      for (uint32_t t : meshlet_triangles) {
+        if (normals[t].isZero(0.0f)) continue;
+        min_cosine = std::min(min_cosine, normals[t].dot(meshlet.cone_axis));
+      }
+      if (min_cosine > 0.0f) {
+        meshlet.cone_cutoff =
+            std::sqrt(std::max(1.0f - min_cosine * min_cosine, 0.0f));
+      }
+    }
+  }
+  indices.swap(output);
+  return meshlets;
+}
+
+void SortMeshletsForOverdraw(std::span<uint32_t> indices,
+                             std::span<const Eigen::Vector3f> positions,
+                             std::vector<Meshlet>* meshlets) {
+  if (meshlets->empty()) return;
+  std::vector<uint32_t> pieces;
+  pieces.reserve(meshlets->size() + 1);
+  for (const Meshlet& meshlet : *meshlets) {
+    DCHECK_EQ(meshlet.range.first_index % 3, 0u);
+    pieces.push_back(meshlet.range.first_index / 3);
+  }
+  DCHECK_EQ(pieces.front(), 0u);
+  DCHECK_EQ(meshlets->back().range.first_index +
+                meshlets->back().range.index_count,
+            indices.size());
+  pieces.push_back(static_cast<uint32_t>(indices.size() / 3));
+  const std::vector<uint32_t> order = FacingOrder(indices, positions, pieces);
+
+  std::vector<uint32_t> sorted;
+  sorted.reserve(indices.size());
+  std::vector<Meshlet> sorted_meshlets;
+  sorted_meshlets.reserve(meshlets->size());
+  for (uint32_t m : order) {
+    Meshlet& meshlet = sorted_meshlets.emplace_back((*meshlets)[m]);
+    meshlet.range.first_index = static_cast<uint32_t>(sorted.size());
+    sorted.insert(sorted.end(), indices.begin() + 3 * pieces[m],
+                  indices.begin() + 3 * pieces[m + 1]);
+  }
+  std::copy(sorted.begin(), sorted.end(), indices.begin());
+  meshlets->swap(sorted_meshlets);
+}
+
+void CullMeshlets(std::span<const Meshlet> meshlets,
+                  const Eigen::Matrix4f& view_proj,
+                  const Eigen::Affine3f& transform, CullMode cull_mode,
+                  std::vector<IndexRange>* ranges, MeshletCullStats* stats) {
+  const Eigen::Matrix4f model_view_proj = view_proj * transform.matrix();
+  // The frustum in object space, with unit plane normals so that the sphere
+  // tests compare distances.
+  Eigen::Vector4f planes[6];
+  ExtractFrustumPlanes(model_view_proj, planes);
+  for (Eigen::Vector4f& plane : planes) {
+    const float length = plane.head<3>().norm();
+    if (length > 0.0f) plane /= length;
+  }
+
+  // The eye in object space: the point where clip-space x, y and w vanish.
+  // An orthographic view (constant w) looks along the inward normal of its
+  // near plane instead. Meshlets whose normals all point away from the eye
+  // (towards it for kBack, and the other way round in a mirrored transform)
+  // are culled.
+  bool cone_culling = cull_mode != CullMode::kNone;
+  const bool orthographic = model_view_proj.row(3).head<3>().isZero(0.0f);
+  Eigen::Vector3f eye = Eigen::Vector3f::Zero();
+  Eigen::Vector3f view_direction = planes[4].head<3>();
+  if (cone_culling && !orthographic) {
+    Eigen::Matrix3f rows;
+    rows.row(0) = model_view_proj.row(0).head<3>();
+    rows.row(1) = model_view_proj.row(1).head<3>();
+    rows.row(2) = model_view_proj.row(3).head<3>();
+    if (rows.determinant() == 0.0f) {
+      cone_culling = false;
+    } else {
+      eye = -rows.inverse() * Eigen::Vector3f(model_view_proj(0, 3),
+                                              model_view_proj(1, 3),
+                                              model_view_proj(3, 3));
+    }
+  }
+  const bool mirrored = transform.linear().determinant() < 0.0f;
+  const float facing =
+      (cull_mode == CullMode::kBack) != mirrored ? -1.0f : 1.0f;
+
+  const size_t first_range = ranges->size();
+  MeshletCullStats counts;
+  counts.meshlets = meshlets.size();
+  for (const Meshlet& meshlet : meshlets) {
+    const uint32_t triangles = meshlet.range.index_count / 3;
+    counts.triangles += triangles;
+    bool in_frustum = true;
+    for (const Eigen::Vector4f& plane : planes) {
+      if (plane.head<3>().dot(meshlet.center) + plane.w() < -meshlet.radius) {
+        in_frustum = false;
+        break;
+      }
+    }
+    if (!in_frustum) {
+      ++counts.frustum_culled;
+      counts.frustum_culled_triangles += triangles;
+      continue;
+    }
+    if (cone_culling) {
+      const Eigen::Vector3f axis = facing * meshlet.cone_axis;
+      bool facing_away;
+      if (orthographic) {
+        facing_away = axis.dot(view_direction) >= meshlet.cone_cutoff;
+      } else {
+        // Every direction from the eye into the sphere is within asin(radius
+        // / distance) of the one to its center.
+        const Eigen::Vector3f to_center = meshlet.center - eye;
+        facing_away = axis.dot(to_center) >=
+                      meshlet.cone_cutoff * to_center.norm() + meshlet.radius;
+      }
+      if (facing_away) {
+        ++counts.cone_culled;
+        counts.cone_culled_triangles += triangles;
+        continue;
+      }
+    }
+    if (ranges->size() > first_range &&
+        ranges->back().first_index + ranges->back().index_count ==
+            meshlet.range.first_index) {
+      ranges->back().index_count += meshlet.range.index_count;
+    } else {
+      ranges->push_back(meshlet.range);
+    }
+  }
+  if (stats) *stats += counts;
+}
+
+}  // namespace sh_renderer
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "culling.h"
+#include "q3_layer.h"
+
+namespace sh_renderer {
+
+struct Geometry;
+
+// --- Index and vertex order optimization ---
+// The stages of Sander, Nehab and Barczak, "Fast Triangle Reordering for
+// Vertex Locality and Reduced Overdraw" (2007), followed by a vertex fetch
+// reordering:
+//  1. OptimizeVertexCache orders the triangles for a post-transform vertex
+//     cache with Tipsify, which fans around one vertex at a time, moving on to
+//     a neighbour still in the cache, and returns the clusters between the
+//     points where no neighbour was left and it had to jump.
+//  2. OptimizeOverdraw splits those clusters further where the cache
+//     efficiency allows and sorts them so that the outward facing ones, which
+//     tend to occlude the rest, come first, whatever the view.
+//  3. OptimizeVertexFetch orders the vertices by first use, so that the
+//     vertex fetches walk the buffers forwards, and remaps the indices.
+// All of them work on triangle lists and keep each triangle's corner order.
+
+// Cache size the optimization targets and the statistics simulate: a FIFO of
+// this many vertices.
+constexpr int kVertexCacheSize = 16;
+
+// The vertex shader work of drawing an index buffer through a FIFO
+// post-transform cache of kVertexCacheSize vertices.
+struct VertexCacheStats {
+  size_t triangles = 0;
+  size_t vertices = 0;    // distinct vertices the indices reference
+  size_t transforms = 0;  // cache misses, each one vertex shader invocation
+
+  // Average cache miss ratio: vertex shader invocations per triangle, from
+  // 3 with no reuse to about 0.5 on large regular meshes.
+  double acmr() const {
+    return triangles ? static_cast<double>(transforms) / triangles : 0.0;
+  }
+  // Average transform to vertex ratio: invocations per distinct vertex, 1 at
+  // best.
+  double atvr() const {
+    return vertices ? static_cast<double>(transforms) / vertices : 0.0;
+  }
+
+  VertexCacheStats& operator+=(const VertexCacheStats& other) {
+    triangles += other.triangles;
+    vertices += other.vertices;
+    transforms += other.transforms;
+    return *this;
+  }
+};
+
+VertexCacheStats AnalyzeVertexCache(std::span<const uint32_t> indices,
+                                    size_t vertex_count);
+
+// Reorders the triangles of `indices` (vertices below `vertex_count`) with
+// Tipsify. Returns the first triangle of each cluster, starting with 0.
+std::vector<uint32_t> OptimizeVertexCache(std::span<uint32_t> indices,
+                                          size_t vertex_count);
+
+// Splits each cluster of `indices` (as OptimizeVertexCache returns them) at
+// the first triangle where its cache miss ratio, from a cold cache, is within
+// `threshold` of the whole cluster's, and sorts the pieces by how much they
+// face away from the centroid of `positions`.
+void OptimizeOverdraw(std::span<uint32_t> indices,
+                      std::span<const Eigen::Vector3f> positions,
+                      std::span<const uint32_t> clusters,
+                      float threshold = 1.05f);
+
+// Reorders the vertex streams of `geometry` by first use in its indices, and
+// the indices with them. Vertices no triangle uses keep their order after the
+// used ones.
+void OptimizeVertexFetch(Geometry* geometry);
+
+// --- Levels of detail ---
+// SimplifyMesh collapses edges in the order of the quadric error metric of
+// Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics"
+// (1997): each vertex carries a quadric of the planes of the triangles around
+// it, and collapsing a vertex onto a neighbour costs the mean squared distance
+// of the neighbour from their combined planes, weighted by triangle area.
+// Vertices are merged, never moved, so the simplified triangles index the
+// original vertex streams. Vertices whose attributes split (texture or
+// lightmap uv seams, hard normals) and those on open borders, which include
+// the cuts between the partitioned and clustered pieces of a mesh, stay put,
+// so seams stay intact and neighbouring pieces stay closed. BuildLodChain
+// builds a geometry's levels from its full detail triangles; SelectLod picks
+// one per view from the projected error.
+
+// Most coarser levels of detail a geometry has.
+constexpr int kMaxGeometryLods = 4;
+
+// A coarser level of detail of a geometry: fewer triangles over the same
+// vertices.
+struct GeometryLod {
+  std::vector<uint32_t> indices;
+  // Estimated distance of the level's surface from the full detail one (the
+  // root of the largest collapse cost), in the geometry's object space. Grows
+  // from level to level.
+  float error = 0.0f;
+
+  // GL Resources. The level's range of the geometry arena's index buffer.
+  uint32_t first_index = 0;
+  uint32_t index_count = 0;
+};
+
+struct LodOptions {
+  int max_lods = kMaxGeometryLods;
+  // Target triangle count of each level relative to the one before it.
+  float reduction = 0.5f;
+  // Geometries with fewer triangles get no levels, and no level targets
+  // fewer.
+  uint32_t min_triangles = 64;
+  // A level that keeps more than this share of the previous level's
+  // triangles (locked seams and borders) ends the chain.
+  float max_kept = 0.8f;
+};
+
+// Collapses the edges of `geometry`'s indexed triangles until at most
+// `target_index_count` indices remain or no collapse is left. Returns the
+// simplified indices; `error` receives their estimated distance from the
+// original surface, in object space.
+std::vector<uint32_t> SimplifyMesh(const Geometry& geometry,
+                                   size_t target_index_count, float* error);
+
+// The coarser levels of detail of `geometry`, each simplified from its full
+// detail triangles and put in vertex cache order. Empty for instances,
+// non-indexed geometries and those below `options.min_triangles`.
+std::vector<GeometryLod> BuildLodChain(const Geometry& geometry,
+                                       const LodOptions& options = {});
+
+// The smallest clip-space w over `box` under `view_proj`: the distance along
+// the view direction of its nearest point in a perspective view, 1 in an
+// orthographic one.
+float MinClipW(const Eigen::Matrix4f& view_proj, const AABB& box);
+
+// The factor that turns a world-space error at clip-space w 1 into multiples
+// of `error_pixels` pixels (or shadow texels) of a `width` x `height` view of
+// `view_proj`. 0, which SelectLod takes for full detail, if `error_pixels` is
+// not positive.
+float LodScale(const Eigen::Matrix4f& view_proj, uint32_t width,
+               uint32_t height, float error_pixels);
+
+// The coarsest level of detail of `geometry` (0 for full detail, l + 1 for
+// Geometry::lods[l]) whose error, under the geometry's transform, projects to
+// at most one unit of `lod_scale` over the nearest point of its bounding box.
+uint32_t SelectLod(const Geometry& geometry, const Eigen::Matrix4f& view_proj,
+                   float lod_scale);
+
+// --- Meshlets ---
+// BuildMeshlets splits a geometry's triangles into meshlets of at most
+// MeshletOptions::max_vertices vertices and max_triangles triangles, each a
+// contiguous range of its indices with a bounding sphere and a cone bounding
+// its triangle normals. A meshlet grows from a seed triangle by the adjacent
+// triangle that adds the fewest vertices and turns the least away from its
+// normals so far, so meshlets follow the flat parts of a mesh.
+//
+// SortMeshletsForOverdraw then restores the overdraw order across meshlets,
+// and OptimizeVertexFetch the vertex fetch order, within the meshlets'
+// ranges.
+//
+// Per view, CullMeshlets drops the meshlets outside the frustum and those
+// whose triangles all face away from the eye (cone culling, as in
+// meshoptimizer's meshopt_computeMeshletBounds), and merges the rest into as
+// few index ranges as possible for a multi-draw. Architecture is mostly flat,
+// so many of a view's meshlets face away from it as a whole; walls seen from
+// inside a room never do.
+
+// A range of a geometry's indices, relative to its first index.
+struct IndexRange {
+  uint32_t first_index = 0;
+  uint32_t index_count = 0;
+};
+
+// Object-space bounds of a range of a geometry's triangles.
+struct Meshlet {
+  IndexRange range;
+  Eigen::Vector3f center = Eigen::Vector3f::Zero();
+  float radius = 0.0f;
+  // Mean direction of the triangle normals, and the sine of the largest angle
+  // between it and any of them; 1 (never culled) if they spread over a
+  // hemisphere.
+  Eigen::Vector3f cone_axis = Eigen::Vector3f::UnitZ();
+  float cone_cutoff = 1.0f;
+};
+
+struct MeshletOptions {
+  uint32_t max_vertices = 64;
+  uint32_t max_triangles = 124;
+  // How much a candidate triangle's angle to the meshlet's normals counts
+  // against the vertices it adds: 1 trades one new vertex for a right angle.
+  float cone_weight = 1.0f;
+};
+
+// Reorders the indexed triangles of `geometry` into meshlets and returns
+// them, in index order. Each meshlet's triangles are in vertex cache order.
+// Empty for instances and non-indexed geometries.
+std::vector<Meshlet> BuildMeshlets(Geometry* geometry,
+                                   const MeshletOptions& options = {});
+
+// Sorts `meshlets`, which cover `indices` in index order as BuildMeshlets
+// returns them, and their triangles with them, the way OptimizeOverdraw sorts
+// its pieces: outward facing first. Each meshlet keeps its triangles' order
+// and `meshlets` stays in index order.
+void SortMeshletsForOverdraw(std::span<uint32_t> indices,
+                             std::span<const Eigen::Vector3f> positions,
+                             std::vector<Meshlet>* meshlets);
+
+// The meshlets and triangles CullMeshlets tested, and those it dropped as
+// outside the frustum and, of the rest, as facing away.
+struct MeshletCullStats {
+  uint64_t meshlets = 0;
+  uint64_t frustum_culled = 0;
+  uint64_t cone_culled = 0;
+  uint64_t triangles = 0;
+  uint64_t frustum_culled_triangles = 0;
+  uint64_t cone_culled_triangles = 0;
+
+  MeshletCullStats& operator+=(const MeshletCullStats& other) {
+    meshlets += other.meshlets;
+    frustum_culled += other.frustum_culled;
+    cone_culled += other.cone_culled;
+    triangles += other.triangles;
+    frustum_culled_triangles += other.frustum_culled_triangles;
+    cone_culled_triangles += other.cone_culled_triangles;
+    return *this;
+  }
+};
+
+// Appends to `ranges` the index ranges of the `meshlets` of a geometry placed
+// by `transform` that may be visible in `view_proj`: those in the frustum
+// and, unless `cull_mode` is kNone, not entirely culled by it (facing away
+// from the eye for kFront). Adjacent ranges are merged. `stats` accumulates
+// the counts if given.
+void CullMeshlets(std::span<const Meshlet> meshlets,
+                  const Eigen::Matrix4f& view_proj,
+                  const Eigen::Affine3f& transform, CullMode cull_mode,
+                  std::vector<IndexRange>* ranges,
+                  MeshletCullStats* stats = nullptr);
+
+}  // namespace sh_renderer
@@ -0,0 +1,693 @@
+#include "mesh_optimizer.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+#include <random>
+#include <set>
+#include <span>
+
+#include "camera.h"
+#include "scene.h"
+
+namespace sh_renderer {
+namespace {
+
+// A grid of `size` x `size` quads in the z = 0 plane, two triangles each, in
+// row order.
+Geometry Grid(int size) {
+  Geometry geo;
+  for (int y = 0; y <= size; ++y) {
+    for (int x = 0; x <= size; ++x) {
+      geo.vertices.emplace_back(x, y, 0);
+      geo.normals.push_back(Eigen::Vector3f::UnitZ());
+      geo.texture_uvs.emplace_back(x, y);
+    }
+  }
+  auto vertex = [&](int x, int y) {
+    return static_cast<uint32_t>(y * (size + 1) + x);
+  };
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      geo.indices.insert(geo.indices.end(),
+                         {vertex(x, y), vertex(x + 1, y), vertex(x, y + 1),
+                          vertex(x + 1, y), vertex(x + 1, y + 1),
+                          vertex(x, y + 1)});
+    }
+  }
+  return geo;
+}
+
+// A unit cube centered on the origin whose faces are `size` x `size` grids,
+// facing outwards, each with its own vertices.
+Geometry Box(int size) {
+  Geometry geo;
+  for (int axis = 0; axis < 3; ++axis) {
+    for (float sign : {-1.0f, 1.0f}) {
+      Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+      normal[axis] = sign;
+      Eigen::Vector3f u = Eigen::Vector3f::Zero();
+      u[(axis + 1) % 3] = 1.0f;
+      const Eigen::Vector3f v = normal.cross(u);
+      const auto base = static_cast<uint32_t>(geo.vertices.size());
+      for (int y = 0; y <= size; ++y) {
+        for (int x = 0; x <= size; ++x) {
+          geo.vertices.push_back(0.5f * normal +
+                                 (static_cast<float>(x) / size - 0.5f) * u +
+                                 (static_cast<float>(y) / size - 0.5f) * v);
+          geo.normals.push_back(normal);
+        }
+      }
+      auto vertex = [&](int x, int y) {
+        return base + static_cast<uint32_t>(y * (size + 1) + x);
+      };
+      for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+          geo.indices.insert(geo.indices.end(),
+                             {vertex(x, y), vertex(x + 1, y), vertex(x, y + 1),
+                              vertex(x + 1, y), vertex(x + 1, y + 1),
+                              vertex(x, y + 1)});
+        }
+      }
+    }
+  }
+  return geo;
+}
+
+void ShuffleTriangles(std::vector<uint32_t>* indices) {
+  std::vector<std::array<uint32_t, 3>> triangles(indices->size() / 3);
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    std::copy_n(indices->begin() + 3 * t, 3, triangles[t].begin());
+  }
+  std::mt19937 rng(3);
+  std::shuffle(triangles.begin(), triangles.end(), rng);
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    std::copy_n(triangles[t].begin(), 3, indices->begin() + 3 * t);
+  }
+}
+
+// The triangles as position triples, in a canonical order.
+std::vector<std::array<float, 9>> SortedTriangles(const Geometry& geo) {
+  std::vector<std::array<float, 9>> triangles;
+  for (size_t i = 0; i < geo.indices.size(); i += 3) {
+    std::array<float, 9> triangle;
+    for (int k = 0; k < 3; ++k) {
+      const Eigen::Vector3f& p = geo.vertices[geo.indices[i + k]];
+      std::copy_n(p.data(), 3, triangle.begin() + 3 * k);
+    }
+    triangles.push_back(triangle);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+TEST(MeshOptimizerTest, AnalyzeVertexCacheCountsMisses) {
+  // Two triangles sharing an edge: four misses.
+  const std::vector<uint32_t> quad = {0, 1, 2, 2, 1, 3};
+  VertexCacheStats stats = AnalyzeVertexCache(quad, 4);
+  EXPECT_EQ(stats.triangles, 2u);
+  EXPECT_EQ(stats.vertices, 4u);
+  EXPECT_EQ(stats.transforms, 4u);
+  EXPECT_DOUBLE_EQ(stats.acmr(), 2.0);
+  EXPECT_DOUBLE_EQ(stats.atvr(), 1.0);
+
+  // A vertex evicted by kVertexCacheSize later misses is transformed again.
+  std::vector<uint32_t> indices = {0, 1, 2};
+  for (uint32_t v = 3; v < 3 + kVertexCacheSize; v += 3) {
+    indices.insert(indices.end(), {v, v + 1, v + 2});
+  }
+  const size_t vertex_count = 3 + kVertexCacheSize + 2;
+  indices.insert(indices.end(), {0, 1, 2});
+  stats = AnalyzeVertexCache(indices, vertex_count);
+  EXPECT_EQ(stats.transforms, stats.vertices + 3);
+}
+
+TEST(MeshOptimizerTest, VertexCacheOrderKeepsTrianglesAndLowersAcmr) {
+  Geometry geo = Grid(32);
+  ShuffleTriangles(&geo.indices);
+  const auto triangles = SortedTriangles(geo);
+  const VertexCacheStats before =
+      AnalyzeVertexCache(geo.indices, geo.vertices.size());
+
+  const std::vector<uint32_t> clusters =
+      OptimizeVertexCache(geo.indices, geo.vertices.size());
+  const VertexCacheStats after =
+      AnalyzeVertexCache(geo.indices, geo.vertices.size());
+
+  EXPECT_EQ(SortedTriangles(geo), triangles);
+  ASSERT_FALSE(clusters.empty());
+  EXPECT_EQ(clusters[0], 0u);
+  EXPECT_TRUE(std::is_sorted(clusters.begin(), clusters.end()));
+  EXPECT_GT(before.acmr(), 2.0);
+  EXPECT_LT(after.acmr(), 0.8);
+  EXPECT_LT(after.atvr(), 1.5);
+}
+
+TEST(MeshOptimizerTest, OverdrawOrderDrawsOutwardFacingClustersFirst) {
+  // A box around the origin, its faces wound outwards, and a small plane at
+  // its centre facing +z.
+  Geometry geo;
+  for (int corner = 0; corner < 8; ++corner) {
+    geo.vertices.emplace_back((corner & 1) ? 1 : -1, (corner & 2) ? 1 : -1,
+                              (corner & 4) ? 1 : -1);
+  }
+  geo.vertices.insert(geo.vertices.end(),
+                      {{-0.1f, -0.1f, 0}, {0.1f, -0.1f, 0}, {0, 0.1f, 0}});
+  geo.indices = {8, 9, 10};  // the inner plane comes first
+  const std::vector<uint32_t> box = {0, 2, 3, 0, 3, 1, 4, 5, 7, 4, 7, 6,
+                                     0, 1, 5, 0, 5, 4, 2, 6, 7, 2, 7, 3,
+                                     0, 4, 6, 0, 6, 2, 1, 3, 7, 1, 7, 5};
+  geo.indices.insert(geo.indices.end(), box.begin(), box.end());
+  const auto triangles = SortedTriangles(geo);
+
+  // One cluster per face (and the plane).
+  std::vector<uint32_t> clusters = {0};
+  for (uint32_t t = 1; t < 13; t += 2) clusters.push_back(t);
+  OptimizeOverdraw(geo.indices, geo.vertices, clusters);
+
+  EXPECT_EQ(SortedTriangles(geo), triangles);
+  // The plane faces away from the centroid least; it now comes last.
+  EXPECT_EQ(std::vector<uint32_t>(geo.indices.end() - 3, geo.indices.end()),
+            (std::vector<uint32_t>{8, 9, 10}));
+}
+
+TEST(MeshOptimizerTest, VertexFetchOrderFollowsFirstUse) {
+  Geometry geo = Grid(2);
+  geo.vertices.emplace_back(5, 5, 5);  // unused
+  geo.normals.push_back(Eigen::Vector3f::UnitX());
+  geo.texture_uvs.emplace_back(5, 5);
+  ShuffleTriangles(&geo.indices);
+  const auto triangles = SortedTriangles(geo);
+
+  OptimizeVertexFetch(&geo);
+
+  EXPECT_EQ(SortedTriangles(geo), triangles);
+  uint32_t next = 0;
+  for (uint32_t v : geo.indices) {
+    ASSERT_LE(v, next);
+    if (v == next) ++next;
+  }
+  EXPECT_EQ(next, 9u);
+  ASSERT_EQ(geo.vertices.size(), 10u);
+  EXPECT_EQ(geo.vertices[9], Eigen::Vector3f(5, 5, 5));
+  EXPECT_EQ(geo.normals[9], Eigen::Vector3f::UnitX());
+  for (size_t v = 0; v < 9; ++v) {
+    EXPECT_EQ(geo.texture_uvs[v], geo.vertices[v].head<2>());
+  }
+}
+
+TEST(MeshOptimizerTest, OptimizeSceneReportsBeforeAndAfter) {
+  Scene scene;
+  for (int i = 0; i < 4; ++i) {
+    scene.geometries.push_back(Grid(16 + i));
+    ShuffleTriangles(&scene.geometries.back().indices);
+  }
+  Geometry instance;
+  instance.instance_of = 0;
+  scene.geometries.push_back(instance);
+  std::vector<std::vector<std::array<float, 9>>> triangles;
+  for (const Geometry& geo : scene.geometries) {
+    triangles.push_back(SortedTriangles(geo));
+  }
+
+  const SceneOptimizationStats stats = OptimizeScene(scene, 2);
+
+  for (size_t i = 0; i < scene.geometries.size(); ++i) {
+    EXPECT_EQ(SortedTriangles(scene.geometries[i]), triangles[i]);
+  }
+  EXPECT_EQ(stats.before.triangles, stats.after.triangles);
+  EXPECT_EQ(stats.before.vertices, stats.after.vertices);
+  EXPECT_LT(stats.after.acmr(), 0.5 * stats.before.acmr());
+  EXPECT_TRUE(scene.geometries.back().indices.empty());
+}
+
+// The z component of the triangles' summed (doubled) area vectors.
+float SignedAreaZ(const Geometry& geo, const std::vector<uint32_t>& indices) {
+  float area = 0.0f;
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const Eigen::Vector3f& a = geo.vertices[indices[i]];
+    const Eigen::Vector3f& b = geo.vertices[indices[i + 1]];
+    const Eigen::Vector3f& c = geo.vertices[indices[i + 2]];
+    area += (b - a).cross(c - a).z();
+  }
+  return area;
+}
+
+TEST(MeshOptimizerTest, SimplifyMeshCollapsesFlatInteriorAndKeepsBorder) {
+  Geometry geo = Grid(16);
+  float error = -1.0f;
+  const std::vector<uint32_t> indices =
+      SimplifyMesh(geo, geo.indices.size() / 4, &error);
+
+  EXPECT_LE(indices.size(), geo.indices.size() / 4);
+  EXPECT_NEAR(error, 0.0f, 1e-4f);
+  // Still the whole square, facing the same way.
+  EXPECT_NEAR(SignedAreaZ(geo, indices), SignedAreaZ(geo, geo.indices),
+              1e-3f);
+  const std::set<uint32_t> used(indices.begin(), indices.end());
+  for (size_t v = 0; v < geo.vertices.size(); ++v) {
+    const Eigen::Vector3f& p = geo.vertices[v];
+    if (p.x() == 0 || p.x() == 16 || p.y() == 0 || p.y() == 16) {
+      EXPECT_TRUE(used.contains(v)) << "border vertex " << v;
+    }
+  }
+}
+
+TEST(MeshOptimizerTest, SimplifyMeshKeepsUvSeams) {
+  // The right half of the grid maps its own uv chart: the vertices at x = 8
+  // are duplicated with other uvs.
+  Geometry geo = Grid(16);
+  std::vector<uint32_t> seam(geo.vertices.size(), UINT32_MAX);
+  for (uint32_t v = 0; v < 17 * 17; ++v) {
+    if (geo.vertices[v].x() != 8) continue;
+    const Eigen::Vector3f p = geo.vertices[v];
+    seam[v] = static_cast<uint32_t>(geo.vertices.size());
+    geo.vertices.push_back(p);
+    geo.normals.push_back(Eigen::Vector3f::UnitZ());
+    geo.texture_uvs.emplace_back(100, p.y());
+  }
+  seam.resize(geo.vertices.size(), UINT32_MAX);
+  for (size_t i = 0; i < geo.indices.size(); i += 3) {
+    float x = 0;
+    for (int k = 0; k < 3; ++k) x += geo.vertices[geo.indices[i + k]].x();
+    if (x <= 24) continue;  // left of the seam
+    for (int k = 0; k < 3; ++k) {
+      uint32_t& v = geo.indices[i + k];
+      if (seam[v] != UINT32_MAX) v = seam[v];
+    }
+  }
+
+  float error = 0.0f;
+  const std::vector<uint32_t> indices = SimplifyMesh(geo, 0, &error);
+
+  EXPECT_LT(indices.size(), geo.indices.size() / 2);
+  const std::set<uint32_t> used(indices.begin(), indices.end());
+  for (uint32_t v = 0; v < 17 * 17; ++v) {
+    if (seam[v] == UINT32_MAX) continue;
+    EXPECT_TRUE(used.contains(v)) << "left seam vertex " << v;
+    EXPECT_TRUE(used.contains(seam[v])) << "right seam vertex " << seam[v];
+  }
+  // Each side keeps its own uvs.
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    bool left = false;
+    bool right = false;
+    bool left_seam = false;
+    bool right_seam = false;
+    for (int k = 0; k < 3; ++k) {
+      const uint32_t v = indices[i + k];
+      left = left || geo.vertices[v].x() < 8;
+      right = right || geo.vertices[v].x() > 8;
+      left_seam = left_seam || seam[v] != UINT32_MAX;
+      right_seam = right_seam || geo.texture_uvs[v].x() == 100;
+    }
+    EXPECT_FALSE(left && right);
+    EXPECT_FALSE(left_seam && right);
+    EXPECT_FALSE(right_seam && left);
+  }
+}
+
+TEST(MeshOptimizerTest, LodChainHalvesTrianglesWithGrowingError) {
+  Geometry geo = Grid(32);
+  for (Eigen::Vector3f& p : geo.vertices) {
+    p.z() = 2.0f * std::sin(0.3f * p.x()) * std::cos(0.2f * p.y());
+  }
+
+  const std::vector<GeometryLod> lods = BuildLodChain(geo);
+
+  ASSERT_GE(lods.size(), 3u);
+  size_t triangles = geo.indices.size() / 3;
+  float error = 0.0f;
+  for (size_t level = 0; level < lods.size(); ++level) {
+    const GeometryLod& lod = lods[level];
+    // The 128 locked border vertices stop the fourth level short of its
+    // target.
+    EXPECT_LE(lod.indices.size() / 3,
+              level < 3 ? triangles / 2 : triangles * 4 / 5);
+    EXPECT_GE(lod.error, error);
+    for (uint32_t v : lod.indices) ASSERT_LT(v, geo.vertices.size());
+    triangles = lod.indices.size() / 3;
+    error = lod.error;
+  }
+  EXPECT_GT(error, 0.0f);
+  EXPECT_LT(error, 2.0f);
+
+  Geometry instance;
+  instance.instance_of = 0;
+  EXPECT_TRUE(BuildLodChain(instance).empty());
+  EXPECT_TRUE(BuildLodChain(Grid(4)).empty());  // below min_triangles
+}
+
+TEST(MeshOptimizerTest, SelectLodCoarsensWithDistance) {
+  // A unit box `distance` in front of a camera at the origin looking down -z,
+  // with levels of 0.01 and 0.1 units of error. A 720 pixel high view at the
+  // default field of view draws about 1050 pixels per unit at w = 1, so the
+  // levels are within a pixel beyond w = 10.5 and w = 105.
+  const Eigen::Matrix4f proj = GetProjectionMatrix(0.658f, 1280.0f / 720.0f,
+                                                   0.1f, 1000.0f);
+  const float lod_scale = LodScale(proj, 1280, 720, 1.0f);
+  Geometry geo;
+  geo.lods.resize(2);
+  geo.lods[0].error = 0.01f;
+  geo.lods[1].error = 0.1f;
+  auto lod_at = [&](float distance) {
+    geo.bounding_box.min = Eigen::Vector3f(-0.5f, -0.5f, -distance - 0.5f);
+    geo.bounding_box.max = Eigen::Vector3f(0.5f, 0.5f, -distance + 0.5f);
+    return SelectLod(geo, proj, lod_scale);
+  };
+
+  EXPECT_NEAR(MinClipW(proj, {.min = Eigen::Vector3f(-1, -1, -21),
+                              .max = Eigen::Vector3f(1, 1, -19)}),
+              19.0f, 1e-3f);
+  EXPECT_EQ(lod_at(5), 0u);
+  EXPECT_EQ(lod_at(20), 1u);
+  EXPECT_EQ(lod_at(150), 2u);
+  EXPECT_EQ(lod_at(-0.2f), 0u);  // around the eye
+  // Twice the scale doubles the error on screen.
+  geo.transform = Eigen::Scaling(2.0f);
+  EXPECT_EQ(lod_at(20), 0u);
+  EXPECT_EQ(lod_at(150), 1u);
+  // No threshold, full detail.
+  EXPECT_EQ(LodScale(proj, 1280, 720, 0.0f), 0.0f);
+  EXPECT_EQ(SelectLod(geo, proj, 0.0f), 0u);
+}
+
+TEST(MeshOptimizerTest, BuildSceneLodsSkipsInstances) {
+  Scene scene;
+  scene.geometries.push_back(Grid(16));
+  scene.geometries.push_back(Grid(2));
+  Geometry instance;
+  instance.instance_of = 0;
+  scene.geometries.push_back(instance);
+
+  BuildSceneLods(scene, {}, 2);
+
+  EXPECT_FALSE(scene.geometries[0].lods.empty());
+  EXPECT_TRUE(scene.geometries[1].lods.empty());
+  EXPECT_TRUE(scene.geometries[2].lods.empty());
+}
+
+TEST(MeshOptimizerTest, MeshletsCoverTheTrianglesWithinTheirLimits) {
+  Geometry geo = Grid(32);
+  const auto expected = SortedTriangles(geo);
+  const std::vector<Meshlet> meshlets = BuildMeshlets(&geo);
+
+  EXPECT_EQ(SortedTriangles(geo), expected);
+  ASSERT_FALSE(meshlets.empty());
+  // 2048 triangles need at least 17 meshlets of 124.
+  EXPECT_GE(meshlets.size(), 17u);
+  EXPECT_LE(meshlets.size(), 32u);
+  uint32_t next_index = 0;
+  for (const Meshlet& meshlet : meshlets) {
+    EXPECT_EQ(meshlet.range.first_index, next_index);
+    EXPECT_LE(meshlet.range.index_count, 3u * 124u);
+    next_index += meshlet.range.index_count;
+    const std::span<const uint32_t> indices(
+        geo.indices.data() + meshlet.range.first_index,
+        meshlet.range.index_count);
+    EXPECT_LE(std::set<uint32_t>(indices.begin(), indices.end()).size(), 64u);
+    // The sphere holds the vertices; the flat grid's cone is a line.
+    for (uint32_t v : indices) {
+      EXPECT_LE((geo.vertices[v] - meshlet.center).norm(),
+                meshlet.radius + 1e-4f);
+    }
+    EXPECT_NEAR(meshlet.cone_axis.z(), 1.0f, 1e-5f);
+    EXPECT_NEAR(meshlet.cone_cutoff, 0.0f, 1e-2f);
+  }
+  EXPECT_EQ(next_index, geo.indices.size());
+
+  Geometry instance;
+  instance.instance_of = 0;
+  EXPECT_TRUE(BuildMeshlets(&instance).empty());
+}
+
+TEST(MeshOptimizerTest, MeshletConesStayNarrow) {
+  // The faces of a box share no vertices: most meshlets stay on one.
+  Geometry box = Box(8);
+  const std::vector<Meshlet> box_meshlets = BuildMeshlets(&box);
+  size_t flat = 0;
+  for (const Meshlet& meshlet : box_meshlets) {
+    if (meshlet.cone_cutoff < 1e-2f) ++flat;
+  }
+  EXPECT_GE(flat, box_meshlets.size() / 2);
+
+  // Around a smooth cylinder, the cone weight grows the meshlets along it
+  // rather than around it.
+  auto mean_cutoff = [](float cone_weight) {
+    constexpr int kSegments = 64;
+    constexpr int kRows = 32;
+    Geometry geo;
+    for (int row = 0; row <= kRows; ++row) {
+      for (int s = 0; s < kSegments; ++s) {
+        const float angle = 2.0f * std::numbers::pi_v<float> * s / kSegments;
+        geo.vertices.emplace_back(std::cos(angle), 0.1f * row,
+                                  -std::sin(angle));
+      }
+    }
+    for (int row = 0; row < kRows; ++row) {
+      for (int s = 0; s < kSegments; ++s) {
+        const uint32_t a = row * kSegments + s;
+        const uint32_t b = row * kSegments + (s + 1) % kSegments;
+        geo.indices.insert(geo.indices.end(), {a, b, a + kSegments, b,
+                                               b + kSegments, a + kSegments});
+      }
+    }
+    const std::vector<Meshlet> meshlets =
+        BuildMeshlets(&geo, {.cone_weight = cone_weight});
+    float sum = 0.0f;
+    for (const Meshlet& meshlet : meshlets) sum += meshlet.cone_cutoff;
+    return sum / meshlets.size();
+  };
+  EXPECT_LT(mean_cutoff(1.0f), 0.9f * mean_cutoff(0.0f));
+}
+
+// Whether any triangle of `geo` that GL would rasterize in `view_proj` under
+// `transform` (front-facing and touching the frustum) is missing from
+// `ranges`; every one in them is counted in `drawn`.
+bool MissesVisibleTriangles(const Geometry& geo,
+                            const Eigen::Matrix4f& view_proj,
+                            const Eigen::Affine3f& transform,
+                            const std::vector<IndexRange>& ranges,
+                            size_t* drawn) {
+  std::vector<bool> in_range(geo.indices.size() / 3, false);
+  *drawn = 0;
+  for (const IndexRange& range : ranges) {
+    for (uint32_t i = 0; i < range.index_count; i += 3) {
+      in_range[(range.first_index + i) / 3] = true;
+      ++*drawn;
+    }
+  }
+  const Eigen::Matrix4f model_view_proj = view_proj * transform.matrix();
+  for (size_t t = 0; t < in_range.size(); ++t) {
+    Eigen::Vector2f ndc[3];
+    bool in_front = true;
+    for (int c = 0; c < 3; ++c) {
+      const Eigen::Vector4f clip =
+          model_view_proj * geo.vertices[geo.indices[3 * t + c]].homogeneous();
+      in_front = in_front && clip.w() > 0.0f;
+      ndc[c] = clip.head<2>() / clip.w();
+    }
+    if (!in_front) continue;
+    // Counter-clockwise in normalized device coordinates is front-facing.
+    const Eigen::Vector2f e1 = ndc[1] - ndc[0];
+    const Eigen::Vector2f e2 = ndc[2] - ndc[0];
+    const float area = e1.x() * e2.y() - e1.y() * e2.x();
+    const bool on_screen = std::all_of(ndc, ndc + 3, [](const auto& p) {
+      return p.cwiseAbs().maxCoeff() < 0.99f;
+    });
+    if (area > 1e-6f && on_screen && !in_range[t]) return true;
+  }
+  return false;
+}
+
+TEST(MeshOptimizerTest, CullMeshletsKeepsWhatTheViewRasterizes) {
+  Geometry geo = Box(16);
+  const std::vector<Meshlet> meshlets = BuildMeshlets(&geo);
+  const size_t triangles = geo.indices.size() / 3;
+  auto look_at = [&](const Eigen::Vector3f& eye) {
+    Camera camera{.position = eye,
+                  .orientation = Eigen::Quaternionf::Identity(),
+                  .intrinsics = {.fov_y_radians = 1.0f, .aspect_ratio = 1.0f}};
+    LookAt(Eigen::Vector3f::Zero(), &camera);
+    return GetViewProjMatrix(camera);
+  };
+
+  const Eigen::Affine3f transforms[] = {
+      Eigen::Affine3f::Identity(),
+      Eigen::Affine3f(Eigen::Translation3f(0.2f, -0.1f, 0.3f) *
+                      Eigen::Scaling(1.0f, 2.0f, 0.5f)),
+      Eigen::Affine3f(Eigen::Scaling(-1.0f, 1.0f, 1.0f))};  // mirrored
+  for (const Eigen::Affine3f& transform : transforms) {
+    for (const Eigen::Vector3f& eye :
+         {Eigen::Vector3f(0, 0, 4), Eigen::Vector3f(3, 2, -3),
+          Eigen::Vector3f(-2, -3, 1)}) {
+      const Eigen::Matrix4f view_proj = look_at(eye);
+      std::vector<IndexRange> ranges;
+      MeshletCullStats stats;
+      CullMeshlets(meshlets, view_proj, transform, CullMode::kFront, &ranges,
+                   &stats);
+      size_t drawn = 0;
+      EXPECT_FALSE(
+          MissesVisibleTriangles(geo, view_proj, transform, ranges, &drawn));
+      // At least the far face is culled.
+      EXPECT_LE(drawn, triangles * 5 / 6) << eye.transpose();
+      EXPECT_EQ(stats.meshlets, meshlets.size());
+      EXPECT_EQ(stats.triangles, triangles);
+      EXPECT_EQ(stats.frustum_culled_triangles + stats.cone_culled_triangles,
+                triangles - drawn);
+      EXPECT_GT(stats.cone_culled, 0u);
+      // Ranges are merged: never adjacent.
+      for (size_t r = 1; r < ranges.size(); ++r) {
+        EXPECT_LT(ranges[r - 1].first_index + ranges[r - 1].index_count,
+                  ranges[r].first_index);
+      }
+    }
+  }
+
+  // Looking straight at a face from afar, only it is drawn.
+  std::vector<IndexRange> ranges;
+  CullMeshlets(meshlets, look_at(Eigen::Vector3f(0, 0, 50)),
+               Eigen::Affine3f::Identity(), CullMode::kFront, &ranges);
+  size_t drawn = 0;
+  for (const IndexRange& range : ranges) drawn += range.index_count / 3;
+  EXPECT_LE(drawn, triangles / 3);
+
+  // Two-sided: everything in the frustum, in one range.
+  ranges.clear();
+  MeshletCullStats stats;
+  CullMeshlets(meshlets, look_at(Eigen::Vector3f(0, 0, 4)),
+               Eigen::Affine3f::Identity(), CullMode::kNone, &ranges, &stats);
+  ASSERT_EQ(ranges.size(), 1u);
+  EXPECT_EQ(ranges[0].index_count, geo.indices.size());
+  EXPECT_EQ(stats.cone_culled, 0u);
+
+  // Behind the camera: nothing.
+  ranges.clear();
+  CullMeshlets(meshlets, look_at(Eigen::Vector3f(0, 0, 4)),
+               Eigen::Affine3f(Eigen::Translation3f(0, 0, 10)),
+               CullMode::kNone, &ranges);
+  EXPECT_TRUE(ranges.empty());
+}
+
+TEST(MeshOptimizerTest, CullMeshletsInOrthographicViews) {
+  Geometry geo = Box(16);
+  const std::vector<Meshlet> meshlets = BuildMeshlets(&geo);
+  const size_t triangles = geo.indices.size() / 3;
+  // A sun shadow cascade's view: looking down -z from z = 5.
+  Eigen::Matrix4f ortho = Eigen::Matrix4f::Identity();
+  ortho(2, 2) = -2.0f / 10.0f;
+  ortho(2, 3) = -(10.0f + 0.0f) / 10.0f;
+  const Eigen::Matrix4f view_proj =
+      ortho * Eigen::Affine3f(Eigen::Translation3f(0, 0, -5)).matrix();
+
+  std::vector<IndexRange> ranges;
+  CullMeshlets(meshlets, view_proj, Eigen::Affine3f::Identity(),
+               CullMode::kFront, &ranges);
+  size_t drawn = 0;
+  EXPECT_FALSE(MissesVisibleTriangles(geo, view_proj,
+                                      Eigen::Affine3f::Identity(), ranges,
+                                      &drawn));
+  EXPECT_LE(drawn, triangles / 3);
+
+  // Culling front faces draws the far side instead.
+  ranges.clear();
+  CullMeshlets(meshlets, view_proj, Eigen::Affine3f::Identity(),
+               CullMode::kBack, &ranges);
+  std::vector<bool> in_range(triangles, false);
+  drawn = 0;
+  for (const IndexRange& range : ranges) {
+    for (uint32_t i = 0; i < range.index_count; i += 3) {
+      in_range[(range.first_index + i) / 3] = true;
+      ++drawn;
+    }
+  }
+  EXPECT_LE(drawn, triangles / 3);
+  for (size_t t = 0; t < triangles; ++t) {
+    bool far_side = true;
+    for (int c = 0; c < 3; ++c) {
+      far_side = far_side && geo.vertices[geo.indices[3 * t + c]].z() < -0.49f;
+    }
+    if (far_side) {
+      EXPECT_TRUE(in_range[t]);
+    }
+  }
+}
+
+TEST(MeshOptimizerTest, BuildSceneMeshletsSkipsInstances) {
+  Scene scene;
+  scene.geometries.push_back(Grid(16));
+  Geometry instance;
+  instance.instance_of = 0;
+  scene.geometries.push_back(instance);
+  scene.geometries.emplace_back();  // no triangles
+
+  BuildSceneMeshlets(scene, {}, 2);
+
+  EXPECT_FALSE(scene.geometries[0].meshlets.empty());
+  EXPECT_TRUE(scene.geometries[1].meshlets.empty());
+  EXPECT_TRUE(scene.geometries[2].meshlets.empty());
+}
+
+TEST(MeshOptimizerTest, SceneMeshletsKeepOverdrawAndVertexFetchOrder) {
+  // A box with a smaller one inside facing inwards, in shuffled order: the
+  // inner faces are the ones the overdraw order draws last.
+  Scene scene;
+  Geometry geo = Box(8);
+  const Geometry inner = Box(4);
+  const auto base = static_cast<uint32_t>(geo.vertices.size());
+  for (const Eigen::Vector3f& v : inner.vertices) {
+    geo.vertices.push_back(0.25f * v);
+  }
+  for (const Eigen::Vector3f& n : inner.normals) geo.normals.push_back(-n);
+  for (size_t i = 0; i < inner.indices.size(); i += 3) {
+    geo.indices.insert(geo.indices.end(),
+                       {base + inner.indices[i], base + inner.indices[i + 2],
+                        base + inner.indices[i + 1]});
+  }
+  ShuffleTriangles(&geo.indices);
+  scene.geometries.push_back(std::move(geo));
+  const auto triangles = SortedTriangles(scene.geometries[0]);
+
+  OptimizeScene(scene, 2);
+  BuildSceneMeshlets(scene, {}, 2);
+
+  const Geometry& out = scene.geometries[0];
+  EXPECT_EQ(SortedTriangles(out), triangles);
+  // The vertices are in first use order over the final indices.
+  uint32_t next = 0;
+  for (uint32_t v : out.indices) {
+    ASSERT_LE(v, next);
+    if (v == next) ++next;
+  }
+  EXPECT_EQ(next, out.vertices.size());
+  // The meshlets still cover the indices in order and bound their vertices.
+  ASSERT_FALSE(out.meshlets.empty());
+  uint32_t next_index = 0;
+  for (const Meshlet& meshlet : out.meshlets) {
+    EXPECT_EQ(meshlet.range.first_index, next_index);
+    next_index += meshlet.range.index_count;
+    for (uint32_t i = meshlet.range.first_index; i < next_index; ++i) {
+      EXPECT_LE((out.vertices[out.indices[i]] - meshlet.center).norm(),
+                meshlet.radius + 1e-4f);
+    }
+  }
+  EXPECT_EQ(next_index, out.indices.size());
+  // Outer faces first, inner ones last.
+  auto is_inner = [&](uint32_t i) {
+    return out.vertices[out.indices[i]].cwiseAbs().maxCoeff() < 0.2f;
+  };
+  const Meshlet& first = out.meshlets.front();
+  const Meshlet& last = out.meshlets.back();
+  for (uint32_t i = 0; i < first.range.index_count; ++i) {
+    EXPECT_FALSE(is_inner(first.range.first_index + i));
+  }
+  for (uint32_t i = 0; i < last.range.index_count; ++i) {
+    EXPECT_TRUE(is_inner(last.range.first_index + i));
+  }
+  EXPECT_LT(AnalyzeVertexCache(out.indices, out.vertices.size()).acmr(), 1.0);
+}
+
+}  // namespace
+}  // namespace sh_renderer
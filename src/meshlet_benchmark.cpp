@@ -0,0 +1,280 @@
+// Report on meshlet culling: builds the meshlets of a scene for each of
+// --cone_weights and reports, over the views of a camera spinning around the
+// middle of the scene and the sun shadow cascades that follow it, how many of
+// the triangles of the geometries in each view's frustum CullMeshlets drops
+// for being outside the frustum and for facing away from the eye, the index
+// ranges left per geometry draw, and the CPU time of the culling per view.
+// The camera views stand for the depth pre-pass and radiance pass, the
+// cascades for the sun shadow pass.
+//
+// Runs on a synthetic atrium (a room of --room_size meters with --num_pillars
+// box pillars and as many round columns) and, with --input, on the glTF scene
+// as the cook leaves it.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "cascade.h"
+#include "culling.h"
+#include "loader.h"
+#include "scene.h"
+
+DEFINE_string(input, "", "Optional glTF scene (e.g. Sponza) to report on.");
+DEFINE_double(room_size, 40.0, "Width and depth of the synthetic atrium.");
+DEFINE_uint32(num_pillars, 16, "Box pillars (and round columns) in it.");
+DEFINE_string(cone_weights, "0,0.5,1,2",
+              "MeshletOptions::cone_weight values to sweep.");
+DEFINE_uint32(views, 64, "Camera views per cone weight.");
+
+namespace sh_renderer {
+namespace {
+
+std::vector<float> ParseList(const std::string& list) {
+  std::vector<float> values;
+  std::istringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    std::istringstream value_stream(item);
+    float value;
+    if (value_stream >> value) values.push_back(value);
+  }
+  return values;
+}
+
+// A unit cube centered on the origin whose faces are `size` x `size` grids
+// with their own vertices, facing outwards, or inwards if `inward`.
+Geometry MakeBox(int size, bool inward) {
+  Geometry geo;
+  for (int axis = 0; axis < 3; ++axis) {
+    for (float sign : {-1.0f, 1.0f}) {
+      Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+      normal[axis] = sign;
+      Eigen::Vector3f u = Eigen::Vector3f::Zero();
+      u[(axis + 1) % 3] = 1.0f;
+      const Eigen::Vector3f v = normal.cross(u);
+      const auto base = static_cast<uint32_t>(geo.vertices.size());
+      for (int y = 0; y <= size; ++y) {
+        for (int x = 0; x <= size; ++x) {
+          geo.vertices.push_back(0.5f * normal +
+                                 (static_cast<float>(x) / size - 0.5f) * u +
+                                 (static_cast<float>(y) / size - 0.5f) * v);
+          geo.normals.push_back(inward ? -normal : normal);
+        }
+      }
+      auto vertex = [&](int x, int y) {
+        return base + static_cast<uint32_t>(y * (size + 1) + x);
+      };
+      for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+          uint32_t quad[6] = {vertex(x, y),         vertex(x + 1, y),
+                              vertex(x, y + 1),     vertex(x + 1, y),
+                              vertex(x + 1, y + 1), vertex(x, y + 1)};
+          if (inward) {
+            std::swap(quad[1], quad[2]);
+            std::swap(quad[4], quad[5]);
+          }
+          geo.indices.insert(geo.indices.end(), quad, quad + 6);
+        }
+      }
+    }
+  }
+  return geo;
+}
+
+// A smooth column of radius 0.5 and height 1 around the y axis, its base at
+// the origin, facing outwards.
+Geometry MakeColumn(int segments, int rows) {
+  Geometry geo;
+  for (int row = 0; row <= rows; ++row) {
+    for (int s = 0; s < segments; ++s) {
+      const float angle = 2.0f * std::numbers::pi_v<float> * s / segments;
+      const Eigen::Vector3f normal(std::cos(angle), 0.0f, -std::sin(angle));
+      geo.vertices.push_back(0.5f * normal +
+                             Eigen::Vector3f(0.0f, 1.0f * row / rows, 0.0f));
+      geo.normals.push_back(normal);
+    }
+  }
+  for (int row = 0; row < rows; ++row) {
+    for (int s = 0; s < segments; ++s) {
+      const auto a = static_cast<uint32_t>(row * segments + s);
+      const auto b = static_cast<uint32_t>(row * segments + (s + 1) % segments);
+      const auto up = static_cast<uint32_t>(segments);
+      geo.indices.insert(geo.indices.end(),
+                         {a, b, a + up, b, b + up, a + up});
+    }
+  }
+  return geo;
+}
+
+// The room, then a ring of box pillars and round columns inside it.
+Scene MakeAtrium() {
+  Scene scene;
+  scene.materials.resize(1);
+  const float size = static_cast<float>(FLAGS_room_size);
+  const float height = 0.3f * size;
+  Geometry room = MakeBox(32, /*inward=*/true);
+  room.transform = Eigen::Translation3f(0.0f, 0.5f * height, 0.0f) *
+                   Eigen::Scaling(size, height, size);
+  room.material_id = 0;
+  scene.geometries.push_back(std::move(room));
+  for (uint32_t i = 0; i < FLAGS_num_pillars; ++i) {
+    const float angle =
+        2.0f * std::numbers::pi_v<float> * i / FLAGS_num_pillars;
+    const Eigen::Vector3f ring(std::cos(angle), 0.0f, std::sin(angle));
+    Geometry pillar = MakeBox(8, /*inward=*/false);
+    pillar.transform =
+        Eigen::Translation3f(0.35f * size * ring +
+                             Eigen::Vector3f(0.0f, 0.5f * height, 0.0f)) *
+        Eigen::Scaling(1.0f, height, 1.0f);
+    pillar.material_id = 0;
+    scene.geometries.push_back(std::move(pillar));
+    Geometry column = MakeColumn(32, 16);
+    column.transform = Eigen::Translation3f(0.2f * size * ring) *
+                       Eigen::Scaling(1.0f, height, 1.0f);
+    column.material_id = 0;
+    scene.geometries.push_back(std::move(column));
+  }
+  ComputeSceneBoundingBoxes(scene);
+  return scene;
+}
+
+struct ViewStats {
+  MeshletCullStats meshlets;
+  uint64_t views = 0;
+  uint64_t draws = 0;   // geometries with meshlets in the frustum
+  uint64_t ranges = 0;  // index ranges left of them
+  double cull_us = 0.0;
+};
+
+void Cull(const Scene& scene, const Eigen::Matrix4f& view_proj,
+          ViewStats* stats) {
+  Eigen::Vector4f planes[6];
+  ExtractFrustumPlanes(view_proj, planes);
+  thread_local std::vector<uint32_t> visible;
+  thread_local std::vector<IndexRange> ranges;
+  FrustumCullGeometries(scene, planes, &visible);
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i : visible) {
+    const Geometry& geo = scene.geometries[i];
+    const Geometry& mesh = GeometryMesh(scene.geometries, geo);
+    if (mesh.meshlets.empty()) continue;
+    CullMode cull_mode = CullMode::kFront;
+    if (geo.material_id >= 0 &&
+        static_cast<size_t>(geo.material_id) < scene.materials.size()) {
+      cull_mode = scene.materials[geo.material_id].cull_mode;
+    }
+    ranges.clear();
+    CullMeshlets(mesh.meshlets, view_proj, geo.transform, cull_mode, &ranges,
+                 &stats->meshlets);
+    ++stats->draws;
+    stats->ranges += ranges.size();
+  }
+  stats->cull_us += std::chrono::duration<double, std::micro>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  ++stats->views;
+}
+
+void LogRow(const std::string& label, const ViewStats& stats) {
+  const MeshletCullStats& m = stats.meshlets;
+  const double views = std::max<uint64_t>(stats.views, 1);
+  const uint64_t in_frustum = m.triangles - m.frustum_culled_triangles;
+  LOG(INFO) << label << ": " << m.triangles / views
+            << " triangles per view in frustum culled geometries, "
+            << 100.0 * m.frustum_culled_triangles /
+                   std::max<uint64_t>(m.triangles, 1)
+            << "% in meshlets outside the frustum, "
+            << 100.0 * m.cone_culled_triangles /
+                   std::max<uint64_t>(in_frustum, 1)
+            << "% of the rest in meshlets facing away; "
+            << static_cast<double>(stats.ranges) /
+                   std::max<uint64_t>(stats.draws, 1)
+            << " ranges per draw, culled in " << stats.cull_us / views
+            << " us per view.";
+}
+
+void Report(const char* name, const Scene& cooked) {
+  AABB bounds;
+  for (const Geometry& geo : cooked.geometries) {
+    if (GeometryMesh(cooked.geometries, geo).vertices.empty()) continue;
+    bounds.min = bounds.min.cwiseMin(geo.bounding_box.min);
+    bounds.max = bounds.max.cwiseMax(geo.bounding_box.max);
+  }
+  const Eigen::Vector3f center = 0.5f * (bounds.min + bounds.max);
+  SunLight sun;
+  sun.direction = Eigen::Vector3f(0.5f, -1.0f, 0.1f).normalized();
+
+  for (float cone_weight : ParseList(FLAGS_cone_weights)) {
+    Scene scene = cooked;
+    const auto start = std::chrono::steady_clock::now();
+    BuildSceneMeshlets(scene, {.cone_weight = cone_weight});
+    const double build_ms = std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+    BuildSceneBvh(scene);
+
+    ViewStats camera_stats;
+    ViewStats shadow_stats;
+    for (uint32_t i = 0; i < FLAGS_views; ++i) {
+      const float yaw = 2.0f * std::numbers::pi_v<float> * i / FLAGS_views;
+      Camera camera{.position = center,
+                    .orientation = Eigen::Quaternionf::Identity(),
+                    .intrinsics = {.z_far = (bounds.max - bounds.min).norm()}};
+      LookAt(center + Eigen::Vector3f(std::cos(yaw), -0.2f, std::sin(yaw)),
+             &camera);
+      Cull(scene, GetViewProjMatrix(camera), &camera_stats);
+      for (const Cascade& cascade : ComputeCascades(sun, camera)) {
+        Cull(scene, cascade.view_projection_matrix, &shadow_stats);
+      }
+    }
+    std::ostringstream label;
+    label << name << ", cone weight " << cone_weight;
+    LOG(INFO) << label.str() << ": meshlets built in " << build_ms << " ms.";
+    LogRow(label.str() + ", camera", camera_stats);
+    LogRow(label.str() + ", sun cascades", shadow_stats);
+  }
+}
+
+int Run() {
+  Report("atrium", MakeAtrium());
+
+  if (!FLAGS_input.empty()) {
+    std::optional<Scene> scene = LoadScene(FLAGS_input);
+    if (!scene) {
+      LOG(ERROR) << "Failed to load scene: " << FLAGS_input;
+      return 1;
+    }
+    PartitionLooseGeometries(*scene);
+    ComputeSceneBoundingBoxes(*scene);
+    ClusterGeometries(*scene, {});
+    OptimizeScene(*scene);
+    Report(FLAGS_input.c_str(), *scene);
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace sh_renderer
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage(
+      "Meshlet culling report: frustum and cone culled triangles per view.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  int result = sh_renderer::Run();
+
+  gflags::ShutDownCommandLineFlags();
+  return result;
+}
@@ -0,0 +1,349 @@
+#include "occlusion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SH_OCCLUSION_X86 1
+#include <immintrin.h>
+#else
+#define SH_OCCLUSION_X86 0
+#endif
+
+namespace sh_renderer {
+
+namespace {
+
+constexpr uint32_t kFullTile = 0xFFFFFFFFu;
+constexpr float kFar = std::numeric_limits<float>::infinity();
+
+// A vertex after clipping: screen position in samples and depth (w).
+struct ScreenVertex {
+  float x;
+  float y;
+  float w;
+};
+
+// E(x, y) = a * (x - x0) + b * (y - y0), positive inside a counter-clockwise
+// triangle. Relative to a vertex, so it stays precise far from the origin.
+struct Edge {
+  float a;
+  float b;
+  float x0;
+  float y0;
+};
+
+// The tile holding sample coordinate `x`, clamped to the buffer.
+int TileIndex(float x, int tile_size, int num_tiles) {
+  const float clamped =
+      std::clamp(x, 0.0f, static_cast<float>(num_tiles * tile_size - 1));
+  return static_cast<int>(clamped) / tile_size;
+}
+
+Edge MakeEdge(const ScreenVertex& from, const ScreenVertex& to) {
+  return {from.y - to.y, to.x - from.x, from.x, from.y};
+}
+
+// The coverage mask of the tile whose lower left sample corner is
+// (`x`, `y`): sample (i, j) is at (x + i + 0.5, y + j + 0.5).
+uint32_t TileCoverage(const Edge edges[3], float x, float y) {
+#if SH_OCCLUSION_X86
+  const __m128 offsets_lo = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  const __m128 offsets_hi = _mm_setr_ps(4.5f, 5.5f, 6.5f, 7.5f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 step_lo[3], step_hi[3];
+  float row_base[3];
+  for (int e = 0; e < 3; ++e) {
+    const __m128 a = _mm_set1_ps(edges[e].a);
+    const __m128 dx = _mm_set1_ps(x - edges[e].x0);
+    step_lo[e] = _mm_mul_ps(a, _mm_add_ps(dx, offsets_lo));
+    step_hi[e] = _mm_mul_ps(a, _mm_add_ps(dx, offsets_hi));
+    row_base[e] = edges[e].b * (y + 0.5f - edges[e].y0);
+  }
+  uint32_t coverage = 0;
+  for (int row = 0; row < kOcclusionTileHeight; ++row) {
+    __m128 inside_lo = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    __m128 inside_hi = inside_lo;
+    for (int e = 0; e < 3; ++e) {
+      const __m128 base = _mm_set1_ps(row_base[e] + edges[e].b * row);
+      inside_lo = _mm_and_ps(
+          inside_lo, _mm_cmpge_ps(_mm_add_ps(step_lo[e], base), zero));
+      inside_hi = _mm_and_ps(
+          inside_hi, _mm_cmpge_ps(_mm_add_ps(step_hi[e], base), zero));
+    }
+    const uint32_t bits = static_cast<uint32_t>(_mm_movemask_ps(inside_lo)) |
+                          static_cast<uint32_t>(_mm_movemask_ps(inside_hi))
+                              << 4;
+    coverage |= bits << (row * kOcclusionTileWidth);
+  }
+  return coverage;
+#else
+  uint32_t coverage = 0;
+  for (int row = 0; row < kOcclusionTileHeight; ++row) {
+    for (int col = 0; col < kOcclusionTileWidth; ++col) {
+      bool inside = true;
+      for (int e = 0; e < 3; ++e) {
+        const float value =
+            edges[e].a * (x + col + 0.5f - edges[e].x0) +
+            edges[e].b * (y + row + 0.5f - edges[e].y0);
+        inside = inside && value >= 0.0f;
+      }
+      if (inside) coverage |= 1u << (col + row * kOcclusionTileWidth);
+    }
+  }
+  return coverage;
+#endif
+}
+
+// Merges a triangle covering `coverage` of tile `t` with farthest depth `z`.
+void UpdateTile(uint32_t coverage, float z, size_t t, OcclusionBuffer* buffer) {
+  float& z0 = buffer->z0[t];
+  float& z1 = buffer->z1[t];
+  uint32_t& mask = buffer->mask[t];
+  // A triangle much nearer than the working layer starts a new one: merging
+  // would leave the layer's depth far back when it fills the tile.
+  if (mask != 0 && z1 - z > z0 - z1) {
+    mask = 0;
+    z1 = 0.0f;
+  }
+  z1 = std::max(z1, z);
+  mask |= coverage;
+  if (mask == kFullTile) {
+    z0 = std::min(z0, z1);
+    z1 = 0.0f;
+    mask = 0;
+  }
+}
+
+void RasterizeTriangle(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2,
+                       OcclusionBuffer* buffer) {
+  float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+  if (!(std::abs(area) > 0.0f)) return;
+  if (area < 0.0f) {
+    std::swap(v1, v2);
+    area = -area;
+  }
+
+  const float min_x = std::min({v0.x, v1.x, v2.x});
+  const float max_x = std::max({v0.x, v1.x, v2.x});
+  const float min_y = std::min({v0.y, v1.y, v2.y});
+  const float max_y = std::max({v0.y, v1.y, v2.y});
+  if (max_x < 0.0f || max_y < 0.0f || min_x >= buffer->width ||
+      min_y >= buffer->height) {
+    return;
+  }
+  const int tx0 = TileIndex(min_x, kOcclusionTileWidth, buffer->tiles_x);
+  const int tx1 = TileIndex(max_x, kOcclusionTileWidth, buffer->tiles_x);
+  const int ty0 = TileIndex(min_y, kOcclusionTileHeight, buffer->tiles_y);
+  const int ty1 = TileIndex(max_y, kOcclusionTileHeight, buffer->tiles_y);
+
+  const Edge edges[3] = {MakeEdge(v0, v1), MakeEdge(v1, v2), MakeEdge(v2, v0)};
+  const float z_min = std::min({v0.w, v1.w, v2.w});
+  const float z_max = std::max({v0.w, v1.w, v2.w});
+
+  // 1/w is linear in screen space, so a tile's farthest point of the triangle
+  // is where the plane of 1/w is least over the tile: at one of its corners,
+  // and no farther than the farthest vertex.
+  const float q0 = 1.0f / v0.w;
+  const float dq1 = 1.0f / v1.w - q0;
+  const float dq2 = 1.0f / v2.w - q0;
+  const float dq_dx = (dq1 * (v2.y - v0.y) - dq2 * (v1.y - v0.y)) / area;
+  const float dq_dy = (dq2 * (v1.x - v0.x) - dq1 * (v2.x - v0.x)) / area;
+  const float corner_x = dq_dx >= 0.0f ? 0.0f : kOcclusionTileWidth;
+  const float corner_y = dq_dy >= 0.0f ? 0.0f : kOcclusionTileHeight;
+  const float q_min = 1.0f / z_max;
+
+  for (int ty = ty0; ty <= ty1; ++ty) {
+    for (int tx = tx0; tx <= tx1; ++tx) {
+      const size_t t = static_cast<size_t>(ty) * buffer->tiles_x + tx;
+      if (z_min >= buffer->z0[t]) continue;  // already hidden here
+      const float x = static_cast<float>(tx * kOcclusionTileWidth);
+      const float y = static_cast<float>(ty * kOcclusionTileHeight);
+      const uint32_t coverage = TileCoverage(edges, x, y);
+      if (coverage == 0) continue;
+      const float q = q0 + dq_dx * (x + corner_x - v0.x) +
+                      dq_dy * (y + corner_y - v0.y);
+      UpdateTile(coverage, 1.0f / std::max(q, q_min), t, buffer);
+    }
+  }
+}
+
+ScreenVertex ToScreen(const Eigen::Vector4f& clip,
+                      const OcclusionBuffer& buffer) {
+  const float inv_w = 1.0f / clip.w();
+  return {(clip.x() * inv_w * 0.5f + 0.5f) * buffer.width,
+          (clip.y() * inv_w * 0.5f + 0.5f) * buffer.height, clip.w()};
+}
+
+// The screen rectangle of a box's corners and their nearest depth.
+struct ScreenRect {
+  float min_x;
+  float max_x;
+  float min_y;
+  float max_y;
+  float z_min;
+};
+
+// Projects the corners of `box`: the min corner plus the box's extent along
+// each axis, in clip space. False if a corner is in front of the near plane.
+bool ProjectBox(const Eigen::Matrix4f& view_proj, const AABB& box,
+                const OcclusionBuffer& buffer, ScreenRect* rect) {
+  const Eigen::Vector3f size = box.max - box.min;
+  const Eigen::Vector4f origin = view_proj * box.min.homogeneous();
+  const Eigen::Vector4f dx = view_proj.col(0) * size.x();
+  const Eigen::Vector4f dy = view_proj.col(1) * size.y();
+  const Eigen::Vector4f dz = view_proj.col(2) * size.z();
+#if SH_OCCLUSION_X86
+  // One lane per corner: corners 0-3 in the low half and 4-7 (max z) in the
+  // high one, bit 0 of the lane selecting max x and bit 1 max y.
+  const __m128 select_x = _mm_setr_ps(0.0f, 1.0f, 0.0f, 1.0f);
+  const __m128 select_y = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+  __m128 lo[4], hi[4];
+  for (int c = 0; c < 4; ++c) {
+    lo[c] = _mm_add_ps(
+        _mm_set1_ps(origin[c]),
+        _mm_add_ps(_mm_mul_ps(select_x, _mm_set1_ps(dx[c])),
+                   _mm_mul_ps(select_y, _mm_set1_ps(dy[c]))));
+    hi[c] = _mm_add_ps(lo[c], _mm_set1_ps(dz[c]));
+  }
+  // z + w >= 0 and w > 0, written to fail on NaN.
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 in_front = _mm_and_ps(
+      _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(lo[2], lo[3]), zero),
+                 _mm_cmpge_ps(_mm_add_ps(hi[2], hi[3]), zero)),
+      _mm_and_ps(_mm_cmpgt_ps(lo[3], zero), _mm_cmpgt_ps(hi[3], zero)));
+  if (_mm_movemask_ps(in_front) != 0xF) return false;
+
+  const __m128 inv_w_lo = _mm_div_ps(_mm_set1_ps(1.0f), lo[3]);
+  const __m128 inv_w_hi = _mm_div_ps(_mm_set1_ps(1.0f), hi[3]);
+  auto screen = [](__m128 clip, __m128 inv_w, float size) {
+    const __m128 half = _mm_set1_ps(0.5f * size);
+    return _mm_add_ps(_mm_mul_ps(_mm_mul_ps(clip, inv_w), half), half);
+  };
+  const float width = static_cast<float>(buffer.width);
+  const float height = static_cast<float>(buffer.height);
+  const __m128 x_lo = screen(lo[0], inv_w_lo, width);
+  const __m128 x_hi = screen(hi[0], inv_w_hi, width);
+  const __m128 y_lo = screen(lo[1], inv_w_lo, height);
+  const __m128 y_hi = screen(hi[1], inv_w_hi, height);
+  auto reduce = [](__m128 v, auto op) {
+    v = op(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = op(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+  };
+  auto min = [](__m128 a, __m128 b) { return _mm_min_ps(a, b); };
+  auto max = [](__m128 a, __m128 b) { return _mm_max_ps(a, b); };
+  rect->min_x = reduce(_mm_min_ps(x_lo, x_hi), min);
+  rect->max_x = reduce(_mm_max_ps(x_lo, x_hi), max);
+  rect->min_y = reduce(_mm_min_ps(y_lo, y_hi), min);
+  rect->max_y = reduce(_mm_max_ps(y_lo, y_hi), max);
+  rect->z_min = reduce(_mm_min_ps(lo[3], hi[3]), min);
+  return true;
+#else
+  Eigen::Vector4f corners[8];
+  corners[0] = origin;
+  corners[1] = origin + dx;
+  corners[2] = origin + dy;
+  corners[3] = origin + dx + dy;
+  for (int corner = 0; corner < 4; ++corner) {
+    corners[corner + 4] = corners[corner] + dz;
+  }
+  *rect = {kFar, -kFar, kFar, -kFar, kFar};
+  for (const Eigen::Vector4f& clip : corners) {
+    if (!(clip.z() + clip.w() >= 0.0f) || !(clip.w() > 0.0f)) return false;
+    const ScreenVertex v = ToScreen(clip, buffer);
+    rect->min_x = std::min(rect->min_x, v.x);
+    rect->max_x = std::max(rect->max_x, v.x);
+    rect->min_y = std::min(rect->min_y, v.y);
+    rect->max_y = std::max(rect->max_y, v.y);
+    rect->z_min = std::min(rect->z_min, v.w);
+  }
+  return true;
+#endif
+}
+
+}  // namespace
+
+void ResetOcclusionBuffer(int width, int height, OcclusionBuffer* buffer) {
+  buffer->tiles_x = (width + kOcclusionTileWidth - 1) / kOcclusionTileWidth;
+  buffer->tiles_y = (height + kOcclusionTileHeight - 1) / kOcclusionTileHeight;
+  buffer->width = buffer->tiles_x * kOcclusionTileWidth;
+  buffer->height = buffer->tiles_y * kOcclusionTileHeight;
+  const size_t num_tiles =
+      static_cast<size_t>(buffer->tiles_x) * buffer->tiles_y;
+  buffer->z0.assign(num_tiles, kFar);
+  buffer->z1.assign(num_tiles, 0.0f);
+  buffer->mask.assign(num_tiles, 0);
+}
+
+size_t RasterizeOccluder(std::span<const Eigen::Vector3f> vertices,
+                         std::span<const uint32_t> indices,
+                         const Eigen::Matrix4f& to_clip,
+                         OcclusionBuffer* buffer) {
+  size_t rasterized = 0;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    Eigen::Vector4f clip[3];
+    for (int k = 0; k < 3; ++k) {
+      clip[k] = to_clip * vertices[indices[i + k]].homogeneous();
+    }
+
+    // Clip against the near plane, z + w >= 0: a triangle becomes at most a
+    // quad.
+    Eigen::Vector4f polygon[4];
+    int count = 0;
+    for (int k = 0; k < 3; ++k) {
+      const Eigen::Vector4f& a = clip[k];
+      const Eigen::Vector4f& b = clip[(k + 1) % 3];
+      const float da = a.z() + a.w();
+      const float db = b.z() + b.w();
+      if (da >= 0.0f) polygon[count++] = a;
+      if ((da >= 0.0f) != (db >= 0.0f)) {
+        polygon[count++] = a + (b - a) * (da / (da - db));
+      }
+    }
+    if (count < 3) continue;
+
+    ScreenVertex screen[4];
+    bool valid = true;
+    for (int k = 0; k < count; ++k) {
+      // On the near plane w is the near distance; a degenerate projection
+      // (w <= 0 there) cannot be rasterized.
+      if (!(polygon[k].w() > 0.0f)) valid = false;
+      screen[k] = ToScreen(polygon[k], *buffer);
+    }
+    if (!valid) continue;
+    for (int k = 1; k + 1 < count; ++k) {
+      RasterizeTriangle(screen[0], screen[k], screen[k + 1], buffer);
+    }
+    ++rasterized;
+  }
+  return rasterized;
+}
+
+bool IsAABBOccluded(const OcclusionBuffer& buffer,
+                    const Eigen::Matrix4f& view_proj, const AABB& box) {
+  ScreenRect rect;
+  if (!ProjectBox(view_proj, box, buffer, &rect)) return false;
+  const float min_x = rect.min_x, max_x = rect.max_x;
+  const float min_y = rect.min_y, max_y = rect.max_y;
+  const float z_min = rect.z_min;
+  if (max_x < 0.0f || max_y < 0.0f || min_x >= buffer.width ||
+      min_y >= buffer.height) {
+    return false;
+  }
+
+  const int tx0 = TileIndex(min_x, kOcclusionTileWidth, buffer.tiles_x);
+  const int tx1 = TileIndex(max_x, kOcclusionTileWidth, buffer.tiles_x);
+  const int ty0 = TileIndex(min_y, kOcclusionTileHeight, buffer.tiles_y);
+  const int ty1 = TileIndex(max_y, kOcclusionTileHeight, buffer.tiles_y);
+  for (int ty = ty0; ty <= ty1; ++ty) {
+    const float* z0 = &buffer.z0[static_cast<size_t>(ty) * buffer.tiles_x];
+    for (int tx = tx0; tx <= tx1; ++tx) {
+      if (z_min <= z0[tx]) return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace sh_renderer
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "culling.h"
+
+namespace sh_renderer {
+
+// --- Software occlusion culling ---
+// A low-resolution depth buffer on the CPU, in the style of masked occlusion
+// culling (Andersson et al.): the occluders' triangles are rasterized into
+// tiles of 8x4 samples, each keeping a 32-bit coverage mask instead of
+// per-sample depths. A tile has two layers: z0, beyond which everything in the
+// tile is hidden, and a working layer of the samples covered so far with
+// their farthest depth z1. When the working layer covers the whole tile, it
+// becomes the new z0. Bounding boxes are then tested against z0.
+//
+// Depth is the clip-space w, the distance along the view direction. A
+// triangle enters a tile's working layer with its farthest depth over the
+// tile.
+
+constexpr int kOcclusionTileWidth = 8;
+constexpr int kOcclusionTileHeight = 4;
+
+// The renderer's buffer size, in samples.
+constexpr int kOcclusionBufferWidth = 256;
+constexpr int kOcclusionBufferHeight = 128;
+
+struct OcclusionBuffer {
+  int width = 0;  // samples, multiples of the tile size
+  int height = 0;
+  int tiles_x = 0;
+  int tiles_y = 0;
+  // Per tile, row major from the bottom left.
+  std::vector<float> z0;
+  std::vector<float> z1;
+  std::vector<uint32_t> mask;  // bit x + 8 * y for sample (x, y) of the tile
+};
+
+// Sizes `buffer` to `width` x `height` samples, rounded up to whole tiles, and
+// clears it: nothing is hidden.
+void ResetOcclusionBuffer(int width, int height, OcclusionBuffer* buffer);
+
+// Rasterizes the triangles `indices` of `vertices` into `buffer`, `to_clip`
+// taking the vertices to GL clip space. Triangles are clipped against the near
+// plane and occlude with either winding. Returns the number rasterized.
+size_t RasterizeOccluder(std::span<const Eigen::Vector3f> vertices,
+                         std::span<const uint32_t> indices,
+                         const Eigen::Matrix4f& to_clip,
+                         OcclusionBuffer* buffer);
+
+// Whether `box` is hidden in every tile its screen rectangle under `view_proj`
+// overlaps. Boxes crossing the near plane or off screen are never hidden.
+bool IsAABBOccluded(const OcclusionBuffer& buffer,
+                    const Eigen::Matrix4f& view_proj, const AABB& box);
+
+}  // namespace sh_renderer
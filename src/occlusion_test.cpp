@@ -0,0 +1,110 @@
+#include "occlusion.h"
+
+#include <gtest/gtest.h>
+
+#include "camera.h"
+
+namespace sh_renderer {
+namespace {
+
+AABB Box(const Eigen::Vector3f& min, const Eigen::Vector3f& max) {
+  AABB box;
+  box.min = min;
+  box.max = max;
+  return box;
+}
+
+// The view of a camera at the origin looking down -Z.
+Eigen::Matrix4f TestViewProj() {
+  return GetViewProjMatrix(
+      Camera{.position = Eigen::Vector3f::Zero(),
+             .orientation = Eigen::Quaternionf::Identity()});
+}
+
+// A quad facing the camera at depth `z`, spanning [x0, x1] x [y0, y1].
+struct Quad {
+  std::vector<Eigen::Vector3f> vertices;
+  std::vector<uint32_t> indices = {0, 1, 2, 0, 2, 3};
+};
+
+Quad MakeQuad(float x0, float x1, float y0, float y1, float z) {
+  return {.vertices = {{x0, y0, z}, {x1, y0, z}, {x1, y1, z}, {x0, y1, z}}};
+}
+
+OcclusionBuffer RasterizeQuad(const Quad& quad) {
+  OcclusionBuffer buffer;
+  ResetOcclusionBuffer(kOcclusionBufferWidth, kOcclusionBufferHeight, &buffer);
+  EXPECT_EQ(RasterizeOccluder(quad.vertices, quad.indices, TestViewProj(),
+                              &buffer),
+            2u);
+  return buffer;
+}
+
+TEST(OcclusionTest, ResetRoundsToTilesAndHidesNothing) {
+  OcclusionBuffer buffer;
+  ResetOcclusionBuffer(30, 10, &buffer);
+  EXPECT_EQ(buffer.width, 32);
+  EXPECT_EQ(buffer.height, 12);
+  EXPECT_EQ(buffer.tiles_x, 4);
+  EXPECT_EQ(buffer.tiles_y, 3);
+  EXPECT_FALSE(IsAABBOccluded(buffer, TestViewProj(),
+                              Box({-1, -1, -100}, {1, 1, -99})));
+}
+
+TEST(OcclusionTest, FullScreenQuadHidesWhatIsBehindIt) {
+  const OcclusionBuffer buffer =
+      RasterizeQuad(MakeQuad(-100, 100, -100, 100, -5));
+  const Eigen::Matrix4f view_proj = TestViewProj();
+  EXPECT_TRUE(IsAABBOccluded(buffer, view_proj, Box({-1, -1, -9}, {1, 1, -7})));
+  EXPECT_FALSE(
+      IsAABBOccluded(buffer, view_proj, Box({-1, -1, -4}, {1, 1, -3})));
+  // Straddling the quad.
+  EXPECT_FALSE(
+      IsAABBOccluded(buffer, view_proj, Box({-1, -1, -6}, {1, 1, -4})));
+}
+
+TEST(OcclusionTest, PartialOccluderHidesOnlyWhatItCovers) {
+  // The left half of the screen.
+  const OcclusionBuffer buffer =
+      RasterizeQuad(MakeQuad(-100, 0, -100, 100, -5));
+  const Eigen::Matrix4f view_proj = TestViewProj();
+  EXPECT_TRUE(
+      IsAABBOccluded(buffer, view_proj, Box({-6, -1, -21}, {-3, 1, -20})));
+  EXPECT_FALSE(
+      IsAABBOccluded(buffer, view_proj, Box({3, -1, -21}, {6, 1, -20})));
+  // Across the quad's edge.
+  EXPECT_FALSE(
+      IsAABBOccluded(buffer, view_proj, Box({-3, -1, -21}, {3, 1, -20})));
+}
+
+TEST(OcclusionTest, EitherWindingOccludes) {
+  Quad quad = MakeQuad(-100, 100, -100, 100, -5);
+  quad.indices = {0, 2, 1, 0, 3, 2};
+  const OcclusionBuffer buffer = RasterizeQuad(quad);
+  EXPECT_TRUE(IsAABBOccluded(buffer, TestViewProj(),
+                             Box({-1, -1, -9}, {1, 1, -7})));
+}
+
+TEST(OcclusionTest, OccludersCrossingTheNearPlaneAreClipped) {
+  // A floor under the camera, from behind it to far ahead.
+  Quad floor;
+  floor.vertices = {{-50, -1, 5}, {50, -1, 5}, {50, -1, -50}, {-50, -1, -50}};
+  const OcclusionBuffer buffer = RasterizeQuad(floor);
+  const Eigen::Matrix4f view_proj = TestViewProj();
+  // Under the floor.
+  EXPECT_TRUE(
+      IsAABBOccluded(buffer, view_proj, Box({-1, -3, -11}, {1, -2, -10})));
+  // Above it.
+  EXPECT_FALSE(
+      IsAABBOccluded(buffer, view_proj, Box({-1, 0, -11}, {1, 1, -10})));
+}
+
+TEST(OcclusionTest, BoxesCrossingTheNearPlaneAreNeverHidden) {
+  const OcclusionBuffer buffer =
+      RasterizeQuad(MakeQuad(-100, 100, -100, 100, -5));
+  EXPECT_FALSE(IsAABBOccluded(buffer, TestViewProj(),
+                              Box({-1, -1, -9}, {1, 1, 1})));
+}
+
+}  // namespace
+}  // namespace sh_renderer
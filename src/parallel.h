@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace sh_renderer {
+
+// Returns the number of worker threads to use when the caller asks for 0
+// ("all cores"). Never returns 0.
+unsigned DefaultThreadCount();
+
+// Calls `fn(i)` for every i in [0, count) on up to `num_threads` worker threads
+// (0 means DefaultThreadCount()) and blocks until all calls have returned.
+// Work items are handed out one at a time, so uneven item costs balance across
+// the workers. With one thread (or one item) everything runs on the caller's
+// thread. `fn` must be safe to call concurrently for distinct indices.
+void ParallelFor(size_t count, unsigned num_threads,
+                 const std::function<void(size_t)>& fn);
+
+}  // namespace sh_renderer
@@ -0,0 +1,33 @@
+#include "parallel.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+namespace sh_renderer {
+namespace {
+
+TEST(ParallelTest, VisitsEveryIndexOnce) {
+  for (unsigned threads : {0u, 1u, 3u, 16u}) {
+    std::vector<std::atomic<int>> visits(1000);
+    ParallelFor(visits.size(), threads, [&](size_t i) { visits[i]++; });
+    for (size_t i = 0; i < visits.size(); ++i) {
+      ASSERT_EQ(visits[i].load(), 1) << "index " << i << ", threads "
+                                     << threads;
+    }
+  }
+}
+
+TEST(ParallelTest, EmptyRangeIsNoOp) {
+  bool called = false;
+  ParallelFor(0, 4, [&](size_t) { called = true; });
+  EXPECT_FALSE(called);
+}
+
+TEST(ParallelTest, DefaultThreadCountIsPositive) {
+  EXPECT_GT(DefaultThreadCount(), 0u);
+}
+
+}  // namespace
+}  // namespace sh_renderer
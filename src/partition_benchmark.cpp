@@ -0,0 +1,179 @@
+// Benchmark of PartitionLooseGeometries, which splits each geometry into its
+// connected components and merges the components whose centers are within
+// 0.1 m. The merge step, GroupNearbyPoints, is timed against the pair loop it
+// replaced on --min_components up to --max_components random component
+// centers, growing 4x per step (to 1M by default), and both are checked to
+// agree; the pair loop is skipped above --max_pair_components. The whole
+// partitioning is then timed on a synthetic scene of --num_geometries
+// geometries, each a field of loose triangles, with one thread and with
+// --threads.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+
+DEFINE_uint32(min_components, 1000, "Smallest component count.");
+DEFINE_uint32(max_components, 1000000, "Largest component count.");
+DEFINE_uint32(max_pair_components, 20000,
+              "Largest component count timed with the pair loop.");
+DEFINE_uint32(num_geometries, 64, "Geometries in the scene benchmark.");
+DEFINE_uint32(triangles_per_geometry, 20000,
+              "Loose triangles per geometry in the scene benchmark.");
+DEFINE_uint32(threads, 0, "Threads of the parallel run; 0 uses every core.");
+
+namespace sh_renderer {
+namespace {
+
+constexpr float kMergeDistance = 0.1f;
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Points at the density of a cluttered scene: about one point per 0.2 m cube,
+// so that a good share of them merge.
+std::vector<Eigen::Vector3f> MakeRandomPoints(uint32_t count) {
+  std::mt19937 rng(count);
+  const float extent = 0.2f * std::cbrt(static_cast<float>(count));
+  std::uniform_real_distribution<float> position(0.0f, extent);
+  std::vector<Eigen::Vector3f> points(count);
+  for (auto& p : points) p = {position(rng), position(rng), position(rng)};
+  return points;
+}
+
+// The pair loop PartitionLooseGeometries merged components with, labelling the
+// groups as GroupNearbyPoints does.
+std::vector<uint32_t> GroupByPairLoop(
+    const std::vector<Eigen::Vector3f>& points, float distance) {
+  const size_t n = points.size();
+  std::vector<uint32_t> parent(n);
+  std::iota(parent.begin(), parent.end(), 0u);
+  auto find = [&](uint32_t i) {
+    while (parent[i] != i) i = parent[i] = parent[parent[i]];
+    return i;
+  };
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = i + 1; j < n; ++j) {
+      if ((points[i] - points[j]).norm() <= distance) {
+        parent[find(j)] = find(i);
+      }
+    }
+  }
+  std::vector<uint32_t> groups(n);
+  std::vector<uint32_t> root_group(n, UINT32_MAX);
+  uint32_t next_group = 0;
+  for (size_t i = 0; i < n; ++i) {
+    uint32_t& group = root_group[find(i)];
+    if (group == UINT32_MAX) group = next_group++;
+    groups[i] = group;
+  }
+  return groups;
+}
+
+void RunGrouping() {
+  std::vector<uint32_t> counts;
+  for (uint64_t count = FLAGS_min_components; count < FLAGS_max_components;
+       count *= 4) {
+    counts.push_back(static_cast<uint32_t>(count));
+  }
+  counts.push_back(FLAGS_max_components);
+
+  for (uint32_t count : counts) {
+    const std::vector<Eigen::Vector3f> points = MakeRandomPoints(count);
+    auto start = std::chrono::steady_clock::now();
+    const std::vector<uint32_t> groups =
+        GroupNearbyPoints(points, kMergeDistance);
+    const double grid_ms = MillisecondsSince(start);
+    const uint32_t num_groups =
+        groups.empty() ? 0
+                       : *std::max_element(groups.begin(), groups.end()) + 1;
+
+    if (count > FLAGS_max_pair_components) {
+      LOG(INFO) << count << " components -> " << num_groups
+                << " groups: grid hash " << grid_ms
+                << " ms, pair loop skipped.";
+      continue;
+    }
+    start = std::chrono::steady_clock::now();
+    const std::vector<uint32_t> expected =
+        GroupByPairLoop(points, kMergeDistance);
+    const double pair_ms = MillisecondsSince(start);
+    CHECK(groups == expected) << "Grid hash and pair loop disagree at "
+                              << count << " components.";
+    LOG(INFO) << count << " components -> " << num_groups
+              << " groups: grid hash " << grid_ms << " ms, pair loop "
+              << pair_ms << " ms (" << pair_ms / std::max(grid_ms, 1e-3)
+              << "x).";
+  }
+}
+
+// Geometries of loose triangles 0.15 m apart in a row, every other one close
+// enough to its neighbour to merge.
+Scene MakeScene() {
+  Scene scene;
+  const uint32_t triangles = FLAGS_triangles_per_geometry;
+  for (uint32_t g = 0; g < FLAGS_num_geometries; ++g) {
+    Geometry geo;
+    geo.material_id = 0;
+    geo.vertices.reserve(3 * triangles);
+    for (uint32_t t = 0; t < triangles; ++t) {
+      const float x = 0.15f * t - (t % 2 ? 0.1f : 0.0f);
+      const Eigen::Vector3f origin(x, static_cast<float>(g), 0.0f);
+      geo.vertices.push_back(origin);
+      geo.vertices.push_back(origin + Eigen::Vector3f(0.01f, 0, 0));
+      geo.vertices.push_back(origin + Eigen::Vector3f(0, 0.01f, 0));
+    }
+    geo.normals.assign(geo.vertices.size(), Eigen::Vector3f::UnitZ());
+    geo.indices.resize(geo.vertices.size());
+    std::iota(geo.indices.begin(), geo.indices.end(), 0u);
+    scene.geometries.push_back(std::move(geo));
+  }
+  return scene;
+}
+
+void RunPartition() {
+  const Scene scene = MakeScene();
+  size_t serial_count = 0;
+  for (unsigned threads : {1u, FLAGS_threads}) {
+    Scene copy = scene;
+    const auto start = std::chrono::steady_clock::now();
+    PartitionLooseGeometries(copy, threads);
+    const double ms = MillisecondsSince(start);
+    if (threads == 1) serial_count = copy.geometries.size();
+    CHECK_EQ(copy.geometries.size(), serial_count);
+    LOG(INFO) << "PartitionLooseGeometries, "
+              << (threads == 0 ? "all" : std::to_string(threads))
+              << " thread(s): " << scene.geometries.size() << " geometries of "
+              << FLAGS_triangles_per_geometry << " triangles -> "
+              << copy.geometries.size() << " in " << ms << " ms.";
+  }
+}
+
+}  // namespace
+}  // namespace sh_renderer
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage(
+      "Loose geometry partitioning benchmark: grid hash vs pair loop.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  sh_renderer::RunGrouping();
+  sh_renderer::RunPartition();
+
+  gflags::ShutDownCommandLineFlags();
+  return 0;
+}
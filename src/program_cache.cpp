@@ -0,0 +1,157 @@
+#include "program_cache.h"
+
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <fstream>
+
+#include "fnv1a.h"
+#include "glad.h"
+
+namespace sh_renderer {
+
+namespace {
+
+// File layout: ProgramBinaryHeader, then `size` bytes of binary.
+constexpr uint32_t kProgramBinaryMagic = 0x42505348;  // "SHPB"
+constexpr uint32_t kProgramBinaryVersion = 1;
+
+struct ProgramBinaryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t format;
+  uint32_t reserved;
+  uint64_t size;
+};
+static_assert(sizeof(ProgramBinaryHeader) == 32);
+
+// Length-prefixed, so adjacent strings can't alias ("ab" + "c" vs "a" + "bc").
+uint64_t HashString(std::string_view s, uint64_t hash) {
+  const uint64_t size = s.size();
+  hash = Fnv1a(&size, sizeof(size), hash);
+  return Fnv1a(s.data(), s.size(), hash);
+}
+
+std::filesystem::path& CacheDirectory() {
+  static std::filesystem::path dir;
+  return dir;
+}
+
+}  // namespace
+
+uint64_t ProgramCacheKey(std::span<const std::string_view> stages,
+                         const std::map<std::string, std::string>& macros,
+                         std::string_view driver) {
+  uint64_t hash = kFnvOffsetBasis;
+  hash = HashString(driver, hash);
+  const uint64_t num_stages = stages.size();
+  hash = Fnv1a(&num_stages, sizeof(num_stages), hash);
+  for (std::string_view source : stages) hash = HashString(source, hash);
+  for (const auto& [name, value] : macros) {
+    hash = HashString(name, hash);
+    hash = HashString(value, hash);
+  }
+  return hash;
+}
+
+std::string GetDriverIdentity() {
+  auto get = [](GLenum name) {
+    const GLubyte* s = glGetString(name);
+    return s ? std::string(reinterpret_cast<const char*>(s)) : std::string();
+  };
+  return get(GL_VENDOR) + "\n" + get(GL_RENDERER) + "\n" + get(GL_VERSION);
+}
+
+std::filesystem::path ProgramCachePath(const std::filesystem::path& cache_dir,
+                                       uint64_t key) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.glbin",
+                static_cast<unsigned long long>(key));
+  return cache_dir / name;
+}
+
+bool WriteProgramBinary(const std::filesystem::path& file, uint64_t key,
+                        const ProgramBinary& binary) {
+  std::error_code ec;
+  if (file.has_parent_path()) {
+    std::filesystem::create_directories(file.parent_path(), ec);
+  }
+
+  ProgramBinaryHeader header = {
+      .magic = kProgramBinaryMagic,
+      .version = kProgramBinaryVersion,
+      .key = key,
+      .format = binary.format,
+      .reserved = 0,
+      .size = binary.data.size(),
+  };
+
+  std::filesystem::path tmp_file = file;
+  tmp_file += ".tmp";
+  {
+    std::ofstream out(tmp_file, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      LOG(WARNING) << "WriteProgramBinary: cannot open " << tmp_file;
+      return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(binary.data.data()),
+              binary.data.size());
+    if (!out) {
+      LOG(WARNING) << "WriteProgramBinary: failed writing " << tmp_file;
+      std::filesystem::remove(tmp_file, ec);
+      return false;
+    }
+  }
+
+  std::filesystem::rename(tmp_file, file, ec);
+  if (ec) {
+    LOG(WARNING) << "WriteProgramBinary: cannot rename " << tmp_file << " to "
+                 << file << ": " << ec.message();
+    std::filesystem::remove(tmp_file, ec);
+    return false;
+  }
+  return true;
+}
+
+std::optional<ProgramBinary> ReadProgramBinary(
+    const std::filesystem::path& file, uint64_t key) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) return std::nullopt;
+
+  ProgramBinaryHeader header;
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    return std::nullopt;
+  }
+  if (header.magic != kProgramBinaryMagic ||
+      header.version != kProgramBinaryVersion || header.key != key) {
+    return std::nullopt;
+  }
+  std::error_code ec;
+  const uintmax_t file_size = std::filesystem::file_size(file, ec);
+  if (ec || header.size != file_size - sizeof(header)) return std::nullopt;
+
+  ProgramBinary binary;
+  binary.format = header.format;
+  binary.data.resize(header.size);
+  if (!in.read(reinterpret_cast<char*>(binary.data.data()), header.size)) {
+    return std::nullopt;
+  }
+  return binary;
+}
+
+void SetProgramCacheDirectory(const std::filesystem::path& cache_dir) {
+  CacheDirectory() = cache_dir;
+}
+
+const std::filesystem::path& GetProgramCacheDirectory() {
+  return CacheDirectory();
+}
+
+ProgramCacheStats& GetProgramCacheStats() {
+  static ProgramCacheStats stats;
+  return stats;
+}
+
+}  // namespace sh_renderer
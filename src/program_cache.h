@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sh_renderer {
+
+// --- Program binary cache ---
+// Linked programs are saved with glGetProgramBinary and restored with
+// glProgramBinary on the next run, skipping GLSL compilation. Each binary is a
+// file in the cache directory named after its key, a hash of everything that
+// determines the binary: the include-resolved stage sources, the macros and the
+// driver. The driver may still reject a binary (e.g. after an update that kept
+// its version string); the program is then compiled and the file rewritten.
+
+// A program binary as returned by glGetProgramBinary.
+struct ProgramBinary {
+  uint32_t format = 0;  // GLenum binary format
+  std::vector<uint8_t> data;
+};
+
+// Hashes the program's inputs into its cache key (pure CPU; no GL). `stages`
+// are the include-resolved sources in attachment order; `driver` identifies
+// the GL implementation (see GetDriverIdentity).
+uint64_t ProgramCacheKey(std::span<const std::string_view> stages,
+                         const std::map<std::string, std::string>& macros,
+                         std::string_view driver);
+
+// Returns the GL vendor, renderer and version strings of the current context,
+// newline separated.
+std::string GetDriverIdentity();
+
+// Returns the cache file of `key` in `cache_dir`.
+std::filesystem::path ProgramCachePath(const std::filesystem::path& cache_dir,
+                                       uint64_t key);
+
+// Writes `binary` tagged with `key` to `file`, creating its directory. The file
+// is written to a temporary name and renamed into place. Returns false on I/O
+// failure.
+bool WriteProgramBinary(const std::filesystem::path& file, uint64_t key,
+                        const ProgramBinary& binary);
+
+// Reads the binary in `file`. Returns std::nullopt if the file is missing,
+// malformed, or tagged with a key other than `key`.
+std::optional<ProgramBinary> ReadProgramBinary(
+    const std::filesystem::path& file, uint64_t key);
+
+// Sets the directory ShaderProgram::Create* use for program binaries. Empty
+// (the default) disables the cache.
+void SetProgramCacheDirectory(const std::filesystem::path& cache_dir);
+const std::filesystem::path& GetProgramCacheDirectory();
+
+// Counts of how the programs created so far were obtained. Reset by the caller.
+struct ProgramCacheStats {
+  uint32_t hits = 0;      // restored from a cached binary
+  uint32_t compiles = 0;  // compiled from source
+  uint32_t rejected = 0;  // cached binaries the driver refused
+};
+
+ProgramCacheStats& GetProgramCacheStats();
+
+}  // namespace sh_renderer
@@ -0,0 +1,70 @@
+#include "program_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+namespace sh_renderer {
+namespace {
+
+std::filesystem::path MakeDir(const std::string& name) {
+  auto dir =
+      std::filesystem::temp_directory_path() / ("sh_program_cache_" + name);
+  std::filesystem::remove_all(dir);
+  return dir;
+}
+
+TEST(ProgramCacheTest, KeyCoversSourcesMacrosAndDriver) {
+  const std::string_view vs = "void main() {}";
+  const std::string_view fs = "out vec4 c; void main() { c = vec4(1); }";
+  const std::string_view stages[] = {vs, fs};
+  const uint64_t key = ProgramCacheKey(stages, {{"CUTOUT", "1"}}, "driver");
+
+  EXPECT_EQ(key, ProgramCacheKey(stages, {{"CUTOUT", "1"}}, "driver"));
+  EXPECT_NE(key, ProgramCacheKey(stages, {{"CUTOUT", "0"}}, "driver"));
+  EXPECT_NE(key, ProgramCacheKey(stages, {}, "driver"));
+  EXPECT_NE(key, ProgramCacheKey(stages, {{"CUTOUT", "1"}}, "driver 2"));
+
+  const std::string_view swapped[] = {fs, vs};
+  EXPECT_NE(key, ProgramCacheKey(swapped, {{"CUTOUT", "1"}}, "driver"));
+
+  // Moving text across the stage boundary changes the key.
+  const std::string_view a[] = {"ab", "c"};
+  const std::string_view b[] = {"a", "bc"};
+  EXPECT_NE(ProgramCacheKey(a, {}, ""), ProgramCacheKey(b, {}, ""));
+}
+
+TEST(ProgramCacheTest, BinaryRoundTrip) {
+  auto dir = MakeDir("round_trip");
+  const std::filesystem::path file = ProgramCachePath(dir, 0x1234);
+  EXPECT_EQ(file.filename(), "0000000000001234.glbin");
+
+  ProgramBinary binary;
+  binary.format = 0x8741;
+  binary.data = {1, 2, 3, 4, 5};
+  ASSERT_TRUE(WriteProgramBinary(file, 0x1234, binary));  // creates `dir`
+
+  std::optional<ProgramBinary> read = ReadProgramBinary(file, 0x1234);
+  ASSERT_TRUE(read.has_value());
+  EXPECT_EQ(read->format, binary.format);
+  EXPECT_EQ(read->data, binary.data);
+
+  // Another key (e.g. a hash collision on the file name) is a miss.
+  EXPECT_FALSE(ReadProgramBinary(file, 0x5678).has_value());
+  EXPECT_FALSE(ReadProgramBinary(dir / "missing.glbin", 0x1234).has_value());
+  std::filesystem::remove_all(dir);
+}
+
+TEST(ProgramCacheTest, RejectsTruncatedFile) {
+  auto dir = MakeDir("truncated");
+  const std::filesystem::path file = ProgramCachePath(dir, 7);
+  ProgramBinary binary;
+  binary.data.assign(64, 0xab);
+  ASSERT_TRUE(WriteProgramBinary(file, 7, binary));
+  std::filesystem::resize_file(file, std::filesystem::file_size(file) - 1);
+  EXPECT_FALSE(ReadProgramBinary(file, 7).has_value());
+  std::filesystem::remove_all(dir);
+}
+
+}  // namespace
+}  // namespace sh_renderer
@@ -0,0 +1,217 @@
+#include "pvs.h"
+
+#include <glog/logging.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace sh_renderer {
+
+namespace {
+
+// File layout:
+//   PvsHeader
+//   zlib stream of the cells' bitsets, each XORed with the previous cell's
+constexpr uint32_t kPvsMagic = 0x56504853;  // "SHPV"
+// Bound the allocation a corrupt header can ask for.
+constexpr int kMaxPvsCellsPerAxis = 4096;
+constexpr size_t kMaxPvsWords = size_t{1} << 28;
+
+struct PvsHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_hash;
+  uint32_t num_geometries;
+  int32_t cells[3];
+  float bounds_min[3];
+  float bounds_max[3];
+  uint64_t compressed_size;
+};
+static_assert(sizeof(PvsHeader) == 64);
+
+uint32_t WordsPerCell(uint32_t num_geometries) {
+  return (num_geometries + 63) / 64;
+}
+
+}  // namespace
+
+Pvs MakePvsGrid(const AABB& bounds, float cell_size, int max_cells_per_axis,
+                uint32_t num_geometries) {
+  CHECK_GT(cell_size, 0.0f);
+  CHECK_GT(max_cells_per_axis, 0);
+  Pvs pvs;
+  pvs.bounds = bounds;
+  const Eigen::Vector3f extent = (bounds.max - bounds.min).cwiseMax(0.0f);
+  for (int axis = 0; axis < 3; ++axis) {
+    const float cells = std::ceil(extent[axis] / cell_size);
+    pvs.cells[axis] = static_cast<int>(
+        std::clamp(cells, 1.0f, static_cast<float>(max_cells_per_axis)));
+  }
+  pvs.num_geometries = num_geometries;
+  pvs.words_per_cell = WordsPerCell(num_geometries);
+  pvs.visible.assign(PvsCellCount(pvs) * pvs.words_per_cell, 0);
+  return pvs;
+}
+
+AABB PvsCellBounds(const Pvs& pvs, const Eigen::Vector3i& cell) {
+  const Eigen::Vector3f step = (pvs.bounds.max - pvs.bounds.min)
+                                   .cwiseQuotient(pvs.cells.cast<float>());
+  AABB box;
+  box.min = pvs.bounds.min + step.cwiseProduct(cell.cast<float>());
+  box.max = pvs.bounds.min +
+            step.cwiseProduct((cell + Eigen::Vector3i::Ones()).cast<float>());
+  return box;
+}
+
+int FindPvsCell(const Pvs& pvs, const Eigen::Vector3f& position) {
+  if (pvs.visible.empty()) return -1;
+  int index = 0;
+  int stride = 1;
+  for (int axis = 0; axis < 3; ++axis) {
+    const float min = pvs.bounds.min[axis];
+    const float max = pvs.bounds.max[axis];
+    if (!(position[axis] >= min && position[axis] <= max)) return -1;
+    int cell = 0;
+    if (max > min) {
+      cell = static_cast<int>((position[axis] - min) / (max - min) *
+                              pvs.cells[axis]);
+      cell = std::min(cell, pvs.cells[axis] - 1);
+    }
+    index += cell * stride;
+    stride *= pvs.cells[axis];
+  }
+  return index;
+}
+
+std::filesystem::path PvsPath(const std::filesystem::path& gltf_file) {
+  std::filesystem::path pvs_file = gltf_file;
+  pvs_file.replace_extension(".shpvs");
+  return pvs_file;
+}
+
+bool WritePvs(const Pvs& pvs, uint64_t source_hash,
+              const std::filesystem::path& pvs_file) {
+  CHECK_EQ(pvs.visible.size(), PvsCellCount(pvs) * pvs.words_per_cell);
+  std::vector<uint64_t> delta = pvs.visible;
+  for (size_t i = delta.size(); i-- > pvs.words_per_cell;) {
+    delta[i] ^= pvs.visible[i - pvs.words_per_cell];
+  }
+
+  const uLong raw_size = static_cast<uLong>(delta.size() * sizeof(uint64_t));
+  uLongf compressed_size = compressBound(raw_size);
+  std::vector<Bytef> compressed(compressed_size);
+  if (compress2(compressed.data(), &compressed_size,
+                reinterpret_cast<const Bytef*>(delta.data()), raw_size,
+                Z_BEST_COMPRESSION) != Z_OK) {
+    LOG(WARNING) << "WritePvs: cannot compress " << pvs_file;
+    return false;
+  }
+
+  PvsHeader header = {
+      .magic = kPvsMagic,
+      .version = kPvsVersion,
+      .source_hash = source_hash,
+      .num_geometries = pvs.num_geometries,
+      .cells = {pvs.cells.x(), pvs.cells.y(), pvs.cells.z()},
+      .bounds_min = {pvs.bounds.min.x(), pvs.bounds.min.y(),
+                     pvs.bounds.min.z()},
+      .bounds_max = {pvs.bounds.max.x(), pvs.bounds.max.y(),
+                     pvs.bounds.max.z()},
+      .compressed_size = compressed_size,
+  };
+
+  std::filesystem::path tmp_file = pvs_file;
+  tmp_file += ".tmp";
+  {
+    std::ofstream out(tmp_file, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      LOG(WARNING) << "WritePvs: cannot open " << tmp_file;
+      return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(compressed.data()),
+              compressed_size);
+    if (!out) {
+      LOG(WARNING) << "WritePvs: failed writing " << tmp_file;
+      std::filesystem::remove(tmp_file);
+      return false;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp_file, pvs_file, ec);
+  if (ec) {
+    LOG(WARNING) << "WritePvs: cannot rename " << tmp_file << " to "
+                 << pvs_file << ": " << ec.message();
+    std::filesystem::remove(tmp_file, ec);
+    return false;
+  }
+  return true;
+}
+
+std::optional<Pvs> ReadPvs(const std::filesystem::path& pvs_file,
+                           uint64_t source_hash) {
+  std::ifstream file(pvs_file, std::ios::binary);
+  if (!file) return std::nullopt;
+  const std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                                std::istreambuf_iterator<char>());
+
+  if (bytes.size() < sizeof(PvsHeader)) return std::nullopt;
+  PvsHeader header;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (header.magic != kPvsMagic) {
+    LOG(WARNING) << "ReadPvs: " << pvs_file << " is not a PVS file";
+    return std::nullopt;
+  }
+  if (header.version != kPvsVersion) {
+    LOG(INFO) << "ReadPvs: " << pvs_file << " has version " << header.version
+              << ", expected " << kPvsVersion;
+    return std::nullopt;
+  }
+  if (header.source_hash != source_hash) {
+    LOG(INFO) << "ReadPvs: " << pvs_file << " is stale";
+    return std::nullopt;
+  }
+  if (header.compressed_size != bytes.size() - sizeof(PvsHeader)) {
+    LOG(WARNING) << "ReadPvs: " << pvs_file << " is truncated";
+    return std::nullopt;
+  }
+
+  Pvs pvs;
+  pvs.cells = Eigen::Vector3i(header.cells[0], header.cells[1],
+                              header.cells[2]);
+  pvs.bounds.min = Eigen::Vector3f(header.bounds_min[0], header.bounds_min[1],
+                                   header.bounds_min[2]);
+  pvs.bounds.max = Eigen::Vector3f(header.bounds_max[0], header.bounds_max[1],
+                                   header.bounds_max[2]);
+  pvs.num_geometries = header.num_geometries;
+  pvs.words_per_cell = WordsPerCell(header.num_geometries);
+  if (pvs.cells.minCoeff() < 1 || pvs.cells.maxCoeff() > kMaxPvsCellsPerAxis ||
+      PvsCellCount(pvs) * pvs.words_per_cell > kMaxPvsWords ||
+      !(pvs.bounds.min.array() <= pvs.bounds.max.array()).all()) {
+    LOG(WARNING) << "ReadPvs: " << pvs_file << " is corrupt";
+    return std::nullopt;
+  }
+
+  pvs.visible.resize(PvsCellCount(pvs) * pvs.words_per_cell);
+  uLongf raw_size = static_cast<uLongf>(pvs.visible.size() * sizeof(uint64_t));
+  const uLongf expected_size = raw_size;
+  if (uncompress(reinterpret_cast<Bytef*>(pvs.visible.data()), &raw_size,
+                 reinterpret_cast<const Bytef*>(bytes.data()) +
+                     sizeof(PvsHeader),
+                 static_cast<uLong>(header.compressed_size)) != Z_OK ||
+      raw_size != expected_size) {
+    LOG(WARNING) << "ReadPvs: " << pvs_file << " is corrupt";
+    return std::nullopt;
+  }
+  for (size_t i = pvs.words_per_cell; i < pvs.visible.size(); ++i) {
+    pvs.visible[i] ^= pvs.visible[i - pvs.words_per_cell];
+  }
+  return pvs;
+}
+
+}  // namespace sh_renderer
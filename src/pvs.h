@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "culling.h"
+
+namespace sh_renderer {
+
+// --- Potentially visible sets ---
+// The scene bounds are split into a grid of view cells, and each cell stores a
+// bitset of the geometries that can be seen from somewhere inside it. The sets
+// are baked offline (BuildPvs in pvs_builder.h) and saved next to the glTF; at
+// runtime the camera's cell drops every geometry it cannot see before the
+// frustum and occlusion culling run. A camera outside the grid sees
+// everything.
+
+struct Pvs {
+  AABB bounds;                                     // of the grid
+  Eigen::Vector3i cells = Eigen::Vector3i::Zero();  // per axis
+  uint32_t num_geometries = 0;
+  uint32_t words_per_cell = 0;  // 64-bit words of one cell's bitset
+  // Per cell, x fastest, words_per_cell words: bit i of word j is geometry
+  // 64 * j + i. Empty when the scene has no PVS.
+  std::vector<uint64_t> visible;
+};
+
+// Version of the PVS file layout. Bump it whenever the layout or the way the
+// sets are baked changes. Changes to the cooked scene need no bump: the file's
+// CookedSceneHash tag covers kSceneCacheVersion.
+constexpr uint32_t kPvsVersion = 2;
+
+// Returns a grid over `bounds` with cells of about `cell_size` (at most
+// `max_cells_per_axis` per axis) for `num_geometries` geometries, all of them
+// hidden from every cell.
+Pvs MakePvsGrid(const AABB& bounds, float cell_size, int max_cells_per_axis,
+                uint32_t num_geometries);
+
+inline size_t PvsCellCount(const Pvs& pvs) {
+  return static_cast<size_t>(pvs.cells.x()) * pvs.cells.y() * pvs.cells.z();
+}
+
+// The bounds of cell (x, y, z).
+AABB PvsCellBounds(const Pvs& pvs, const Eigen::Vector3i& cell);
+
+// The index of the cell containing `position`, or -1 if it lies outside the
+// grid (or the PVS is empty).
+int FindPvsCell(const Pvs& pvs, const Eigen::Vector3f& position);
+
+inline std::span<uint64_t> PvsCellBits(Pvs& pvs, int cell) {
+  return {pvs.visible.data() + static_cast<size_t>(cell) * pvs.words_per_cell,
+          pvs.words_per_cell};
+}
+
+inline std::span<const uint64_t> PvsCellBits(const Pvs& pvs, int cell) {
+  return {pvs.visible.data() + static_cast<size_t>(cell) * pvs.words_per_cell,
+          pvs.words_per_cell};
+}
+
+inline bool IsPvsBitSet(std::span<const uint64_t> bits, uint32_t geometry) {
+  return (bits[geometry >> 6] >> (geometry & 63)) & 1;
+}
+
+inline void SetPvsBit(std::span<uint64_t> bits, uint32_t geometry) {
+  bits[geometry >> 6] |= uint64_t{1} << (geometry & 63);
+}
+
+// Returns the default PVS path for a glTF file: the same directory and stem
+// with a ".shpvs" extension.
+std::filesystem::path PvsPath(const std::filesystem::path& gltf_file);
+
+// Writes `pvs` to `pvs_file`, tagged with the scene's `source_hash` (the
+// CookedSceneHash of its sources, which covers the cook version and the
+// clustering budget). The bitsets are stored zlib-compressed, each cell XORed
+// with the previous one so that the many near-identical neighbours compress to
+// almost nothing. The file is written to a temporary name and renamed into
+// place. Returns false on I/O failure.
+bool WritePvs(const Pvs& pvs, uint64_t source_hash,
+              const std::filesystem::path& pvs_file);
+
+// Reads `pvs_file`. Returns std::nullopt if the file is missing, malformed,
+// from another layout version, or was baked from sources whose hash differs
+// from `source_hash`.
+std::optional<Pvs> ReadPvs(const std::filesystem::path& pvs_file,
+                           uint64_t source_hash);
+
+}  // namespace sh_renderer
@@ -0,0 +1,172 @@
+#include "pvs_builder.h"
+
+#include <embree4/rtcore.h>
+#include <glog/logging.h>
+
+#include <cmath>
+#include <limits>
+#include <numbers>
+#include <random>
+
+#include "parallel.h"
+
+namespace sh_renderer {
+
+namespace {
+
+// A ray passes through at most this many see-through surfaces.
+constexpr int kMaxSeeThroughHits = 16;
+// Offset past a see-through hit, relative to the distance travelled.
+constexpr float kSeeThroughEpsilon = 1e-4f;
+
+bool IsSeeThrough(const Scene& scene, int material_id) {
+  if (material_id < 0 ||
+      static_cast<size_t>(material_id) >= scene.materials.size()) {
+    return false;  // occluder shells block the view
+  }
+  const Material& mat = scene.materials[material_id];
+  return mat.alpha_cutout || !mat.layers.empty();
+}
+
+bool Overlaps(const AABB& a, const AABB& b) {
+  return (a.min.array() <= b.max.array()).all() &&
+         (b.min.array() <= a.max.array()).all();
+}
+
+// Adds every geometry with triangles to `rtc_scene` in world space, with its
+// scene index as the geometry ID. Returns whether any was added.
+bool AddTriangles(const Scene& scene, RTCDevice device, RTCScene rtc_scene) {
+  bool added = false;
+  for (size_t i = 0; i < scene.geometries.size(); ++i) {
+    const Geometry& geo = scene.geometries[i];
+    const Geometry& mesh = GeometryMesh(scene.geometries, geo);
+    const size_t num_triangles = mesh.indices.size() / 3;
+    if (mesh.vertices.empty() || num_triangles == 0) continue;
+
+    RTCGeometry rtc_geometry =
+        rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+    float* vertices = static_cast<float*>(rtcSetNewGeometryBuffer(
+        rtc_geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
+        3 * sizeof(float), mesh.vertices.size()));
+    for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+      const Eigen::Vector3f p = geo.transform * mesh.vertices[v];
+      vertices[3 * v + 0] = p.x();
+      vertices[3 * v + 1] = p.y();
+      vertices[3 * v + 2] = p.z();
+    }
+    uint32_t* indices = static_cast<uint32_t*>(rtcSetNewGeometryBuffer(
+        rtc_geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
+        3 * sizeof(uint32_t), num_triangles));
+    std::copy_n(mesh.indices.begin(), 3 * num_triangles, indices);
+    rtcCommitGeometry(rtc_geometry);
+    rtcAttachGeometryByID(rtc_scene, rtc_geometry, static_cast<unsigned>(i));
+    rtcReleaseGeometry(rtc_geometry);
+    added = true;
+  }
+  return added;
+}
+
+// Marks in `bits` every geometry the ray from `origin` along `direction` hits,
+// up to and including the first one that blocks the view.
+void TraceVisibility(const Scene& scene, RTCScene rtc_scene,
+                     const Eigen::Vector3f& origin,
+                     const Eigen::Vector3f& direction,
+                     std::span<uint64_t> bits) {
+  float tnear = 0.0f;
+  for (int hit = 0; hit < kMaxSeeThroughHits; ++hit) {
+    RTCRayHit ray_hit;
+    ray_hit.ray.org_x = origin.x();
+    ray_hit.ray.org_y = origin.y();
+    ray_hit.ray.org_z = origin.z();
+    ray_hit.ray.tnear = tnear;
+    ray_hit.ray.dir_x = direction.x();
+    ray_hit.ray.dir_y = direction.y();
+    ray_hit.ray.dir_z = direction.z();
+    ray_hit.ray.time = 0.0f;
+    ray_hit.ray.tfar = std::numeric_limits<float>::infinity();
+    ray_hit.ray.mask = ~0u;
+    ray_hit.ray.id = 0;
+    ray_hit.ray.flags = 0;
+    ray_hit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+    ray_hit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+    rtcIntersect1(rtc_scene, &ray_hit);
+    if (ray_hit.hit.geomID == RTC_INVALID_GEOMETRY_ID) return;
+
+    SetPvsBit(bits, ray_hit.hit.geomID);
+    if (!IsSeeThrough(scene,
+                      scene.geometries[ray_hit.hit.geomID].material_id)) {
+      return;
+    }
+    tnear = ray_hit.ray.tfar * (1.0f + kSeeThroughEpsilon) + kSeeThroughEpsilon;
+  }
+}
+
+}  // namespace
+
+Pvs BuildPvs(const Scene& scene, const PvsBuildOptions& options) {
+  CHECK_GT(options.samples_per_cell, 0);
+  CHECK_GT(options.rays_per_sample, 0);
+  AABB bounds;
+  for (const Geometry& geo : scene.geometries) {
+    bounds.min = bounds.min.cwiseMin(geo.bounding_box.min);
+    bounds.max = bounds.max.cwiseMax(geo.bounding_box.max);
+  }
+  if (!(bounds.min.array() <= bounds.max.array()).all()) {
+    bounds.min = bounds.max = Eigen::Vector3f::Zero();
+  }
+  Pvs pvs = MakePvsGrid(bounds, options.cell_size, options.max_cells_per_axis,
+                        static_cast<uint32_t>(scene.geometries.size()));
+
+  RTCDevice device = rtcNewDevice(nullptr);
+  CHECK(device) << "rtcNewDevice failed: " << rtcGetDeviceError(nullptr);
+  RTCScene rtc_scene = rtcNewScene(device);
+  rtcSetSceneBuildQuality(rtc_scene, RTC_BUILD_QUALITY_HIGH);
+  const bool has_triangles = AddTriangles(scene, device, rtc_scene);
+  rtcCommitScene(rtc_scene);
+
+  ParallelFor(PvsCellCount(pvs), options.num_threads, [&](size_t cell) {
+    const Eigen::Vector3i coords(
+        static_cast<int>(cell % pvs.cells.x()),
+        static_cast<int>(cell / pvs.cells.x() % pvs.cells.y()),
+        static_cast<int>(cell / (pvs.cells.x() * pvs.cells.y())));
+    const AABB cell_bounds = PvsCellBounds(pvs, coords);
+    std::span<uint64_t> bits = PvsCellBits(pvs, static_cast<int>(cell));
+
+    for (size_t i = 0; i < scene.geometries.size(); ++i) {
+      const Geometry& geo = scene.geometries[i];
+      const Geometry& mesh = GeometryMesh(scene.geometries, geo);
+      // Geometries without triangles are not traced: never hide them.
+      if (Overlaps(geo.bounding_box, cell_bounds) || mesh.indices.size() < 3 ||
+          mesh.vertices.empty()) {
+        SetPvsBit(bits, static_cast<uint32_t>(i));
+      }
+    }
+    if (!has_triangles) return;
+
+    // Seeded per cell, so the result does not depend on the scheduling.
+    std::mt19937 rng(options.seed ^ static_cast<uint32_t>(cell * 0x9e3779b9u));
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (int s = 0; s < options.samples_per_cell; ++s) {
+      const Eigen::Vector3f origin =
+          cell_bounds.min +
+          (cell_bounds.max - cell_bounds.min)
+              .cwiseProduct(Eigen::Vector3f(uniform(rng), uniform(rng),
+                                            uniform(rng)));
+      for (int r = 0; r < options.rays_per_sample; ++r) {
+        // Uniform on the sphere.
+        const float z = 1.0f - 2.0f * uniform(rng);
+        const float phi = 2.0f * std::numbers::pi_v<float> * uniform(rng);
+        const float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        const Eigen::Vector3f direction(radius * std::cos(phi),
+                                        radius * std::sin(phi), z);
+        TraceVisibility(scene, rtc_scene, origin, direction, bits);
+      }
+    }
+  });
+
+  rtcReleaseScene(rtc_scene);
+  rtcReleaseDevice(device);
+  return pvs;
+}
+
+}  // namespace sh_renderer
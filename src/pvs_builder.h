@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pvs.h"
+#include "scene.h"
+
+namespace sh_renderer {
+
+// --- PVS baking ---
+// Casts Embree rays through the scene's triangles from random points in each
+// view cell; every geometry a ray hits is visible from the cell. Rays pass
+// through alpha-tested and layered materials, whose triangles may not block
+// the view. A geometry whose bounding box overlaps a cell is always visible
+// from it, however small.
+
+struct PvsBuildOptions {
+  float cell_size = 2.0f;
+  int max_cells_per_axis = 64;
+  int samples_per_cell = 16;
+  int rays_per_sample = 1024;
+  uint32_t seed = 1;
+  unsigned num_threads = 0;  // 0 means DefaultThreadCount()
+};
+
+// Bakes the PVS of `scene` over the union of its geometries' bounding boxes,
+// which must be computed (ComputeSceneBoundingBoxes). Bit i stands for
+// scene.geometries[i].
+Pvs BuildPvs(const Scene& scene, const PvsBuildOptions& options);
+
+}  // namespace sh_renderer
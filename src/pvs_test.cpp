@@ -0,0 +1,139 @@
+#include "pvs.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "pvs_builder.h"
+#include "scene.h"
+
+namespace sh_renderer {
+namespace {
+
+std::filesystem::path MakeDir(const std::string& name) {
+  auto dir = std::filesystem::temp_directory_path() / ("sh_pvs_" + name);
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  return dir;
+}
+
+AABB Box(const Eigen::Vector3f& min, const Eigen::Vector3f& max) {
+  AABB box;
+  box.min = min;
+  box.max = max;
+  return box;
+}
+
+// Adds a square in the plane x = `x`, spanning [-half, half] in y and z.
+void AddWall(Scene* scene, float x, float half, int material_id) {
+  Geometry geo;
+  geo.vertices = {{x, -half, -half},
+                  {x, half, -half},
+                  {x, half, half},
+                  {x, -half, half}};
+  geo.indices = {0, 1, 2, 0, 2, 3};
+  geo.material_id = material_id;
+  scene->geometries.push_back(std::move(geo));
+}
+
+// Geometries 0 and 1 face each other across a wider wall, geometry 2, which
+// is opaque unless `cutout_wall`.
+Scene TwoRoomScene(bool cutout_wall) {
+  Scene scene;
+  scene.materials.resize(2);
+  scene.materials[1].alpha_cutout = true;
+  AddWall(&scene, -5.0f, 5.0f, 0);
+  AddWall(&scene, 5.0f, 5.0f, 0);
+  AddWall(&scene, 0.0f, 6.0f, cutout_wall ? 1 : 0);
+  ComputeSceneBoundingBoxes(scene);
+  return scene;
+}
+
+PvsBuildOptions TestOptions() {
+  return {.cell_size = 5.0f,
+          .samples_per_cell = 4,
+          .rays_per_sample = 256,
+          .num_threads = 2};
+}
+
+TEST(PvsTest, GridCoversTheBoundsWithCappedCells) {
+  const Pvs pvs = MakePvsGrid(Box({0, 0, 0}, {10, 1, 100}), /*cell_size=*/2.0f,
+                              /*max_cells_per_axis=*/16,
+                              /*num_geometries=*/65);
+  EXPECT_EQ(pvs.cells, Eigen::Vector3i(5, 1, 16));
+  EXPECT_EQ(pvs.words_per_cell, 2u);
+  EXPECT_EQ(pvs.visible.size(), 5u * 16u * 2u);
+
+  EXPECT_EQ(FindPvsCell(pvs, {0, 0, 0}), 0);
+  EXPECT_EQ(FindPvsCell(pvs, {3, 0.5f, 0}), 1);
+  EXPECT_EQ(FindPvsCell(pvs, {9, 0, 10}), 4 + 5 * 1);
+  EXPECT_EQ(FindPvsCell(pvs, {10, 1, 100}), 4 + 5 * 15);  // far corner
+  EXPECT_EQ(FindPvsCell(pvs, {-0.1f, 0, 0}), -1);
+  EXPECT_EQ(FindPvsCell(pvs, {0, 0, 100.1f}), -1);
+  EXPECT_EQ(FindPvsCell(Pvs(), {0, 0, 0}), -1);
+
+  const AABB cell = PvsCellBounds(pvs, {1, 0, 2});
+  EXPECT_TRUE(cell.min.isApprox(Eigen::Vector3f(2, 0, 12.5f)));
+  EXPECT_TRUE(cell.max.isApprox(Eigen::Vector3f(4, 1, 18.75f)));
+}
+
+TEST(PvsTest, FileRoundTripsAndRejectsStaleOrBrokenFiles) {
+  const auto dir = MakeDir("round_trip");
+  const auto pvs_file = PvsPath(dir / "scene.gltf");
+  EXPECT_EQ(pvs_file, dir / "scene.shpvs");
+
+  Pvs pvs = MakePvsGrid(Box({-1, -2, -3}, {7, 6, 5}), 1.0f, 64, 130);
+  for (int cell = 0; cell < static_cast<int>(PvsCellCount(pvs)); ++cell) {
+    SetPvsBit(PvsCellBits(pvs, cell), cell % 130);
+    SetPvsBit(PvsCellBits(pvs, cell), 129);
+  }
+  ASSERT_TRUE(WritePvs(pvs, /*source_hash=*/42, pvs_file));
+  // Neighbouring cells are alike, so the file is much smaller than the sets.
+  EXPECT_LT(std::filesystem::file_size(pvs_file),
+            pvs.visible.size() * sizeof(uint64_t) / 10);
+
+  std::optional<Pvs> read = ReadPvs(pvs_file, 42);
+  ASSERT_TRUE(read.has_value());
+  EXPECT_EQ(read->cells, pvs.cells);
+  EXPECT_EQ(read->bounds.min, pvs.bounds.min);
+  EXPECT_EQ(read->bounds.max, pvs.bounds.max);
+  EXPECT_EQ(read->num_geometries, 130u);
+  EXPECT_EQ(read->words_per_cell, 3u);
+  EXPECT_EQ(read->visible, pvs.visible);
+  EXPECT_TRUE(IsPvsBitSet(PvsCellBits(*read, 5), 5));
+  EXPECT_FALSE(IsPvsBitSet(PvsCellBits(*read, 5), 6));
+
+  EXPECT_FALSE(ReadPvs(pvs_file, 43).has_value());
+  EXPECT_FALSE(ReadPvs(dir / "missing.shpvs", 42).has_value());
+  std::filesystem::resize_file(pvs_file,
+                               std::filesystem::file_size(pvs_file) - 1);
+  EXPECT_FALSE(ReadPvs(pvs_file, 42).has_value());
+}
+
+TEST(PvsTest, WallHidesTheOtherRoom) {
+  const Scene scene = TwoRoomScene(/*cutout_wall=*/false);
+  const Pvs pvs = BuildPvs(scene, TestOptions());
+  ASSERT_EQ(pvs.cells.x(), 2);
+  for (int cell = 0; cell < static_cast<int>(PvsCellCount(pvs)); ++cell) {
+    const std::span<const uint64_t> bits = PvsCellBits(pvs, cell);
+    const bool left = cell % pvs.cells.x() == 0;
+    EXPECT_EQ(IsPvsBitSet(bits, 0), left) << cell;
+    EXPECT_EQ(IsPvsBitSet(bits, 1), !left) << cell;
+    EXPECT_TRUE(IsPvsBitSet(bits, 2)) << cell;
+  }
+}
+
+TEST(PvsTest, RaysPassThroughAlphaTestedWalls) {
+  const Scene scene = TwoRoomScene(/*cutout_wall=*/true);
+  const Pvs pvs = BuildPvs(scene, TestOptions());
+  for (int cell = 0; cell < static_cast<int>(PvsCellCount(pvs)); ++cell) {
+    const std::span<const uint64_t> bits = PvsCellBits(pvs, cell);
+    EXPECT_TRUE(IsPvsBitSet(bits, 0)) << cell;
+    EXPECT_TRUE(IsPvsBitSet(bits, 1)) << cell;
+  }
+}
+
+}  // namespace
+}  // namespace sh_renderer
@@ -0,0 +1,291 @@
+#include "render_queue.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+
+#include "glad.h"
+
+namespace sh_renderer {
+
+namespace {
+
+constexpr int kPassShift = 60;
+constexpr int kProgramShift = 58;
+constexpr int kCullModeShift = 56;
+constexpr int kLayerSetShift = 40;
+constexpr int kMaterialShift = 24;
+
+constexpr int kRadixBits = 8;
+constexpr int kRadixBuckets = 1 << kRadixBits;
+constexpr int kRadixPasses = 64 / kRadixBits;
+
+bool HasMaterial(const Scene& scene, int material_id) {
+  return material_id >= 0 &&
+         static_cast<size_t>(material_id) < scene.materials.size();
+}
+
+// Appends the draw of `geometry` with `key` at the level of detail the view
+// selects, culling its meshlets with `cull_mode` if the view asks for it.
+void AddItem(const Scene& scene, const Geometry& geometry, uint64_t key,
+             CullMode cull_mode, const DrawLists& lists, RenderQueue* queue) {
+  RenderItem item = {.key = key,
+                     .geometry = &geometry,
+                     .lod = SelectLod(geometry, lists.view_proj,
+                                      lists.lod_scale)};
+  const Geometry& mesh = GeometryMesh(scene.geometries, geometry);
+  if (lists.meshlet_culling && item.lod == 0 && !mesh.meshlets.empty()) {
+    item.first_range = static_cast<uint32_t>(queue->ranges.size());
+    CullMeshlets(mesh.meshlets, lists.view_proj, geometry.transform, cull_mode,
+                 &queue->ranges,
+                 &GetRenderQueueStats(RenderKeyPass(key)).meshlets);
+    item.range_count =
+        static_cast<uint32_t>(queue->ranges.size()) - item.first_range;
+    if (item.range_count == 0) return;
+  }
+  queue->items.push_back(item);
+}
+
+// Appends the depth-only draw of `geometry`. Only alpha-tested draws bind
+// their material.
+void AddDepthItem(const Scene& scene, const Geometry& geometry,
+                  RenderPass pass, RenderProgram program,
+                  const DrawLists& lists, RenderQueue* queue) {
+  CullMode cull_mode = CullMode::kFront;
+  if (HasMaterial(scene, geometry.material_id)) {
+    cull_mode = scene.materials[geometry.material_id].cull_mode;
+  }
+  const int material_id =
+      program == RenderProgram::kCutout ? geometry.material_id : -1;
+  AddItem(scene, geometry,
+          MakeRenderKey(pass, program, cull_mode, /*layer_set=*/0, material_id,
+                        QuantizeViewDepth(lists.view_proj,
+                                          geometry.bounding_box)),
+          cull_mode, lists, queue);
+}
+
+void AddRadianceItem(const Scene& scene, const Geometry& geometry,
+                     const DrawLists& lists, RenderQueue* queue) {
+  RenderProgram program = RenderProgram::kOpaque;
+  CullMode cull_mode = CullMode::kFront;
+  uint32_t layer_set = 0;
+  if (HasMaterial(scene, geometry.material_id)) {
+    const Material& mat = scene.materials[geometry.material_id];
+    if (!mat.layers.empty()) {
+      program = RenderProgram::kLayered;
+    } else if (mat.alpha_cutout) {
+      program = RenderProgram::kCutout;
+    }
+    cull_mode = mat.cull_mode;
+    layer_set = mat.layer_set;
+  }
+  AddItem(scene, geometry,
+          MakeRenderKey(RenderPass::kRadiance, program, cull_mode, layer_set,
+                        geometry.material_id,
+                        QuantizeViewDepth(lists.view_proj,
+                                          geometry.bounding_box)),
+          cull_mode, lists, queue);
+}
+
+}  // namespace
+
+const char* RenderPassName(RenderPass pass) {
+  switch (pass) {
+    case RenderPass::kSunShadow:
+      return "sun shadow";
+    case RenderPass::kSpotShadow:
+      return "spot shadow";
+    case RenderPass::kDepthPrepass:
+      return "depth pre-pass";
+    case RenderPass::kRadiance:
+      return "radiance";
+  }
+  return "unknown";
+}
+
+uint64_t MakeRenderKey(RenderPass pass, RenderProgram program,
+                       CullMode cull_mode, uint32_t layer_set, int material_id,
+                       uint32_t depth) {
+  DCHECK_LE(layer_set, kMaxRenderKeyLayerSets);
+  DCHECK_GE(material_id, -1);
+  DCHECK_LE(static_cast<uint32_t>(material_id + 1), kMaxRenderKeyMaterials);
+  DCHECK_LE(depth, kMaxRenderKeyDepth);
+  const uint64_t material = static_cast<uint32_t>(material_id + 1);
+  return static_cast<uint64_t>(pass) << kPassShift |
+         static_cast<uint64_t>(program) << kProgramShift |
+         static_cast<uint64_t>(cull_mode) << kCullModeShift |
+         static_cast<uint64_t>(layer_set) << kLayerSetShift |
+         material << kMaterialShift | depth;
+}
+
+RenderPass RenderKeyPass(uint64_t key) {
+  return static_cast<RenderPass>((key & kRenderKeyPassMask) >> kPassShift);
+}
+
+RenderProgram RenderKeyProgram(uint64_t key) {
+  return static_cast<RenderProgram>((key & kRenderKeyProgramMask) >>
+                                    kProgramShift);
+}
+
+CullMode RenderKeyCullMode(uint64_t key) {
+  return static_cast<CullMode>((key & kRenderKeyCullModeMask) >>
+                               kCullModeShift);
+}
+
+int RenderKeyMaterial(uint64_t key) {
+  return static_cast<int>((key & kRenderKeyMaterialMask) >> kMaterialShift) -
+         1;
+}
+
+uint32_t RenderKeyDepth(uint64_t key) {
+  return static_cast<uint32_t>(key & kRenderKeyDepthMask);
+}
+
+uint32_t QuantizeViewDepth(const Eigen::Matrix4f& view_proj, const AABB& box) {
+  const Eigen::Vector3f center = 0.5f * (box.min + box.max);
+  const Eigen::Vector4f clip = view_proj * center.homogeneous();
+  if (!(clip.w() > 0.0f)) return 0;
+  const float depth = std::clamp(0.5f * (clip.z() / clip.w()) + 0.5f, 0.0f,
+                                 1.0f);
+  return static_cast<uint32_t>(depth * kMaxRenderKeyDepth);
+}
+
+void BuildRenderQueue(const Scene& scene, const DrawLists& lists,
+                      RenderPass pass, RenderQueue* queue) {
+  // Layer sets are numbered per material, so this bounds both fields.
+  CHECK_LE(scene.materials.size(), kMaxRenderKeyMaterials);
+  queue->items.clear();
+  queue->ranges.clear();
+  if (pass == RenderPass::kRadiance) {
+    queue->items.reserve(lists.shaded.size());
+    for (const Geometry* geo : lists.shaded) {
+      AddRadianceItem(scene, *geo, lists, queue);
+    }
+  } else {
+    queue->items.reserve(lists.opaque.size() + lists.cutout.size());
+    for (const Geometry* geo : lists.opaque) {
+      AddDepthItem(scene, *geo, pass, RenderProgram::kOpaque, lists, queue);
+    }
+    for (const Geometry* geo : lists.cutout) {
+      AddDepthItem(scene, *geo, pass, RenderProgram::kCutout, lists, queue);
+    }
+  }
+  SortRenderQueue(queue);
+}
+
+void SortRenderQueue(RenderQueue* queue) {
+  std::vector<RenderItem>& items = queue->items;
+  const size_t n = items.size();
+  if (n < 2) return;
+
+  // One histogram per key byte, all filled in a single read of the keys.
+  std::array<std::array<uint32_t, kRadixBuckets>, kRadixPasses> counts{};
+  for (const RenderItem& item : items) {
+    for (int pass = 0; pass < kRadixPasses; ++pass) {
+      ++counts[pass][(item.key >> (pass * kRadixBits)) & (kRadixBuckets - 1)];
+    }
+  }
+
+  queue->scratch.resize(n);
+  RenderItem* src = items.data();
+  RenderItem* dst = queue->scratch.data();
+  for (int pass = 0; pass < kRadixPasses; ++pass) {
+    std::array<uint32_t, kRadixBuckets>& count = counts[pass];
+    const int shift = pass * kRadixBits;
+    // A byte every key shares leaves the order unchanged.
+    if (count[(src[0].key >> shift) & (kRadixBuckets - 1)] == n) continue;
+
+    uint32_t offset = 0;
+    for (uint32_t& c : count) {
+      const uint32_t bucket_size = c;
+      c = offset;
+      offset += bucket_size;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      dst[count[(src[i].key >> shift) & (kRadixBuckets - 1)]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+  if (src != items.data()) items.swap(queue->scratch);
+}
+
+void ForEachRenderQueueRun(
+    const RenderQueue& queue,
+    const std::function<void(uint64_t key, uint64_t changed,
+                             std::span<const RenderItem> run)>& draw_run) {
+  const std::vector<RenderItem>& items = queue.items;
+  if (items.empty()) return;
+  RenderQueueStats& stats = GetRenderQueueStats(RenderKeyPass(items[0].key));
+  stats.items += items.size();
+
+  uint64_t previous = 0;
+  size_t begin = 0;
+  while (begin < items.size()) {
+    const uint64_t state = items[begin].key & kRenderKeyStateMask;
+    size_t end = begin + 1;
+    while (end < items.size() &&
+           (items[end].key & kRenderKeyStateMask) == state) {
+      ++end;
+    }
+    const uint64_t changed = begin == 0 ? ~uint64_t{0} : state ^ previous;
+    ++stats.runs;
+    if (changed & kRenderKeyProgramMask) ++stats.program_changes;
+    if (changed & kRenderKeyCullModeMask) ++stats.cull_mode_changes;
+    if (changed & kRenderKeyLayerSetMask) ++stats.layer_set_changes;
+    if (changed & kRenderKeyMaterialMask) ++stats.material_changes;
+
+    draw_run(items[begin].key, changed,
+             std::span<const RenderItem>(items.data() + begin, end - begin));
+    previous = state;
+    begin = end;
+  }
+}
+
+void ApplyCullMode(CullMode cull_mode) {
+  switch (cull_mode) {
+    case CullMode::kFront:
+      glEnable(GL_CULL_FACE);
+      glCullFace(GL_BACK);
+      break;
+    case CullMode::kBack:
+      glEnable(GL_CULL_FACE);
+      glCullFace(GL_FRONT);
+      break;
+    case CullMode::kNone:
+      glDisable(GL_CULL_FACE);
+      break;
+  }
+}
+
+void SubmitRenderQueue(
+    const GeometryArena& arena, const RenderQueue& queue,
+    const std::function<void(uint64_t key, uint64_t changed)>& set_state) {
+  DrawBatch batch(arena);
+  ForEachRenderQueueRun(
+      queue, [&](uint64_t key, uint64_t changed,
+                 std::span<const RenderItem> run) {
+        if (changed & kRenderKeyCullModeMask) {
+          ApplyCullMode(RenderKeyCullMode(key));
+        }
+        set_state(key, changed);
+        for (const RenderItem& item : run) {
+          if (item.range_count > 0) {
+            batch.Add(*item.geometry,
+                      std::span<const IndexRange>(queue.ranges)
+                          .subspan(item.first_range, item.range_count));
+          } else {
+            batch.Add(*item.geometry, item.lod);
+          }
+        }
+        batch.Submit();
+      });
+  ApplyCullMode(CullMode::kFront);
+}
+
+RenderQueueStats& GetRenderQueueStats(RenderPass pass) {
+  static std::array<RenderQueueStats, kNumRenderPasses> stats;
+  return stats[static_cast<int>(pass)];
+}
+
+}  // namespace sh_renderer
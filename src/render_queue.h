@@ -0,0 +1,144 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "culling.h"
+#include "geometry_arena.h"
+#include "scene.h"
+#include "visibility.h"
+
+namespace sh_renderer {
+
+// --- Render queue ---
+// Each pass turns a view's DrawLists into RenderItems whose 64-bit key encodes
+// the GL state the draw needs, radix sorts them, and submits one batch per run
+// of equal state. From the most significant bit:
+//
+//   [63:60] pass  [59:58] program  [57:56] cull mode
+//   [55:40] layer set  [39:24] material + 1  [23:0] view depth
+//
+// Items that bind nothing per material (the depth-only draws without an alpha
+// test) leave the layer set and material zero, so they merge into one run per
+// cull mode sorted front to back. The rest group by material and are front to
+// back within it.
+//
+// With meshlet culling on (DrawLists::meshlet_culling), each full detail item
+// of a geometry with meshlets draws only the index ranges CullMeshlets leaves
+// for the view, and is dropped if it leaves none.
+
+enum class RenderPass : uint8_t {
+  kSunShadow,
+  kSpotShadow,
+  kDepthPrepass,
+  kRadiance,
+};
+constexpr int kNumRenderPasses = 4;
+
+const char* RenderPassName(RenderPass pass);
+
+// The program (or shader path) drawing an item. The depth-only passes draw
+// kOpaque and kCutout with different programs and VAOs; the radiance pass has
+// one program whose alpha test and layer compositor are branches, which the
+// key keeps coherent.
+enum class RenderProgram : uint8_t {
+  kOpaque,
+  kCutout,
+  kLayered,  // radiance only: materials with a Quake 3 layer stack
+};
+
+constexpr int kRenderKeyDepthBits = 24;
+constexpr uint32_t kMaxRenderKeyDepth = (1u << kRenderKeyDepthBits) - 1;
+constexpr uint32_t kMaxRenderKeyMaterials = 0xFFFF;  // material + 1 in 16 bits
+constexpr uint32_t kMaxRenderKeyLayerSets = 0xFFFF;
+
+// Key fields, for testing which of them differ between two keys.
+constexpr uint64_t kRenderKeyPassMask = uint64_t{0xF} << 60;
+constexpr uint64_t kRenderKeyProgramMask = uint64_t{0x3} << 58;
+constexpr uint64_t kRenderKeyCullModeMask = uint64_t{0x3} << 56;
+constexpr uint64_t kRenderKeyLayerSetMask = uint64_t{0xFFFF} << 40;
+constexpr uint64_t kRenderKeyMaterialMask = uint64_t{0xFFFF} << 24;
+constexpr uint64_t kRenderKeyDepthMask = kMaxRenderKeyDepth;
+// Every field that selects GL state; items equal in these share a batch.
+constexpr uint64_t kRenderKeyStateMask = ~kRenderKeyDepthMask;
+
+// `material_id` is -1 for items that bind no material.
+uint64_t MakeRenderKey(RenderPass pass, RenderProgram program,
+                       CullMode cull_mode, uint32_t layer_set, int material_id,
+                       uint32_t depth);
+
+RenderPass RenderKeyPass(uint64_t key);
+RenderProgram RenderKeyProgram(uint64_t key);
+CullMode RenderKeyCullMode(uint64_t key);
+int RenderKeyMaterial(uint64_t key);  // -1 if none
+uint32_t RenderKeyDepth(uint64_t key);
+
+// The NDC depth of the centre of `box` under `view_proj`, mapped to
+// [0, kMaxRenderKeyDepth]. Boxes whose centre is behind the eye get 0.
+uint32_t QuantizeViewDepth(const Eigen::Matrix4f& view_proj, const AABB& box);
+
+struct RenderItem {
+  uint64_t key = 0;
+  const Geometry* geometry = nullptr;
+  uint32_t lod = 0;  // level of detail to draw (see SelectLod)
+  // The item's slice of RenderQueue::ranges; none draws the whole level.
+  uint32_t first_range = 0;
+  uint32_t range_count = 0;
+};
+
+struct RenderQueue {
+  std::vector<RenderItem> items;
+  std::vector<RenderItem> scratch;  // radix sort ping-pong buffer
+  std::vector<IndexRange> ranges;   // the meshlet culled items' index ranges
+};
+
+// Replaces `queue`'s items with the draws `pass` makes of `lists` and sorts
+// them: the shaded list for the radiance pass, the opaque and cutout lists for
+// the depth-only passes. Depths are taken in `lists.view_proj`, each item's
+// level of detail is selected with `lists.lod_scale`, and its meshlets are
+// culled if `lists.meshlet_culling`.
+void BuildRenderQueue(const Scene& scene, const DrawLists& lists,
+                      RenderPass pass, RenderQueue* queue);
+
+// Sorts the items by key: a stable LSD radix sort, one pass per key byte,
+// skipping bytes every key shares.
+void SortRenderQueue(RenderQueue* queue);
+
+// Calls `draw_run` for each run of adjacent items with equal state bits, with
+// the bits of the key that differ from the previous run's (all of them for the
+// first run), and counts the runs and changes in GetRenderQueueStats.
+void ForEachRenderQueueRun(
+    const RenderQueue& queue,
+    const std::function<void(uint64_t key, uint64_t changed,
+                             std::span<const RenderItem> run)>& draw_run);
+
+// Sets the face culling of `cull_mode`.
+void ApplyCullMode(CullMode cull_mode);
+
+// Draws the sorted `queue` as one DrawBatch per run. The face culling of each
+// run follows its cull mode; `set_state` binds the rest of the state the
+// changed bits select (program, VAO, material textures) before its batch. The
+// arena must be bound. Leaves back-face culling enabled.
+void SubmitRenderQueue(
+    const GeometryArena& arena, const RenderQueue& queue,
+    const std::function<void(uint64_t key, uint64_t changed)>& set_state);
+
+// Per-pass queue statistics. Accumulated by ForEachRenderQueueRun and, for
+// the meshlets, BuildRenderQueue; reset by the caller. A run is one batch,
+// submitted after at least one state change.
+struct RenderQueueStats {
+  uint64_t items = 0;
+  uint64_t runs = 0;
+  uint64_t program_changes = 0;
+  uint64_t cull_mode_changes = 0;
+  uint64_t layer_set_changes = 0;
+  uint64_t material_changes = 0;
+  MeshletCullStats meshlets;
+};
+
+RenderQueueStats& GetRenderQueueStats(RenderPass pass);
+
+}  // namespace sh_renderer
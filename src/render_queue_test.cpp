@@ -0,0 +1,314 @@
+#include "render_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <numbers>
+#include <random>
+
+#include "camera.h"
+
+namespace sh_renderer {
+namespace {
+
+// Adds a drawable unit-sized geometry centred at `center`.
+void AddGeometry(Scene* scene, const Eigen::Vector3f& center,
+                 int material_id) {
+  Geometry geo;
+  geo.material_id = material_id;
+  geo.index_count = 3;
+  geo.bounding_box.min = center - Eigen::Vector3f::Constant(0.5f);
+  geo.bounding_box.max = center + Eigen::Vector3f::Constant(0.5f);
+  scene->geometries.push_back(std::move(geo));
+}
+
+// The view of a camera at the origin looking down -Z.
+Eigen::Matrix4f TestViewProj() {
+  return GetViewProjMatrix(
+      Camera{.position = Eigen::Vector3f::Zero(),
+             .orientation = Eigen::Quaternionf::Identity()});
+}
+
+std::vector<const Geometry*> QueueGeometries(const RenderQueue& queue) {
+  std::vector<const Geometry*> geometries;
+  for (const RenderItem& item : queue.items) {
+    geometries.push_back(item.geometry);
+  }
+  return geometries;
+}
+
+TEST(RenderQueueTest, KeyFieldsRoundTrip) {
+  const uint64_t key =
+      MakeRenderKey(RenderPass::kRadiance, RenderProgram::kLayered,
+                    CullMode::kNone, 1234, 4321, kMaxRenderKeyDepth);
+  EXPECT_EQ(RenderKeyPass(key), RenderPass::kRadiance);
+  EXPECT_EQ(RenderKeyProgram(key), RenderProgram::kLayered);
+  EXPECT_EQ(RenderKeyCullMode(key), CullMode::kNone);
+  EXPECT_EQ((key & kRenderKeyLayerSetMask) >> 40, 1234u);
+  EXPECT_EQ(RenderKeyMaterial(key), 4321);
+  EXPECT_EQ(RenderKeyDepth(key), kMaxRenderKeyDepth);
+
+  const uint64_t none =
+      MakeRenderKey(RenderPass::kSunShadow, RenderProgram::kOpaque,
+                    CullMode::kFront, 0, -1, 0);
+  EXPECT_EQ(none, 0u);
+  EXPECT_EQ(RenderKeyMaterial(none), -1);
+}
+
+TEST(RenderQueueTest, KeysOrderStateBeforeDepth) {
+  auto key = [](RenderProgram program, int material, uint32_t depth) {
+    return MakeRenderKey(RenderPass::kDepthPrepass, program, CullMode::kFront,
+                         0, material, depth);
+  };
+  // Program, then material, then depth.
+  EXPECT_LT(key(RenderProgram::kOpaque, 9, kMaxRenderKeyDepth),
+            key(RenderProgram::kCutout, 0, 0));
+  EXPECT_LT(key(RenderProgram::kCutout, 0, kMaxRenderKeyDepth),
+            key(RenderProgram::kCutout, 1, 0));
+  EXPECT_LT(key(RenderProgram::kCutout, 1, 10),
+            key(RenderProgram::kCutout, 1, 11));
+  EXPECT_LT(MakeRenderKey(RenderPass::kSunShadow, RenderProgram::kLayered,
+                          CullMode::kNone, kMaxRenderKeyLayerSets, 100, 0),
+            key(RenderProgram::kOpaque, -1, 0));
+}
+
+TEST(RenderQueueTest, QuantizedDepthGrowsWithDistance) {
+  const Eigen::Matrix4f view_proj = TestViewProj();
+  auto depth_at = [&](float z) {
+    AABB box;
+    box.min = Eigen::Vector3f(-0.1f, -0.1f, z - 0.1f);
+    box.max = Eigen::Vector3f(0.1f, 0.1f, z + 0.1f);
+    return QuantizeViewDepth(view_proj, box);
+  };
+  EXPECT_LT(depth_at(-2.0f), depth_at(-5.0f));
+  EXPECT_LT(depth_at(-5.0f), depth_at(-50.0f));
+  EXPECT_LE(depth_at(-50.0f), kMaxRenderKeyDepth);
+  EXPECT_EQ(depth_at(5.0f), 0u);  // behind the eye
+}
+
+TEST(RenderQueueTest, RadixSortMatchesStableSort) {
+  std::mt19937_64 rng(3);
+  for (size_t n : {0, 1, 2, 17, 1000}) {
+    RenderQueue queue;
+    std::vector<Geometry> geometries(n);
+    for (size_t i = 0; i < n; ++i) {
+      // Few distinct states and depths, so equal keys exercise stability, and
+      // constant high bytes exercise the skipped passes.
+      const uint64_t key = MakeRenderKey(
+          RenderPass::kRadiance, static_cast<RenderProgram>(rng() % 3),
+          CullMode::kFront, 0, static_cast<int>(rng() % 5),
+          static_cast<uint32_t>(rng() % 300));
+      queue.items.push_back({key, &geometries[i]});
+    }
+    std::vector<RenderItem> expected = queue.items;
+    std::stable_sort(expected.begin(), expected.end(),
+                     [](const RenderItem& a, const RenderItem& b) {
+                       return a.key < b.key;
+                     });
+
+    SortRenderQueue(&queue);
+    ASSERT_EQ(queue.items.size(), n);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_EQ(queue.items[i].key, expected[i].key) << i;
+      EXPECT_EQ(queue.items[i].geometry, expected[i].geometry) << i;
+    }
+  }
+}
+
+TEST(RenderQueueTest, DepthPassDrawsOpaqueFrontToBackInOneRun) {
+  Scene scene;
+  scene.materials.resize(3);
+  scene.materials[2].alpha_cutout = true;
+  AddGeometry(&scene, {0, 0, -9}, 0);
+  AddGeometry(&scene, {0, 0, -3}, 1);
+  AddGeometry(&scene, {0, 0, -6}, -1);  // occluder shell
+  AddGeometry(&scene, {0, 0, -8}, 2);
+  AddGeometry(&scene, {0, 0, -4}, 2);
+
+  DrawLists lists;
+  lists.view_proj = TestViewProj();
+  lists.opaque = {&scene.geometries[0], &scene.geometries[1],
+                  &scene.geometries[2]};
+  lists.cutout = {&scene.geometries[3], &scene.geometries[4]};
+  RenderQueue queue;
+  BuildRenderQueue(scene, lists, RenderPass::kDepthPrepass, &queue);
+
+  EXPECT_EQ(QueueGeometries(queue),
+            (std::vector<const Geometry*>{
+                &scene.geometries[1], &scene.geometries[2],
+                &scene.geometries[0], &scene.geometries[4],
+                &scene.geometries[3]}));
+
+  GetRenderQueueStats(RenderPass::kDepthPrepass) = {};
+  std::vector<size_t> run_sizes;
+  ForEachRenderQueueRun(queue, [&](uint64_t key, uint64_t changed,
+                                   std::span<const RenderItem> run) {
+    run_sizes.push_back(run.size());
+    EXPECT_NE(changed, 0u);
+  });
+  EXPECT_EQ(run_sizes, (std::vector<size_t>{3, 2}));
+  const RenderQueueStats& stats =
+      GetRenderQueueStats(RenderPass::kDepthPrepass);
+  EXPECT_EQ(stats.items, 5u);
+  EXPECT_EQ(stats.runs, 2u);
+  EXPECT_EQ(stats.program_changes, 2u);
+  EXPECT_EQ(stats.material_changes, 2u);
+}
+
+TEST(RenderQueueTest, RadianceRunsPerMaterialAndCullMode) {
+  Scene scene;
+  scene.materials.resize(4);
+  scene.materials[1].cull_mode = CullMode::kNone;
+  // Materials 2 and 3 share their layer textures.
+  scene.materials[2].layers.resize(1);
+  scene.materials[2].layer_set = 1;
+  scene.materials[3].layers.resize(1);
+  scene.materials[3].layer_set = 1;
+  AddGeometry(&scene, {0, 0, -5}, 3);
+  AddGeometry(&scene, {0, 0, -5}, 0);
+  AddGeometry(&scene, {0, 0, -6}, 2);
+  AddGeometry(&scene, {0, 0, -7}, 1);
+  AddGeometry(&scene, {0, 0, -2}, 0);
+
+  DrawLists lists;
+  lists.view_proj = TestViewProj();
+  for (const Geometry& geo : scene.geometries) lists.shaded.push_back(&geo);
+  RenderQueue queue;
+  BuildRenderQueue(scene, lists, RenderPass::kRadiance, &queue);
+
+  std::vector<int> run_materials;
+  std::vector<uint64_t> run_changes;
+  GetRenderQueueStats(RenderPass::kRadiance) = {};
+  ForEachRenderQueueRun(queue, [&](uint64_t key, uint64_t changed,
+                                   std::span<const RenderItem> run) {
+    run_materials.push_back(RenderKeyMaterial(key));
+    run_changes.push_back(changed);
+  });
+  // Plain materials with back-face culling, then the two-sided one, then the
+  // layered ones.
+  EXPECT_EQ(run_materials, (std::vector<int>{0, 1, 2, 3}));
+  EXPECT_EQ(queue.items[0].geometry, &scene.geometries[4]);  // nearer
+  // `changed` holds the differing bits, within the differing fields only.
+  auto fields = [](uint64_t changed) {
+    uint64_t fields = 0;
+    for (uint64_t mask :
+         {kRenderKeyPassMask, kRenderKeyProgramMask, kRenderKeyCullModeMask,
+          kRenderKeyLayerSetMask, kRenderKeyMaterialMask}) {
+      if (changed & mask) fields |= mask;
+    }
+    return fields;
+  };
+  EXPECT_EQ(fields(run_changes[1]),
+            kRenderKeyCullModeMask | kRenderKeyMaterialMask);
+  EXPECT_EQ(fields(run_changes[3]), kRenderKeyMaterialMask);
+
+  const RenderQueueStats& stats = GetRenderQueueStats(RenderPass::kRadiance);
+  EXPECT_EQ(stats.items, 5u);
+  EXPECT_EQ(stats.runs, 4u);
+  EXPECT_EQ(stats.program_changes, 2u);
+  EXPECT_EQ(stats.cull_mode_changes, 3u);
+  EXPECT_EQ(stats.layer_set_changes, 2u);
+  EXPECT_EQ(stats.material_changes, 4u);
+}
+
+TEST(RenderQueueTest, ItemsCarryTheViewsLevelOfDetail) {
+  Scene scene;
+  scene.materials.resize(1);
+  AddGeometry(&scene, {0, 0, -3}, 0);
+  AddGeometry(&scene, {0, 0, -200}, 0);
+  for (Geometry& geo : scene.geometries) {
+    geo.lods.resize(2);
+    geo.lods[0].error = 0.01f;
+    geo.lods[1].error = 0.1f;
+  }
+
+  DrawLists lists;
+  lists.view_proj = TestViewProj();
+  lists.opaque = {&scene.geometries[0], &scene.geometries[1]};
+  lists.shaded = lists.opaque;
+  RenderQueue queue;
+  BuildRenderQueue(scene, lists, RenderPass::kRadiance, &queue);
+  ASSERT_EQ(queue.items.size(), 2u);
+  EXPECT_EQ(queue.items[0].lod, 0u);  // full detail without a scale
+  EXPECT_EQ(queue.items[1].lod, 0u);
+
+  lists.lod_scale = LodScale(lists.view_proj, 1280, 720, 1.0f);
+  for (RenderPass pass : {RenderPass::kRadiance, RenderPass::kDepthPrepass}) {
+    BuildRenderQueue(scene, lists, pass, &queue);
+    ASSERT_EQ(queue.items.size(), 2u);
+    EXPECT_EQ(queue.items[0].geometry, &scene.geometries[0]);
+    EXPECT_EQ(queue.items[0].lod, 0u);
+    EXPECT_EQ(queue.items[1].lod, 2u);
+  }
+}
+
+TEST(RenderQueueTest, ItemsDrawTheirVisibleMeshlets) {
+  // A mesh of two meshlets 3 units in front of the camera, one facing it and
+  // one facing away, and instances of it: turned around, two-sided, and
+  // behind the camera.
+  Scene scene;
+  scene.materials.resize(2);
+  scene.materials[1].cull_mode = CullMode::kNone;
+  AddGeometry(&scene, {0, 0, -3}, 0);
+  scene.geometries[0].index_count = 12;
+  for (float facing : {1.0f, -1.0f}) {
+    scene.geometries[0].meshlets.push_back(
+        {.range = {facing > 0.0f ? 0u : 6u, 6},
+         .center = Eigen::Vector3f(0, 0, -3),
+         .radius = 0.5f,
+         .cone_axis = facing * Eigen::Vector3f::UnitZ(),
+         .cone_cutoff = 0.0f});
+  }
+  const Eigen::Affine3f placements[] = {
+      Eigen::Translation3f(0, 0, -6) *
+          Eigen::AngleAxisf(std::numbers::pi_v<float>,
+                            Eigen::Vector3f::UnitY()),
+      Eigen::Affine3f::Identity(),
+      Eigen::Affine3f(Eigen::Translation3f(0, 0, 10))};
+  for (const Eigen::Affine3f& transform : placements) {
+    AddGeometry(&scene, {0, 0, -3}, 0);
+    scene.geometries.back().instance_of = 0;
+    scene.geometries.back().index_count = 12;
+    scene.geometries.back().transform = transform;
+  }
+  scene.geometries[2].material_id = 1;
+
+  DrawLists lists;
+  lists.view_proj = TestViewProj();
+  for (const Geometry& geo : scene.geometries) lists.opaque.push_back(&geo);
+  RenderQueue queue;
+  BuildRenderQueue(scene, lists, RenderPass::kDepthPrepass, &queue);
+  ASSERT_EQ(queue.items.size(), 4u);
+  for (const RenderItem& item : queue.items) EXPECT_EQ(item.range_count, 0u);
+
+  GetRenderQueueStats(RenderPass::kDepthPrepass) = {};
+  lists.meshlet_culling = true;
+  BuildRenderQueue(scene, lists, RenderPass::kDepthPrepass, &queue);
+  // The instance behind the camera is dropped.
+  ASSERT_EQ(queue.items.size(), 3u);
+  // Each item's ranges as (first index, index count) pairs.
+  auto ranges_of = [&](const Geometry& geo) {
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    for (const RenderItem& item : queue.items) {
+      if (item.geometry != &geo) continue;
+      for (uint32_t r = 0; r < item.range_count; ++r) {
+        const IndexRange& range = queue.ranges[item.first_range + r];
+        ranges.push_back({range.first_index, range.index_count});
+      }
+    }
+    return ranges;
+  };
+  using Ranges = std::vector<std::pair<uint32_t, uint32_t>>;
+  EXPECT_EQ(ranges_of(scene.geometries[0]), (Ranges{{0, 6}}));
+  EXPECT_EQ(ranges_of(scene.geometries[1]), (Ranges{{6, 6}}));
+  EXPECT_EQ(ranges_of(scene.geometries[2]), (Ranges{{0, 12}}));
+
+  const MeshletCullStats& stats =
+      GetRenderQueueStats(RenderPass::kDepthPrepass).meshlets;
+  EXPECT_EQ(stats.meshlets, 8u);
+  EXPECT_EQ(stats.frustum_culled, 2u);
+  EXPECT_EQ(stats.cone_culled, 2u);
+}
+
+}  // namespace
+}  // namespace sh_renderer
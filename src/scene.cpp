@@ -4,13 +4,20 @@
 #include <tinyexr.h>
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
 #include <cstring>
+#include <limits>
+#include <map>
 #include <numeric>
+#include <set>
+#include <sstream>
 #include <unordered_map>
 
 #include "camera.h"
 #include "glad.h"
+#include "parallel.h"
 
 namespace sh_renderer {
 
@@ -46,9 +53,9 @@ GLuint CreateTexture2D(const Texture& texture, bool srgb = true) {
   else if (texture.channels == 1)
     format = GL_RED;
 
-  if (!texture.pixel_data.empty()) {
+  if (HasPixels(texture)) {
     glTextureSubImage2D(tex, 0, 0, 0, texture.width, texture.height, format,
-                        GL_UNSIGNED_BYTE, texture.pixel_data.data());
+                        GL_UNSIGNED_BYTE, texture.pixel_data->data());
     glGenerateTextureMipmap(tex);
   }
 
@@ -116,330 +123,214 @@ GLuint CreateTexture2D(const Texture32F& texture) {
   return tex;
 }
 
-void UploadGeometry(Geometry& geo) {
-  if (geo.vertices.empty()) return;
-
-  // Create VAO
-  glCreateVertexArrays(1, &geo.vao);
-
-  // Create VBO
-  // Interleave data? Or separate buffers?
-  // Let's use a single struct for vertex data usually, but here we have SOA in
-  // struct Geometry. Let's start with separate buffers or interleave them
-  // manually. Actually, standard is to use separate bindings or one large
-  // buffer. Let's pack them into a single buffer for cache locality (AOS).
-  // Format: Position (3f), Normal (3f), UV (2f), LightmapUV (2f), Tangent (4f)
-  // stride = 12 + 12 + 8 + 8 + 16 = 56 bytes.
-
-  struct Vertex {
-    float pos[3];
-    float norm[3];
-    float uv[2];
-    float luv[2];
-    float tan[4];
-  };
-
-  std::vector<Vertex> vertices;
-  vertices.reserve(geo.vertices.size());
-  bool has_lightmap = !geo.lightmap_uvs.empty();
+// Distance within which the centres of two connected components put them in
+// the same partitioned geometry.
+constexpr float kMergeDistance = 0.1f;
 
-  for (size_t i = 0; i < geo.vertices.size(); ++i) {
-    Vertex v;
-    v.pos[0] = geo.vertices[i].x();
-    v.pos[1] = geo.vertices[i].y();
-    v.pos[2] = geo.vertices[i].z();
-
-    if (i < geo.normals.size()) {
-      v.norm[0] = geo.normals[i].x();
-      v.norm[1] = geo.normals[i].y();
-      v.norm[2] = geo.normals[i].z();
-    } else {
-      v.norm[0] = 0;
-      v.norm[1] = 1;
-      v.norm[2] = 0;
-    }
+// Union-find over [0, n) with path compression and union by size.
+class DisjointSets {
+ public:
+  explicit DisjointSets(size_t n) : parent_(n), size_(n, 1) {
+    std::iota(parent_.begin(), parent_.end(), 0u);
+  }
 
-    if (i < geo.texture_uvs.size()) {
-      v.uv[0] = geo.texture_uvs[i].x();
-      v.uv[1] = geo.texture_uvs[i].y();
-    } else {
-      v.uv[0] = 0;
-      v.uv[1] = 0;
+  uint32_t Find(uint32_t i) {
+    uint32_t root = i;
+    while (root != parent_[root]) root = parent_[root];
+    while (i != root) {
+      const uint32_t next = parent_[i];
+      parent_[i] = root;
+      i = next;
     }
+    return root;
+  }
 
-    if (has_lightmap && i < geo.lightmap_uvs.size()) {
-      v.luv[0] = geo.lightmap_uvs[i].x();
-      v.luv[1] = geo.lightmap_uvs[i].y();
-    } else {
-      v.luv[0] = 0;
-      v.luv[1] = 0;
-    }
+  void Unite(uint32_t i, uint32_t j) {
+    uint32_t root_i = Find(i);
+    uint32_t root_j = Find(j);
+    if (root_i == root_j) return;
+    if (size_[root_i] < size_[root_j]) std::swap(root_i, root_j);
+    parent_[root_j] = root_i;
+    size_[root_i] += size_[root_j];
+  }
 
-    if (i < geo.tangents.size()) {
-      v.tan[0] = geo.tangents[i].x();
-      v.tan[1] = geo.tangents[i].y();
-      v.tan[2] = geo.tangents[i].z();
-      v.tan[3] = geo.tangents[i].w();
-    } else {
-      v.tan[0] = 1;
-      v.tan[1] = 0;
-      v.tan[2] = 0;
-      v.tan[3] = 1;
+  // Numbers the sets densely in order of their first element; returns the
+  // number of sets.
+  uint32_t Label(std::vector<uint32_t>* labels) {
+    const auto n = static_cast<uint32_t>(parent_.size());
+    constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> root_label(n, kNone);
+    labels->resize(n);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      uint32_t& label = root_label[Find(i)];
+      if (label == kNone) label = count++;
+      (*labels)[i] = label;
     }
-    vertices.push_back(v);
+    return count;
   }
 
-  glCreateBuffers(1, &geo.vbo);
-  glNamedBufferStorage(geo.vbo, vertices.size() * sizeof(Vertex),
-                       vertices.data(), 0);
-
-  // EBO
-  if (!geo.indices.empty()) {
-    glCreateBuffers(1, &geo.ebo);
-    glNamedBufferStorage(geo.ebo, geo.indices.size() * sizeof(uint32_t),
-                         geo.indices.data(), 0);
-    glVertexArrayElementBuffer(geo.vao, geo.ebo);
-    geo.index_count = static_cast<uint32_t>(geo.indices.size());
-  } else {
-    geo.index_count = 0;
-  }
-
-  // Bindings
-  const GLuint binding_index = 0;
-  glVertexArrayVertexBuffer(geo.vao, binding_index, geo.vbo, 0, sizeof(Vertex));
-
-  // Attributes
-  // 0: Pos
-  glEnableVertexArrayAttrib(geo.vao, 0);
-  glVertexArrayAttribFormat(geo.vao, 0, 3, GL_FLOAT, GL_FALSE,
-                            offsetof(Vertex, pos));
-  glVertexArrayAttribBinding(geo.vao, 0, binding_index);
-
-  // 1: Normal
-  glEnableVertexArrayAttrib(geo.vao, 1);
-  glVertexArrayAttribFormat(geo.vao, 1, 3, GL_FLOAT, GL_FALSE,
-                            offsetof(Vertex, norm));
-  glVertexArrayAttribBinding(geo.vao, 1, binding_index);
-
-  // 2: UV
-  glEnableVertexArrayAttrib(geo.vao, 2);
-  glVertexArrayAttribFormat(geo.vao, 2, 2, GL_FLOAT, GL_FALSE,
-                            offsetof(Vertex, uv));
-  glVertexArrayAttribBinding(geo.vao, 2, binding_index);
-
-  // 3: Lightmap UV
-  glEnableVertexArrayAttrib(geo.vao, 3);
-  glVertexArrayAttribFormat(geo.vao, 3, 2, GL_FLOAT, GL_FALSE,
-                            offsetof(Vertex, luv));
-  glVertexArrayAttribBinding(geo.vao, 3, binding_index);
-
-  // 4: Tangent
-  glEnableVertexArrayAttrib(geo.vao, 4);
-  glVertexArrayAttribFormat(geo.vao, 4, 4, GL_FLOAT, GL_FALSE,
-                            offsetof(Vertex, tan));
-  glVertexArrayAttribBinding(geo.vao, 4, binding_index);
-}
+ private:
+  std::vector<uint32_t> parent_;
+  std::vector<uint32_t> size_;
+};
 
+// Splits `geometry` into the groups of its connected components whose world
+// space centres lie within kMergeDistance of each other. Returns the pieces in
+// order of their first vertex, each keeping its vertices in their original
+// order, or nothing if the geometry has no vertices.
 std::vector<Geometry> PartitionLooseGeometry(const Geometry& geometry) {
   std::vector<Geometry> result;
   if (geometry.vertices.empty()) return result;
-
-  int num_vertices = static_cast<int>(geometry.vertices.size());
-  std::vector<int> parent(num_vertices);
-  std::vector<int> size(num_vertices, 1);
-  for (int i = 0; i < num_vertices; ++i) parent[i] = i;
-
-  auto find = [&](int i) {
-    int root = i;
-    while (root != parent[root]) root = parent[root];
-    int curr = i;
-    while (curr != root) {
-      int nxt = parent[curr];
-      parent[curr] = root;
-      curr = nxt;
-    }
-    return root;
-  };
-
-  auto unite = [&](int i, int j) {
-    int root_i = find(i);
-    int root_j = find(j);
-    if (root_i != root_j) {
-      if (size[root_i] < size[root_j]) {
-        parent[root_i] = root_j;
-        size[root_j] += size[root_i];
-      } else {
-        parent[root_j] = root_i;
-        size[root_i] += size[root_j];
-      }
-    }
-  };
-
-  // 1. Identify connected components of the mesh.
-  // Merge identical vertices to handle discontinuous indices for the same
-  // position.
-  std::vector<int> sorted_verts(num_vertices);
-  std::iota(sorted_verts.begin(), sorted_verts.end(), 0);
-  std::sort(sorted_verts.begin(), sorted_verts.end(), [&](int a, int b) {
-    const auto& va = geometry.vertices[a];
-    const auto& vb = geometry.vertices[b];
-    if (va.x() != vb.x()) return va.x() < vb.x();
-    if (va.y() != vb.y()) return va.y() < vb.y();
-    return va.z() < vb.z();
-  });
-
-  for (int i = 0; i < num_vertices - 1; ++i) {
-    if ((geometry.vertices[sorted_verts[i]] -
-         geometry.vertices[sorted_verts[i + 1]])
+  const auto num_vertices = static_cast<uint32_t>(geometry.vertices.size());
+  const std::vector<Eigen::Vector3f>& vertices = geometry.vertices;
+
+  // 1. Identify connected components of the mesh. Merge identical vertices to
+  //    handle discontinuous indices for the same position.
+  DisjointSets vertex_sets(num_vertices);
+  std::vector<uint32_t> sorted_verts(num_vertices);
+  std::iota(sorted_verts.begin(), sorted_verts.end(), 0u);
+  std::sort(sorted_verts.begin(), sorted_verts.end(),
+            [&](uint32_t a, uint32_t b) {
+              const auto& va = vertices[a];
+              const auto& vb = vertices[b];
+              if (va.x() != vb.x()) return va.x() < vb.x();
+              if (va.y() != vb.y()) return va.y() < vb.y();
+              return va.z() < vb.z();
+            });
+  for (uint32_t i = 0; i + 1 < num_vertices; ++i) {
+    if ((vertices[sorted_verts[i]] - vertices[sorted_verts[i + 1]])
             .squaredNorm() < 1e-8f) {
-      unite(sorted_verts[i], sorted_verts[i + 1]);
+      vertex_sets.Unite(sorted_verts[i], sorted_verts[i + 1]);
     }
   }
 
-  if (geometry.indices.empty()) {
-    for (int i = 0; i + 2 < num_vertices; i += 3) {
-      unite(i, i + 1);
-      unite(i + 1, i + 2);
-    }
-  } else {
-    for (size_t i = 0; i + 2 < geometry.indices.size(); i += 3) {
-      unite(geometry.indices[i], geometry.indices[i + 1]);
-      unite(geometry.indices[i + 1], geometry.indices[i + 2]);
-    }
+  // Triangles as vertex triples: indexed, or consecutive vertices.
+  const size_t num_triangles = geometry.indices.empty()
+                                   ? num_vertices / 3
+                                   : geometry.indices.size() / 3;
+  auto corner = [&](size_t triangle, int k) {
+    return geometry.indices.empty()
+               ? static_cast<uint32_t>(3 * triangle + k)
+               : geometry.indices[3 * triangle + k];
+  };
+  for (size_t t = 0; t < num_triangles; ++t) {
+    vertex_sets.Unite(corner(t, 0), corner(t, 1));
+    vertex_sets.Unite(corner(t, 1), corner(t, 2));
   }
 
-  // 2. For each connected component record the center.
-  std::unordered_map<int, std::vector<int>> comp_verts;
-  for (int i = 0; i < num_vertices; ++i) {
-    comp_verts[find(i)].push_back(i);
+  // 2. Record the world space center of each connected component.
+  std::vector<uint32_t> component;
+  const uint32_t num_comps = vertex_sets.Label(&component);
+  std::vector<Eigen::Vector3f> centers(num_comps, Eigen::Vector3f::Zero());
+  std::vector<uint32_t> comp_sizes(num_comps, 0);
+  for (uint32_t v = 0; v < num_vertices; ++v) {
+    centers[component[v]] += vertices[v];
+    ++comp_sizes[component[v]];
   }
-
-  struct ComponentData {
-    int id;
-    Eigen::Vector3f center;
-  };
-  std::vector<ComponentData> components;
-  for (const auto& [comp_id, verts] : comp_verts) {
-    Eigen::Vector3f center = Eigen::Vector3f::Zero();
-    for (int v : verts) {
-      center += geometry.vertices[v];
-    }
-    center /= static_cast<float>(verts.size());
-    center = geometry.transform * center;
-    components.push_back({comp_id, center});
-  }
-
-  // 3. Conduct union-find for the components. If two components are within
-  //    0.1 meters of each other, merge them.
-  int num_comps = static_cast<int>(components.size());
-  std::vector<int> comp_parent(num_comps);
-  std::vector<int> comp_size(num_comps, 1);
-  for (int i = 0; i < num_comps; ++i) comp_parent[i] = i;
-
-  auto comp_find = [&](int i) {
-    int root = i;
-    while (root != comp_parent[root]) root = comp_parent[root];
-    int curr = i;
-    while (curr != root) {
-      int nxt = comp_parent[curr];
-      comp_parent[curr] = root;
-      curr = nxt;
-    }
-    return root;
-  };
-
-  auto comp_unite = [&](int i, int j) {
-    int root_i = comp_find(i);
-    int root_j = comp_find(j);
-    if (root_i != root_j) {
-      if (comp_size[root_i] < comp_size[root_j]) {
-        comp_parent[root_i] = root_j;
-        comp_size[root_j] += comp_size[root_i];
-      } else {
-        comp_parent[root_j] = root_i;
-        comp_size[root_i] += comp_size[root_j];
-      }
-    }
-  };
-
-  for (int i = 0; i < num_comps; ++i) {
-    for (int j = i + 1; j < num_comps; ++j) {
-      if ((components[i].center - components[j].center).norm() <= 0.1f) {
-        comp_unite(i, j);
-      }
-    }
+  for (uint32_t c = 0; c < num_comps; ++c) {
+    centers[c] = geometry.transform * (centers[c] / comp_sizes[c]);
   }
 
-  // 4. Create a geometry for each set (a.k.a.root of the union-find tree).
-  //    Remember to partition the vertices and indices of the specified
-  //    geometry.
-  std::unordered_map<int, std::vector<int>> merged_comps;
-  for (int i = 0; i < num_comps; ++i) {
-    merged_comps[comp_find(i)].push_back(components[i].id);
+  // 3. Merge the components whose centers are close.
+  const std::vector<uint32_t> groups =
+      GroupNearbyPoints(centers, kMergeDistance);
+  const uint32_t num_results =
+      groups.empty() ? 0 : *std::max_element(groups.begin(), groups.end()) + 1;
+
+  // 4. Create a geometry for each group, with its vertices and triangles.
+  std::vector<uint32_t> piece(num_vertices);
+  std::vector<uint32_t> old_to_new(num_vertices);
+  std::vector<uint32_t> piece_vertices(num_results, 0);
+  std::vector<size_t> piece_indices(num_results, 0);
+  for (uint32_t v = 0; v < num_vertices; ++v) {
+    piece[v] = groups[component[v]];
+    old_to_new[v] = piece_vertices[piece[v]]++;
+  }
+  for (size_t t = 0; t < num_triangles; ++t) {
+    piece_indices[piece[corner(t, 0)]] += 3;
   }
 
-  std::vector<int> vert_to_result(num_vertices, -1);
-  std::vector<uint32_t> old_to_new(num_vertices, 0);
-
-  int num_results = 0;
-  for (const auto& [root_comp_idx, comp_ids] : merged_comps) {
-    int res_idx = num_results++;
-    Geometry sub_geo;
+  result.resize(num_results);
+  for (uint32_t r = 0; r < num_results; ++r) {
+    Geometry& sub_geo = result[r];
     sub_geo.material_id = geometry.material_id;
     sub_geo.transform = geometry.transform;
-
-    for (int c_id : comp_ids) {
-      for (int old_v : comp_verts[c_id]) {
-        vert_to_result[old_v] = res_idx;
-        old_to_new[old_v] = static_cast<uint32_t>(sub_geo.vertices.size());
-
-        sub_geo.vertices.push_back(geometry.vertices[old_v]);
-        if (!geometry.normals.empty())
-          sub_geo.normals.push_back(geometry.normals[old_v]);
-        if (!geometry.texture_uvs.empty())
-          sub_geo.texture_uvs.push_back(geometry.texture_uvs[old_v]);
-        if (!geometry.lightmap_uvs.empty())
-          sub_geo.lightmap_uvs.push_back(geometry.lightmap_uvs[old_v]);
-        if (!geometry.tangents.empty())
-          sub_geo.tangents.push_back(geometry.tangents[old_v]);
-      }
+    sub_geo.vertices.reserve(piece_vertices[r]);
+    if (!geometry.normals.empty()) sub_geo.normals.reserve(piece_vertices[r]);
+    if (!geometry.texture_uvs.empty()) {
+      sub_geo.texture_uvs.reserve(piece_vertices[r]);
     }
-    result.push_back(std::move(sub_geo));
-  }
-
-  // Generate indices for the partitioned geometries.
-  if (geometry.indices.empty()) {
-    for (int i = 0; i + 2 < num_vertices; i += 3) {
-      int v0 = i;
-      int v1 = i + 1;
-      int v2 = i + 2;
-      int res_idx = vert_to_result[v0];
-      if (res_idx != -1 && vert_to_result[v1] == res_idx &&
-          vert_to_result[v2] == res_idx) {
-        result[res_idx].indices.push_back(old_to_new[v0]);
-        result[res_idx].indices.push_back(old_to_new[v1]);
-        result[res_idx].indices.push_back(old_to_new[v2]);
-      }
+    if (!geometry.lightmap_uvs.empty()) {
+      sub_geo.lightmap_uvs.reserve(piece_vertices[r]);
     }
-  } else {
-    for (size_t i = 0; i + 2 < geometry.indices.size(); i += 3) {
-      int v0 = geometry.indices[i];
-      int v1 = geometry.indices[i + 1];
-      int v2 = geometry.indices[i + 2];
-      int res_idx = vert_to_result[v0];
-      if (res_idx != -1 && vert_to_result[v1] == res_idx &&
-          vert_to_result[v2] == res_idx) {
-        result[res_idx].indices.push_back(old_to_new[v0]);
-        result[res_idx].indices.push_back(old_to_new[v1]);
-        result[res_idx].indices.push_back(old_to_new[v2]);
-      }
+    if (!geometry.tangents.empty()) sub_geo.tangents.reserve(piece_vertices[r]);
+    sub_geo.indices.reserve(piece_indices[r]);
+  }
+  for (uint32_t v = 0; v < num_vertices; ++v) {
+    Geometry& sub_geo = result[piece[v]];
+    sub_geo.vertices.push_back(vertices[v]);
+    if (!geometry.normals.empty()) {
+      sub_geo.normals.push_back(geometry.normals[v]);
+    }
+    if (!geometry.texture_uvs.empty()) {
+      sub_geo.texture_uvs.push_back(geometry.texture_uvs[v]);
+    }
+    if (!geometry.lightmap_uvs.empty()) {
+      sub_geo.lightmap_uvs.push_back(geometry.lightmap_uvs[v]);
+    }
+    if (!geometry.tangents.empty()) {
+      sub_geo.tangents.push_back(geometry.tangents[v]);
     }
   }
-
-  // 5. Return the list of geometries.
+  // A triangle's vertices are connected, so they always share a piece.
+  for (size_t t = 0; t < num_triangles; ++t) {
+    std::vector<uint32_t>& indices = result[piece[corner(t, 0)]].indices;
+    for (int k = 0; k < 3; ++k) indices.push_back(old_to_new[corner(t, k)]);
+  }
   return result;
 }
 
+// What geometries must share to be merged into one draw by ClusterGeometries.
+struct ClusterKey {
+  int material_id = -1;
+  uint32_t streams = 0;  // bit per non-empty optional vertex stream
+  std::array<float, 16> transform = {};
+
+  auto operator<=>(const ClusterKey&) const = default;
+};
+
+ClusterKey MakeClusterKey(const Geometry& geo) {
+  ClusterKey key;
+  key.material_id = geo.material_id;
+  key.streams = (geo.normals.empty() ? 0 : 1) |
+                (geo.texture_uvs.empty() ? 0 : 2) |
+                (geo.lightmap_uvs.empty() ? 0 : 4) |
+                (geo.tangents.empty() ? 0 : 8);
+  std::copy_n(geo.transform.matrix().data(), 16, key.transform.begin());
+  return key;
+}
+
+// Appends the vertices and triangles of `geo`, whose streams match `cluster`'s.
+void AppendToCluster(Geometry&& geo, Geometry* cluster) {
+  const auto base = static_cast<uint32_t>(cluster->vertices.size());
+  auto append = [](auto& from, auto& to) {
+    to.insert(to.end(), from.begin(), from.end());
+  };
+  append(geo.vertices, cluster->vertices);
+  append(geo.normals, cluster->normals);
+  append(geo.texture_uvs, cluster->texture_uvs);
+  append(geo.lightmap_uvs, cluster->lightmap_uvs);
+  append(geo.tangents, cluster->tangents);
+  cluster->indices.reserve(cluster->indices.size() + geo.indices.size());
+  for (uint32_t index : geo.indices) cluster->indices.push_back(base + index);
+  cluster->bounding_box.min =
+      cluster->bounding_box.min.cwiseMin(geo.bounding_box.min);
+  cluster->bounding_box.max =
+      cluster->bounding_box.max.cwiseMax(geo.bounding_box.max);
+  geo = Geometry();
+}
+
 // Uploads a flat descriptor array as an SSBO laid out for `uint count; T
 // items[];`. The array begins at the std430 offset for `T` after the count: the
 // next multiple of alignof(T) (4 for our all-scalar structs, so the shader uses
@@ -461,6 +352,26 @@ void UploadDescriptorSSBO(const std::vector<T>& items, SSBO* ssbo) {
   *ssbo = CreateSSBO(buffer.data(), data_size);
 }
 
+// Calls `fn(texture, srgb)` for every texture slot of the material, including
+// layer textures and animMap frames. `MaterialT` is Material or const Material.
+template <typename MaterialT, typename Fn>
+void ForEachTexture(MaterialT& mat, Fn&& fn) {
+  fn(mat.albedo, true);
+  fn(mat.normal_texture, false);
+  fn(mat.metallic_roughness_texture, false);
+  if (mat.emissive_texture) fn(*mat.emissive_texture, true);
+  for (auto& layer : mat.layers) {
+    fn(layer.texture, true);
+    for (auto& frame : layer.anim_frames) fn(frame, true);
+  }
+}
+
+// Approximate GL storage for the texture with its full mip chain.
+size_t GpuTextureBytes(const Texture& texture) {
+  return static_cast<size_t>(texture.width) * texture.height *
+         texture.channels * 4 / 3;
+}
+
 }  // namespace
 
 void BuildLayerBuffers(const std::vector<Material>& materials,
@@ -482,6 +393,9 @@ void BuildLayerBuffers(const std::vector<Material>& materials,
     // Coverage matches the baker: the modern albedo's alpha when it has one
     // (4-channel), else the base layer's Q3 alpha.
     gm.modern_has_alpha = mat.albedo.channels == 4 ? 1 : 0;
+    for (int c = 0; c < 3; ++c) gm.emissive_factor[c] = mat.emissive_factor[c];
+    gm.emissive_strength = mat.emissive_strength;
+    gm.has_emissive_texture = mat.emissive_texture ? 1 : 0;
     out_materials->push_back(gm);
 
     for (const auto& layer : mat.layers) {
@@ -510,50 +424,41 @@ void BuildLayerBuffers(const std::vector<Material>& materials,
   }
 }
 
-void UploadSceneToGPU(Scene& scene) {
-  // Upload Materials (Textures)
-  // Upload Materials (Textures)
-  for (auto& mat : scene.materials) {
-    // Albedo (sRGB)
-    if (mat.albedo.texture_id == 0 && !mat.albedo.pixel_data.empty()) {
-      mat.albedo.texture_id = CreateTexture2D(mat.albedo, true);
-    }
-    // Normal (Linear)
-    if (mat.normal_texture.texture_id == 0 &&
-        !mat.normal_texture.pixel_data.empty()) {
-      mat.normal_texture.texture_id =
-          CreateTexture2D(mat.normal_texture, false);
-    }
-    // Metallic-Roughness (Linear)
-    if (mat.metallic_roughness_texture.texture_id == 0 &&
-        !mat.metallic_roughness_texture.pixel_data.empty()) {
-      mat.metallic_roughness_texture.texture_id =
-          CreateTexture2D(mat.metallic_roughness_texture, false);
-    }
-    // Emissive (sRGB)
-    if (mat.emissive_texture && mat.emissive_texture->texture_id == 0 &&
-        !mat.emissive_texture->pixel_data.empty()) {
-      mat.emissive_texture->texture_id =
-          CreateTexture2D(*mat.emissive_texture, true);
-    }
-
-    // SH_material_layers: upload each layer's texture, or all animMap frames
-    // (sRGB). A static layer uses `texture`; an animated one uses `anim_frames`
-    // (the draw selects the active frame on the CPU).
-    for (auto& layer : mat.layers) {
-      if (layer.anim_frames.empty()) {
-        if (layer.texture.texture_id == 0 && !layer.texture.pixel_data.empty()) {
-          layer.texture.texture_id = CreateTexture2D(layer.texture, true);
-        }
-      } else {
-        for (auto& frame : layer.anim_frames) {
-          if (frame.texture_id == 0 && !frame.pixel_data.empty()) {
-            frame.texture_id = CreateTexture2D(frame, true);
-          }
-        }
+void AssignLayerSets(std::vector<Material>& materials) {
+  std::map<std::vector<uint32_t>, uint32_t> sets;
+  std::vector<uint32_t> textures;
+  for (Material& mat : materials) {
+    mat.layer_set = 0;
+    if (mat.layers.empty()) continue;
+    textures.clear();
+    for (const Layer& layer : mat.layers) {
+      textures.push_back(layer.texture.texture_id);
+      for (const Texture& frame : layer.anim_frames) {
+        textures.push_back(frame.texture_id);
       }
+      // Separates the layers, so frames cannot pass for the next layer.
+      textures.push_back(0);
     }
+    auto [it, inserted] = sets.try_emplace(textures, 0);
+    if (inserted) it->second = static_cast<uint32_t>(sets.size());
+    mat.layer_set = it->second;
   }
+}
+
+void UploadSceneToGPU(Scene& scene, VertexFormat vertex_format) {
+  // Upload Materials (Textures). Slots sharing a pixel buffer with the same
+  // colour space share one GL texture. Layer textures and animMap frames are
+  // sRGB; the draw selects the active frame on the CPU.
+  std::map<std::pair<const void*, bool>, GLuint> uploaded;
+  for (auto& mat : scene.materials) {
+    ForEachTexture(mat, [&](Texture& texture, bool srgb) {
+      if (texture.texture_id != 0 || !HasPixels(texture)) return;
+      GLuint& tex = uploaded[{texture.pixel_data.get(), srgb}];
+      if (tex == 0) tex = CreateTexture2D(texture, srgb);
+      texture.texture_id = tex;
+    });
+  }
+  AssignLayerSets(scene.materials);
 
   // Upload Lightmaps
   for (int i = 0; i < 3; ++i) {
@@ -565,9 +470,14 @@ void UploadSceneToGPU(Scene& scene) {
   }
 
   // Upload Geometry
-  for (auto& geo : scene.geometries) {
-    UploadGeometry(geo);
-  }
+  size_t vertex_bytes = 0;
+  size_t instanced_bytes = 0;
+  scene.geometry_arena = CreateGeometryArena(
+      scene.geometries, vertex_format, &vertex_bytes, &instanced_bytes);
+  LOG(INFO) << "Geometry arena: " << vertex_bytes / (1024.0 * 1024.0)
+            << " MiB of vertices for " << scene.geometries.size()
+            << " geometries, " << instanced_bytes / (1024.0 * 1024.0)
+            << " MiB of vertices and indices saved by instancing";
 
   // SH_material_layers descriptors.
   {
@@ -772,10 +682,45 @@ void AllocateShadowMapForLights(Scene& scene, const Camera& camera) {
       light.has_shadow = 1;
       light.shadow_uv_offset = offset / 2048.0f;
       light.shadow_uv_scale = Eigen::Vector2f(size, size) / 2048.0f;
+      light.shadow_view_proj = ComputeSpotShadowViewProj(light);
     }
   }
 }
 
+Eigen::Matrix4f ComputeSpotShadowViewProj(const SpotLight& light) {
+  Eigen::Vector3f up = Eigen::Vector3f(0, 1, 0);
+  if (std::abs(light.direction.y()) > 0.999f) {
+    up = Eigen::Vector3f(1, 0, 0);
+  }
+
+  Eigen::Matrix3f R;
+  Eigen::Vector3f Z = -light.direction.normalized();
+  Eigen::Vector3f X = up.cross(Z).normalized();
+  Eigen::Vector3f Y = Z.cross(X).normalized();
+  R.col(0) = X;
+  R.col(1) = Y;
+  R.col(2) = Z;
+  Eigen::Matrix4f view_matrix = Eigen::Matrix4f::Identity();
+  view_matrix.block<3, 3>(0, 0) = R.transpose();
+  view_matrix.block<3, 1>(0, 3) = -R.transpose() * light.position;
+
+  float fov_y = 2.0f * std::acos(light.cos_outer_cone);
+  float aspect = 1.0f;
+  float z_near = 0.1f;
+  float z_far = light.radius;
+  if (z_far < z_near + 0.1f) z_far = z_near + 10.0f;
+
+  float f = 1.0f / std::tan(fov_y / 2.0f);
+  Eigen::Matrix4f proj_matrix = Eigen::Matrix4f::Zero();
+  proj_matrix(0, 0) = f / aspect;
+  proj_matrix(1, 1) = f;
+  proj_matrix(2, 2) = (z_near + z_far) / (z_near - z_far);
+  proj_matrix(2, 3) = (2.0f * z_far * z_near) / (z_near - z_far);
+  proj_matrix(3, 2) = -1.0f;
+
+  return proj_matrix * view_matrix;
+}
+
 void ComputeSceneBoundingBoxes(Scene& scene) {
   for (auto& geo : scene.geometries) {
     geo.bounding_box.min =
@@ -783,9 +728,8 @@ void ComputeSceneBoundingBoxes(Scene& scene) {
     geo.bounding_box.max =
         Eigen::Vector3f::Constant(-std::numeric_limits<float>::infinity());
 
-    if (geo.vertices.empty()) continue;
-
-    for (const auto& v : geo.vertices) {
+    const Geometry& mesh = GeometryMesh(scene.geometries, geo);
+    for (const auto& v : mesh.vertices) {
       Eigen::Vector3f world_v = geo.transform * v;
       geo.bounding_box.min = geo.bounding_box.min.cwiseMin(world_v);
       geo.bounding_box.max = geo.bounding_box.max.cwiseMax(world_v);
@@ -793,28 +737,372 @@ void ComputeSceneBoundingBoxes(Scene& scene) {
   }
 }
 
-void OptimizeScene(Scene& scene) {
-  std::sort(scene.geometries.begin(), scene.geometries.end(),
-            [](const Geometry& a, const Geometry& b) {
-              return a.material_id < b.material_id;
-            });
+void BuildSceneBvh(Scene& scene) {
+  std::vector<AABB> boxes;
+  boxes.reserve(scene.geometries.size());
+  for (const auto& geo : scene.geometries) boxes.push_back(geo.bounding_box);
+  scene.bvh = BuildBvh(boxes);
+}
+
+void FrustumCullGeometries(const Scene& scene, const Eigen::Vector4f planes[6],
+                           std::vector<uint32_t>* visible) {
+  visible->clear();
+  QueryBvhFrustum(scene.bvh, planes, visible);
+
+  // Back to scene order. Past a few percent of the scene, marking the hits in
+  // a bitmask and reading it back in order is cheaper than sorting them.
+  if (visible->size() * 64 < scene.geometries.size()) {
+    std::sort(visible->begin(), visible->end());
+    return;
+  }
+  thread_local std::vector<uint64_t> mask;
+  mask.assign((scene.geometries.size() + 63) / 64, 0);
+  for (uint32_t i : *visible) mask[i / 64] |= uint64_t{1} << (i % 64);
+  visible->clear();
+  CompactVisible(mask, visible);
+}
+
+std::vector<uint32_t> GroupNearbyPoints(
+    std::span<const Eigen::Vector3f> points, float distance) {
+  const auto n = static_cast<uint32_t>(points.size());
+  DisjointSets sets(n);
+
+  // Bucket the points into a grid of cells a little wider than `distance`, so
+  // rounding cannot put two points within it more than one cell apart. Cell
+  // coordinates wrap to 21 bits in the key; points from cells that collide
+  // are only extra candidates for the distance test.
+  const float inv_cell = 1.0f / (1.001f * distance);
+  constexpr uint64_t kCellMask = (uint64_t{1} << 21) - 1;
+  auto cell_key = [&](const Eigen::Vector3i& cell) {
+    return (static_cast<uint64_t>(cell.x()) & kCellMask) << 42 |
+           (static_cast<uint64_t>(cell.y()) & kCellMask) << 21 |
+           (static_cast<uint64_t>(cell.z()) & kCellMask);
+  };
+  auto cell_of = [&](const Eigen::Vector3f& p) -> Eigen::Vector3i {
+    return (p * inv_cell).array().floor().cast<int>();
+  };
+  std::vector<std::pair<uint64_t, uint32_t>> sorted(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    sorted[i] = {cell_key(cell_of(points[i])), i};
+  }
+  std::sort(sorted.begin(), sorted.end());
+  // The points in cell order, and each occupied cell's range of them.
+  std::vector<Eigen::Vector3f> cell_ordered(n);
+  for (uint32_t k = 0; k < n; ++k) cell_ordered[k] = points[sorted[k].second];
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> cell_points;
+  cell_points.reserve(n);
+  for (uint32_t begin = 0; begin < n;) {
+    uint32_t end = begin + 1;
+    while (end < n && sorted[end].first == sorted[begin].first) ++end;
+    ranges.emplace_back(begin, end);
+    cell_points.emplace(sorted[begin].first, ranges.back());
+    begin = end;
+  }
+
+  // Test the pairs within each cell, then against the 13 neighbours of the
+  // forward half of its 3x3x3 block; the other half tests it in turn.
+  const float distance_squared = distance * distance;
+  auto test = [&](uint32_t a, uint32_t b) {
+    if ((cell_ordered[a] - cell_ordered[b]).squaredNorm() <= distance_squared) {
+      sets.Unite(sorted[a].second, sorted[b].second);
+    }
+  };
+  for (const auto& [begin, end] : ranges) {
+    for (uint32_t a = begin; a < end; ++a) {
+      for (uint32_t b = a + 1; b < end; ++b) test(a, b);
+    }
+    const Eigen::Vector3i cell = cell_of(cell_ordered[begin]);
+    for (int offset = 14; offset < 27; ++offset) {
+      const Eigen::Vector3i neighbour =
+          cell + Eigen::Vector3i(offset % 3 - 1, offset / 3 % 3 - 1,
+                                 offset / 9 - 1);
+      const auto it = cell_points.find(cell_key(neighbour));
+      if (it == cell_points.end()) continue;
+      for (uint32_t a = begin; a < end; ++a) {
+        for (uint32_t b = it->second.first; b < it->second.second; ++b) {
+          test(a, b);
+        }
+      }
+    }
+  }
+
+  std::vector<uint32_t> groups;
+  sets.Label(&groups);
+  return groups;
 }
 
-void PartitionLooseGeometries(Scene& scene) {
-  for (auto it = scene.geometries.begin(); it != scene.geometries.end();) {
-    std::vector<Geometry> independent_geos = PartitionLooseGeometry(*it);
-    if (independent_geos.size() <= 1) {
-      if (!independent_geos.empty()) {
-        *it = std::move(independent_geos[0]);
+void PartitionLooseGeometries(Scene& scene, unsigned num_threads) {
+  // Partition the meshes in parallel; each frees its source once split.
+  const size_t count = scene.geometries.size();
+  std::vector<std::vector<Geometry>> split(count);
+  ParallelFor(count, num_threads, [&](size_t i) {
+    Geometry& geo = scene.geometries[i];
+    if (geo.instance_of >= 0) return;
+    split[i] = PartitionLooseGeometry(geo);
+    if (!split[i].empty()) geo = Geometry();
+  });
+
+  // The pieces of each original geometry in `partitioned`: first and count.
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const Geometry& geo = scene.geometries[i];
+    total += geo.instance_of >= 0
+                 ? std::max<size_t>(split[geo.instance_of].size(), 1)
+                 : std::max<size_t>(split[i].size(), 1);
+  }
+  std::vector<Geometry> partitioned;
+  partitioned.reserve(total);
+  std::vector<std::pair<int32_t, int32_t>> pieces(count);
+  for (size_t i = 0; i < count; ++i) {
+    Geometry& geo = scene.geometries[i];
+    const auto first = static_cast<int32_t>(partitioned.size());
+    if (geo.instance_of >= 0) {
+      DCHECK_LT(geo.instance_of, static_cast<int32_t>(i));
+      // Instances take the partition of their mesh.
+      const auto [mesh_first, mesh_count] = pieces[geo.instance_of];
+      for (int32_t k = 0; k < mesh_count; ++k) {
+        Geometry piece;
+        piece.material_id = geo.material_id;
+        piece.transform = geo.transform;
+        piece.instance_of = mesh_first + k;
+        partitioned.push_back(std::move(piece));
       }
-      ++it;
+      pieces[i] = {first, mesh_count};
       continue;
     }
-    it = scene.geometries.erase(it);
-    it = scene.geometries.insert(it, independent_geos.begin(),
-                                 independent_geos.end());
-    it += independent_geos.size();
+    if (split[i].empty()) {
+      partitioned.push_back(std::move(geo));
+    } else {
+      for (Geometry& piece : split[i]) partitioned.push_back(std::move(piece));
+      std::vector<Geometry>().swap(split[i]);
+    }
+    pieces[i] = {first, static_cast<int32_t>(partitioned.size()) - first};
+  }
+
+  // Area lights keep pointing at the first piece of their geometry.
+  for (AreaLight& light : scene.area_lights) {
+    if (light.geometry == nullptr) continue;
+    const size_t index = light.geometry - scene.geometries.data();
+    if (index >= scene.geometries.size()) continue;
+    light.geometry = &partitioned[pieces[index].first];
+  }
+  scene.geometries = std::move(partitioned);
+}
+
+void ClusterGeometries(Scene& scene, const ClusterBudget& budget) {
+  if (budget.max_triangles == 0) return;
+  const size_t count = scene.geometries.size();
+
+  // Geometries drawn under another's record stay alone: instances, the meshes
+  // they share and area light emitters.
+  std::vector<bool> fixed(count, false);
+  for (size_t i = 0; i < count; ++i) {
+    const Geometry& geo = scene.geometries[i];
+    if (geo.instance_of < 0) continue;
+    fixed[i] = true;
+    fixed[geo.instance_of] = true;
+  }
+  for (const AreaLight& light : scene.area_lights) {
+    if (light.geometry == nullptr) continue;
+    const size_t index = light.geometry - scene.geometries.data();
+    if (index < count) fixed[index] = true;
+  }
+  std::map<ClusterKey, std::vector<uint32_t>> groups;
+  for (size_t i = 0; i < count; ++i) {
+    const Geometry& geo = scene.geometries[i];
+    if (fixed[i] || geo.indices.empty()) continue;
+    groups[MakeClusterKey(geo)].push_back(static_cast<uint32_t>(i));
+  }
+
+  // Split each group along a BVH over its geometries: the nodes nearest the
+  // root within both budgets become clusters. `cluster_of` is the first
+  // geometry of each geometry's cluster.
+  std::vector<uint32_t> cluster_of(count);
+  std::iota(cluster_of.begin(), cluster_of.end(), 0u);
+  size_t num_clusters = 0;
+  size_t num_clustered = 0;
+  for (const auto& [key, members] : groups) {
+    if (members.size() < 2) continue;
+    std::vector<AABB> boxes;
+    boxes.reserve(members.size());
+    for (uint32_t i : members) {
+      boxes.push_back(scene.geometries[i].bounding_box);
+    }
+    const Bvh bvh = BuildBvh(boxes, /*max_leaf_size=*/1);
+    // Triangles of the primitives before each leaf-order position.
+    std::vector<size_t> triangles_before(bvh.primitives.size() + 1, 0);
+    for (size_t k = 0; k < bvh.primitives.size(); ++k) {
+      triangles_before[k + 1] =
+          triangles_before[k] +
+          scene.geometries[members[bvh.primitives[k]]].indices.size() / 3;
+    }
+    auto emit = [&](uint32_t first, uint32_t size) {
+      uint32_t head = UINT32_MAX;
+      for (uint32_t k = first; k < first + size; ++k) {
+        head = std::min(head, members[bvh.primitives[k]]);
+      }
+      for (uint32_t k = first; k < first + size; ++k) {
+        cluster_of[members[bvh.primitives[k]]] = head;
+      }
+      ++num_clusters;
+      num_clustered += size;
+    };
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty()) {
+      const BvhNode& node = bvh.nodes[stack.back()];
+      const uint32_t index = stack.back();
+      stack.pop_back();
+      const size_t triangles = triangles_before[node.first + node.count] -
+                               triangles_before[node.first];
+      const Eigen::Vector3f extent = node.bounds.max - node.bounds.min;
+      const bool fits = triangles <= budget.max_triangles &&
+                        extent.maxCoeff() <= budget.max_extent;
+      if (fits || node.count == 1) {
+        emit(node.first, node.count);
+      } else if (node.second_child != 0) {
+        stack.push_back(node.second_child);
+        stack.push_back(index + 1);
+      } else {
+        // A leaf at the depth limit over budget: its geometries stay alone.
+        for (uint32_t k = 0; k < node.count; ++k) emit(node.first + k, 1);
+      }
+    }
+  }
+
+  // Each cluster takes the place of its first geometry, merging the others
+  // into it in scene order.
+  std::vector<Geometry> clustered;
+  std::vector<int32_t> new_index(count, -1);
+  for (size_t i = 0; i < count; ++i) {
+    if (cluster_of[i] != i) continue;
+    new_index[i] = static_cast<int32_t>(clustered.size());
+    clustered.push_back(std::move(scene.geometries[i]));
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (cluster_of[i] == i) continue;
+    AppendToCluster(std::move(scene.geometries[i]),
+                    &clustered[new_index[cluster_of[i]]]);
+  }
+  for (Geometry& geo : clustered) {
+    if (geo.instance_of >= 0) geo.instance_of = new_index[geo.instance_of];
+  }
+  for (AreaLight& light : scene.area_lights) {
+    if (light.geometry == nullptr) continue;
+    const size_t index = light.geometry - scene.geometries.data();
+    if (index >= count) continue;
+    light.geometry = &clustered[new_index[index]];
+  }
+  LOG(INFO) << "Clustered " << num_clustered << " of " << count
+            << " geometries into " << num_clusters << " (at most "
+            << budget.max_triangles << " triangles and " << budget.max_extent
+            << " m): " << clustered.size() << " geometries.";
+  scene.geometries = std::move(clustered);
+}
+
+SceneOptimizationStats OptimizeScene(Scene& scene, unsigned num_threads) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<SceneOptimizationStats> stats(scene.geometries.size());
+  ParallelFor(scene.geometries.size(), num_threads, [&](size_t i) {
+    Geometry& geo = scene.geometries[i];
+    if (geo.instance_of >= 0 || geo.indices.size() < 3) return;
+    const size_t vertex_count = geo.vertices.size();
+    stats[i].before = AnalyzeVertexCache(geo.indices, vertex_count);
+    const std::vector<uint32_t> clusters =
+        OptimizeVertexCache(geo.indices, vertex_count);
+    OptimizeOverdraw(geo.indices, geo.vertices, clusters);
+    OptimizeVertexFetch(&geo);
+    stats[i].after = AnalyzeVertexCache(geo.indices, vertex_count);
+  });
+
+  SceneOptimizationStats total;
+  for (const SceneOptimizationStats& geo_stats : stats) {
+    total.before += geo_stats.before;
+    total.after += geo_stats.after;
+  }
+  LOG(INFO) << "Optimized the index order of " << total.after.triangles
+            << " triangles in "
+            << std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms: ACMR " << total.before.acmr() << " -> "
+            << total.after.acmr() << ", ATVR " << total.before.atvr()
+            << " -> " << total.after.atvr() << " (FIFO cache of "
+            << kVertexCacheSize << ").";
+  return total;
+}
+
+void BuildSceneLods(Scene& scene, const LodOptions& options,
+                    unsigned num_threads) {
+  const auto start = std::chrono::steady_clock::now();
+  ParallelFor(scene.geometries.size(), num_threads, [&](size_t i) {
+    Geometry& geo = scene.geometries[i];
+    geo.lods = BuildLodChain(geo, options);
+  });
+
+  // Triangles per level, counting full detail for the levels a geometry
+  // lacks.
+  std::vector<size_t> triangles(options.max_lods + 1, 0);
+  size_t geometries = 0;
+  for (const Geometry& geo : scene.geometries) {
+    if (!geo.lods.empty()) ++geometries;
+    size_t count = geo.indices.size() / 3;
+    for (size_t level = 0; level < triangles.size(); ++level) {
+      if (level > 0 && level <= geo.lods.size()) {
+        count = geo.lods[level - 1].indices.size() / 3;
+      }
+      triangles[level] += count;
+    }
+  }
+  std::ostringstream levels;
+  for (size_t level = 0; level < triangles.size(); ++level) {
+    levels << (level ? ", " : "") << triangles[level];
+  }
+  LOG(INFO) << "Built levels of detail for " << geometries
+            << " geometries in "
+            << std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms: " << levels.str() << " triangles per level.";
+}
+
+void BuildSceneMeshlets(Scene& scene, const MeshletOptions& options,
+                        unsigned num_threads) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<VertexCacheStats> stats(scene.geometries.size());
+  ParallelFor(scene.geometries.size(), num_threads, [&](size_t i) {
+    Geometry& geo = scene.geometries[i];
+    // The levels index the vertices OptimizeVertexFetch is about to move.
+    DCHECK(geo.lods.empty()) << "Build the meshlets before the levels.";
+    geo.meshlets = BuildMeshlets(&geo, options);
+    if (geo.meshlets.empty()) return;
+    SortMeshletsForOverdraw(geo.indices, geo.vertices, &geo.meshlets);
+    OptimizeVertexFetch(&geo);
+    stats[i] = AnalyzeVertexCache(geo.indices, geo.vertices.size());
+  });
+
+  size_t meshlets = 0;
+  VertexCacheStats total;
+  for (size_t i = 0; i < scene.geometries.size(); ++i) {
+    meshlets += scene.geometries[i].meshlets.size();
+    total += stats[i];
   }
+  LOG(INFO) << "Built " << meshlets << " meshlets in "
+            << std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms, "
+            << (meshlets ? static_cast<double>(total.triangles) / meshlets
+                         : 0.0)
+            << " triangles each on average; in meshlet order ACMR "
+            << total.acmr() << ", ATVR " << total.atvr() << ".";
+}
+
+const Geometry& GeometryMesh(const std::vector<Geometry>& geometries,
+                             const Geometry& geometry) {
+  if (geometry.instance_of < 0) return geometry;
+  DCHECK_LT(geometry.instance_of, static_cast<int32_t>(geometries.size()));
+  return geometries[geometry.instance_of];
 }
 
 // ... Existing functions ...
@@ -851,14 +1139,16 @@ std::vector<Eigen::Vector4f> TransformedTangents(const Geometry& geometry) {
   return out;
 }
 
-float SurfaceArea(const Geometry& geometry) {
+float SurfaceArea(const std::vector<Geometry>& geometries,
+                  const Geometry& geometry) {
   // Basic implementation for area lights
   // Only works if indexed triangles
+  const Geometry& mesh = GeometryMesh(geometries, geometry);
   float area = 0.0f;
-  for (size_t i = 0; i < geometry.indices.size(); i += 3) {
-    const auto& v0 = geometry.vertices[geometry.indices[i]];
-    const auto& v1 = geometry.vertices[geometry.indices[i + 1]];
-    const auto& v2 = geometry.vertices[geometry.indices[i + 2]];
+  for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+    const auto& v0 = mesh.vertices[mesh.indices[i]];
+    const auto& v1 = mesh.vertices[mesh.indices[i + 1]];
+    const auto& v2 = mesh.vertices[mesh.indices[i + 2]];
 
     // Transform? The function signature implies local space, but usually we
     // want world area. Let's assume input geometry is local, so we apply
@@ -927,14 +1217,68 @@ void LogScene(const Scene& scene) {
     LOG(INFO) << "Sun Light: 0";
   }
 
+  // Vertex data with and without sharing meshes between instances.
   size_t total_vertices = 0;
   size_t total_indices = 0;
+  size_t instances = 0;
+  size_t mesh_bytes = 0;
+  size_t instance_bytes = 0;
+  std::vector<uint8_t> instanced(scene.geometries.size(), 0);
+  auto geometry_bytes = [](const Geometry& geo) {
+    return geo.vertices.size() * sizeof(Eigen::Vector3f) +
+           geo.normals.size() * sizeof(Eigen::Vector3f) +
+           geo.texture_uvs.size() * sizeof(Eigen::Vector2f) +
+           geo.lightmap_uvs.size() * sizeof(Eigen::Vector2f) +
+           geo.tangents.size() * sizeof(Eigen::Vector4f) +
+           geo.indices.size() * sizeof(uint32_t);
+  };
   for (const auto& geo : scene.geometries) {
     total_vertices += geo.vertices.size();
     total_indices += geo.indices.size();
+    mesh_bytes += geometry_bytes(geo);
+    if (geo.instance_of < 0) continue;
+    ++instances;
+    instanced[geo.instance_of] = 1;
+    instance_bytes += geometry_bytes(GeometryMesh(scene.geometries, geo));
   }
+  constexpr double kMiB = 1024.0 * 1024.0;
   LOG(INFO) << "Total Vertices: " << total_vertices;
   LOG(INFO) << "Total Indices: " << total_indices;
+  LOG(INFO) << "Instances: " << instances << " of "
+            << std::count(instanced.begin(), instanced.end(), 1)
+            << " shared meshes";
+  LOG(INFO) << "Vertex CPU Memory: " << mesh_bytes / kMiB << " MiB ("
+            << instance_bytes / kMiB << " MiB saved by instancing)";
+
+  // Texture memory with and without sharing buffers between slots.
+  size_t slot_count = 0;
+  size_t slot_cpu_bytes = 0;
+  size_t slot_gpu_bytes = 0;
+  size_t cpu_bytes = 0;
+  size_t gpu_bytes = 0;
+  std::set<const void*> buffers;
+  std::set<std::pair<const void*, bool>> gl_textures;
+  for (const auto& mat : scene.materials) {
+    ForEachTexture(mat, [&](const Texture& texture, bool srgb) {
+      if (!HasPixels(texture)) return;
+      const void* buffer = texture.pixel_data.get();
+      ++slot_count;
+      slot_cpu_bytes += texture.pixel_data->size();
+      slot_gpu_bytes += GpuTextureBytes(texture);
+      if (buffers.insert(buffer).second) {
+        cpu_bytes += texture.pixel_data->size();
+      }
+      if (gl_textures.insert({buffer, srgb}).second) {
+        gpu_bytes += GpuTextureBytes(texture);
+      }
+    });
+  }
+  LOG(INFO) << "Textures: " << slot_count << " slots, " << buffers.size()
+            << " pixel buffers, " << gl_textures.size() << " GL textures";
+  LOG(INFO) << "Texture CPU Memory: " << cpu_bytes / kMiB << " MiB ("
+            << (slot_cpu_bytes - cpu_bytes) / kMiB << " MiB saved by sharing)";
+  LOG(INFO) << "Texture GPU Memory: ~" << gpu_bytes / kMiB << " MiB ("
+            << (slot_gpu_bytes - gpu_bytes) / kMiB << " MiB saved by sharing)";
   LOG(INFO) << "-------------------";
 }
 
@@ -6,17 +6,33 @@
 #include <array>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "bvh.h"
 #include "culling.h"
+#include "geometry_arena.h"
+#include "mesh_optimizer.h"
+#include "pvs.h"
 #include "q3_layer.h"
 #include "ssbo.h"
+#include "vertex_format.h"
 
 namespace sh_renderer {
 
 // --- Texture ---
+// 8-bit pixels of a Texture. Immutable once loaded, so every texture slot that
+// samples the same source image shares one buffer (see TextureRegistry in
+// loader.h); UploadSceneToGPU also creates one GL texture per buffer.
+using PixelData = std::shared_ptr<const std::vector<uint8_t>>;
+
+inline PixelData MakePixelData(std::vector<uint8_t> pixels) {
+  return std::make_shared<const std::vector<uint8_t>>(std::move(pixels));
+}
+
 struct Texture {
   // If set, the texture is loaded from a file. This denotes the provenance of
   // the texture.
@@ -25,12 +41,16 @@ struct Texture {
   uint32_t width = 0;
   uint32_t height = 0;
   uint32_t channels = 0;
-  std::vector<uint8_t> pixel_data;
+  PixelData pixel_data;
 
-  // GL Resource
+  // GL Resource. Shared by all textures with the same pixel_data and sRGB-ness.
   uint32_t texture_id = 0;
 };
 
+inline bool HasPixels(const Texture& texture) {
+  return texture.pixel_data && !texture.pixel_data->empty();
+}
+
 // --- Texture32F ---
 struct Texture32F {
   // If set, the texture is loaded from a file. This denotes the provenance of
@@ -95,6 +115,10 @@ struct Material {
   std::vector<Layer> layers;
   int base_layer = 0;
   CullMode cull_mode = CullMode::kFront;
+
+  // GL Resources. Materials whose layers sample the same textures share a
+  // layer set (0 for none; see AssignLayerSets).
+  uint32_t layer_set = 0;
 };
 
 // --- Geometry ---
@@ -106,15 +130,34 @@ struct Geometry {
   std::vector<Eigen::Vector4f> tangents;  // xyz + w (sign)
 
   std::vector<uint32_t> indices;
+  // Coarser levels of detail of the indexed triangles, finest first (see
+  // BuildLodChain). Instances get their mesh's errors and arena ranges, without
+  // the indices, when uploaded.
+  std::vector<GeometryLod> lods;
+  // The full detail triangles' meshlets, in index order (see BuildMeshlets),
+  // which CPU culled views cull one by one. Instances use their mesh's.
+  std::vector<Meshlet> meshlets;
 
   int material_id = -1;  // Index into Scene::materials
   Eigen::Affine3f transform = Eigen::Affine3f::Identity();
 
-  // GL Resources
-  uint32_t vao = 0;
-  uint32_t vbo = 0;
-  uint32_t ebo = 0;
+  // Instancing. The index in Scene::geometries of the earlier geometry whose
+  // vertices and indices this one places again under its own transform, or -1
+  // if it holds its own. Instances leave the vertex streams and indices empty
+  // and share their mesh's range of the geometry arena (see GeometryMesh).
+  int32_t instance_of = -1;
+
+  // GL Resources. The geometry's range in Scene::geometry_arena (index_count
+  // is 0 until uploaded, or for geometry without vertices), and the index of
+  // its GpuDrawRecord, which draws pass as the base instance.
+  uint32_t first_index = 0;
   uint32_t index_count = 0;
+  int32_t base_vertex = 0;
+  uint32_t draw_id = 0;
+  // Position dequantization for the vertex shaders (position = offset + scale *
+  // attribute). Identity unless uploaded as VertexFormat::kQuantized.
+  Eigen::Vector3f position_scale = Eigen::Vector3f::Ones();
+  Eigen::Vector3f position_offset = Eigen::Vector3f::Zero();
 
   // Culling
   AABB bounding_box;
@@ -189,7 +232,13 @@ struct Scene {
   // Baked Indirect SH Lightmaps
   std::array<Texture32F, 3> lightmaps_packed;
 
+  // Culling. Hierarchy over the geometries' bounding boxes (BuildSceneBvh),
+  // and the view cells' visible sets if baked for the scene (empty otherwise).
+  Bvh bvh;
+  Pvs pvs;
+
   // GL Resources
+  GeometryArena geometry_arena;
   SSBO point_light_list_ssbo;
   SSBO spot_light_list_ssbo;
   // SH_material_layers descriptors (see GpuMaterial/GpuMaterialLayer/GpuTcMod).
@@ -199,11 +248,13 @@ struct Scene {
   ShadowAtlasContext shadow_atlas;
 };
 
-// GPU-side SH_material_layers descriptors (std430, tightly packed, all 4-byte
-// scalars padded to 16-byte multiples). Layer textures are NOT referenced here:
-// the draw binds each material's layers to a capped sampler array in order and
-// the CPU selects the active animMap frame. The base layer's colour comes from
-// the modern baseColorTexture instead of its sampler (shader checks base_layer).
+// GPU-side material and SH_material_layers descriptors (std430, tightly packed,
+// all 4-byte scalars padded to 16-byte multiples). GpuMaterial also carries the
+// emission parameters, so the radiance pass sets no per-material uniforms.
+// Layer textures are NOT referenced here: the draw binds each material's
+// layers to a capped sampler array in order and the CPU selects the active
+// animMap frame. The base layer's colour comes from the modern
+// baseColorTexture instead of its sampler (shader checks base_layer).
 // Max layer samplers bound per draw (the shader's `u_layers` array size). Q3
 // materials rarely exceed this; extra stages are dropped.
 constexpr int kMaxLayers = 8;
@@ -213,8 +264,12 @@ struct GpuMaterial {
   int32_t layer_count;       // 0 for plain PBR materials
   int32_t base_layer;        // index within [0, layer_count)
   int32_t modern_has_alpha;  // 1 if the base coverage comes from the modern albedo
+  float emissive_factor[3];
+  float emissive_strength;
+  int32_t has_emissive_texture;
+  int32_t _pad[3];
 };
-static_assert(sizeof(GpuMaterial) == 16);
+static_assert(sizeof(GpuMaterial) == 48);
 
 struct GpuMaterialLayer {
   int32_t blend_src;  // BlendFactor
@@ -247,6 +302,12 @@ void BuildLayerBuffers(const std::vector<Material>& materials,
                        std::vector<GpuMaterialLayer>* out_layers,
                        std::vector<GpuTcMod>* out_tcmods);
 
+// Numbers the materials' layer texture sets: materials whose layers (and
+// animMap frames) use the same GL textures in the same order get the same
+// Material::layer_set, starting at 1; materials without layers get 0. Run
+// after the textures are uploaded.
+void AssignLayerSets(std::vector<Material>& materials);
+
 // GPU-side light structs (std430 layout).
 // These are tightly packed for SSBO upload.
 struct GpuPointLight {
@@ -281,29 +342,108 @@ float ComputeLightRadius(float intensity, const Eigen::Vector3f& color,
 // Uploads the scene geometry and textures to the GPU.
 // Populates the GL resource handles in the scene structs.
 // Uses Direct State Access (DSA) for all GL operations.
-void UploadSceneToGPU(Scene& scene);
+// All geometry goes into one GeometryArena with vertices packed in
+// `vertex_format`.
+void UploadSceneToGPU(Scene& scene,
+                      VertexFormat vertex_format = VertexFormat::kFloat);
 
 // Uploads the point and spot light lists to the GPU SSBOs.
 void UploadLightsToGPU(Scene& scene);
 
 // Frustum cull spot lights against main camera, rank by form factor,
-// and allocate into the shadow atlas.
+// and allocate into the shadow atlas. Sets the shadow_view_proj of the lights
+// that get a shadow.
 void AllocateShadowMapForLights(Scene& scene, const class Camera& camera);
 
+// Returns the view-projection of a spot light's shadow map: a perspective
+// covering its outer cone out to its radius.
+Eigen::Matrix4f ComputeSpotShadowViewProj(const SpotLight& light);
+
 // Computes the world-space bounding box for each geometry in the scene.
 void ComputeSceneBoundingBoxes(Scene& scene);
 
-// Optimizes the scene by sorting geometries by material_id to minimize state
-// changes.
-void OptimizeScene(Scene& scene);
+// Builds scene.bvh over the geometries' bounding boxes. Call again whenever
+// the geometries or their bounding boxes change.
+void BuildSceneBvh(Scene& scene);
+
+// Replaces `visible` with the indices of the geometries whose bounding box
+// intersects the frustum `planes`, found through scene.bvh, in ascending
+// (scene) order.
+void FrustumCullGeometries(const Scene& scene, const Eigen::Vector4f planes[6],
+                           std::vector<uint32_t>* visible);
 
 // Partitions each loose geometry in the scene into independent connected
-// components that are further away than 0.1 meters. Replaces the original
-// geometry with the partitioned geometries in the scene.
-void PartitionLooseGeometries(Scene& scene);
+// components that are further away than 0.1 meters, on up to `num_threads`
+// threads (0 for all cores). Replaces the original geometry with the
+// partitioned geometries in the scene, in order of their first vertex.
+// Instances take the partition of their mesh, each piece instancing the mesh's
+// piece.
+void PartitionLooseGeometries(Scene& scene, unsigned num_threads = 0);
+
+// Budgets of the clusters ClusterGeometries builds.
+struct ClusterBudget {
+  // Most triangles in a cluster; 0 disables clustering.
+  uint32_t max_triangles = 4096;
+  // Longest edge of a cluster's world-space bounding box, in meters.
+  float max_extent = 4.0f;
+};
+
+// Merges the geometries that can be drawn as one (same material, transform
+// and vertex streams; indexed; neither instanced, an instance nor an area
+// light) into spatially coherent clusters within `budget`. Each group of
+// mergeable geometries is split along a BVH over their bounding boxes, and the
+// nodes nearest the root within both budgets become clusters; a geometry
+// over budget on its own stays alone. A cluster takes the place of its first
+// geometry and the scene order is kept otherwise. Expects the bounding boxes
+// computed (ComputeSceneBoundingBoxes) and keeps them current.
+void ClusterGeometries(Scene& scene, const ClusterBudget& budget);
+
+// The vertex cache statistics of the scene's index buffers before and after
+// OptimizeScene.
+struct SceneOptimizationStats {
+  VertexCacheStats before;
+  VertexCacheStats after;
+};
+
+// Optimizes the triangle and vertex order of every indexed geometry holding
+// its own vertices, on up to `num_threads` threads (0 for all cores): vertex
+// cache order, then overdraw order, then vertex fetch order (see
+// mesh_optimizer.h). The triangles and the vertices themselves do not change.
+// Logs and returns the ACMR and ATVR before and after.
+SceneOptimizationStats OptimizeScene(Scene& scene, unsigned num_threads = 0);
+
+// Builds the levels of detail of every indexed geometry holding its own
+// vertices (BuildLodChain), on up to `num_threads` threads (0 for all cores),
+// and logs the triangles of each level. Run after OptimizeScene and
+// BuildSceneMeshlets, which reorder the vertices the levels index.
+void BuildSceneLods(Scene& scene, const LodOptions& options = {},
+                    unsigned num_threads = 0);
+
+// Splits the full detail triangles of every indexed geometry holding its own
+// vertices into meshlets (BuildMeshlets), on up to `num_threads` threads (0
+// for all cores), sorts them for overdraw (SortMeshletsForOverdraw) and
+// orders the vertices by first use again (OptimizeVertexFetch). Logs the
+// meshlet count, how many triangles a meshlet holds on average and the final
+// ACMR and ATVR. Reorders the triangles and vertices, so run after
+// OptimizeScene and before BuildSceneLods.
+void BuildSceneMeshlets(Scene& scene, const MeshletOptions& options = {},
+                        unsigned num_threads = 0);
+
+// Groups the `points` within `distance` of each other, transitively, through a
+// uniform grid hash. Returns each point's group, numbered in order of the
+// group's first point. Exposed for testing and benchmarking.
+std::vector<uint32_t> GroupNearbyPoints(
+    std::span<const Eigen::Vector3f> points, float distance);
+
+// The geometry holding `geometry`'s vertices and indices: `geometry` itself,
+// or the mesh it is an instance of (Geometry::instance_of) in `geometries`.
+const Geometry& GeometryMesh(const std::vector<Geometry>& geometries,
+                             const Geometry& geometry);
 
 // Logs statistics about the scene, such as the total number of geometries,
-// materials, lights, and vertices.
+// materials, lights, and vertices, the vertex memory saved by instancing
+// shared meshes, and the texture memory saved by sharing pixel buffers between
+// texture slots.
 void LogScene(const Scene& scene);
 
 // Transforms the geometry by the transform matrix.
@@ -311,8 +451,9 @@ std::vector<Eigen::Vector3f> TransformedVertices(const Geometry& geometry);
 std::vector<Eigen::Vector3f> TransformedNormals(const Geometry& geometry);
 std::vector<Eigen::Vector4f> TransformedTangents(const Geometry& geometry);
 
-// Returns the surface area of the geometry.
-float SurfaceArea(const Geometry& geometry);
+// Returns the world-space surface area of `geometry`, one of `geometries`.
+float SurfaceArea(const std::vector<Geometry>& geometries,
+                  const Geometry& geometry);
 
 // Loads the SH lightmap EXRs into the scene.
 void LoadLightmaps(Scene& scene, const std::filesystem::path& gltf_file);
@@ -0,0 +1,765 @@
+#include "scene_cache.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fnv1a.h"
+#include "loader.h"
+#include "pvs.h"
+
+namespace sh_renderer {
+
+namespace {
+
+// File layout:
+//   SceneCacheHeader
+//   payload: a flat sequence of scalars, length-prefixed strings and
+//            length-prefixed arrays. Array contents start on a 16-byte boundary
+//            so vertex/index streams can be copied straight out of the mapping.
+constexpr uint32_t kSceneCacheMagic = 0x43534853;  // "SHSC"
+constexpr size_t kArrayAlignment = 16;
+
+struct SceneCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_hash;
+  uint64_t payload_size;
+  uint64_t reserved;
+};
+static_assert(sizeof(SceneCacheHeader) == 32);
+static_assert(sizeof(SceneCacheHeader) % kArrayAlignment == 0);
+
+// --- Hashing ---
+
+// Folds the whole file into `hash`. Returns false if the file can't be read.
+bool HashFile(const std::filesystem::path& path, uint64_t* hash) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return false;
+  std::vector<char> chunk(1 << 20);
+  while (file) {
+    file.read(chunk.data(), chunk.size());
+    *hash = Fnv1a(chunk.data(), static_cast<size_t>(file.gcount()), *hash);
+  }
+  return file.eof();
+}
+
+// Decodes %XX escapes in a glTF URI.
+std::string DecodeUri(const std::string& uri) {
+  std::string out;
+  out.reserve(uri.size());
+  for (size_t i = 0; i < uri.size(); ++i) {
+    if (uri[i] == '%' && i + 2 < uri.size() &&
+        std::isxdigit(static_cast<unsigned char>(uri[i + 1])) &&
+        std::isxdigit(static_cast<unsigned char>(uri[i + 2]))) {
+      out.push_back(static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr,
+                                                16)));
+      i += 2;
+    } else {
+      out.push_back(uri[i]);
+    }
+  }
+  return out;
+}
+
+// --- Serialization ---
+
+struct CacheWriter {
+  std::vector<uint8_t> bytes;
+  // Index of each texture pixel buffer in the pixel table.
+  std::unordered_map<const std::vector<uint8_t>*, int32_t> pixel_indices;
+
+  void Append(const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    bytes.insert(bytes.end(), p, p + size);
+  }
+
+  void Align() {
+    bytes.resize((bytes.size() + kArrayAlignment - 1) & ~(kArrayAlignment - 1));
+  }
+
+  template <typename T>
+  void Put(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Append(&value, sizeof(T));
+  }
+
+  // Element types are plain float/integer aggregates (including fixed-size
+  // Eigen vectors), stored with their in-memory layout.
+  template <typename T, typename Alloc>
+  void PutArray(const std::vector<T, Alloc>& values) {
+    Put<uint64_t>(values.size());
+    Align();
+    Append(values.data(), values.size() * sizeof(T));
+  }
+
+  void PutString(const std::string& s) {
+    Put<uint64_t>(s.size());
+    Append(s.data(), s.size());
+  }
+};
+
+struct CacheReader {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  size_t offset = 0;
+  bool ok = true;
+  std::vector<PixelData> pixel_table;
+
+  bool Consume(void* out, size_t n) {
+    if (!ok || n > size - offset) {
+      ok = false;
+      return false;
+    }
+    std::memcpy(out, data + offset, n);
+    offset += n;
+    return true;
+  }
+
+  void Align() {
+    size_t aligned = (offset + kArrayAlignment - 1) & ~(kArrayAlignment - 1);
+    if (aligned > size) {
+      ok = false;
+      return;
+    }
+    offset = aligned;
+  }
+
+  template <typename T>
+  T Get() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value{};
+    Consume(&value, sizeof(T));
+    return value;
+  }
+
+  template <typename T, typename Alloc>
+  void GetArray(std::vector<T, Alloc>* values) {
+    uint64_t count = Get<uint64_t>();
+    Align();
+    if (!ok || count > (size - offset) / sizeof(T)) {
+      ok = false;
+      return;
+    }
+    values->resize(count);
+    Consume(values->data(), count * sizeof(T));
+  }
+
+  std::string GetString() {
+    uint64_t length = Get<uint64_t>();
+    if (!ok || length > size - offset) {
+      ok = false;
+      return {};
+    }
+    std::string s(reinterpret_cast<const char*>(data + offset), length);
+    offset += length;
+    return s;
+  }
+
+  // Bounds a count read from the file before it is used to size a container.
+  // Every serialized element takes at least one byte.
+  uint64_t GetCount() {
+    uint64_t count = Get<uint64_t>();
+    if (count > size - offset) ok = false;
+    return ok ? count : 0;
+  }
+};
+
+void PutVec3(CacheWriter& w, const Eigen::Vector3f& v) {
+  w.Put(v.x());
+  w.Put(v.y());
+  w.Put(v.z());
+}
+
+Eigen::Vector3f GetVec3(CacheReader& r) {
+  float x = r.Get<float>();
+  float y = r.Get<float>();
+  float z = r.Get<float>();
+  return Eigen::Vector3f(x, y, z);
+}
+
+// Texture pixels are written once into the pixel table and referenced by
+// index, so slots that share a buffer still share it after loading.
+void PutTexture(CacheWriter& w, const Texture& texture) {
+  w.Put<uint8_t>(texture.file_path.has_value());
+  if (texture.file_path) w.PutString(texture.file_path->string());
+  w.Put(texture.width);
+  w.Put(texture.height);
+  w.Put(texture.channels);
+  w.Put<int32_t>(texture.pixel_data
+                     ? w.pixel_indices.at(texture.pixel_data.get())
+                     : -1);
+}
+
+Texture GetTexture(CacheReader& r) {
+  Texture texture;
+  if (r.Get<uint8_t>()) texture.file_path = r.GetString();
+  texture.width = r.Get<uint32_t>();
+  texture.height = r.Get<uint32_t>();
+  texture.channels = r.Get<uint32_t>();
+  int32_t pixel_index = r.Get<int32_t>();
+  if (pixel_index >= static_cast<int32_t>(r.pixel_table.size())) {
+    r.ok = false;
+  } else if (pixel_index >= 0) {
+    texture.pixel_data = r.pixel_table[pixel_index];
+  }
+  return texture;
+}
+
+void CollectPixels(const Texture& texture, CacheWriter& w,
+                   std::vector<const std::vector<uint8_t>*>* table) {
+  const std::vector<uint8_t>* pixels = texture.pixel_data.get();
+  if (pixels && w.pixel_indices.emplace(pixels, table->size()).second) {
+    table->push_back(pixels);
+  }
+}
+
+void PutPixelTable(CacheWriter& w, const std::vector<Material>& materials) {
+  std::vector<const std::vector<uint8_t>*> table;
+  for (const Material& material : materials) {
+    CollectPixels(material.albedo, w, &table);
+    CollectPixels(material.normal_texture, w, &table);
+    CollectPixels(material.metallic_roughness_texture, w, &table);
+    if (material.emissive_texture) {
+      CollectPixels(*material.emissive_texture, w, &table);
+    }
+    for (const Layer& layer : material.layers) {
+      CollectPixels(layer.texture, w, &table);
+      for (const Texture& frame : layer.anim_frames) {
+        CollectPixels(frame, w, &table);
+      }
+    }
+  }
+  w.Put<uint64_t>(table.size());
+  for (const std::vector<uint8_t>* pixels : table) w.PutArray(*pixels);
+}
+
+void GetPixelTable(CacheReader& r) {
+  uint64_t count = r.GetCount();
+  r.pixel_table.reserve(count);
+  for (uint64_t i = 0; i < count && r.ok; ++i) {
+    std::vector<uint8_t> pixels;
+    r.GetArray(&pixels);
+    r.pixel_table.push_back(MakePixelData(std::move(pixels)));
+  }
+}
+
+void PutLayer(CacheWriter& w, const Layer& layer) {
+  PutTexture(w, layer.texture);
+  w.Put<uint64_t>(layer.anim_frames.size());
+  for (const Texture& frame : layer.anim_frames) PutTexture(w, frame);
+  w.Put(layer.anim_freq);
+  w.Put<int32_t>(static_cast<int32_t>(layer.blend_src));
+  w.Put<int32_t>(static_cast<int32_t>(layer.blend_dst));
+  w.Put<int32_t>(static_cast<int32_t>(layer.rgbgen.type));
+  w.Put<int32_t>(static_cast<int32_t>(layer.rgbgen.wave));
+  w.Put(layer.rgbgen.base);
+  w.Put(layer.rgbgen.amplitude);
+  w.Put(layer.rgbgen.phase);
+  w.Put(layer.rgbgen.frequency);
+  w.Put<uint64_t>(layer.tcmods.size());
+  for (const TcMod& tcmod : layer.tcmods) {
+    w.Put<int32_t>(static_cast<int32_t>(tcmod.type));
+    w.Put<int32_t>(static_cast<int32_t>(tcmod.wave));
+    w.PutArray(tcmod.values);
+  }
+  w.Put<uint8_t>(layer.is_base);
+}
+
+Layer GetLayer(CacheReader& r) {
+  Layer layer;
+  layer.texture = GetTexture(r);
+  uint64_t frame_count = r.GetCount();
+  for (uint64_t i = 0; i < frame_count && r.ok; ++i) {
+    layer.anim_frames.push_back(GetTexture(r));
+  }
+  layer.anim_freq = r.Get<float>();
+  layer.blend_src = static_cast<BlendFactor>(r.Get<int32_t>());
+  layer.blend_dst = static_cast<BlendFactor>(r.Get<int32_t>());
+  layer.rgbgen.type = static_cast<RgbGenType>(r.Get<int32_t>());
+  layer.rgbgen.wave = static_cast<WaveType>(r.Get<int32_t>());
+  layer.rgbgen.base = r.Get<float>();
+  layer.rgbgen.amplitude = r.Get<float>();
+  layer.rgbgen.phase = r.Get<float>();
+  layer.rgbgen.frequency = r.Get<float>();
+  uint64_t tcmod_count = r.GetCount();
+  for (uint64_t i = 0; i < tcmod_count && r.ok; ++i) {
+    TcMod tcmod;
+    tcmod.type = static_cast<TcModType>(r.Get<int32_t>());
+    tcmod.wave = static_cast<WaveType>(r.Get<int32_t>());
+    r.GetArray(&tcmod.values);
+    layer.tcmods.push_back(std::move(tcmod));
+  }
+  layer.is_base = r.Get<uint8_t>() != 0;
+  return layer;
+}
+
+void PutMaterial(CacheWriter& w, const Material& material) {
+  w.PutString(material.name);
+  PutTexture(w, material.albedo);
+  PutTexture(w, material.normal_texture);
+  PutTexture(w, material.metallic_roughness_texture);
+  PutVec3(w, material.emissive_factor);
+  w.Put(material.emissive_strength);
+  w.Put<uint8_t>(material.emissive_texture.has_value());
+  if (material.emissive_texture) PutTexture(w, *material.emissive_texture);
+  w.Put<uint8_t>(material.alpha_cutout);
+  w.Put<uint64_t>(material.layers.size());
+  for (const Layer& layer : material.layers) PutLayer(w, layer);
+  w.Put<int32_t>(material.base_layer);
+  w.Put<int32_t>(static_cast<int32_t>(material.cull_mode));
+}
+
+Material GetMaterial(CacheReader& r) {
+  Material material;
+  material.name = r.GetString();
+  material.albedo = GetTexture(r);
+  material.normal_texture = GetTexture(r);
+  material.metallic_roughness_texture = GetTexture(r);
+  material.emissive_factor = GetVec3(r);
+  material.emissive_strength = r.Get<float>();
+  if (r.Get<uint8_t>()) material.emissive_texture = GetTexture(r);
+  material.alpha_cutout = r.Get<uint8_t>() != 0;
+  uint64_t layer_count = r.GetCount();
+  for (uint64_t i = 0; i < layer_count && r.ok; ++i) {
+    material.layers.push_back(GetLayer(r));
+  }
+  material.base_layer = r.Get<int32_t>();
+  material.cull_mode = static_cast<CullMode>(r.Get<int32_t>());
+  return material;
+}
+
+void PutGeometry(CacheWriter& w, const Geometry& geometry) {
+  w.PutArray(geometry.vertices);
+  w.PutArray(geometry.normals);
+  w.PutArray(geometry.texture_uvs);
+  w.PutArray(geometry.lightmap_uvs);
+  w.PutArray(geometry.tangents);
+  w.PutArray(geometry.indices);
+  w.Put<uint64_t>(geometry.lods.size());
+  for (const GeometryLod& lod : geometry.lods) {
+    w.PutArray(lod.indices);
+    w.Put(lod.error);
+  }
+  w.PutArray(geometry.meshlets);
+  w.Put<int32_t>(geometry.material_id);
+  for (int i = 0; i < 16; ++i) w.Put(geometry.transform.matrix().data()[i]);
+  w.Put<int32_t>(geometry.instance_of);
+  PutVec3(w, geometry.bounding_box.min);
+  PutVec3(w, geometry.bounding_box.max);
+}
+
+Geometry GetGeometry(CacheReader& r) {
+  Geometry geometry;
+  r.GetArray(&geometry.vertices);
+  r.GetArray(&geometry.normals);
+  r.GetArray(&geometry.texture_uvs);
+  r.GetArray(&geometry.lightmap_uvs);
+  r.GetArray(&geometry.tangents);
+  r.GetArray(&geometry.indices);
+  const uint64_t lod_count = r.GetCount();
+  for (uint64_t i = 0; i < lod_count && r.ok; ++i) {
+    GeometryLod& lod = geometry.lods.emplace_back();
+    r.GetArray(&lod.indices);
+    lod.error = r.Get<float>();
+  }
+  r.GetArray(&geometry.meshlets);
+  geometry.material_id = r.Get<int32_t>();
+  for (int i = 0; i < 16; ++i) {
+    geometry.transform.matrix().data()[i] = r.Get<float>();
+  }
+  geometry.instance_of = r.Get<int32_t>();
+  geometry.bounding_box.min = GetVec3(r);
+  geometry.bounding_box.max = GetVec3(r);
+  return geometry;
+}
+
+// Index of `element` in `items`, or -1 if it doesn't point into the vector.
+template <typename T>
+int32_t IndexOf(const std::vector<T>& items, const T* element) {
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (&items[i] == element) return static_cast<int32_t>(i);
+  }
+  return -1;
+}
+
+void PutScene(CacheWriter& w, const Scene& scene) {
+  PutPixelTable(w, scene.materials);
+  w.Put<uint64_t>(scene.materials.size());
+  for (const Material& material : scene.materials) PutMaterial(w, material);
+
+  w.Put<uint64_t>(scene.geometries.size());
+  for (const Geometry& geometry : scene.geometries) PutGeometry(w, geometry);
+
+  w.Put<uint64_t>(scene.point_lights.size());
+  for (const PointLight& light : scene.point_lights) {
+    PutVec3(w, light.position);
+    PutVec3(w, light.color);
+    w.Put(light.intensity);
+    w.Put(light.radius);
+  }
+
+  w.Put<uint64_t>(scene.spot_lights.size());
+  for (const SpotLight& light : scene.spot_lights) {
+    PutVec3(w, light.position);
+    PutVec3(w, light.direction);
+    PutVec3(w, light.color);
+    w.Put(light.intensity);
+    w.Put(light.radius);
+    w.Put(light.cos_inner_cone);
+    w.Put(light.cos_outer_cone);
+  }
+
+  w.Put<uint8_t>(scene.sun_light.has_value());
+  if (scene.sun_light) {
+    PutVec3(w, scene.sun_light->direction);
+    PutVec3(w, scene.sun_light->color);
+    w.Put(scene.sun_light->intensity);
+  }
+
+  // Area lights reference their material and geometry by index. The geometry
+  // pointer set by the loader refers to the pre-partition geometry, so it is
+  // only kept when it still points into scene.geometries.
+  w.Put<uint64_t>(scene.area_lights.size());
+  for (const AreaLight& light : scene.area_lights) {
+    PutVec3(w, light.position);
+    PutVec3(w, light.direction);
+    PutVec3(w, light.color);
+    w.Put(light.intensity);
+    w.Put(light.area);
+    w.Put<int32_t>(IndexOf(scene.materials, light.material));
+    w.Put<int32_t>(IndexOf(scene.geometries, light.geometry));
+  }
+}
+
+bool GetScene(CacheReader& r, Scene* scene) {
+  GetPixelTable(r);
+  uint64_t material_count = r.GetCount();
+  scene->materials.reserve(material_count);
+  for (uint64_t i = 0; i < material_count && r.ok; ++i) {
+    scene->materials.push_back(GetMaterial(r));
+  }
+
+  uint64_t geometry_count = r.GetCount();
+  scene->geometries.reserve(geometry_count);
+  for (uint64_t i = 0; i < geometry_count && r.ok; ++i) {
+    scene->geometries.push_back(GetGeometry(r));
+    // An instance refers to an earlier geometry holding its own vertices.
+    const int32_t mesh = scene->geometries.back().instance_of;
+    if (mesh >= static_cast<int32_t>(i) ||
+        (mesh >= 0 && scene->geometries[mesh].instance_of >= 0)) {
+      r.ok = false;
+    }
+  }
+
+  uint64_t point_count = r.GetCount();
+  for (uint64_t i = 0; i < point_count && r.ok; ++i) {
+    PointLight light;
+    light.position = GetVec3(r);
+    light.color = GetVec3(r);
+    light.intensity = r.Get<float>();
+    light.radius = r.Get<float>();
+    scene->point_lights.push_back(light);
+  }
+
+  uint64_t spot_count = r.GetCount();
+  for (uint64_t i = 0; i < spot_count && r.ok; ++i) {
+    SpotLight light;
+    light.position = GetVec3(r);
+    light.direction = GetVec3(r);
+    light.color = GetVec3(r);
+    light.intensity = r.Get<float>();
+    light.radius = r.Get<float>();
+    light.cos_inner_cone = r.Get<float>();
+    light.cos_outer_cone = r.Get<float>();
+    scene->spot_lights.push_back(light);
+  }
+
+  if (r.Get<uint8_t>()) {
+    SunLight sun;
+    sun.direction = GetVec3(r);
+    sun.color = GetVec3(r);
+    sun.intensity = r.Get<float>();
+    scene->sun_light = sun;
+  }
+
+  uint64_t area_count = r.GetCount();
+  for (uint64_t i = 0; i < area_count && r.ok; ++i) {
+    AreaLight light;
+    light.position = GetVec3(r);
+    light.direction = GetVec3(r);
+    light.color = GetVec3(r);
+    light.intensity = r.Get<float>();
+    light.area = r.Get<float>();
+    int32_t material_index = r.Get<int32_t>();
+    int32_t geometry_index = r.Get<int32_t>();
+    if (material_index >= static_cast<int32_t>(scene->materials.size()) ||
+        geometry_index >= static_cast<int32_t>(scene->geometries.size())) {
+      r.ok = false;
+      break;
+    }
+    if (material_index >= 0) {
+      light.material = &scene->materials[material_index];
+    }
+    if (geometry_index >= 0) {
+      light.geometry = &scene->geometries[geometry_index];
+    }
+    scene->area_lights.push_back(light);
+  }
+
+  return r.ok && r.offset == r.size;
+}
+
+// Read-only mapping of a whole file; unmapped on destruction.
+struct MappedFile {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() {
+    if (data) munmap(const_cast<uint8_t*>(data), size);
+  }
+};
+
+bool MapFile(const std::filesystem::path& path, MappedFile* mapped) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  void* ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                   MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) return false;
+  mapped->data = static_cast<const uint8_t*>(ptr);
+  mapped->size = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+double ElapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Attaches the PVS baked for `gltf_file` to `scene`, if there is a current
+// one (tagged with the CookedSceneHash `cooked_hash`). The sources are hashed
+// only if a PVS file exists.
+void LoadScenePvs(const std::filesystem::path& gltf_file,
+                  std::optional<uint64_t> cooked_hash,
+                  const ClusterBudget& cluster_budget, Scene* scene) {
+  const std::filesystem::path pvs_file = PvsPath(gltf_file);
+  if (!std::filesystem::exists(pvs_file)) return;
+  if (!cooked_hash) {
+    const std::optional<uint64_t> source_hash = HashSceneSources(gltf_file);
+    if (!source_hash) return;
+    cooked_hash = CookedSceneHash(*source_hash, cluster_budget);
+  }
+  std::optional<Pvs> pvs = ReadPvs(pvs_file, *cooked_hash);
+  if (!pvs) return;
+  if (pvs->num_geometries != scene->geometries.size()) {
+    LOG(WARNING) << "LoadScenePvs: " << pvs_file << " has "
+                 << pvs->num_geometries << " geometries, the scene "
+                 << scene->geometries.size();
+    return;
+  }
+  scene->pvs = std::move(*pvs);
+  LOG(INFO) << "Loaded PVS " << pvs_file << " with " << PvsCellCount(scene->pvs)
+            << " view cells.";
+}
+
+}  // namespace
+
+std::filesystem::path SceneCachePath(const std::filesystem::path& gltf_file) {
+  std::filesystem::path cache_file = gltf_file;
+  cache_file.replace_extension(".shcache");
+  return cache_file;
+}
+
+std::optional<uint64_t> HashSceneSources(
+    const std::filesystem::path& gltf_file) {
+  uint64_t hash = kFnvOffsetBasis;
+  if (!HashFile(gltf_file, &hash)) return std::nullopt;
+
+  // A .glb embeds its buffers; only a .gltf needs its external files hashed.
+  if (gltf_file.extension() == ".glb") return hash;
+
+  std::ifstream file(gltf_file);
+  nlohmann::json document = nlohmann::json::parse(file, nullptr,
+                                                  /*allow_exceptions=*/false);
+  if (document.is_discarded()) return std::nullopt;
+
+  const std::filesystem::path base_dir = gltf_file.parent_path();
+  for (const char* key : {"buffers", "images"}) {
+    if (!document.contains(key) || !document[key].is_array()) continue;
+    for (const auto& entry : document[key]) {
+      if (!entry.contains("uri") || !entry["uri"].is_string()) continue;
+      std::string uri = entry["uri"].get<std::string>();
+      // Data URIs are part of the document and already hashed.
+      if (uri.rfind("data:", 0) == 0) continue;
+      uri = DecodeUri(uri);
+      hash = Fnv1a(uri.data(), uri.size(), hash);
+      if (!HashFile(base_dir / uri, &hash)) {
+        LOG(WARNING) << "HashSceneSources: cannot read " << base_dir / uri;
+        return std::nullopt;
+      }
+    }
+  }
+  return hash;
+}
+
+uint64_t CookedSceneHash(uint64_t source_hash,
+                         const ClusterBudget& cluster_budget) {
+  uint64_t hash = source_hash;
+  // The cook itself: a PVS indexes the cooked geometries, so it goes stale
+  // with any change to how they are produced or ordered.
+  hash = Fnv1a(&kSceneCacheVersion, sizeof(kSceneCacheVersion), hash);
+  hash = Fnv1a(&cluster_budget.max_triangles,
+               sizeof(cluster_budget.max_triangles), hash);
+  hash = Fnv1a(&cluster_budget.max_extent, sizeof(cluster_budget.max_extent),
+               hash);
+  return hash;
+}
+
+bool WriteSceneCache(const Scene& scene, uint64_t source_hash,
+                     const std::filesystem::path& cache_file) {
+  CacheWriter writer;
+  PutScene(writer, scene);
+
+  SceneCacheHeader header = {
+      .magic = kSceneCacheMagic,
+      .version = kSceneCacheVersion,
+      .source_hash = source_hash,
+      .payload_size = writer.bytes.size(),
+      .reserved = 0,
+  };
+
+  std::filesystem::path tmp_file = cache_file;
+  tmp_file += ".tmp";
+  {
+    std::ofstream out(tmp_file, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      LOG(WARNING) << "WriteSceneCache: cannot open " << tmp_file;
+      return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(writer.bytes.data()),
+              writer.bytes.size());
+    if (!out) {
+      LOG(WARNING) << "WriteSceneCache: failed writing " << tmp_file;
+      std::filesystem::remove(tmp_file);
+      return false;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp_file, cache_file, ec);
+  if (ec) {
+    LOG(WARNING) << "WriteSceneCache: cannot rename " << tmp_file << " to "
+                 << cache_file << ": " << ec.message();
+    std::filesystem::remove(tmp_file, ec);
+    return false;
+  }
+  return true;
+}
+
+std::optional<Scene> ReadSceneCache(const std::filesystem::path& cache_file,
+                                    uint64_t source_hash) {
+  MappedFile mapped;
+  if (!MapFile(cache_file, &mapped)) return std::nullopt;
+
+  if (mapped.size < sizeof(SceneCacheHeader)) return std::nullopt;
+  SceneCacheHeader header;
+  std::memcpy(&header, mapped.data, sizeof(header));
+  if (header.magic != kSceneCacheMagic) {
+    LOG(WARNING) << "ReadSceneCache: " << cache_file << " is not a scene cache";
+    return std::nullopt;
+  }
+  if (header.version != kSceneCacheVersion) {
+    LOG(INFO) << "ReadSceneCache: " << cache_file << " has version "
+              << header.version << ", expected " << kSceneCacheVersion;
+    return std::nullopt;
+  }
+  if (header.source_hash != source_hash) {
+    LOG(INFO) << "ReadSceneCache: " << cache_file << " is stale";
+    return std::nullopt;
+  }
+  if (header.payload_size != mapped.size - sizeof(SceneCacheHeader)) {
+    LOG(WARNING) << "ReadSceneCache: " << cache_file << " is truncated";
+    return std::nullopt;
+  }
+
+  CacheReader reader{
+      .data = mapped.data + sizeof(SceneCacheHeader),
+      .size = header.payload_size,
+  };
+  Scene scene;
+  if (!GetScene(reader, &scene)) {
+    LOG(WARNING) << "ReadSceneCache: " << cache_file << " is corrupt";
+    return std::nullopt;
+  }
+  return scene;
+}
+
+std::optional<Scene> LoadCookedScene(const std::filesystem::path& gltf_file,
+                                     unsigned num_decode_threads,
+                                     bool use_cache,
+                                     const ClusterBudget& cluster_budget) {
+  auto start_time = std::chrono::steady_clock::now();
+  const std::filesystem::path cache_file = SceneCachePath(gltf_file);
+
+  std::optional<uint64_t> cooked_hash;
+  if (use_cache) {
+    if (std::optional<uint64_t> source_hash = HashSceneSources(gltf_file)) {
+      cooked_hash = CookedSceneHash(*source_hash, cluster_budget);
+      std::optional<Scene> scene = ReadSceneCache(cache_file, *cooked_hash);
+      if (scene) {
+        BuildSceneBvh(*scene);
+        LoadLightmaps(*scene, gltf_file);
+        LoadScenePvs(gltf_file, cooked_hash, cluster_budget, &*scene);
+        LOG(INFO) << "Loaded cooked scene " << cache_file << " in "
+                  << ElapsedMs(start_time) << " ms.";
+        return scene;
+      }
+    }
+  }
+
+  std::optional<Scene> scene = LoadScene(gltf_file, num_decode_threads);
+  if (!scene) return std::nullopt;
+  PartitionLooseGeometries(*scene);
+  ComputeSceneBoundingBoxes(*scene);
+  ClusterGeometries(*scene, cluster_budget);
+  OptimizeScene(*scene);
+  BuildSceneMeshlets(*scene);
+  BuildSceneLods(*scene);
+  BuildSceneBvh(*scene);
+  LoadScenePvs(gltf_file, cooked_hash, cluster_budget, &*scene);
+  LOG(INFO) << "Cooked scene " << gltf_file.filename() << " in "
+            << ElapsedMs(start_time) << " ms.";
+
+  if (cooked_hash) {
+    auto write_start_time = std::chrono::steady_clock::now();
+    if (WriteSceneCache(*scene, *cooked_hash, cache_file)) {
+      LOG(INFO) << "Wrote cooked scene " << cache_file << " in "
+                << ElapsedMs(write_start_time) << " ms.";
+    }
+  }
+  return scene;
+}
+
+}  // namespace sh_renderer
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include "scene.h"
+
+namespace sh_renderer {
+
+// Version of the cooked scene layout. Bump it whenever the file layout or the
+// preprocessing that produces the cooked scene (partitioning, clustering,
+// optimization, levels of detail, meshlets, bounding boxes) changes, so stale
+// caches are rejected.
+constexpr uint32_t kSceneCacheVersion = 9;
+
+// Returns the default cooked-scene cache path for a glTF file: the same
+// directory and stem with a ".shcache" extension.
+std::filesystem::path SceneCachePath(const std::filesystem::path& gltf_file);
+
+// Computes a 64-bit content hash of the glTF document and every external
+// buffer and image file it references. Returns std::nullopt if any of those
+// files cannot be read.
+std::optional<uint64_t> HashSceneSources(const std::filesystem::path& gltf_file);
+
+// Folds kSceneCacheVersion and the cooking options that shape the cooked
+// geometries into `source_hash`. Cooked scenes and PVS files are tagged with
+// the result, so they are rejected once the cook or its options change.
+uint64_t CookedSceneHash(uint64_t source_hash,
+                         const ClusterBudget& cluster_budget);
+
+// Writes the cooked scene (geometry with its levels of detail and meshlets,
+// bounding boxes, materials with their textures and layer stacks, and lights)
+// to `cache_file`, tagged with `source_hash`. GL resources and lightmaps are
+// not stored. The file is written to a temporary name and renamed into place.
+// Returns false on I/O failure.
+bool WriteSceneCache(const Scene& scene, uint64_t source_hash,
+                     const std::filesystem::path& cache_file);
+
+// Memory-maps `cache_file` and rebuilds the scene from it. Returns
+// std::nullopt if the file is missing, malformed, from another layout version,
+// or was cooked from sources whose hash differs from `source_hash`.
+std::optional<Scene> ReadSceneCache(const std::filesystem::path& cache_file,
+                                    uint64_t source_hash);
+
+// Returns the scene ready for upload: loads the glTF (LoadScene), partitions,
+// computes bounding boxes, clusters within `cluster_budget`, optimizes the
+// index order (OptimizeScene), builds the meshlets (BuildSceneMeshlets) and
+// the levels of detail (BuildSceneLods) and builds the BVH. With `use_cache`,
+// a valid cooked scene next to the glTF, cooked with the same budget, is used
+// instead (only the lightmaps are loaded from disk and the BVH rebuilt), and a
+// fresh one is written after a cold load. Either way, a current PVS next to
+// the glTF (PvsPath) is attached as Scene::pvs.
+std::optional<Scene> LoadCookedScene(const std::filesystem::path& gltf_file,
+                                     unsigned num_decode_threads,
+                                     bool use_cache,
+                                     const ClusterBudget& cluster_budget = {});
+
+}  // namespace sh_renderer
@@ -0,0 +1,273 @@
+#include "scene_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace sh_renderer {
+namespace {
+
+std::filesystem::path MakeDir(const std::string& name) {
+  auto dir = std::filesystem::temp_directory_path() / ("sh_scene_cache_" + name);
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  return dir;
+}
+
+void Write(const std::filesystem::path& p, const std::string& s) {
+  std::ofstream f(p, std::ios::binary);
+  f << s;
+}
+
+Texture MakeTexture(uint8_t fill) {
+  Texture texture;
+  texture.file_path = "/textures/t" + std::to_string(fill) + ".png";
+  texture.width = 2;
+  texture.height = 2;
+  texture.channels = 4;
+  texture.pixel_data = MakePixelData(std::vector<uint8_t>(16, fill));
+  return texture;
+}
+
+Scene MakeScene() {
+  Scene scene;
+
+  Material plain;
+  plain.name = "plain";
+  plain.albedo = MakeTexture(1);
+  plain.alpha_cutout = true;
+  plain.emissive_factor = Eigen::Vector3f(1, 0.5f, 0.25f);
+  plain.emissive_strength = 3.f;
+  plain.emissive_texture = MakeTexture(2);
+  scene.materials.push_back(plain);
+
+  Material q3;
+  q3.name = "textures/base_wall/glow";
+  Layer base;
+  base.texture = MakeTexture(3);
+  base.is_base = true;
+  Layer glow;
+  glow.texture = MakeTexture(4);
+  glow.anim_frames = {glow.texture, MakeTexture(5)};  // frame 0 shares pixels
+  glow.anim_freq = 2.f;
+  glow.blend_src = BlendFactor::kOne;
+  glow.blend_dst = BlendFactor::kOne;
+  glow.rgbgen.type = RgbGenType::kWave;
+  glow.rgbgen.wave = WaveType::kSawtooth;
+  glow.rgbgen.frequency = 0.5f;
+  glow.tcmods.push_back({TcModType::kScroll, {0.1f, -0.2f}, WaveType::kSine});
+  glow.tcmods.push_back(
+      {TcModType::kTurb, {0.f, 0.1f, 0.f, 1.f}, WaveType::kSine});
+  q3.layers = {base, glow};
+  q3.cull_mode = CullMode::kNone;
+  scene.materials.push_back(q3);
+
+  Geometry geo;
+  geo.vertices = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}};
+  geo.normals = {{0, 0, 1}, {0, 0, 1}, {0, 0, 1}};
+  geo.texture_uvs = {{0, 0}, {1, 0}, {0, 1}};
+  geo.lightmap_uvs = {{0.1f, 0.1f}, {0.2f, 0.1f}, {0.1f, 0.2f}};
+  geo.tangents = {{1, 0, 0, 1}, {1, 0, 0, 1}, {1, 0, 0, -1}};
+  geo.indices = {0, 1, 2};
+  geo.lods.push_back({.indices = {0, 1, 2}, .error = 0.25f});
+  geo.lods.push_back({.indices = {}, .error = 0.5f});
+  geo.meshlets.push_back({.range = {0, 3},
+                          .center = Eigen::Vector3f(0.3f, 0.3f, 0),
+                          .radius = 0.75f,
+                          .cone_axis = Eigen::Vector3f::UnitZ(),
+                          .cone_cutoff = 0.0f});
+  geo.material_id = 1;
+  geo.transform = Eigen::Translation3f(1, 2, 3) *
+                  Eigen::AngleAxisf(0.5f, Eigen::Vector3f::UnitY());
+  geo.bounding_box.min = Eigen::Vector3f(-1, -2, -3);
+  geo.bounding_box.max = Eigen::Vector3f(4, 5, 6);
+  scene.geometries.push_back(geo);
+
+  Geometry shell;  // occluder shell: positions only, no material
+  shell.vertices = {{0, 0, 0}, {0, 0, 1}, {1, 0, 0}};
+  shell.indices = {2, 1, 0};
+  scene.geometries.push_back(shell);
+
+  Geometry instance;  // the first geometry again, elsewhere
+  instance.instance_of = 0;
+  instance.material_id = 1;
+  instance.transform = Eigen::Translation3f(-4, 0, 0);
+  scene.geometries.push_back(instance);
+
+  PointLight point;
+  point.position = Eigen::Vector3f(1, 2, 3);
+  point.color = Eigen::Vector3f(1, 0, 0);
+  point.intensity = 10.f;
+  point.radius = 5.f;
+  scene.point_lights.push_back(point);
+
+  SpotLight spot;
+  spot.direction = Eigen::Vector3f(0, -1, 0);
+  spot.cos_inner_cone = 0.9f;
+  spot.cos_outer_cone = 0.8f;
+  scene.spot_lights.push_back(spot);
+
+  scene.sun_light = SunLight{.direction = Eigen::Vector3f(0, -1, 1).normalized(),
+                             .intensity = 4.f};
+
+  AreaLight area;
+  area.area = 2.f;
+  area.material = &scene.materials[0];
+  area.geometry = &scene.geometries[0];
+  scene.area_lights.push_back(area);
+  return scene;
+}
+
+void ExpectTexturesEqual(const Texture& a, const Texture& b) {
+  EXPECT_EQ(a.file_path, b.file_path);
+  EXPECT_EQ(a.width, b.width);
+  EXPECT_EQ(a.height, b.height);
+  EXPECT_EQ(a.channels, b.channels);
+  ASSERT_EQ(a.pixel_data == nullptr, b.pixel_data == nullptr);
+  if (a.pixel_data) {
+    EXPECT_EQ(*a.pixel_data, *b.pixel_data);
+  }
+}
+
+TEST(SceneCacheTest, RoundTrip) {
+  auto dir = MakeDir("round_trip");
+  Scene scene = MakeScene();
+  ASSERT_TRUE(WriteSceneCache(scene, 42, dir / "scene.shcache"));
+  EXPECT_FALSE(std::filesystem::exists(dir / "scene.shcache.tmp"));
+
+  std::optional<Scene> cached = ReadSceneCache(dir / "scene.shcache", 42);
+  ASSERT_TRUE(cached.has_value());
+
+  ASSERT_EQ(cached->materials.size(), 2);
+  const Material& plain = cached->materials[0];
+  EXPECT_EQ(plain.name, "plain");
+  ExpectTexturesEqual(plain.albedo, scene.materials[0].albedo);
+  EXPECT_TRUE(plain.alpha_cutout);
+  EXPECT_EQ(plain.emissive_factor, scene.materials[0].emissive_factor);
+  EXPECT_EQ(plain.emissive_strength, 3.f);
+  ASSERT_TRUE(plain.emissive_texture.has_value());
+  ExpectTexturesEqual(*plain.emissive_texture,
+                      *scene.materials[0].emissive_texture);
+  EXPECT_FALSE(plain.normal_texture.file_path.has_value());
+
+  const Material& q3 = cached->materials[1];
+  EXPECT_EQ(q3.cull_mode, CullMode::kNone);
+  ASSERT_EQ(q3.layers.size(), 2);
+  EXPECT_TRUE(q3.layers[0].is_base);
+  const Layer& glow = q3.layers[1];
+  ASSERT_EQ(glow.anim_frames.size(), 2);
+  ExpectTexturesEqual(glow.anim_frames[1], MakeTexture(5));
+  EXPECT_EQ(glow.anim_frames[0].pixel_data, glow.texture.pixel_data);
+  EXPECT_EQ(glow.anim_freq, 2.f);
+  EXPECT_EQ(glow.blend_dst, BlendFactor::kOne);
+  EXPECT_EQ(glow.rgbgen.type, RgbGenType::kWave);
+  EXPECT_EQ(glow.rgbgen.wave, WaveType::kSawtooth);
+  ASSERT_EQ(glow.tcmods.size(), 2);
+  EXPECT_EQ(glow.tcmods[0].type, TcModType::kScroll);
+  EXPECT_EQ(glow.tcmods[0].values, (std::vector<float>{0.1f, -0.2f}));
+  EXPECT_EQ(glow.tcmods[1].values.size(), 4);
+
+  ASSERT_EQ(cached->geometries.size(), 3);
+  const Geometry& geo = cached->geometries[0];
+  const Geometry& expected = scene.geometries[0];
+  EXPECT_EQ(geo.vertices, expected.vertices);
+  EXPECT_EQ(geo.normals, expected.normals);
+  EXPECT_EQ(geo.texture_uvs, expected.texture_uvs);
+  EXPECT_EQ(geo.lightmap_uvs, expected.lightmap_uvs);
+  EXPECT_EQ(geo.tangents, expected.tangents);
+  EXPECT_EQ(geo.indices, expected.indices);
+  ASSERT_EQ(geo.lods.size(), 2u);
+  EXPECT_EQ(geo.lods[0].indices, expected.lods[0].indices);
+  EXPECT_EQ(geo.lods[0].error, 0.25f);
+  EXPECT_TRUE(geo.lods[1].indices.empty());
+  EXPECT_EQ(geo.lods[1].error, 0.5f);
+  ASSERT_EQ(geo.meshlets.size(), 1u);
+  EXPECT_EQ(geo.meshlets[0].range.index_count, 3u);
+  EXPECT_EQ(geo.meshlets[0].center, expected.meshlets[0].center);
+  EXPECT_EQ(geo.meshlets[0].radius, 0.75f);
+  EXPECT_EQ(geo.meshlets[0].cone_axis, Eigen::Vector3f::UnitZ());
+  EXPECT_EQ(geo.meshlets[0].cone_cutoff, 0.0f);
+  EXPECT_EQ(geo.material_id, 1);
+  EXPECT_TRUE(geo.transform.matrix().isApprox(expected.transform.matrix()));
+  EXPECT_EQ(geo.bounding_box.min, expected.bounding_box.min);
+  EXPECT_EQ(geo.bounding_box.max, expected.bounding_box.max);
+  EXPECT_EQ(geo.index_count, 0u);
+  EXPECT_EQ(cached->geometries[1].material_id, -1);
+  EXPECT_TRUE(cached->geometries[1].normals.empty());
+  EXPECT_EQ(geo.instance_of, -1);
+  EXPECT_EQ(cached->geometries[2].instance_of, 0);
+  EXPECT_TRUE(cached->geometries[2].vertices.empty());
+
+  ASSERT_EQ(cached->point_lights.size(), 1);
+  EXPECT_EQ(cached->point_lights[0].position, Eigen::Vector3f(1, 2, 3));
+  EXPECT_EQ(cached->point_lights[0].radius, 5.f);
+  ASSERT_EQ(cached->spot_lights.size(), 1);
+  EXPECT_EQ(cached->spot_lights[0].cos_outer_cone, 0.8f);
+  ASSERT_TRUE(cached->sun_light.has_value());
+  EXPECT_EQ(cached->sun_light->intensity, 4.f);
+  ASSERT_EQ(cached->area_lights.size(), 1);
+  EXPECT_EQ(cached->area_lights[0].area, 2.f);
+  EXPECT_EQ(cached->area_lights[0].material, &cached->materials[0]);
+  EXPECT_EQ(cached->area_lights[0].geometry, &cached->geometries[0]);
+  std::filesystem::remove_all(dir);
+}
+
+TEST(SceneCacheTest, RejectsStaleHash) {
+  auto dir = MakeDir("stale");
+  ASSERT_TRUE(WriteSceneCache(MakeScene(), 1, dir / "scene.shcache"));
+  EXPECT_FALSE(ReadSceneCache(dir / "scene.shcache", 2).has_value());
+  std::filesystem::remove_all(dir);
+}
+
+TEST(SceneCacheTest, RejectsTruncatedAndMissingFiles) {
+  auto dir = MakeDir("truncated");
+  auto cache_file = dir / "scene.shcache";
+  ASSERT_TRUE(WriteSceneCache(MakeScene(), 7, cache_file));
+  auto size = std::filesystem::file_size(cache_file);
+  std::filesystem::resize_file(cache_file, size - 5);
+  EXPECT_FALSE(ReadSceneCache(cache_file, 7).has_value());
+  EXPECT_FALSE(ReadSceneCache(dir / "missing.shcache", 7).has_value());
+  std::filesystem::remove_all(dir);
+}
+
+TEST(SceneCacheTest, HashCoversExternalBuffers) {
+  auto dir = MakeDir("hash");
+  Write(dir / "scene.gltf",
+        R"({"asset": {"version": "2.0"},
+            "buffers": [{"uri": "geo%20data.bin", "byteLength": 4}],
+            "images": [{"uri": "data:image/png;base64,AAAA"}]})");
+  Write(dir / "geo data.bin", "abcd");
+
+  std::optional<uint64_t> hash = HashSceneSources(dir / "scene.gltf");
+  ASSERT_TRUE(hash.has_value());
+  EXPECT_EQ(HashSceneSources(dir / "scene.gltf"), hash);
+
+  Write(dir / "geo data.bin", "abce");
+  std::optional<uint64_t> changed = HashSceneSources(dir / "scene.gltf");
+  ASSERT_TRUE(changed.has_value());
+  EXPECT_NE(*changed, *hash);
+
+  std::filesystem::remove(dir / "geo data.bin");
+  EXPECT_FALSE(HashSceneSources(dir / "scene.gltf").has_value());
+  std::filesystem::remove_all(dir);
+}
+
+TEST(SceneCacheTest, CookedHashCoversClusterBudget) {
+  const ClusterBudget budget;
+  EXPECT_EQ(CookedSceneHash(1, budget), CookedSceneHash(1, budget));
+  EXPECT_NE(CookedSceneHash(1, budget), CookedSceneHash(2, budget));
+  EXPECT_NE(CookedSceneHash(1, budget),
+            CookedSceneHash(1, {.max_triangles = 1024}));
+  EXPECT_NE(CookedSceneHash(1, budget),
+            CookedSceneHash(1, {.max_extent = 8.0f}));
+}
+
+TEST(SceneCacheTest, CachePathSitsNextToGltf) {
+  EXPECT_EQ(SceneCachePath("/data/sponza/Sponza.gltf"),
+            std::filesystem::path("/data/sponza/Sponza.shcache"));
+}
+
+}  // namespace
+}  // namespace sh_renderer
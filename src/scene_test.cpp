@@ -2,6 +2,9 @@
 
 #include <gtest/gtest.h>
 
+#include <numeric>
+#include <random>
+
 namespace sh_renderer {
 
 TEST(SceneTest, TransformedVertices) {
@@ -115,6 +118,219 @@ TEST(SceneTest, PartitionLooseGeometries_HandlesNoIndices) {
   EXPECT_EQ(scene.geometries.size(), 2);
 }
 
+TEST(SceneTest, PartitionLooseGeometries_KeepsGeometryAndVertexOrder) {
+  Scene scene;
+  // Three triangles with interleaved vertices: the one at x = 10 comes first.
+  Geometry geo;
+  geo.vertices = {{10, 0, 0}, {0, 0, 0}, {11, 0, 0}, {1, 0, 0},
+                  {10, 1, 0}, {0, 1, 0}, {20, 0, 0}, {21, 0, 0},
+                  {20, 1, 0}};
+  geo.normals.assign(9, Eigen::Vector3f::UnitZ());
+  geo.indices = {1, 3, 5, 0, 2, 4, 6, 7, 8};
+  geo.material_id = 2;
+  scene.geometries.push_back(geo);
+  Geometry other;
+  other.vertices = {{0, 0, 5}, {1, 0, 5}, {0, 1, 5}};
+  scene.geometries.push_back(other);
+
+  PartitionLooseGeometries(scene, /*num_threads=*/4);
+
+  ASSERT_EQ(scene.geometries.size(), 4u);
+  EXPECT_EQ(scene.geometries[0].vertices,
+            (std::vector<Eigen::Vector3f>{{10, 0, 0}, {11, 0, 0}, {10, 1, 0}}));
+  EXPECT_EQ(scene.geometries[0].indices, (std::vector<uint32_t>{0, 1, 2}));
+  EXPECT_EQ(scene.geometries[1].vertices,
+            (std::vector<Eigen::Vector3f>{{0, 0, 0}, {1, 0, 0}, {0, 1, 0}}));
+  EXPECT_EQ(scene.geometries[2].vertices[0], Eigen::Vector3f(20, 0, 0));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(scene.geometries[i].material_id, 2);
+    EXPECT_EQ(scene.geometries[i].normals.size(), 3u);
+  }
+  EXPECT_EQ(scene.geometries[3].vertices, other.vertices);
+}
+
+TEST(SceneTest, GroupNearbyPointsMatchesPairwiseMerge) {
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> position(-2.0f, 2.0f);
+  std::vector<Eigen::Vector3f> points(3000);
+  for (auto& p : points) p = {position(rng), position(rng), position(rng)};
+  // Exactly at the merge distance, across cell boundaries, and far away
+  // enough for the cell coordinates to wrap.
+  points.push_back({0.05f, 0, 0});
+  points.push_back({-0.05f, 0, 0});
+  points.push_back({2.0e5f, 0, 0});
+  points.push_back({2.0e5f + 0.05f, 0, 0});
+  const float distance = 0.1f;
+
+  const std::vector<uint32_t> groups = GroupNearbyPoints(points, distance);
+
+  // The pair loop over every point it replaces.
+  const size_t n = points.size();
+  std::vector<uint32_t> expected(n);
+  std::iota(expected.begin(), expected.end(), 0u);
+  auto find = [&](uint32_t i) {
+    while (expected[i] != i) i = expected[i];
+    return i;
+  };
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = i + 1; j < n; ++j) {
+      if ((points[i] - points[j]).norm() <= distance) {
+        expected[find(j)] = find(i);
+      }
+    }
+  }
+  ASSERT_EQ(groups.size(), n);
+  uint32_t next_group = 0;
+  std::vector<int64_t> group_of_root(n, -1);
+  for (size_t i = 0; i < n; ++i) {
+    int64_t& group = group_of_root[find(i)];
+    if (group < 0) group = next_group++;
+    EXPECT_EQ(groups[i], group) << i;
+  }
+  EXPECT_EQ(groups[n - 1], groups[n - 2]);
+  EXPECT_EQ(groups[n - 3], groups[n - 4]);
+  EXPECT_LT(next_group, n);
+}
+
+TEST(SceneTest, PartitionLooseGeometries_InstancesFollowTheirMesh) {
+  Scene scene;
+  Geometry geo;
+  // Two triangles far apart, and a single one.
+  geo.vertices = {{0.0f, 0.0f, 0.0f},  {1.0f, 0.0f, 0.0f},
+                  {0.0f, 1.0f, 0.0f},  {10.0f, 0.0f, 0.0f},
+                  {11.0f, 0.0f, 0.0f}, {10.0f, 1.0f, 0.0f}};
+  geo.indices = {0, 1, 2, 3, 4, 5};
+  geo.material_id = 3;
+  scene.geometries.push_back(geo);
+  Geometry single;
+  single.vertices = {{0.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f},
+                     {0.0f, 1.0f, 0.0f}};
+  scene.geometries.push_back(single);
+  Geometry instance;
+  instance.instance_of = 0;
+  instance.material_id = 3;
+  instance.transform = Eigen::Translation3f(0, 0, 5);
+  scene.geometries.push_back(instance);
+  scene.area_lights.push_back({.geometry = &scene.geometries[2]});
+
+  PartitionLooseGeometries(scene);
+
+  // The mesh's two pieces, the single triangle, then the instance's pieces.
+  ASSERT_EQ(scene.geometries.size(), 5u);
+  EXPECT_EQ(scene.geometries[2].vertices.size(), 3u);
+  for (int i = 0; i < 2; ++i) {
+    const Geometry& piece = scene.geometries[3 + i];
+    EXPECT_EQ(piece.instance_of, i);
+    EXPECT_EQ(piece.material_id, 3);
+    EXPECT_TRUE(piece.vertices.empty());
+    EXPECT_TRUE(piece.transform.isApprox(instance.transform));
+    EXPECT_EQ(GeometryMesh(scene.geometries, piece).vertices,
+              scene.geometries[i].vertices);
+  }
+  EXPECT_EQ(scene.area_lights[0].geometry, &scene.geometries[3]);
+  EXPECT_FLOAT_EQ(SurfaceArea(scene.geometries, scene.geometries[3]), 0.5f);
+}
+
+// A triangle of size 0.5 at `origin`, with normals.
+Geometry SmallTriangle(const Eigen::Vector3f& origin, int material_id) {
+  Geometry geo;
+  geo.vertices = {origin, origin + Eigen::Vector3f(0.5f, 0, 0),
+                  origin + Eigen::Vector3f(0, 0.5f, 0)};
+  geo.normals.assign(3, Eigen::Vector3f::UnitZ());
+  geo.indices = {0, 1, 2};
+  geo.material_id = material_id;
+  return geo;
+}
+
+TEST(SceneTest, ClusterGeometries_MergesNearbyPiecesOfAMaterial) {
+  Scene scene;
+  // Two rows of material 0 ten meters apart, with material 1 in between.
+  for (int i = 0; i < 4; ++i) {
+    scene.geometries.push_back(SmallTriangle({1.0f * i, 0, 0}, 0));
+    scene.geometries.push_back(SmallTriangle({1.0f * i, 1, 0}, 1));
+    scene.geometries.push_back(SmallTriangle({1.0f * i, 10, 0}, 0));
+  }
+  ComputeSceneBoundingBoxes(scene);
+
+  ClusterGeometries(scene, {.max_triangles = 100, .max_extent = 5.0f});
+
+  // Each row is one cluster, in place of its first triangle.
+  ASSERT_EQ(scene.geometries.size(), 3u);
+  const Geometry& row = scene.geometries[0];
+  EXPECT_EQ(row.material_id, 0);
+  EXPECT_EQ(row.vertices.size(), 12u);
+  EXPECT_EQ(row.normals.size(), 12u);
+  EXPECT_EQ(row.indices.size(), 12u);
+  EXPECT_EQ(row.indices[3], 3u);
+  EXPECT_EQ(row.vertices[row.indices[3]], Eigen::Vector3f(1, 0, 0));
+  EXPECT_EQ(row.bounding_box.min, Eigen::Vector3f(0, 0, 0));
+  EXPECT_EQ(row.bounding_box.max, Eigen::Vector3f(3.5f, 0.5f, 0));
+  EXPECT_EQ(scene.geometries[1].material_id, 1);
+  EXPECT_EQ(scene.geometries[2].material_id, 0);
+  EXPECT_EQ(scene.geometries[2].bounding_box.min, Eigen::Vector3f(0, 10, 0));
+}
+
+TEST(SceneTest, ClusterGeometries_KeepsClustersWithinBudget) {
+  Scene grid;
+  for (int i = 0; i < 64; ++i) {
+    grid.geometries.push_back(
+        SmallTriangle({0.5f * (i % 8), 0.5f * (i / 8), 0}, 0));
+  }
+  ComputeSceneBoundingBoxes(grid);
+
+  Scene scene = grid;
+  ClusterGeometries(scene, {.max_triangles = 6, .max_extent = 100.0f});
+  size_t triangles = 0;
+  for (const Geometry& geo : scene.geometries) {
+    EXPECT_LE(geo.indices.size(), 18u);
+    triangles += geo.indices.size() / 3;
+  }
+  EXPECT_EQ(triangles, 64u);
+  EXPECT_LE(scene.geometries.size(), 32u);
+
+  scene = grid;
+  ClusterGeometries(scene, {.max_triangles = 1000, .max_extent = 1.2f});
+  EXPECT_LT(scene.geometries.size(), 64u);
+  for (const Geometry& geo : scene.geometries) {
+    const Eigen::Vector3f extent =
+        geo.bounding_box.max - geo.bounding_box.min;
+    EXPECT_LE(extent.maxCoeff(), 1.2f);
+  }
+}
+
+TEST(SceneTest, ClusterGeometries_LeavesInstancesAndLightsAlone) {
+  Scene scene;
+  scene.geometries.push_back(SmallTriangle({0, 0, 0}, 0));
+  scene.geometries.push_back(SmallTriangle({1, 0, 0}, 0));  // instanced mesh
+  scene.geometries.push_back(SmallTriangle({2, 0, 0}, 0));  // area light
+  scene.geometries.push_back(SmallTriangle({3, 0, 0}, 0));
+  Geometry instance;
+  instance.material_id = 0;
+  instance.instance_of = 1;
+  scene.geometries.push_back(instance);
+  scene.geometries.push_back(SmallTriangle({0, 1, 0}, 0));
+  AreaLight light;
+  light.geometry = &scene.geometries[2];
+  scene.area_lights.push_back(light);
+  ComputeSceneBoundingBoxes(scene);
+
+  ClusterGeometries(scene, {.max_triangles = 100, .max_extent = 100.0f});
+
+  ASSERT_EQ(scene.geometries.size(), 4u);
+  EXPECT_EQ(scene.geometries[0].indices.size(), 9u);  // 0, 3 and 5
+  EXPECT_EQ(scene.geometries[1].vertices[0], Eigen::Vector3f(1, 0, 0));
+  EXPECT_EQ(scene.area_lights[0].geometry, &scene.geometries[2]);
+  EXPECT_EQ(scene.geometries[2].vertices[0], Eigen::Vector3f(2, 0, 0));
+  EXPECT_EQ(scene.geometries[3].instance_of, 1);
+
+  // A zero triangle budget turns clustering off.
+  const size_t count = scene.geometries.size();
+  scene.geometries.push_back(SmallTriangle({0, 2, 0}, 0));
+  ComputeSceneBoundingBoxes(scene);
+  ClusterGeometries(scene, {.max_triangles = 0});
+  EXPECT_EQ(scene.geometries.size(), count + 1);
+}
+
 TEST(SceneTest, BuildLayerBuffersPacksStack) {
   std::vector<Material> materials(2);
 
@@ -125,6 +341,9 @@ TEST(SceneTest, BuildLayerBuffersPacksStack) {
   materials[1].name = "layered";
   materials[1].base_layer = 1;
   materials[1].albedo.channels = 4;  // modern albedo carries alpha
+  materials[1].emissive_factor = Eigen::Vector3f(1.0f, 0.5f, 0.25f);
+  materials[1].emissive_strength = 3.0f;
+  materials[1].emissive_texture = Texture();
   Layer l0;
   l0.blend_src = BlendFactor::kOne;
   l0.blend_dst = BlendFactor::kZero;
@@ -153,6 +372,11 @@ TEST(SceneTest, BuildLayerBuffersPacksStack) {
   EXPECT_EQ(gpu_materials[1].base_layer, 1);
   EXPECT_EQ(gpu_materials[0].modern_has_alpha, 0);  // plain, 0 channels
   EXPECT_EQ(gpu_materials[1].modern_has_alpha, 1);  // 4-channel albedo
+  EXPECT_EQ(gpu_materials[0].has_emissive_texture, 0);
+  EXPECT_EQ(gpu_materials[0].emissive_strength, 0.0f);
+  EXPECT_EQ(gpu_materials[1].has_emissive_texture, 1);
+  EXPECT_EQ(gpu_materials[1].emissive_strength, 3.0f);
+  EXPECT_EQ(gpu_materials[1].emissive_factor[1], 0.5f);
 
   ASSERT_EQ(gpu_layers.size(), 2u);
   EXPECT_EQ(gpu_layers[0].blend_src, static_cast<int>(BlendFactor::kOne));
@@ -172,4 +396,51 @@ TEST(SceneTest, BuildLayerBuffersPacksStack) {
   EXPECT_FLOAT_EQ(gpu_tcmods[1].v[0], 0.5f);
 }
 
+TEST(SceneTest, AssignLayerSetsSharesIdenticalTextureStacks) {
+  auto layer = [](uint32_t texture_id) {
+    Layer l;
+    l.texture.texture_id = texture_id;
+    return l;
+  };
+  std::vector<Material> materials(5);
+  materials[1].layers = {layer(7), layer(8)};
+  materials[2].layers = {layer(7), layer(9)};
+  materials[3].layers = {layer(7), layer(8)};  // same textures as material 1
+  // Same textures as material 1, but 8 is an animMap frame of layer 0.
+  materials[4].layers = {layer(7)};
+  materials[4].layers[0].anim_frames = {materials[4].layers[0].texture,
+                                        Texture()};
+  materials[4].layers[0].anim_frames[1].texture_id = 8;
+
+  AssignLayerSets(materials);
+  EXPECT_EQ(materials[0].layer_set, 0u);
+  EXPECT_EQ(materials[1].layer_set, 1u);
+  EXPECT_EQ(materials[2].layer_set, 2u);
+  EXPECT_EQ(materials[3].layer_set, 1u);
+  EXPECT_EQ(materials[4].layer_set, 3u);
+}
+
+TEST(SceneTest, SpotShadowViewProjCoversCone) {
+  SpotLight light;
+  light.position = Eigen::Vector3f(1.0f, 2.0f, 3.0f);
+  light.direction = Eigen::Vector3f(0.0f, 0.0f, -1.0f);
+  light.radius = 10.0f;
+  Eigen::Matrix4f view_proj = ComputeSpotShadowViewProj(light);
+
+  auto to_ndc = [&](const Eigen::Vector3f& p) {
+    Eigen::Vector4f clip = view_proj * p.homogeneous();
+    return Eigen::Vector3f(clip.head<3>() / clip.w());
+  };
+  // On the axis, inside the radius: centre of the map, in the depth range.
+  Eigen::Vector3f on_axis = to_ndc(light.position + 5.0f * light.direction);
+  EXPECT_NEAR(on_axis.x(), 0.0f, 1e-5f);
+  EXPECT_NEAR(on_axis.y(), 0.0f, 1e-5f);
+  EXPECT_GT(on_axis.z(), -1.0f);
+  EXPECT_LT(on_axis.z(), 1.0f);
+  // Behind the light: clipped (w < 0).
+  Eigen::Vector4f behind =
+      view_proj * (light.position - light.direction).homogeneous();
+  EXPECT_LT(behind.w(), 0.0f);
+}
+
 }  // namespace sh_renderer
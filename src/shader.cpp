@@ -2,9 +2,13 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <vector>
+
+#include "program_cache.h"
 
 namespace sh_renderer {
 namespace {
@@ -23,8 +27,10 @@ std::string ReadFile(const std::filesystem::path& path) {
   return buffer.str();
 }
 
+// Creates and compiles a shader with `macros` defined after its #version line.
+// Does not wait for the compile: the status is collected with the program's
+// (see ShaderProgram::FinishLink).
 GLuint CompileShader(GLenum type, const std::string& source,
-                     const std::string& name,
                      const std::map<std::string, std::string>& macros) {
   std::string final_source = source;
   if (!macros.empty()) {
@@ -51,21 +57,32 @@ GLuint CompileShader(GLenum type, const std::string& source,
   const char* src = final_source.c_str();
   glShaderSource(shader, 1, &src, nullptr);
   glCompileShader(shader);
+  return shader;
+}
 
+// Logs the info log of `shader` if it failed to compile. Returns whether it
+// compiled.
+bool CheckCompileStatus(GLuint shader, const std::string& name) {
   GLint success;
   glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
   if (!success) {
     char info_log[1024];
     glGetShaderInfoLog(shader, 1024, nullptr, info_log);
     LOG(ERROR) << "Failed to compile shader (" << name << "):\n" << info_log;
-    glDeleteShader(shader);
-    return 0;
   }
-  return shader;
+  return success;
+}
+
+// Whether the driver can save program binaries at all.
+bool ProgramBinariesSupported() {
+  GLint num_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  return num_formats > 0;
 }
 
 std::string ExpandIncludes(std::string_view source,
-                           const std::filesystem::path& base_dir, int depth) {
+                           const std::filesystem::path& base_dir, int depth,
+                           std::vector<std::filesystem::path>* included) {
   if (depth > kMaxIncludeDepth) {
     LOG(ERROR) << "Shader #include nesting too deep (under " << base_dir << ")";
     return std::string(source);
@@ -102,152 +119,419 @@ std::string ExpandIncludes(std::string_view source,
     std::string include_file_path =
         line.substr(file_name_start + 1, file_name_end - file_name_start - 1);
     std::filesystem::path inc_path = base_dir / include_file_path;
+    if (included) included->push_back(inc_path);
     std::string inc_src = ReadFile(inc_path);
-    out << ExpandIncludes(inc_src, inc_path.parent_path(), depth + 1) << "\n";
+    out << ExpandIncludes(inc_src, inc_path.parent_path(), depth + 1, included)
+        << "\n";
   }
 
   return out.str();
 }
 
+// Queries every active uniform outside a block, adding each element of an array
+// as "name[i]" along with the bare name for element 0.
+std::unordered_map<std::string, GLint> QueryUniformLocations(GLuint program) {
+  std::unordered_map<std::string, GLint> locations;
+  GLint count = 0;
+  glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+  GLint max_name_length = 0;
+  glGetProgramInterfaceiv(program, GL_UNIFORM, GL_MAX_NAME_LENGTH,
+                          &max_name_length);
+  std::string name(std::max(max_name_length, 1), '\0');
+
+  const GLenum properties[] = {GL_LOCATION, GL_ARRAY_SIZE};
+  for (GLint i = 0; i < count; ++i) {
+    GLint values[2] = {-1, 0};
+    glGetProgramResourceiv(program, GL_UNIFORM, i, 2, properties, 2, nullptr,
+                           values);
+    const GLint location = values[0];
+    if (location < 0) continue;  // in a uniform block
+    GLsizei length = 0;
+    glGetProgramResourceName(program, GL_UNIFORM, i, max_name_length, &length,
+                             name.data());
+    std::string resource(name.data(), length);
+    locations[resource] = location;
+
+    // Arrays report "name[0]"; add the bare name and the other elements.
+    constexpr std::string_view kFirstElement = "[0]";
+    if (resource.ends_with(kFirstElement)) {
+      std::string base = resource.substr(0, resource.size() - 3);
+      locations[base] = location;
+      for (GLint e = 1; e < values[1]; ++e) {
+        locations[base + "[" + std::to_string(e) + "]"] = location + e;
+      }
+    }
+  }
+  return locations;
+}
+
+}  // namespace
+
+std::string ResolveShaderIncludes(
+    std::string_view source, const std::filesystem::path& base_dir,
+    std::vector<std::filesystem::path>* included) {
+  return ExpandIncludes(source, base_dir, /*depth=*/0, included);
+}
+
+namespace {
+
+// One include-resolved shader stage.
+struct ShaderStage {
+  GLenum type;
+  std::string source;
+  std::string name;  // for compile errors
+};
+
 }  // namespace
 
-std::string ResolveShaderIncludes(std::string_view source,
-                                  const std::filesystem::path& base_dir) {
-  return ExpandIncludes(source, base_dir, /*depth=*/0);
+struct ShaderProgram::PendingLink {
+  std::vector<ShaderStage> stages;
+  std::map<std::string, std::string> macros;
+  std::vector<GLuint> shaders;  // submitted compiles; none if from a binary
+  std::filesystem::path cache_file;  // empty without the binary cache
+  uint64_t cache_key = 0;
+};
+
+namespace {
+
+// Whether the driver compiles on its own threads, with a non-blocking
+// completion query.
+bool ParallelCompileSupported() { return GLAD_GL_KHR_parallel_shader_compile; }
+
+// Submits the compiles of `stages` and the link of `program`, returning the
+// shaders (to delete once the status is collected).
+std::vector<GLuint> SubmitCompileAndLink(
+    GLuint program, const std::vector<ShaderStage>& stages,
+    const std::map<std::string, std::string>& macros, bool retrievable) {
+  std::vector<GLuint> shaders;
+  for (const ShaderStage& stage : stages) {
+    GLuint shader = CompileShader(stage.type, stage.source, macros);
+    glAttachShader(program, shader);
+    shaders.push_back(shader);
+  }
+  if (retrievable) {
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glLinkProgram(program);
+  return shaders;
 }
 
-ShaderProgram::ShaderProgram(ShaderProgram&& other) noexcept : id_(other.id_) {
+thread_local bool shader_batch_active = false;
+
+}  // namespace
+
+ShaderProgram::ShaderProgram() = default;
+
+ShaderProgram::ShaderProgram(ShaderProgram&& other) noexcept
+    : id_(other.id_),
+      uniform_locations_(std::move(other.uniform_locations_)),
+      pending_(std::move(other.pending_)),
+      source_(std::move(other.source_)),
+      files_(std::move(other.files_)) {
   other.id_ = 0;
+  other.uniform_locations_.clear();
 }
 
 ShaderProgram& ShaderProgram::operator=(ShaderProgram&& other) noexcept {
   if (this != &other) {
+    if (pending_) {
+      for (GLuint shader : pending_->shaders) glDeleteShader(shader);
+    }
     if (id_) glDeleteProgram(id_);
     id_ = other.id_;
+    uniform_locations_ = std::move(other.uniform_locations_);
+    pending_ = std::move(other.pending_);
+    source_ = std::move(other.source_);
+    files_ = std::move(other.files_);
     other.id_ = 0;
+    other.uniform_locations_.clear();
   }
   return *this;
 }
 
 ShaderProgram::~ShaderProgram() {
+  if (pending_) {
+    for (GLuint shader : pending_->shaders) glDeleteShader(shader);
+  }
   if (id_) glDeleteProgram(id_);
 }
 
 std::optional<ShaderProgram> ShaderProgram::CreateCompute(
     const std::filesystem::path& compute_path,
     const std::map<std::string, std::string>& macros) {
-  std::string compute_src = ReadFile(compute_path);
-  if (compute_src.empty()) return std::nullopt;
-  compute_src = ResolveShaderIncludes(compute_src, compute_path.parent_path());
-
-  GLuint compute_shader = CompileShader(GL_COMPUTE_SHADER, compute_src,
-                                        compute_path.string(), macros);
-  if (!compute_shader) return std::nullopt;
-
-  GLuint program = glCreateProgram();
-  glAttachShader(program, compute_shader);
-  glLinkProgram(program);
-
-  // Flag shader for deletion when program is deleted
-  glDeleteShader(compute_shader);
-
-  GLint success;
-  glGetProgramiv(program, GL_LINK_STATUS, &success);
-  if (!success) {
-    char info_log[1024];
-    glGetProgramInfoLog(program, 1024, nullptr, info_log);
-    LOG(ERROR) << "Failed to link compute program:\n" << info_log;
-    glDeleteProgram(program);
-    return std::nullopt;
-  }
-
-  return ShaderProgram(program);
+  return CreateFromFiles({.compute = compute_path, .macros = macros});
 }
 
 std::optional<ShaderProgram> ShaderProgram::CreateGraphics(
     const std::filesystem::path& vertex_path,
     const std::filesystem::path& fragment_path,
     const std::map<std::string, std::string>& macros) {
-  std::string vertex_src = ReadFile(vertex_path);
-  if (vertex_src.empty()) return std::nullopt;
-  vertex_src = ResolveShaderIncludes(vertex_src, vertex_path.parent_path());
-
-  std::string fragment_src = ReadFile(fragment_path);
-  if (fragment_src.empty()) return std::nullopt;
-  fragment_src =
-      ResolveShaderIncludes(fragment_src, fragment_path.parent_path());
+  return CreateFromFiles(
+      {.vertex = vertex_path, .fragment = fragment_path, .macros = macros});
+}
 
-  return CreateFromSource(vertex_src, fragment_src, macros);
+std::optional<ShaderProgram> ShaderProgram::CreateFromFiles(
+    const ProgramSource& source) {
+  std::optional<ShaderProgram> program = Submit(source);
+  if (!program || ShaderBatch::Active()) return program;
+  if (!program->FinishLink()) return std::nullopt;
+  return program;
 }
 
 std::optional<ShaderProgram> ShaderProgram::CreateFromSource(
     std::string_view vertex_source, std::string_view fragment_source,
     const std::map<std::string, std::string>& macros) {
-  GLuint vertex_shader = CompileShader(
-      GL_VERTEX_SHADER, std::string(vertex_source), "Vertex Source", macros);
-  if (!vertex_shader) return std::nullopt;
+  auto pending = std::make_unique<PendingLink>();
+  pending->stages = {
+      {GL_VERTEX_SHADER, std::string(vertex_source), "Vertex Source"},
+      {GL_FRAGMENT_SHADER, std::string(fragment_source), "Fragment Source"}};
+  pending->macros = macros;
+  ShaderProgram program = Start(std::move(pending));
+  if (!program.FinishLink()) return std::nullopt;
+  return program;
+}
 
-  GLuint fragment_shader =
-      CompileShader(GL_FRAGMENT_SHADER, std::string(fragment_source),
-                    "Fragment Source", macros);
-  if (!fragment_shader) {
-    glDeleteShader(vertex_shader);
-    return std::nullopt;
+std::optional<ShaderProgram> ShaderProgram::Submit(
+    const ProgramSource& source) {
+  auto pending = std::make_unique<PendingLink>();
+  pending->macros = source.macros;
+  std::vector<std::filesystem::path> files;
+
+  auto add_stage = [&](GLenum type, const std::filesystem::path& path) {
+    std::string src = ReadFile(path);
+    if (src.empty()) return false;
+    files.push_back(path);
+    src = ResolveShaderIncludes(src, path.parent_path(), &files);
+    pending->stages.push_back({type, std::move(src), path.string()});
+    return true;
+  };
+  if (!source.compute.empty()) {
+    if (!add_stage(GL_COMPUTE_SHADER, source.compute)) return std::nullopt;
+  } else {
+    if (!add_stage(GL_VERTEX_SHADER, source.vertex) ||
+        !add_stage(GL_FRAGMENT_SHADER, source.fragment)) {
+      return std::nullopt;
+    }
   }
 
-  GLuint program = glCreateProgram();
-  glAttachShader(program, vertex_shader);
-  glAttachShader(program, fragment_shader);
-  glLinkProgram(program);
+  ShaderProgram program = Start(std::move(pending));
+  program.source_ = source;
+  program.files_ = std::move(files);
+  return program;
+}
 
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
+ShaderProgram ShaderProgram::Start(std::unique_ptr<PendingLink> pending) {
+  ShaderProgram program;
+  program.id_ = glCreateProgram();
+
+  // Restore the program from its cached binary. Whether the driver accepts it
+  // is known once the link status is collected.
+  const std::filesystem::path& cache_dir = GetProgramCacheDirectory();
+  if (!cache_dir.empty() && ProgramBinariesSupported()) {
+    std::vector<std::string_view> sources;
+    for (const ShaderStage& stage : pending->stages) {
+      sources.push_back(stage.source);
+    }
+    static const std::string driver = GetDriverIdentity();
+    pending->cache_key = ProgramCacheKey(sources, pending->macros, driver);
+    pending->cache_file = ProgramCachePath(cache_dir, pending->cache_key);
+
+    if (auto binary =
+            ReadProgramBinary(pending->cache_file, pending->cache_key)) {
+      glProgramBinary(program.id_, binary->format, binary->data.data(),
+                      static_cast<GLsizei>(binary->data.size()));
+      program.pending_ = std::move(pending);
+      return program;
+    }
+  }
+
+  pending->shaders =
+      SubmitCompileAndLink(program.id_, pending->stages, pending->macros,
+                           /*retrievable=*/!pending->cache_file.empty());
+  program.pending_ = std::move(pending);
+  return program;
+}
+
+bool ShaderProgram::IsLinkComplete() const {
+  if (!pending_ || !ParallelCompileSupported()) return true;
+  GLint complete = GL_FALSE;
+  glGetProgramiv(id_, GL_COMPLETION_STATUS_KHR, &complete);
+  return complete == GL_TRUE;
+}
+
+bool ShaderProgram::FinishLink() {
+  if (!pending_) return id_ != 0;
+  std::unique_ptr<PendingLink> pending = std::move(pending_);
+  ProgramCacheStats& stats = GetProgramCacheStats();
 
   GLint success;
-  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  glGetProgramiv(id_, GL_LINK_STATUS, &success);
+  if (pending->shaders.empty()) {
+    if (success) {
+      ++stats.hits;
+      CacheUniformLocations();
+      return true;
+    }
+    // The driver refused the cached binary: compile the program instead.
+    LOG(INFO) << "Program binary " << pending->cache_file
+              << " rejected by the driver; recompiling.";
+    ++stats.rejected;
+    pending->shaders = SubmitCompileAndLink(id_, pending->stages,
+                                            pending->macros,
+                                            /*retrievable=*/true);
+    glGetProgramiv(id_, GL_LINK_STATUS, &success);
+  }
+
+  // Compile errors explain most link failures, so report those first.
+  bool compiled = true;
+  for (size_t i = 0; i < pending->shaders.size(); ++i) {
+    compiled &= CheckCompileStatus(pending->shaders[i],
+                                   pending->stages[i].name);
+    glDetachShader(id_, pending->shaders[i]);
+    glDeleteShader(pending->shaders[i]);
+  }
   if (!success) {
-    char info_log[1024];
-    glGetProgramInfoLog(program, 1024, nullptr, info_log);
-    LOG(ERROR) << "Failed to link graphics program:\n" << info_log;
-    glDeleteProgram(program);
-    return std::nullopt;
+    if (compiled) {
+      char info_log[1024];
+      glGetProgramInfoLog(id_, 1024, nullptr, info_log);
+      LOG(ERROR) << "Failed to link program (" << pending->stages[0].name
+                 << "):\n"
+                 << info_log;
+    }
+    glDeleteProgram(id_);
+    id_ = 0;
+    return false;
+  }
+  ++stats.compiles;
+  CacheUniformLocations();
+
+  if (!pending->cache_file.empty()) {
+    GLint length = 0;
+    glGetProgramiv(id_, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length > 0) {
+      ProgramBinary binary;
+      binary.data.resize(length);
+      GLenum format = 0;
+      glGetProgramBinary(id_, length, nullptr, &format, binary.data.data());
+      binary.format = format;
+      WriteProgramBinary(pending->cache_file, pending->cache_key, binary);
+    }
+  }
+  return true;
+}
+
+void ShaderProgram::CacheUniformLocations() {
+  uniform_locations_.clear();
+  for (auto& [name, location] : QueryUniformLocations(id_)) {
+    uniform_locations_.emplace(name, location);
   }
+}
+
+ShaderBatch::ShaderBatch() {
+  CHECK(!shader_batch_active) << "ShaderBatch scopes don't nest.";
+  shader_batch_active = true;
+  // Let the driver use as many compiler threads as it likes.
+  if (ParallelCompileSupported()) glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+}
+
+ShaderBatch::~ShaderBatch() { shader_batch_active = false; }
+
+bool ShaderBatch::Active() { return shader_batch_active; }
 
-  return ShaderProgram(program);
+bool ShaderBatch::Finish(std::initializer_list<ShaderProgram*> programs) {
+  shader_batch_active = false;
+  bool ok = true;
+  for (ShaderProgram* program : programs) ok &= program->FinishLink();
+  return ok;
+}
+
+UniformHandle ShaderProgram::Handle(std::string_view name) const {
+  auto it = uniform_locations_.find(name);
+  return UniformHandle(id_, it != uniform_locations_.end() ? it->second : -1);
 }
 
 void ShaderProgram::Uniform(std::string_view name, int value) const {
-  glUniform1i(glGetUniformLocation(id_, std::string(name).c_str()), value);
+  Handle(name).Set(value);
 }
 
 void ShaderProgram::Uniform(std::string_view name, float value) const {
-  glUniform1f(glGetUniformLocation(id_, std::string(name).c_str()), value);
+  Handle(name).Set(value);
 }
 
 void ShaderProgram::Uniform(std::string_view name,
                             const Eigen::Vector2i& value) const {
-  glUniform2iv(glGetUniformLocation(id_, std::string(name).c_str()), 1,
-               value.data());
+  Handle(name).Set(value);
 }
 
 void ShaderProgram::Uniform(std::string_view name,
                             const Eigen::Vector2f& value) const {
-  glUniform2fv(glGetUniformLocation(id_, std::string(name).c_str()), 1,
-               value.data());
+  Handle(name).Set(value);
 }
 
 void ShaderProgram::Uniform(std::string_view name,
                             const Eigen::Vector3f& value) const {
-  glUniform3fv(glGetUniformLocation(id_, std::string(name).c_str()), 1,
-               value.data());
+  Handle(name).Set(value);
 }
 
 void ShaderProgram::Uniform(std::string_view name,
                             const Eigen::Matrix4f& value) const {
-  glUniformMatrix4fv(glGetUniformLocation(id_, std::string(name).c_str()), 1,
-                     GL_FALSE, value.data());
+  Handle(name).Set(value);
 }
 
 void ShaderProgram::Use() const { glUseProgram(id_); }
 
+void UniformHandle::Set(int value) const {
+  if (location_ >= 0) glProgramUniform1i(program_, location_, value);
+}
+
+void UniformHandle::Set(float value) const {
+  if (location_ >= 0) glProgramUniform1f(program_, location_, value);
+}
+
+void UniformHandle::Set(const Eigen::Vector2i& value) const {
+  if (location_ >= 0) glProgramUniform2iv(program_, location_, 1, value.data());
+}
+
+void UniformHandle::Set(const Eigen::Vector2f& value) const {
+  if (location_ >= 0) glProgramUniform2fv(program_, location_, 1, value.data());
+}
+
+void UniformHandle::Set(const Eigen::Vector3f& value) const {
+  if (location_ >= 0) glProgramUniform3fv(program_, location_, 1, value.data());
+}
+
+void UniformHandle::Set(const Eigen::Matrix4f& value) const {
+  if (location_ >= 0) {
+    glProgramUniformMatrix4fv(program_, location_, 1, GL_FALSE, value.data());
+  }
+}
+
+void UniformHandle::Set(std::span<const float> values) const {
+  if (location_ < 0 || values.empty()) return;
+  glProgramUniform1fv(program_, location_, static_cast<GLsizei>(values.size()),
+                      values.data());
+}
+
+void UniformHandle::Set(std::span<const Eigen::Vector3f> values) const {
+  if (location_ < 0 || values.empty()) return;
+  static_assert(sizeof(Eigen::Vector3f) == 3 * sizeof(float));
+  glProgramUniform3fv(program_, location_, static_cast<GLsizei>(values.size()),
+                      values.data()->data());
+}
+
+void UniformHandle::Set(std::span<const Eigen::Vector4f> values) const {
+  if (location_ < 0 || values.empty()) return;
+  static_assert(sizeof(Eigen::Vector4f) == 4 * sizeof(float));
+  glProgramUniform4fv(program_, location_, static_cast<GLsizei>(values.size()),
+                      values.data()->data());
+}
+
+void UniformHandle::Set(std::span<const Eigen::Matrix4f> values) const {
+  if (location_ < 0 || values.empty()) return;
+  static_assert(sizeof(Eigen::Matrix4f) == 16 * sizeof(float));
+  glProgramUniformMatrix4fv(program_, location_,
+                            static_cast<GLsizei>(values.size()), GL_FALSE,
+                            values.data()->data());
+}
+
 }  // namespace sh_renderer
@@ -2,20 +2,66 @@
 
 #include <Eigen/Core>
 #include <filesystem>
+#include <initializer_list>
 #include <map>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "glad.h"
 
 namespace sh_renderer {
 
+// A uniform location resolved once with ShaderProgram::Handle, set through the
+// DSA glProgramUniform* calls: no name lookup, and the program need not be
+// bound. Setting a handle to an unknown or optimized-out uniform is a no-op,
+// like GL's location -1.
+class UniformHandle {
+ public:
+  UniformHandle() = default;
+  UniformHandle(GLuint program, GLint location)
+      : program_(program), location_(location) {}
+
+  explicit operator bool() const { return location_ >= 0; }
+  GLint location() const { return location_; }
+
+  void Set(int value) const;
+  void Set(float value) const;
+  void Set(const Eigen::Vector2i& value) const;
+  void Set(const Eigen::Vector2f& value) const;
+  void Set(const Eigen::Vector3f& value) const;
+  void Set(const Eigen::Matrix4f& value) const;
+
+  // Sets consecutive elements of an array uniform, starting at this handle's
+  // element, in one call.
+  void Set(std::span<const float> values) const;
+  void Set(std::span<const Eigen::Vector3f> values) const;
+  void Set(std::span<const Eigen::Vector4f> values) const;
+  void Set(std::span<const Eigen::Matrix4f> values) const;
+
+ private:
+  GLuint program_ = 0;
+  GLint location_ = -1;
+};
+
+// The files a program is built from, kept so it can be rebuilt (see
+// ShaderHotReload).
+struct ProgramSource {
+  std::filesystem::path vertex;
+  std::filesystem::path fragment;
+  std::filesystem::path compute;  // set instead of vertex and fragment
+  std::map<std::string, std::string> macros;
+};
+
 // Wraps an OpenGL shader program.
 class ShaderProgram {
  public:
   // Creates an empty shader program.
-  ShaderProgram() = default;
+  ShaderProgram();
 
   // Move-only.
   ShaderProgram(ShaderProgram&& other) noexcept;
@@ -25,6 +71,12 @@ class ShaderProgram {
 
   ~ShaderProgram();
 
+  // The Create* functions restore the program from the program binary cache
+  // when it is enabled (SetProgramCacheDirectory) and holds a binary the driver
+  // accepts, and otherwise compile it and store its binary. Inside a
+  // ShaderBatch, the files-based ones return the program pending (see
+  // FinishLink) and fail only on unreadable files.
+
   // Loads and compiles a compute shader from a file.
   // Returns std::nullopt on failure.
   static std::optional<ShaderProgram> CreateCompute(
@@ -44,10 +96,40 @@ class ShaderProgram {
       std::string_view vertex_source, std::string_view fragment_source,
       const std::map<std::string, std::string>& macros = {});
 
+  // Loads the program's files and submits its compile and link without
+  // waiting for the driver; the program is returned pending. Returns
+  // std::nullopt if a file can't be read.
+  static std::optional<ShaderProgram> Submit(const ProgramSource& source);
+
+  // Whether the compile and link status has yet to be collected.
+  bool pending() const { return pending_ != nullptr; }
+
+  // Whether a pending program's link has completed, so FinishLink won't block.
+  // Always true without GL_KHR_parallel_shader_compile.
+  bool IsLinkComplete() const;
+
+  // Collects a pending program's status, logging compile and link errors,
+  // caches its uniform locations and stores its binary. A program that failed
+  // becomes empty. Returns whether the program is valid.
+  bool FinishLink();
+
+  // The files the program was created from, or nullptr for CreateFromSource.
+  const ProgramSource* source() const {
+    return source_ ? &*source_ : nullptr;
+  }
+
+  // Every file read to build the program, including #included ones.
+  const std::vector<std::filesystem::path>& files() const { return files_; }
+
   // Checks if the program is valid.
   explicit operator bool() const { return id_ != 0; }
 
-  // Sets a uniform value by name.
+  // Returns the handle of the uniform `name` from the location cache filled
+  // at link time. Array elements are addressed as "name[i]"; "name" is element
+  // 0. Resolve handles once and keep them for per-frame updates.
+  UniformHandle Handle(std::string_view name) const;
+
+  // Sets a uniform value by name (a cache lookup; see Handle).
   void Uniform(std::string_view name, int value) const;
   void Uniform(std::string_view name, float value) const;
   void Uniform(std::string_view name, const Eigen::Vector2i& value) const;
@@ -61,16 +143,65 @@ class ShaderProgram {
   GLuint id() const { return id_; }
 
  private:
-  explicit ShaderProgram(GLuint id) : id_(id) {}
+  // State of a program whose status hasn't been collected (see FinishLink):
+  // its stage sources and macros, and its cache file.
+  struct PendingLink;
+
+  // Starts building `pending`'s stages into a program, through the program
+  // binary cache: restores the cached binary or submits the compiles and the
+  // link. The returned program is pending.
+  static ShaderProgram Start(std::unique_ptr<PendingLink> pending);
+
+  // Submit()s `source`; outside a ShaderBatch also finishes it (nullopt on
+  // failure).
+  static std::optional<ShaderProgram> CreateFromFiles(
+      const ProgramSource& source);
+
+  // Caches the uniform locations of the linked program.
+  void CacheUniformLocations();
+
+  // Heterogeneous lookup, so Handle() needs no std::string.
+  struct NameHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const {
+      return std::hash<std::string_view>{}(name);
+    }
+  };
 
   GLuint id_ = 0;
+  std::unordered_map<std::string, GLint, NameHash, std::equal_to<>>
+      uniform_locations_;
+  std::unique_ptr<PendingLink> pending_;
+  std::optional<ProgramSource> source_;
+  std::vector<std::filesystem::path> files_;
+};
+
+// Defers the status of every file-based program created on this thread while
+// it is alive. All compiles and links are then submitted before any status is
+// queried, so the driver can compile them concurrently (on its own threads
+// with GL_KHR_parallel_shader_compile). Finish collects the results.
+class ShaderBatch {
+ public:
+  ShaderBatch();
+  ~ShaderBatch();
+  ShaderBatch(const ShaderBatch&) = delete;
+  ShaderBatch& operator=(const ShaderBatch&) = delete;
+
+  // Whether a batch is deferring program status on this thread.
+  static bool Active();
+
+  // Ends the batch and finishes the programs created in it (FinishLink).
+  // Returns whether all of them are valid.
+  bool Finish(std::initializer_list<ShaderProgram*> programs);
 };
 
 // Resolves `#include "file"` directives in GLSL source by inlining the file's
 // contents (paths are resolved relative to `base_dir`, then to the included
 // file's own directory for nested includes). GLSL has no native include, so this
-// is plain textual substitution, applied before compilation. Exposed for testing.
-std::string ResolveShaderIncludes(std::string_view source,
-                                  const std::filesystem::path& base_dir);
+// is plain textual substitution, applied before compilation. The included
+// files are appended to `included` if given. Exposed for testing.
+std::string ResolveShaderIncludes(
+    std::string_view source, const std::filesystem::path& base_dir,
+    std::vector<std::filesystem::path>* included = nullptr);
 
 }  // namespace sh_renderer
@@ -0,0 +1,62 @@
+#include "shader_hot_reload.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace sh_renderer {
+
+std::filesystem::file_time_type NewestWriteTime(
+    const std::vector<std::filesystem::path>& files) {
+  std::filesystem::file_time_type newest = std::filesystem::file_time_type::min();
+  for (const auto& file : files) {
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(file, ec);
+    if (!ec) newest = std::max(newest, time);
+  }
+  return newest;
+}
+
+void ShaderHotReload::Watch(ShaderProgram* program) {
+  CHECK(program->source()) << "Only programs created from files can reload.";
+  watched_.push_back({.program = program,
+                      .stamp = NewestWriteTime(program->files()),
+                      .rebuild = std::nullopt});
+}
+
+int ShaderHotReload::Poll(std::chrono::milliseconds scan_interval) {
+  const auto now = std::chrono::steady_clock::now();
+  const bool scan = now - last_scan_ >= scan_interval;
+  if (scan) last_scan_ = now;
+
+  int swapped = 0;
+  for (Watched& w : watched_) {
+    if (w.rebuild) {
+      if (!w.rebuild->IsLinkComplete()) continue;
+      const ProgramSource& source = *w.rebuild->source();
+      const std::string name = source.compute.empty()
+                                   ? source.fragment.string()
+                                   : source.compute.string();
+      if (w.rebuild->FinishLink()) {
+        *w.program = std::move(*w.rebuild);
+        ++swapped;
+        LOG(INFO) << "Reloaded shader program " << name;
+      } else {
+        LOG(ERROR) << "Keeping the previous " << name
+                   << " program; the rebuild failed.";
+      }
+      w.rebuild.reset();
+      continue;
+    }
+
+    if (!scan) continue;
+    // Every save triggers one rebuild, whether or not the last one failed.
+    auto stamp = NewestWriteTime(w.program->files());
+    if (stamp <= w.stamp) continue;
+    w.stamp = stamp;
+    w.rebuild = ShaderProgram::Submit(*w.program->source());
+  }
+  return swapped;
+}
+
+}  // namespace sh_renderer
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+#include "shader.h"
+
+namespace sh_renderer {
+
+// Rebuilds watched programs when one of their files (including #included ones)
+// changes on disk. A rebuild is submitted without waiting for the driver and
+// swapped into the watched program once its link has completed, so with
+// GL_KHR_parallel_shader_compile the frame loop never blocks on a compile.
+// Without the extension the status query of a rebuild blocks the frame it is
+// collected in. A rebuild that fails to compile keeps the old program.
+//
+// Uniform handles resolved from a watched program are invalidated by a swap;
+// resolve them again (or use ShaderProgram::Uniform).
+class ShaderHotReload {
+ public:
+  // Watches `program`, which must outlive this object and have been created
+  // from files (ShaderProgram::source()).
+  void Watch(ShaderProgram* program);
+
+  // Call once per frame. Scans the watched files at most every
+  // `scan_interval`, submits rebuilds of changed programs and swaps in the
+  // rebuilds whose link has completed. Returns the number of programs swapped.
+  int Poll(std::chrono::milliseconds scan_interval =
+               std::chrono::milliseconds(250));
+
+ private:
+  struct Watched {
+    ShaderProgram* program;
+    std::filesystem::file_time_type stamp;  // newest write time of its files
+    std::optional<ShaderProgram> rebuild;   // pending replacement
+  };
+
+  std::vector<Watched> watched_;
+  std::chrono::steady_clock::time_point last_scan_;
+};
+
+// Returns the newest last-write time of `files`, skipping unreadable ones.
+std::filesystem::file_time_type NewestWriteTime(
+    const std::vector<std::filesystem::path>& files);
+
+}  // namespace sh_renderer
@@ -5,6 +5,9 @@
 #include <filesystem>
 #include <fstream>
 #include <string>
+#include <vector>
+
+#include "window.h"
 
 namespace sh_renderer {
 namespace {
@@ -51,6 +54,20 @@ TEST(ShaderInclude, ResolvesNestedIncludes) {
   std::filesystem::remove_all(dir);
 }
 
+TEST(ShaderInclude, RecordsIncludedFiles) {
+  auto dir = MakeDir("record");
+  Write(dir / "c.glsl", "C_CONTENT\n");
+  Write(dir / "b.glsl", "#include \"c.glsl\"\n");
+  std::string src = "#include \"b.glsl\"\n";
+
+  std::vector<std::filesystem::path> included;
+  ResolveShaderIncludes(src, dir, &included);
+  ASSERT_EQ(included.size(), 2u);
+  EXPECT_EQ(included[0], dir / "b.glsl");
+  EXPECT_EQ(included[1], dir / "c.glsl");
+  std::filesystem::remove_all(dir);
+}
+
 TEST(ShaderInclude, HandlesIndentationAndPassesOtherLines) {
   auto dir = MakeDir("indent");
   Write(dir / "x.glsl", "X_CONTENT\n");
@@ -72,5 +89,42 @@ TEST(ShaderInclude, NoIncludeLeavesContentIntact) {
   EXPECT_EQ(out.find("#include"), npos);
 }
 
+TEST(ShaderUniforms, CacheMatchesGlLocations) {
+  auto window = CreateWindow(64, 64, "Uniform cache test");
+  ASSERT_TRUE(window.has_value());
+  {
+    auto program = ShaderProgram::CreateFromSource(
+        "#version 460 core\n"
+        "uniform mat4 u_matrix;\n"
+        "uniform float u_weights[4];\n"
+        "void main() { gl_Position = u_matrix * vec4(u_weights[3]); }\n",
+        "#version 460 core\n"
+        "struct Light { vec3 color; float intensity; };\n"
+        "uniform Light u_light;\n"
+        "out vec4 color;\n"
+        "void main() { color = vec4(u_light.color * u_light.intensity, 1); }\n");
+    ASSERT_TRUE(program.has_value());
+    for (const char* name :
+         {"u_matrix", "u_weights", "u_weights[0]", "u_weights[3]",
+          "u_light.color", "u_light.intensity"}) {
+      UniformHandle handle = program->Handle(name);
+      EXPECT_TRUE(handle) << name;
+      EXPECT_EQ(handle.location(), glGetUniformLocation(program->id(), name))
+          << name;
+    }
+    EXPECT_FALSE(program->Handle("u_missing"));
+    EXPECT_FALSE(program->Handle("u_weights[4]"));
+
+    // Array elements set in one call land in consecutive locations.
+    const float weights[] = {1, 2, 3, 4};
+    program->Handle("u_weights").Set(std::span<const float>(weights));
+    float readback = 0;
+    glGetUniformfv(program->id(), program->Handle("u_weights[2]").location(),
+                   &readback);
+    EXPECT_EQ(readback, 3.0f);
+  }
+  DestroyWindow(*window);
+}
+
 }  // namespace
 }  // namespace sh_renderer
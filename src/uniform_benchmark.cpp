@@ -0,0 +1,177 @@
+// Microbenchmark of the per-frame uniform overhead of the radiance and SSAO
+// passes. Sets the same uniforms three ways:
+//   lookup:  glGetUniformLocation on a freshly built std::string per call, as
+//            ShaderProgram::Uniform did before the location cache;
+//   cached:  ShaderProgram::Uniform, a hash lookup in the link-time cache;
+//   handles: UniformHandles resolved once, with array uniforms in one call.
+// A fourth run, frame_constants, adds the per-frame camera/sun block that
+// replaced the loose camera uniforms: ComputeFrameConstants and one write into
+// the persistently mapped ring.
+// Run from the repository root (the shaders are loaded from glsl/).
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cascade.h"
+#include "draw_radiance.h"
+#include "draw_ssao.h"
+#include "frame_constants.h"
+#include "shader.h"
+#include "window.h"
+
+DEFINE_uint32(frames, 20000, "Frames to simulate per strategy.");
+
+namespace sh_renderer {
+namespace {
+
+constexpr int kSsaoSamples = 32;
+
+// The values one frame uploads.
+struct FrameUniforms {
+  Eigen::Vector2i tile_count = Eigen::Vector2i(80, 45);
+  std::array<float, kNumShadowMapCascades> splits = {};
+  std::array<Eigen::Matrix4f, kNumShadowMapCascades> cascade_view_projs;
+  std::vector<Eigen::Vector3f> ssao_kernel =
+      std::vector<Eigen::Vector3f>(kSsaoSamples, Eigen::Vector3f(0, 0, 1));
+};
+
+void LookupSet(GLuint program, std::string_view name, const float* v,
+               int components) {
+  GLint location = glGetUniformLocation(program, std::string(name).c_str());
+  if (components == 16) {
+    glUniformMatrix4fv(location, 1, GL_FALSE, v);
+  } else if (components == 3) {
+    glUniform3fv(location, 1, v);
+  } else {
+    glUniform1f(location, *v);
+  }
+}
+
+void LookupSet(GLuint program, std::string_view name,
+               const Eigen::Vector2i& v) {
+  glUniform2iv(glGetUniformLocation(program, std::string(name).c_str()), 1,
+               v.data());
+}
+
+void FrameWithLookups(const ShaderProgram& radiance, const ShaderProgram& ssao,
+                      const FrameUniforms& u) {
+  GLuint id = radiance.id();
+  glUseProgram(id);
+  for (unsigned i = 0; i < kNumShadowMapCascades; ++i) {
+    LookupSet(id, "u_sun_cascade_splits[" + std::to_string(i) + "]",
+              &u.splits[i], 1);
+    LookupSet(id, "u_sun_cascade_view_projections[" + std::to_string(i) + "]",
+              u.cascade_view_projs[i].data(), 16);
+  }
+  LookupSet(id, "u_tile_count", u.tile_count);
+
+  glUseProgram(ssao.id());
+  for (int i = 0; i < kSsaoSamples; ++i) {
+    LookupSet(ssao.id(), "u_samples[" + std::to_string(i) + "]",
+              u.ssao_kernel[i].data(), 3);
+  }
+}
+
+void FrameWithCache(const ShaderProgram& radiance, const ShaderProgram& ssao,
+                    const FrameUniforms& u) {
+  radiance.Use();
+  for (unsigned i = 0; i < kNumShadowMapCascades; ++i) {
+    radiance.Uniform("u_sun_cascade_splits[" + std::to_string(i) + "]",
+                     u.splits[i]);
+    radiance.Uniform(
+        "u_sun_cascade_view_projections[" + std::to_string(i) + "]",
+        u.cascade_view_projs[i]);
+  }
+  radiance.Uniform("u_tile_count", u.tile_count);
+
+  ssao.Use();
+  for (int i = 0; i < kSsaoSamples; ++i) {
+    ssao.Uniform("u_samples[" + std::to_string(i) + "]", u.ssao_kernel[i]);
+  }
+}
+
+struct Handles {
+  explicit Handles(const ShaderProgram& radiance, const ShaderProgram& ssao)
+      : splits(radiance.Handle("u_sun_cascade_splits")),
+        cascade_view_projs(radiance.Handle("u_sun_cascade_view_projections")),
+        tile_count(radiance.Handle("u_tile_count")),
+        samples(ssao.Handle("u_samples")) {}
+
+  UniformHandle splits, cascade_view_projs, tile_count, samples;
+};
+
+void FrameWithHandles(const Handles& h, const FrameUniforms& u) {
+  h.splits.Set(std::span<const float>(u.splits));
+  h.cascade_view_projs.Set(
+      std::span<const Eigen::Matrix4f>(u.cascade_view_projs));
+  h.tile_count.Set(u.tile_count);
+  h.samples.Set(std::span<const Eigen::Vector3f>(u.ssao_kernel));
+}
+
+template <typename Fn>
+void Measure(const char* name, Fn&& frame) {
+  glFinish();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < FLAGS_frames; ++i) frame(static_cast<float>(i));
+  glFinish();
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  LOG(INFO) << name << ": " << elapsed.count() / FLAGS_frames
+            << " us per frame";
+}
+
+int Run() {
+  auto window = CreateWindow(64, 64, "Uniform benchmark");
+  if (!window) {
+    LOG(ERROR) << "Failed to create window.";
+    return 1;
+  }
+  {
+    ShaderProgram radiance = CreateRadianceProgram();
+    ShaderProgram ssao = CreateSSAOProgram();
+    if (!radiance || !ssao) return 1;
+
+    FrameUniforms uniforms;
+    for (auto& m : uniforms.cascade_view_projs) m.setIdentity();
+
+    Measure("lookup",
+            [&](float) { FrameWithLookups(radiance, ssao, uniforms); });
+    Measure("cached", [&](float) { FrameWithCache(radiance, ssao, uniforms); });
+    Handles handles(radiance, ssao);
+    Measure("handles", [&](float) { FrameWithHandles(handles, uniforms); });
+
+    Camera camera{.position = Eigen::Vector3f(1, 2, 3),
+                  .orientation = Eigen::Quaternionf::Identity()};
+    FrameConstantsRing ring = CreateFrameConstantsRing();
+    Measure("frame_constants", [&](float t) {
+      BeginFrame(ComputeFrameConstants(camera, SunLight(), 1280, 720, t),
+                 &ring);
+      FrameWithHandles(handles, uniforms);
+      EndFrame(&ring);
+    });
+    DestroyFrameConstantsRing(&ring);
+  }
+  DestroyWindow(*window);
+  return 0;
+}
+
+}  // namespace
+}  // namespace sh_renderer
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("Per-frame uniform update microbenchmark.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  int result = sh_renderer::Run();
+
+  gflags::ShutDownCommandLineFlags();
+  return result;
+}
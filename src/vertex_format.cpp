@@ -0,0 +1,236 @@
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "glad.h"
+#include "scene.h"
+
+namespace sh_renderer {
+
+namespace {
+
+template <typename T>
+void Store(uint8_t* dst, const T& value) {
+  std::memcpy(dst, &value, sizeof(T));
+}
+
+// Encodes one signed component for a normalized 10-bit (or 2-bit) field.
+uint32_t PackSnorm(float v, int bits) {
+  const float max_value = static_cast<float>((1 << (bits - 1)) - 1);
+  int32_t q = static_cast<int32_t>(
+      std::lround(std::clamp(v, -1.0f, 1.0f) * max_value));
+  return static_cast<uint32_t>(q) & ((1u << bits) - 1);
+}
+
+// GL's normalized signed decode: max(c / (2^(b-1) - 1), -1).
+float UnpackSnorm(uint32_t field, int bits) {
+  int32_t q = static_cast<int32_t>(field << (32 - bits)) >> (32 - bits);
+  const float max_value = static_cast<float>((1 << (bits - 1)) - 1);
+  return std::max(static_cast<float>(q) / max_value, -1.0f);
+}
+
+}  // namespace
+
+bool UvsFitHalf(const Geometry& geometry) {
+  for (const auto& uv : geometry.texture_uvs) {
+    if (!(uv.cwiseAbs().maxCoeff() < kMaxHalfUv)) return false;
+  }
+  return true;
+}
+
+std::optional<VertexFormat> ParseVertexFormat(std::string_view name) {
+  if (name == "float") return VertexFormat::kFloat;
+  if (name == "compact") return VertexFormat::kCompact;
+  if (name == "quantized") return VertexFormat::kQuantized;
+  return std::nullopt;
+}
+
+uint32_t PackSnorm1010102(const Eigen::Vector4f& v) {
+  return PackSnorm(v.x(), 10) | (PackSnorm(v.y(), 10) << 10) |
+         (PackSnorm(v.z(), 10) << 20) | (PackSnorm(v.w(), 2) << 30);
+}
+
+Eigen::Vector4f UnpackSnorm1010102(uint32_t packed) {
+  return Eigen::Vector4f(UnpackSnorm(packed & 0x3ff, 10),
+                         UnpackSnorm((packed >> 10) & 0x3ff, 10),
+                         UnpackSnorm((packed >> 20) & 0x3ff, 10),
+                         UnpackSnorm(packed >> 30, 2));
+}
+
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const uint32_t float_exponent = (bits >> 23) & 0xff;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (float_exponent == 0xff) {  // Inf / NaN
+    return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+  }
+  const int32_t exponent = static_cast<int32_t>(float_exponent) - 127 + 15;
+  if (exponent >= 31) return static_cast<uint16_t>(sign | 0x7c00);
+  if (exponent <= 0) {
+    if (exponent < -10) return static_cast<uint16_t>(sign);
+    // Denormal: shift the full 24-bit mantissa into place, round to even.
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) ++half;
+    return static_cast<uint16_t>(sign | half);
+  }
+  uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) |
+                  (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  // A carry out of the mantissa correctly bumps the exponent.
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+  return static_cast<uint16_t>(half);
+}
+
+float HalfToFloat(uint16_t half) {
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1f;
+  const uint32_t mantissa = half & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0) {
+    float value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -value : value;
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+uint16_t PackUnorm16(float value) {
+  return static_cast<uint16_t>(
+      std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+PackedVertices PackVertices(const Geometry& geometry, VertexFormat format,
+                            bool allow_half_uvs) {
+  PackedVertices packed;
+  const bool compact = format != VertexFormat::kFloat;
+  const bool quantized = format == VertexFormat::kQuantized;
+  const bool half_uvs = compact && allow_half_uvs && UvsFitHalf(geometry);
+
+  // Layout. Attribute offsets stay 4-byte aligned.
+  auto& attribs = packed.attribs;
+  auto add = [&](int location, uint32_t stream, int components, GLenum type,
+                 bool normalized, uint32_t size) {
+    attribs[location] = {components, type, normalized, stream,
+                         packed.strides[stream]};
+    packed.strides[stream] += size;
+  };
+  if (quantized) {
+    add(0, kPositionStream, 3, GL_UNSIGNED_SHORT, true, 8);  // xyz + pad
+  } else {
+    add(0, kPositionStream, 3, GL_FLOAT, false, 12);
+  }
+  if (compact) {
+    add(1, kDepthStream, 4, GL_INT_2_10_10_10_REV, true, 4);
+  } else {
+    add(1, kDepthStream, 3, GL_FLOAT, false, 12);
+  }
+  if (half_uvs) {
+    add(2, kDepthStream, 2, GL_HALF_FLOAT, false, 4);
+  } else {
+    add(2, kDepthStream, 2, GL_FLOAT, false, 8);
+  }
+  if (compact) {
+    add(3, kShadingStream, 2, GL_UNSIGNED_SHORT, true, 4);
+    add(4, kShadingStream, 4, GL_INT_2_10_10_10_REV, true, 4);
+  } else {
+    add(3, kShadingStream, 2, GL_FLOAT, false, 8);
+    add(4, kShadingStream, 4, GL_FLOAT, false, 16);
+  }
+
+  // Streams are stored back to back, each starting on a 16-byte boundary.
+  const size_t count = geometry.vertices.size();
+  uint32_t size = 0;
+  for (uint32_t stream = 0; stream < kNumVertexStreams; ++stream) {
+    packed.stream_offsets[stream] = size;
+    size += (static_cast<uint32_t>(count) * packed.strides[stream] + 15) & ~15u;
+  }
+  packed.data.assign(size, 0);
+
+  // Quantization range: the local-space AABB of the positions.
+  Eigen::Vector3f min = Eigen::Vector3f::Zero();
+  Eigen::Vector3f extent = Eigen::Vector3f::Ones();
+  if (quantized && !geometry.vertices.empty()) {
+    min = geometry.vertices[0];
+    Eigen::Vector3f max = geometry.vertices[0];
+    for (const auto& v : geometry.vertices) {
+      min = min.cwiseMin(v);
+      max = max.cwiseMax(v);
+    }
+    extent = max - min;
+    packed.position_scale = extent;
+    packed.position_offset = min;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    // Start of attribute `location` for vertex i.
+    auto at = [&](int location) {
+      const VertexAttrib& attrib = attribs[location];
+      return packed.data.data() + packed.stream_offsets[attrib.stream] +
+             i * packed.strides[attrib.stream] + attrib.offset;
+    };
+
+    const Eigen::Vector3f& p = geometry.vertices[i];
+    Eigen::Vector3f n = i < geometry.normals.size() ? geometry.normals[i]
+                                                    : Eigen::Vector3f(0, 1, 0);
+    Eigen::Vector2f uv = i < geometry.texture_uvs.size()
+                             ? geometry.texture_uvs[i]
+                             : Eigen::Vector2f::Zero();
+    Eigen::Vector2f luv = i < geometry.lightmap_uvs.size()
+                              ? geometry.lightmap_uvs[i]
+                              : Eigen::Vector2f::Zero();
+    Eigen::Vector4f t = i < geometry.tangents.size()
+                            ? geometry.tangents[i]
+                            : Eigen::Vector4f(1, 0, 0, 1);
+
+    uint8_t* pos = at(0);
+    if (quantized) {
+      for (int c = 0; c < 3; ++c) {
+        float u = extent[c] > 0.0f ? (p[c] - min[c]) / extent[c] : 0.0f;
+        Store(pos + 2 * c, PackUnorm16(u));
+      }
+    } else {
+      Store(pos, p.x());
+      Store(pos + 4, p.y());
+      Store(pos + 8, p.z());
+    }
+
+    if (compact) {
+      Store(at(1), PackSnorm1010102(Eigen::Vector4f(n.x(), n.y(), n.z(), 0.0f)));
+      Store(at(4), PackSnorm1010102(t));
+      Store(at(3), PackUnorm16(luv.x()));
+      Store(at(3) + 2, PackUnorm16(luv.y()));
+    } else {
+      Store(at(1), n.x());
+      Store(at(1) + 4, n.y());
+      Store(at(1) + 8, n.z());
+      Store(at(3), luv.x());
+      Store(at(3) + 4, luv.y());
+      for (int c = 0; c < 4; ++c) Store(at(4) + 4 * c, t[c]);
+    }
+
+    if (half_uvs) {
+      Store(at(2), FloatToHalf(uv.x()));
+      Store(at(2) + 2, FloatToHalf(uv.y()));
+    } else {
+      Store(at(2), uv.x());
+      Store(at(2) + 4, uv.y());
+    }
+  }
+  return packed;
+}
+
+}  // namespace sh_renderer
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace sh_renderer {
+
+struct Geometry;
+
+// Vertex layouts UploadGeometry can build; sizes below are per vertex summed
+// over all streams. Every layout uses the same attribute locations (0 position,
+// 1 normal, 2 uv, 3 lightmap uv, 4 tangent) and GL expands the packed formats
+// on fetch, so the vertex shaders only decode quantized positions
+// (position = offset + scale * attr, from the draw record).
+enum class VertexFormat {
+  // 56 bytes: every attribute as 32-bit floats.
+  kFloat,
+  // 28 bytes: float position, snorm 10:10:10:2 normal and tangent (w = tangent
+  // sign), half-float uv and unorm16 lightmap uv.
+  kCompact,
+  // 24 bytes: kCompact with unorm16 positions within the local-space AABB.
+  kQuantized,
+};
+
+// Parses "float", "compact" or "quantized".
+std::optional<VertexFormat> ParseVertexFormat(std::string_view name);
+
+// Texture uvs with a magnitude at or above this keep 32-bit floats in the
+// compact layouts; half precision is coarser than 1/256 beyond it.
+constexpr float kMaxHalfUv = 8.0f;
+
+// Vertex data is split into streams so passes that need few attributes fetch
+// only those: the shadow and depth-only passes read positions, the
+// depth-normal and cutout passes add the depth stream, and the radiance pass
+// reads all three. Each stream is interleaved with its own stride.
+enum VertexStream : uint32_t {
+  kPositionStream = 0,  // position
+  kDepthStream = 1,     // normal, uv
+  kShadingStream = 2,   // lightmap uv, tangent
+  kNumVertexStreams = 3,
+};
+
+// One vertex attribute of a packed layout, in glVertexArrayAttribFormat terms.
+// `offset` is relative to the start of a vertex in its stream.
+struct VertexAttrib {
+  int components = 0;
+  uint32_t type = 0;  // GLenum
+  bool normalized = false;
+  uint32_t stream = kPositionStream;
+  uint32_t offset = 0;
+};
+
+// Vertex streams ready for upload into one buffer. `attribs` is indexed by
+// attribute location; stream `s` starts at `stream_offsets[s]` in `data`.
+struct PackedVertices {
+  std::vector<uint8_t> data;
+  std::array<uint32_t, kNumVertexStreams> stream_offsets = {};
+  std::array<uint32_t, kNumVertexStreams> strides = {};
+  std::array<VertexAttrib, 5> attribs;
+  // Position dequantization; identity unless the layout is kQuantized.
+  Eigen::Vector3f position_scale = Eigen::Vector3f::Ones();
+  Eigen::Vector3f position_offset = Eigen::Vector3f::Zero();
+};
+
+// Returns true if every texture uv of the geometry is below kMaxHalfUv in
+// magnitude, i.e. the compact layouts may store its uvs as half floats.
+bool UvsFitHalf(const Geometry& geometry);
+
+// Packs the geometry's vertex attributes into streams in `format` (pure CPU;
+// no GL). Missing normals, uvs and tangents get the same defaults as the float
+// layout. `allow_half_uvs = false` keeps float uvs in the compact layouts even
+// when they would fit, so several geometries can share one layout.
+PackedVertices PackVertices(const Geometry& geometry, VertexFormat format,
+                            bool allow_half_uvs = true);
+
+// Scalar encoders used by the compact layouts, with the matching GL decodes.
+// Exposed for testing.
+uint32_t PackSnorm1010102(const Eigen::Vector4f& v);
+Eigen::Vector4f UnpackSnorm1010102(uint32_t packed);
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t half);
+uint16_t PackUnorm16(float value);
+
+}  // namespace sh_renderer
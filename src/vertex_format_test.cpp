@@ -0,0 +1,191 @@
+#include "vertex_format.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "glad.h"
+#include "scene.h"
+
+namespace sh_renderer {
+namespace {
+
+template <typename T>
+T Load(const PackedVertices& packed, size_t vertex, int location,
+       int component = 0) {
+  const VertexAttrib& attrib = packed.attribs[location];
+  T value;
+  std::memcpy(&value,
+              packed.data.data() + packed.stream_offsets[attrib.stream] +
+                  vertex * packed.strides[attrib.stream] + attrib.offset +
+                  component * sizeof(T),
+              sizeof(T));
+  return value;
+}
+
+Geometry MakeRandomGeometry(size_t count, float uv_range) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> pos(-50.f, 50.f);
+  std::uniform_real_distribution<float> unit(-1.f, 1.f);
+  std::uniform_real_distribution<float> uv(-uv_range, uv_range);
+  std::uniform_real_distribution<float> luv(0.f, 1.f);
+  Geometry geo;
+  for (size_t i = 0; i < count; ++i) {
+    geo.vertices.emplace_back(pos(rng), pos(rng), pos(rng));
+    Eigen::Vector3f n(unit(rng), unit(rng), unit(rng));
+    geo.normals.push_back(n.normalized());
+    geo.texture_uvs.emplace_back(uv(rng), uv(rng));
+    geo.lightmap_uvs.emplace_back(luv(rng), luv(rng));
+    Eigen::Vector3f t = n.unitOrthogonal();
+    geo.tangents.emplace_back(t.x(), t.y(), t.z(), i % 2 ? 1.f : -1.f);
+  }
+  return geo;
+}
+
+TEST(VertexFormatTest, ParsesNames) {
+  EXPECT_EQ(ParseVertexFormat("float"), VertexFormat::kFloat);
+  EXPECT_EQ(ParseVertexFormat("compact"), VertexFormat::kCompact);
+  EXPECT_EQ(ParseVertexFormat("quantized"), VertexFormat::kQuantized);
+  EXPECT_FALSE(ParseVertexFormat("half").has_value());
+}
+
+uint32_t TotalStride(const PackedVertices& packed) {
+  return packed.strides[kPositionStream] + packed.strides[kDepthStream] +
+         packed.strides[kShadingStream];
+}
+
+TEST(VertexFormatTest, Strides) {
+  Geometry geo = MakeRandomGeometry(5, 2.f);
+  EXPECT_EQ(TotalStride(PackVertices(geo, VertexFormat::kFloat)), 56u);
+  EXPECT_EQ(TotalStride(PackVertices(geo, VertexFormat::kCompact)), 28u);
+  EXPECT_EQ(TotalStride(PackVertices(geo, VertexFormat::kQuantized)), 24u);
+  for (VertexFormat format : {VertexFormat::kFloat, VertexFormat::kCompact,
+                              VertexFormat::kQuantized}) {
+    PackedVertices packed = PackVertices(geo, format);
+    for (const VertexAttrib& attrib : packed.attribs) {
+      EXPECT_EQ(attrib.offset % 4, 0u);
+      EXPECT_GT(attrib.components, 0);
+      EXPECT_LT(attrib.offset, packed.strides[attrib.stream]);
+    }
+    // Streams are 16-byte aligned, back to back, and don't overlap.
+    for (uint32_t stream = 0; stream < kNumVertexStreams; ++stream) {
+      EXPECT_EQ(packed.stream_offsets[stream] % 16, 0u);
+      uint32_t end = packed.stream_offsets[stream] + 5 * packed.strides[stream];
+      uint32_t next = stream + 1 < kNumVertexStreams
+                          ? packed.stream_offsets[stream + 1]
+                          : static_cast<uint32_t>(packed.data.size());
+      EXPECT_LE(end, next);
+    }
+  }
+}
+
+// The shadow and depth passes only touch the position (and depth) streams.
+TEST(VertexFormatTest, StreamAssignment) {
+  Geometry geo = MakeRandomGeometry(3, 2.f);
+  for (VertexFormat format : {VertexFormat::kFloat, VertexFormat::kQuantized}) {
+    PackedVertices packed = PackVertices(geo, format);
+    EXPECT_EQ(packed.attribs[0].stream, kPositionStream);
+    EXPECT_EQ(packed.attribs[1].stream, kDepthStream);
+    EXPECT_EQ(packed.attribs[2].stream, kDepthStream);
+    EXPECT_EQ(packed.attribs[3].stream, kShadingStream);
+    EXPECT_EQ(packed.attribs[4].stream, kShadingStream);
+  }
+  PackedVertices floats = PackVertices(geo, VertexFormat::kFloat);
+  EXPECT_EQ(floats.strides[kPositionStream], 12u);
+  EXPECT_EQ(floats.strides[kDepthStream], 20u);
+  EXPECT_EQ(floats.strides[kShadingStream], 24u);
+  EXPECT_EQ(Load<float>(floats, 2, 0, 1), geo.vertices[2].y());
+  EXPECT_EQ(Load<float>(floats, 2, 4, 3), geo.tangents[2].w());
+}
+
+TEST(VertexFormatTest, Snorm1010102RoundTrip) {
+  for (float x : {-1.f, -0.5f, 0.f, 0.3f, 1.f}) {
+    Eigen::Vector4f v(x, -x, x * 0.5f, x < 0 ? -1.f : 1.f);
+    Eigen::Vector4f decoded = UnpackSnorm1010102(PackSnorm1010102(v));
+    EXPECT_LE((decoded.head<3>() - v.head<3>()).cwiseAbs().maxCoeff(),
+              0.5f / 511.f + 1e-6f);
+    EXPECT_EQ(decoded.w(), v.w());
+  }
+}
+
+TEST(VertexFormatTest, HalfRoundTrip) {
+  EXPECT_EQ(HalfToFloat(FloatToHalf(0.f)), 0.f);
+  EXPECT_EQ(HalfToFloat(FloatToHalf(1.f)), 1.f);
+  EXPECT_EQ(HalfToFloat(FloatToHalf(-2.5f)), -2.5f);
+  EXPECT_EQ(FloatToHalf(1.f), 0x3c00);
+  EXPECT_EQ(FloatToHalf(65504.f), 0x7bff);
+  EXPECT_TRUE(std::isinf(HalfToFloat(FloatToHalf(1e6f))));
+  EXPECT_FLOAT_EQ(HalfToFloat(FloatToHalf(6e-8f)), std::ldexp(1.f, -24));
+  for (float v = -7.9f; v < 7.9f; v += 0.0137f) {
+    // Relative precision of half is 2^-11.
+    EXPECT_NEAR(HalfToFloat(FloatToHalf(v)), v,
+                std::max(std::abs(v), 1e-4f) * std::ldexp(1.f, -11));
+  }
+}
+
+// The normal-precision check for the compact layouts: decoded attributes stay
+// within the format's quantization error of the float layout.
+TEST(VertexFormatTest, CompactMatchesFloatWithinPrecision) {
+  Geometry geo = MakeRandomGeometry(1000, kMaxHalfUv * 0.99f);
+  PackedVertices floats = PackVertices(geo, VertexFormat::kFloat);
+  PackedVertices quantized = PackVertices(geo, VertexFormat::kQuantized);
+  ASSERT_EQ(quantized.attribs[0].type, GL_UNSIGNED_SHORT);
+  ASSERT_EQ(quantized.attribs[2].type, GL_HALF_FLOAT);
+
+  float max_normal_degrees = 0.f;
+  for (size_t i = 0; i < geo.vertices.size(); ++i) {
+    Eigen::Vector3f position;
+    for (int c = 0; c < 3; ++c) {
+      float u = Load<uint16_t>(quantized, i, 0, c) / 65535.f;
+      position[c] = quantized.position_offset[c] +
+                    quantized.position_scale[c] * u;
+      EXPECT_FLOAT_EQ(Load<float>(floats, i, 0, c), geo.vertices[i][c]);
+    }
+    EXPECT_LE((position - geo.vertices[i]).cwiseAbs().maxCoeff(),
+              quantized.position_scale.maxCoeff() / 65535.f);
+
+    Eigen::Vector3f normal =
+        UnpackSnorm1010102(Load<uint32_t>(quantized, i, 1)).head<3>();
+    float cos_angle = std::clamp(normal.normalized().dot(geo.normals[i]),
+                                 -1.f, 1.f);
+    max_normal_degrees =
+        std::max(max_normal_degrees, std::acos(cos_angle) * 180.f / 3.14159f);
+
+    Eigen::Vector4f tangent = UnpackSnorm1010102(Load<uint32_t>(quantized, i, 4));
+    EXPECT_EQ(tangent.w(), geo.tangents[i].w());
+
+    for (int c = 0; c < 2; ++c) {
+      float uv = HalfToFloat(Load<uint16_t>(quantized, i, 2, c));
+      EXPECT_NEAR(uv, geo.texture_uvs[i][c], kMaxHalfUv * std::ldexp(1.f, -11));
+      float luv = Load<uint16_t>(quantized, i, 3, c) / 65535.f;
+      EXPECT_NEAR(luv, geo.lightmap_uvs[i][c], 0.5f / 65535.f + 1e-7f);
+    }
+  }
+  EXPECT_LT(max_normal_degrees, 0.2f);
+}
+
+TEST(VertexFormatTest, LargeUvsStayFloat) {
+  Geometry geo = MakeRandomGeometry(16, 40.f);
+  PackedVertices packed = PackVertices(geo, VertexFormat::kCompact);
+  EXPECT_EQ(packed.attribs[2].type, GL_FLOAT);
+  EXPECT_EQ(TotalStride(packed), 32u);
+  EXPECT_EQ(Load<float>(packed, 3, 2, 1), geo.texture_uvs[3].y());
+}
+
+TEST(VertexFormatTest, OccluderShellGetsDefaults) {
+  Geometry shell;
+  shell.vertices = {{0, 0, 0}, {2, 0, 0}, {0, 0, 2}};
+  PackedVertices packed = PackVertices(shell, VertexFormat::kQuantized);
+  EXPECT_EQ(UnpackSnorm1010102(Load<uint32_t>(packed, 0, 1)).head<3>(),
+            Eigen::Vector3f(0, 1, 0));
+  EXPECT_EQ(UnpackSnorm1010102(Load<uint32_t>(packed, 0, 4)),
+            Eigen::Vector4f(1, 0, 0, 1));
+  // Zero extent along y must not divide by zero.
+  EXPECT_EQ(packed.position_scale, Eigen::Vector3f(2, 0, 2));
+  EXPECT_EQ(Load<uint16_t>(packed, 1, 0, 0), 65535);
+}
+
+}  // namespace
+}  // namespace sh_renderer
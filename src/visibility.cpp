@@ -0,0 +1,223 @@
+#include "visibility.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <span>
+#include <utility>
+
+#include "culling.h"
+
+namespace sh_renderer {
+
+namespace {
+
+// Besides the occluder shells, the occlusion buffer gets up to kMaxOccluders
+// opaque geometries, the largest on screen: those with the largest bounding
+// radius over view depth, if at least kMinOccluderSize. Meshes with more than
+// kMaxOccluderTriangles cost more to rasterize than they usually save.
+constexpr size_t kMaxOccluders = 32;
+constexpr float kMinOccluderSize = 0.1f;
+constexpr size_t kMaxOccluderTriangles = 4096;
+
+bool IsOpaqueMaterial(const Scene& scene, int material_id) {
+  if (material_id < 0 ||
+      static_cast<size_t>(material_id) >= scene.materials.size()) {
+    return false;
+  }
+  const Material& mat = scene.materials[material_id];
+  return !mat.alpha_cutout && mat.layers.empty();
+}
+
+// Rasterizes the occluders among `in_frustum` into `buffer` and removes the
+// geometries it hides from `in_frustum`.
+void OcclusionCull(const Scene& scene, const Eigen::Matrix4f& view_proj,
+                   OcclusionBuffer* buffer, std::vector<uint32_t>* in_frustum) {
+  const auto start = std::chrono::steady_clock::now();
+  VisibilityStats& stats = GetVisibilityStats();
+
+  thread_local std::vector<uint32_t> occluders;
+  thread_local std::vector<std::pair<float, uint32_t>> candidates;
+  occluders.clear();
+  candidates.clear();
+  for (uint32_t i : *in_frustum) {
+    const Geometry& geo = scene.geometries[i];
+    const Geometry& mesh = GeometryMesh(scene.geometries, geo);
+    if (geo.index_count == 0 || mesh.indices.empty()) continue;
+    if (geo.material_id < 0) {
+      occluders.push_back(i);
+      continue;
+    }
+    if (!IsOpaqueMaterial(scene, geo.material_id) ||
+        mesh.indices.size() > 3 * kMaxOccluderTriangles) {
+      continue;
+    }
+    const AABB& box = geo.bounding_box;
+    const Eigen::Vector3f center = 0.5f * (box.min + box.max);
+    const float radius = 0.5f * (box.max - box.min).norm();
+    const float depth = (view_proj * center.homogeneous()).w();
+    const float size = depth > radius ? radius / depth : 1.0f;
+    if (size >= kMinOccluderSize) candidates.push_back({size, i});
+  }
+  if (candidates.size() > kMaxOccluders) {
+    std::nth_element(candidates.begin(), candidates.begin() + kMaxOccluders,
+                     candidates.end(), std::greater<>());
+    candidates.resize(kMaxOccluders);
+  }
+  for (const auto& [size, i] : candidates) occluders.push_back(i);
+
+  ResetOcclusionBuffer(kOcclusionBufferWidth, kOcclusionBufferHeight, buffer);
+  for (uint32_t i : occluders) {
+    const Geometry& geo = scene.geometries[i];
+    const Geometry& mesh = GeometryMesh(scene.geometries, geo);
+    stats.occluder_triangles +=
+        RasterizeOccluder(mesh.vertices, mesh.indices,
+                          view_proj * geo.transform.matrix(), buffer);
+  }
+  stats.occluders += occluders.size();
+
+  // The occluders stay: each covers its own box in the buffer.
+  std::sort(occluders.begin(), occluders.end());
+  const size_t tested = in_frustum->size();
+  std::erase_if(*in_frustum, [&](uint32_t i) {
+    return !std::binary_search(occluders.begin(), occluders.end(), i) &&
+           IsAABBOccluded(*buffer, view_proj,
+                          scene.geometries[i].bounding_box);
+  });
+  stats.occlusion_tested += tested;
+  stats.occlusion_culled += tested - in_frustum->size();
+  stats.occlusion_ms += std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+}
+
+// Removes from `in_frustum` the geometries not in the view cell's set
+// `pvs_cell`.
+void PvsCull(std::span<const uint64_t> pvs_cell,
+             std::vector<uint32_t>* in_frustum) {
+  VisibilityStats& stats = GetVisibilityStats();
+  const size_t tested = in_frustum->size();
+  std::erase_if(*in_frustum,
+                [&](uint32_t i) { return !IsPvsBitSet(pvs_cell, i); });
+  stats.pvs_tested += tested;
+  stats.pvs_culled += tested - in_frustum->size();
+}
+
+// Replaces `lists` with the geometries in the frustum of `view_proj`, less
+// those outside `pvs_cell` if not empty and those `occlusion` hides if given.
+// Only the camera view fills `lists->shaded`.
+void CullView(const Scene& scene, const Eigen::Matrix4f& view_proj,
+              float lod_scale, bool shaded, std::span<const uint64_t> pvs_cell,
+              OcclusionBuffer* occlusion, std::vector<uint32_t>* in_frustum,
+              DrawLists* lists) {
+  lists->view_proj = view_proj;
+  lists->lod_scale = lod_scale;
+  lists->gpu_depth = nullptr;
+  lists->gpu_shaded = nullptr;
+  Eigen::Vector4f planes[6];
+  ExtractFrustumPlanes(view_proj, planes);
+  FrustumCullGeometries(scene, planes, in_frustum);
+  if (!pvs_cell.empty()) PvsCull(pvs_cell, in_frustum);
+  if (occlusion) OcclusionCull(scene, view_proj, occlusion, in_frustum);
+
+  lists->opaque.clear();
+  lists->cutout.clear();
+  lists->shaded.clear();
+  for (uint32_t i : *in_frustum) {
+    const Geometry& geo = scene.geometries[i];
+    if (geo.index_count == 0) continue;
+    const bool has_material =
+        geo.material_id >= 0 &&
+        static_cast<size_t>(geo.material_id) < scene.materials.size();
+    if (has_material && scene.materials[geo.material_id].alpha_cutout) {
+      lists->cutout.push_back(&geo);
+    } else {
+      lists->opaque.push_back(&geo);
+    }
+    if (shaded && geo.material_id >= 0) lists->shaded.push_back(&geo);
+  }
+}
+
+}  // namespace
+
+void ComputeFrameVisibility(const Scene& scene, const Camera& camera,
+                            const std::vector<Cascade>& cascades,
+                            FrameVisibility* visibility) {
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t views = 1;
+
+  std::span<const uint64_t> pvs_cell;
+  if (visibility->pvs_culling) {
+    const int cell = FindPvsCell(scene.pvs, camera.position);
+    if (cell >= 0) pvs_cell = PvsCellBits(scene.pvs, cell);
+  }
+  const float error_pixels = visibility->lod_error_pixels;
+  const Eigen::Matrix4f camera_view_proj = GetViewProjMatrix(camera);
+  CullView(scene, camera_view_proj,
+           LodScale(camera_view_proj, visibility->viewport_width,
+                    visibility->viewport_height, error_pixels),
+           /*shaded=*/true, pvs_cell,
+           visibility->occlusion_culling ? &visibility->occlusion : nullptr,
+           &visibility->in_frustum, &visibility->camera);
+
+  visibility->cascades.resize(cascades.size());
+  for (size_t i = 0; i < cascades.size(); ++i) {
+    const Eigen::Matrix4f& view_proj = cascades[i].view_projection_matrix;
+    CullView(scene, view_proj,
+             LodScale(view_proj, kCascadeShadowMapSize, kCascadeShadowMapSize,
+                      error_pixels),
+             /*shaded=*/false, /*pvs_cell=*/{}, /*occlusion=*/nullptr,
+             &visibility->in_frustum, &visibility->cascades[i]);
+    ++views;
+  }
+
+  visibility->spot_lights.resize(scene.spot_lights.size());
+  for (size_t i = 0; i < scene.spot_lights.size(); ++i) {
+    const SpotLight& light = scene.spot_lights[i];
+    DrawLists& lists = visibility->spot_lights[i];
+    if (!light.has_shadow) {
+      lists.opaque.clear();
+      lists.cutout.clear();
+      lists.shaded.clear();
+      lists.gpu_depth = nullptr;
+      lists.gpu_shaded = nullptr;
+      continue;
+    }
+    const Eigen::Vector2f tile =
+        light.shadow_uv_scale *
+        static_cast<float>(scene.shadow_atlas.resolution);
+    CullView(scene, light.shadow_view_proj,
+             LodScale(light.shadow_view_proj, static_cast<uint32_t>(tile.x()),
+                      static_cast<uint32_t>(tile.y()), error_pixels),
+             /*shaded=*/false, /*pvs_cell=*/{}, /*occlusion=*/nullptr,
+             &visibility->in_frustum, &lists);
+    ++views;
+  }
+
+  visibility->camera.meshlet_culling = visibility->meshlet_culling;
+  for (DrawLists& lists : visibility->cascades) {
+    lists.meshlet_culling = visibility->meshlet_culling;
+  }
+  for (DrawLists& lists : visibility->spot_lights) {
+    lists.meshlet_culling = visibility->meshlet_culling;
+  }
+
+  VisibilityStats& stats = GetVisibilityStats();
+  ++stats.frames;
+  stats.views += views;
+  stats.cpu_ms += std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  stats.depth_draws +=
+      visibility->camera.opaque.size() + visibility->camera.cutout.size();
+  for (const Geometry& geo : scene.geometries) {
+    if (geo.index_count != 0) ++stats.depth_candidates;
+  }
+}
+
+VisibilityStats& GetVisibilityStats() {
+  static VisibilityStats stats;
+  return stats;
+}
+
+}  // namespace sh_renderer
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <vector>
+
+#include "camera.h"
+#include "cascade.h"
+#include "occlusion.h"
+#include "scene.h"
+
+namespace sh_renderer {
+
+struct GpuCullView;
+
+// --- Visibility stage ---
+// Frustum culls the scene once per view and frame: the camera, each sun shadow
+// cascade and each shadowed spot light. The passes drawing a view (depth
+// pre-pass and radiance for the camera, the shadow passes for the lights) draw
+// its DrawLists instead of scanning the scene themselves.
+//
+// With occlusion culling on, the camera view also drops the geometries hidden
+// behind its occluders: the occluder shells (geometries without a material)
+// and the opaque geometries nearest and largest on screen, rasterized into an
+// OcclusionBuffer each frame.
+//
+// With PVS culling on and a PVS baked for the scene, the camera view first
+// drops the geometries its view cell cannot see (see pvs.h).
+//
+// With GPU culling (gpu_culling.h), CullFrameOnGpu replaces this stage: the
+// lists stay empty and point at the views a compute kernel culled instead.
+//
+// With LOD selection on, each view draws every geometry at the coarsest level
+// of detail whose error projects to at most lod_error_pixels pixels of the
+// camera's viewport, or texels of the view's shadow map or atlas tile, so the
+// far cascades and the small spot light tiles draw the coarse levels.
+//
+// With meshlet culling on, the passes drawing a view's lists also drop the
+// meshlets of each full detail draw that are outside the view's frustum or
+// face away from its eye (see CullMeshlets). GPU culled views cull them in
+// the cull kernel, except those of instanced draws.
+
+// The visible geometries of one view, split by the program that draws them,
+// in scene order. The passes order them for drawing with a RenderQueue.
+struct DrawLists {
+  Eigen::Matrix4f view_proj = Eigen::Matrix4f::Identity();
+  // The view's LodScale; 0 draws full detail.
+  float lod_scale = 0.0f;
+  // Whether the passes cull the meshlets of the full detail draws.
+  bool meshlet_culling = false;
+  // Depth-only passes: geometries drawn without an alpha test (including the
+  // occluder shells), and those with one.
+  std::vector<const Geometry*> opaque;
+  std::vector<const Geometry*> cutout;
+  // Radiance pass (camera view only): geometries with a material.
+  std::vector<const Geometry*> shaded;
+  // With GPU culling, the views the passes draw instead of the lists: the
+  // depth-only one, and the radiance one (camera view only).
+  const GpuCullView* gpu_depth = nullptr;
+  const GpuCullView* gpu_shaded = nullptr;
+};
+
+struct FrameVisibility {
+  DrawLists camera;
+  std::vector<DrawLists> cascades;     // parallel to the frame's cascades
+  std::vector<DrawLists> spot_lights;  // parallel to Scene::spot_lights; empty
+                                       // for lights without a shadow
+  std::vector<uint32_t> in_frustum;    // scratch
+
+  bool occlusion_culling = false;
+  OcclusionBuffer occlusion;
+
+  bool pvs_culling = false;
+
+  bool meshlet_culling = false;
+
+  // LOD selection, off at 0. The camera's viewport size in pixels.
+  float lod_error_pixels = 0.0f;
+  uint32_t viewport_width = 0;
+  uint32_t viewport_height = 0;
+};
+
+// Builds `visibility` for this frame. The spot light shadows must already be
+// allocated (AllocateShadowMapForLights). The lists keep their capacity from
+// frame to frame.
+void ComputeFrameVisibility(const Scene& scene, const Camera& camera,
+                            const std::vector<Cascade>& cascades,
+                            FrameVisibility* visibility);
+
+// Cost and effect of the visibility stage. Accumulated by
+// ComputeFrameVisibility; reset by the caller.
+struct VisibilityStats {
+  uint64_t frames = 0;
+  uint64_t views = 0;
+  double cpu_ms = 0.0;  // time spent in ComputeFrameVisibility
+  // Geometries the camera's depth pre-pass draws, and those it would draw
+  // without culling (every geometry with indices).
+  uint64_t depth_draws = 0;
+  uint64_t depth_candidates = 0;
+  // Occlusion culling of the camera view: the time spent rasterizing and
+  // testing (part of cpu_ms), the occluders and their triangles, and the
+  // geometries in the frustum tested and found hidden.
+  double occlusion_ms = 0.0;
+  uint64_t occluders = 0;
+  uint64_t occluder_triangles = 0;
+  uint64_t occlusion_tested = 0;
+  uint64_t occlusion_culled = 0;
+  // PVS culling of the camera view: the geometries in the frustum tested and
+  // found invisible from the camera's cell. Nothing is tested while the camera
+  // is outside the grid.
+  uint64_t pvs_tested = 0;
+  uint64_t pvs_culled = 0;
+};
+
+VisibilityStats& GetVisibilityStats();
+
+}  // namespace sh_renderer
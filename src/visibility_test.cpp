@@ -0,0 +1,205 @@
+#include "visibility.h"
+
+#include <gtest/gtest.h>
+
+namespace sh_renderer {
+namespace {
+
+// Adds a drawable unit-sized geometry centred at `center`.
+void AddGeometry(Scene* scene, const Eigen::Vector3f& center, int material_id,
+                 uint32_t index_count = 3) {
+  Geometry geo;
+  geo.material_id = material_id;
+  geo.index_count = index_count;
+  geo.bounding_box.min = center - Eigen::Vector3f::Constant(0.5f);
+  geo.bounding_box.max = center + Eigen::Vector3f::Constant(0.5f);
+  scene->geometries.push_back(std::move(geo));
+}
+
+// A camera at the origin looking down -Z.
+Camera TestCamera() {
+  return Camera{.position = Eigen::Vector3f::Zero(),
+                .orientation = Eigen::Quaternionf::Identity()};
+}
+
+// Material 0 is opaque, material 1 alpha-tested. In front of the camera:
+// geometries 0 (opaque), 1 (cutout), 2 (occluder shell) and 4 (no indices);
+// geometry 3 is behind it.
+Scene TestScene() {
+  Scene scene;
+  scene.materials.resize(2);
+  scene.materials[1].alpha_cutout = true;
+  AddGeometry(&scene, {0, 0, -5}, 0);
+  AddGeometry(&scene, {1, 0, -6}, 1);
+  AddGeometry(&scene, {-1, 0, -7}, -1);
+  AddGeometry(&scene, {0, 0, 5}, 0);
+  AddGeometry(&scene, {0, 1, -5}, 0, /*index_count=*/0);
+  BuildSceneBvh(scene);
+  return scene;
+}
+
+TEST(VisibilityTest, CameraListsSplitByProgram) {
+  Scene scene = TestScene();
+  FrameVisibility visibility;
+  ComputeFrameVisibility(scene, TestCamera(), {}, &visibility);
+
+  const DrawLists& lists = visibility.camera;
+  EXPECT_EQ(lists.opaque, (std::vector<const Geometry*>{
+                              &scene.geometries[0], &scene.geometries[2]}));
+  EXPECT_EQ(lists.cutout,
+            (std::vector<const Geometry*>{&scene.geometries[1]}));
+  // The occluder shell has no material, so the radiance pass skips it.
+  EXPECT_EQ(lists.shaded, (std::vector<const Geometry*>{
+                              &scene.geometries[0], &scene.geometries[1]}));
+}
+
+TEST(VisibilityTest, ListsAreRebuiltEachFrame) {
+  Scene scene = TestScene();
+  FrameVisibility visibility;
+  Camera camera = TestCamera();
+  ComputeFrameVisibility(scene, camera, {}, &visibility);
+
+  // Turn around: only geometry 3 is visible.
+  camera.orientation =
+      Eigen::Quaternionf(Eigen::AngleAxisf(M_PI, Eigen::Vector3f::UnitY()));
+  ComputeFrameVisibility(scene, camera, {}, &visibility);
+  EXPECT_EQ(visibility.camera.opaque,
+            (std::vector<const Geometry*>{&scene.geometries[3]}));
+  EXPECT_TRUE(visibility.camera.cutout.empty());
+}
+
+TEST(VisibilityTest, ShadowViewsFollowCascadesAndShadowedLights) {
+  Scene scene = TestScene();
+  SpotLight shadowed;
+  shadowed.direction = Eigen::Vector3f(0, 0, 1);  // towards geometry 3
+  shadowed.radius = 20.0f;
+  shadowed.has_shadow = 1;
+  shadowed.shadow_view_proj = ComputeSpotShadowViewProj(shadowed);
+  SpotLight unshadowed = shadowed;
+  unshadowed.has_shadow = 0;
+  scene.spot_lights = {unshadowed, shadowed};
+
+  // One cascade seeing everything.
+  Cascade cascade;
+  cascade.view_projection_matrix = Eigen::Matrix4f::Identity();
+  cascade.view_projection_matrix.topLeftCorner<3, 3>() *= 0.01f;
+
+  FrameVisibility visibility;
+  ComputeFrameVisibility(scene, TestCamera(), {cascade}, &visibility);
+
+  ASSERT_EQ(visibility.cascades.size(), 1u);
+  EXPECT_EQ(visibility.cascades[0].opaque.size(), 3u);
+  EXPECT_EQ(visibility.cascades[0].cutout.size(), 1u);
+  EXPECT_TRUE(visibility.cascades[0].shaded.empty());
+
+  ASSERT_EQ(visibility.spot_lights.size(), 2u);
+  EXPECT_TRUE(visibility.spot_lights[0].opaque.empty());
+  EXPECT_EQ(visibility.spot_lights[1].opaque,
+            (std::vector<const Geometry*>{&scene.geometries[3]}));
+}
+
+TEST(VisibilityTest, ViewsScaleLevelsOfDetailByTheirResolution) {
+  Scene scene = TestScene();
+  SpotLight light;
+  light.radius = 20.0f;
+  light.has_shadow = 1;
+  light.shadow_view_proj = ComputeSpotShadowViewProj(light);
+  light.shadow_uv_scale = Eigen::Vector2f::Constant(0.125f);  // 256 texels
+  scene.spot_lights = {light};
+  Cascade cascade;
+  cascade.view_projection_matrix = Eigen::Matrix4f::Identity();
+  cascade.view_projection_matrix.topLeftCorner<3, 3>() *= 0.01f;
+
+  FrameVisibility visibility;
+  ComputeFrameVisibility(scene, TestCamera(), {cascade}, &visibility);
+  EXPECT_EQ(visibility.camera.lod_scale, 0.0f);  // off by default
+  EXPECT_EQ(visibility.cascades[0].lod_scale, 0.0f);
+
+  visibility.lod_error_pixels = 2.0f;
+  visibility.viewport_width = 1280;
+  visibility.viewport_height = 720;
+  ComputeFrameVisibility(scene, TestCamera(), {cascade}, &visibility);
+  const Eigen::Matrix4f camera_view_proj = GetViewProjMatrix(TestCamera());
+  EXPECT_FLOAT_EQ(visibility.camera.lod_scale,
+                  LodScale(camera_view_proj, 1280, 720, 2.0f));
+  EXPECT_FLOAT_EQ(visibility.cascades[0].lod_scale,
+                  0.5f * kCascadeShadowMapSize * 0.01f / 2.0f);
+  EXPECT_FLOAT_EQ(visibility.spot_lights[0].lod_scale,
+                  LodScale(light.shadow_view_proj, 256, 256, 2.0f));
+}
+
+TEST(VisibilityTest, StatsCountSkippedDepthDraws) {
+  Scene scene = TestScene();
+  FrameVisibility visibility;
+  GetVisibilityStats() = {};
+  ComputeFrameVisibility(scene, TestCamera(), {}, &visibility);
+
+  const VisibilityStats& stats = GetVisibilityStats();
+  EXPECT_EQ(stats.frames, 1u);
+  EXPECT_EQ(stats.views, 1u);
+  EXPECT_EQ(stats.depth_draws, 3u);
+  EXPECT_EQ(stats.depth_candidates, 4u);
+}
+
+TEST(VisibilityTest, OcclusionCullingDropsGeometryBehindOccluders) {
+  Scene scene = TestScene();
+  // An occluder shell filling the view at z = -4, hiding geometries 0 and 1.
+  Geometry shell;
+  shell.vertices = {{-50, -50, -4}, {50, -50, -4}, {50, 50, -4}, {-50, 50, -4}};
+  shell.indices = {0, 1, 2, 0, 2, 3};
+  shell.index_count = 6;
+  shell.bounding_box.min = Eigen::Vector3f(-50, -50, -4);
+  shell.bounding_box.max = Eigen::Vector3f(50, 50, -4);
+  scene.geometries.push_back(std::move(shell));
+  AddGeometry(&scene, {0, 0, -2}, 0);  // in front of it
+  BuildSceneBvh(scene);
+
+  FrameVisibility visibility;
+  visibility.occlusion_culling = true;
+  GetVisibilityStats() = {};
+  ComputeFrameVisibility(scene, TestCamera(), {}, &visibility);
+
+  EXPECT_EQ(visibility.camera.opaque, (std::vector<const Geometry*>{
+                                          &scene.geometries[5],
+                                          &scene.geometries[6]}));
+  EXPECT_TRUE(visibility.camera.cutout.empty());
+  const VisibilityStats& stats = GetVisibilityStats();
+  EXPECT_EQ(stats.occluders, 1u);
+  EXPECT_EQ(stats.occluder_triangles, 2u);
+  EXPECT_EQ(stats.occlusion_tested, 6u);
+  EXPECT_EQ(stats.occlusion_culled, 4u);
+}
+
+TEST(VisibilityTest, PvsCullingKeepsOnlyTheCameraCellsSet) {
+  Scene scene = TestScene();
+  // One view cell around the camera, seeing geometries 0 and 2 only.
+  AABB bounds;
+  bounds.min = Eigen::Vector3f(-2, -2, -10);
+  bounds.max = Eigen::Vector3f(2, 2, 10);
+  scene.pvs = MakePvsGrid(bounds, /*cell_size=*/2.0f, /*max_cells_per_axis=*/1,
+                          scene.geometries.size());
+  ASSERT_EQ(PvsCellCount(scene.pvs), 1u);
+  SetPvsBit(PvsCellBits(scene.pvs, 0), 0);
+  SetPvsBit(PvsCellBits(scene.pvs, 0), 2);
+
+  FrameVisibility visibility;
+  visibility.pvs_culling = true;
+  GetVisibilityStats() = {};
+  ComputeFrameVisibility(scene, TestCamera(), {}, &visibility);
+  EXPECT_EQ(visibility.camera.opaque, (std::vector<const Geometry*>{
+                                          &scene.geometries[0],
+                                          &scene.geometries[2]}));
+  EXPECT_TRUE(visibility.camera.cutout.empty());
+  EXPECT_EQ(GetVisibilityStats().pvs_tested, 4u);
+  EXPECT_EQ(GetVisibilityStats().pvs_culled, 2u);
+
+  // Outside the grid, nothing is culled.
+  Camera outside = TestCamera();
+  outside.position.x() = 3.0f;
+  ComputeFrameVisibility(scene, outside, {}, &visibility);
+  EXPECT_EQ(visibility.camera.cutout.size(), 1u);
+  EXPECT_EQ(GetVisibilityStats().pvs_tested, 4u);
+}
+
+}  // namespace
+}  // namespace sh_renderer